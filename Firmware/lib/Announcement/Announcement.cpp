@@ -0,0 +1,97 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - status announcements                                                                      *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "Announcement.h"
+#include <Preferences.h>
+#include <mbedtls/md.h>
+
+// NVS namespace and key of the boot number
+#define ANNOUNCEMENT_NAMESPACE "announce"
+#define KEY_BOOT "boot"
+
+static void writeUint32(uint8_t *buffer, uint32_t value)
+{
+  buffer[0] = value >> 24;
+  buffer[1] = value >> 16;
+  buffer[2] = value >> 8;
+  buffer[3] = value;
+}
+
+static uint32_t readUint32(const uint8_t *buffer)
+{
+  return ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) | ((uint32_t)buffer[2] << 8) | buffer[3];
+}
+
+static bool computeMac(const uint8_t *buffer, size_t length, const char *key, uint8_t *mac)
+{
+  uint8_t digest[32];
+  const mbedtls_md_info_t *info = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+  if (mbedtls_md_hmac(info, (const uint8_t *)key, strlen(key), buffer, length, digest) != 0)
+    return false;
+  memcpy(mac, digest, ANNOUNCEMENT_MAC_SIZE);
+  return true;
+}
+
+size_t encodeAnnouncement(const Announcement &announcement, const char *key, uint8_t *buffer)
+{
+  buffer[0] = 'O';
+  buffer[1] = 'A';
+  buffer[2] = ANNOUNCEMENT_VERSION;
+  buffer[3] = announcement.onAir ? '1' : '0';
+  writeUint32(buffer + 4, announcement.boot);
+  writeUint32(buffer + 8, announcement.sequence);
+  if (!computeMac(buffer, 12, key, buffer + 12))
+    return 0;
+  return ANNOUNCEMENT_SIZE;
+}
+
+bool decodeAnnouncement(const uint8_t *buffer, size_t length, const char *key, Announcement *announcement)
+{
+  if (length != ANNOUNCEMENT_SIZE || buffer[0] != 'O' || buffer[1] != 'A' || buffer[2] != ANNOUNCEMENT_VERSION)
+    return false;
+  if (buffer[3] != '0' && buffer[3] != '1')
+    return false;
+
+  // Compare MAC in constant time
+  uint8_t mac[ANNOUNCEMENT_MAC_SIZE];
+  if (!computeMac(buffer, 12, key, mac))
+    return false;
+  uint8_t difference = 0;
+  for (size_t i = 0; i < ANNOUNCEMENT_MAC_SIZE; i++)
+    difference |= mac[i] ^ buffer[12 + i];
+  if (difference != 0)
+    return false;
+
+  announcement->onAir = buffer[3] == '1';
+  announcement->boot = readUint32(buffer + 4);
+  announcement->sequence = readUint32(buffer + 8);
+  return true;
+}
+
+uint32_t nextAnnouncementBoot()
+{
+  Preferences preferences;
+  if (!preferences.begin(ANNOUNCEMENT_NAMESPACE, false))
+    return 0;
+  uint32_t boot = preferences.getUInt(KEY_BOOT, 0) + 1;
+  bool saved = preferences.putUInt(KEY_BOOT, boot) > 0;
+  preferences.end();
+  return saved ? boot : 0;
+}
+
+bool AnnouncementFilter::accept(const Announcement &announcement)
+{
+  // Older master boot, or same boot and not newer sequence number (with wraparound)
+  if (_valid && (announcement.boot < _boot || (announcement.boot == _boot && (int32_t)(announcement.sequence - _sequence) <= 0)))
+    return false;
+
+  // First announcement or master rebooted
+  _valid = true;
+  _boot = announcement.boot;
+  _sequence = announcement.sequence;
+  return true;
+}
@@ -0,0 +1,94 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - status announcements                                                                      *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Compact authenticated status datagram sent by the master directly to slaves, bypassing the MQTT server.          *
+ * Each announcement carries boot number of the master (kept in NVS and incremented at every boot) and sequence     *
+ * number, so repeated and replayed copies can be discarded, and truncated HMAC-SHA256 computed with shared key, so *
+ * other devices on the network cannot switch the LEDs. Announcements are sent over any datagram transport          *
+ * (multicast, ESP-NOW); the same boot and sequence numbers are used on all of them, so a slave merges all channels *
+ * with a single filter and keeps the first copy to arrive.                                                         *
+ * Announcement layout (20 bytes, big endian):                                                                      *
+ *   0  magic "OA"   2  version   3  status ('0' or '1')   4  boot number   8  sequence number   12  HMAC (8 bytes) *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+
+#define ANNOUNCEMENT_VERSION 2
+#define ANNOUNCEMENT_MAC_SIZE 8                         // bytes; truncated HMAC-SHA256
+#define ANNOUNCEMENT_SIZE (12 + ANNOUNCEMENT_MAC_SIZE) // bytes; total announcement size
+
+// Results of AnnouncementChannel::receive()
+#define ANNOUNCEMENT_NONE 0    // Nothing received
+#define ANNOUNCEMENT_VALID 1   // Valid announcement received (may still be a repetition)
+#define ANNOUNCEMENT_INVALID 2 // Malformed datagram or wrong key
+
+struct Announcement
+{
+  bool onAir;        // Announced status
+  uint32_t boot;     // Boot number of the master
+  uint32_t sequence; // Incremented with every announcement sent by the master
+};
+
+// Writes signed announcement to buffer, which must have at least ANNOUNCEMENT_SIZE bytes
+size_t encodeAnnouncement(const Announcement &announcement, const char *key, uint8_t *buffer);
+
+// Verifies and reads announcement, returns false if it is malformed or not signed with the key
+bool decodeAnnouncement(const uint8_t *buffer, size_t length, const char *key, Announcement *announcement);
+
+// Increments boot number kept in NVS and returns it, 0 when NVS is not available
+uint32_t nextAnnouncementBoot();
+
+// Drops announcements which were already seen; keyed MAC prevents forging and boot and sequence numbers only grow,
+// so a recorded announcement is never accepted after a newer one. A slave which lost the filter state (power cycle)
+// accepts the first valid announcement, a replayed one then lasts only until the next announcement of the master.
+// Master whose NVS was erased counts boots from 1 again and slaves ignore it until they lose the filter state.
+class AnnouncementFilter
+{
+public:
+  // Returns true if the announcement is newer than all announcements accepted so far
+  bool accept(const Announcement &announcement);
+
+  // Forgets the last accepted announcement
+  void reset() { _valid = false; }
+
+private:
+  bool _valid = false;
+  uint32_t _boot = 0;
+  uint32_t _sequence = 0;
+};
+
+// Sends and receives announcements over datagram transport (see Transport library)
+template <class Transport>
+class AnnouncementChannel
+{
+public:
+  AnnouncementChannel(const char *key) : _key(key) {}
+
+  Transport &transport() { return _transport; }
+
+  bool send(const Announcement &announcement)
+  {
+    uint8_t buffer[ANNOUNCEMENT_SIZE];
+    size_t length = encodeAnnouncement(announcement, _key, buffer);
+    return length > 0 && _transport.send(buffer, length, NULL, 0);
+  }
+
+  // Reads one datagram, returns ANNOUNCEMENT_NONE when there is nothing to read
+  int receive(Announcement *announcement)
+  {
+    uint8_t buffer[ANNOUNCEMENT_SIZE + 1];
+    int length = _transport.receive(buffer, sizeof(buffer));
+    if (length <= 0)
+      return ANNOUNCEMENT_NONE;
+    return decodeAnnouncement(buffer, length, _key, announcement) ? ANNOUNCEMENT_VALID : ANNOUNCEMENT_INVALID;
+  }
+
+private:
+  const char *_key;
+  Transport _transport;
+};
@@ -0,0 +1,348 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - runtime configuration                                                                     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "Config.h"
+#include <Preferences.h>
+#include <stddef.h>
+
+// NVS keys
+#define KEY_MESSAGE "message"   // Confirmed message
+#define KEY_PENDING "pending"   // Message with unconfirmed connection settings
+#define KEY_REJECTED "rejected" // Hash of reverted message
+
+/* Settings fields **************************************************************************************************/
+
+#define FIELD_STRING 0
+#define FIELD_UINT16 1
+#define FIELD_UINT32 2
+
+struct Field
+{
+  const char *name; // Name of the compile-time default
+  uint8_t type;     // FIELD_*
+  uint8_t changes;  // CONFIG_CHANGED_* flag
+  uint16_t offset;
+  uint16_t size;
+  uint32_t min; // Minimum value, or minimum length of string
+  uint32_t max; // Maximum value, unused for string
+};
+
+#define STRING_FIELD(name, member, changes, minLength) \
+  {name, FIELD_STRING, changes, offsetof(Settings, member), sizeof(Settings::member), minLength, 0}
+#define NUMBER_FIELD(name, member, changes, min, max)                                \
+  {name, sizeof(Settings::member) == 2 ? FIELD_UINT16 : FIELD_UINT32, changes,      \
+   offsetof(Settings, member), sizeof(Settings::member), min, max}
+
+static const Field FIELDS[] = {
+    STRING_FIELD("WIFI_SSID", wifiSsid, CONFIG_CHANGED_WIFI, 1),
+    STRING_FIELD("WIFI_PASS", wifiPass, CONFIG_CHANGED_WIFI, 0),
+    STRING_FIELD("MQTT_SERVER", mqttServer, CONFIG_CHANGED_MQTT, 1),
+    NUMBER_FIELD("MQTT_PORT", mqttPort, CONFIG_CHANGED_MQTT, 1, 65535),
+    STRING_FIELD("MQTT_USERNAME", mqttUsername, CONFIG_CHANGED_MQTT, 0),
+    STRING_FIELD("MQTT_PASSWORD", mqttPassword, CONFIG_CHANGED_MQTT, 0),
+    STRING_FIELD("MQTT_TOPIC_STATUS", mqttTopicStatus, CONFIG_CHANGED_MQTT, 1),
+    STRING_FIELD("MQTT_TOPIC_ARRIVE", mqttTopicArrive, CONFIG_CHANGED_MQTT, 1),
+    STRING_FIELD("MQTT_TOPIC_DEPART", mqttTopicDepart, CONFIG_CHANGED_MQTT, 1),
+    NUMBER_FIELD("MQTT_RECONNECT_DELAY", mqttReconnectDelay, CONFIG_CHANGED_TIMING, 1000, 3600000),
+    NUMBER_FIELD("LED_INTERVAL", ledInterval, CONFIG_CHANGED_TIMING, 0, 60000),
+    NUMBER_FIELD("LED_TTL", ledTtl, CONFIG_CHANGED_TIMING, 1000, 3600000),
+    NUMBER_FIELD("LED_TIMEOUT", ledTimeout, CONFIG_CHANGED_TIMING, 2000, 7200000),
+    NUMBER_FIELD("REBOOT_INTERVAL", rebootInterval, CONFIG_CHANGED_TIMING, 0, 0xFFFFFFFF),
+    NUMBER_FIELD("WIFI_TIMEOUT", wifiTimeout, CONFIG_CHANGED_TIMING, 10000, 600000),
+    NUMBER_FIELD("LOOP_SLEEP", loopSleep, CONFIG_CHANGED_TIMING, 0, 1000),
+    NUMBER_FIELD("ANNOUNCEMENT_HEARTBEAT", announcementHeartbeat, CONFIG_CHANGED_TIMING, 500, 60000),
+    NUMBER_FIELD("ANNOUNCEMENT_TIMEOUT", announcementTimeout, CONFIG_CHANGED_TIMING, 1000, 600000),
+};
+#define FIELD_COUNT (sizeof(FIELDS) / sizeof(FIELDS[0]))
+
+// FNV-1a hash identifies messages without keeping them in memory
+static uint32_t messageHash(const char *message, size_t length)
+{
+  uint32_t hash = 2166136261UL;
+  for (size_t i = 0; i < length; i++)
+  {
+    hash ^= (uint8_t)message[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+/* Runtime configuration ********************************************************************************************/
+
+bool Config::begin(const Settings &defaults)
+{
+  _defaults = &defaults;
+  _active = 0;
+  _buffers[0] = defaults;
+  _pending = CONFIG_UNCHANGED;
+
+  Preferences preferences;
+  if (!preferences.begin(CONFIG_NAMESPACE, false))
+  {
+    strlcpy(_error, "NVS not available", sizeof(_error));
+    return false;
+  }
+  _rejectedHash = preferences.getUInt(KEY_REJECTED, 0);
+
+  // Restart before confirmation could be caused by the settings, so they are not used again
+  char message[CONFIG_MAX_MESSAGE];
+  bool reverted = false;
+  if (preferences.isKey(KEY_PENDING))
+  {
+    size_t length = preferences.getBytes(KEY_PENDING, message, sizeof(message));
+    _rejectedHash = messageHash(message, length);
+    preferences.putUInt(KEY_REJECTED, _rejectedHash);
+    preferences.remove(KEY_PENDING);
+    strlcpy(_error, "unconfirmed settings reverted", sizeof(_error));
+    reverted = true;
+  }
+
+  size_t length = preferences.isKey(KEY_MESSAGE) ? preferences.getBytes(KEY_MESSAGE, message, sizeof(message)) : 0;
+  preferences.end();
+  if (length == 0)
+    return false;
+  if (!parse(message, length, _buffers[0]))
+  {
+    // Stored message may not be valid for newer firmware
+    _buffers[0] = defaults;
+    return false;
+  }
+  return !reverted;
+}
+
+int Config::update(const char *message, size_t length)
+{
+  if (_defaults == NULL)
+  {
+    strlcpy(_error, "not initialized", sizeof(_error));
+    return CONFIG_INVALID;
+  }
+  if (length > CONFIG_MAX_MESSAGE)
+  {
+    strlcpy(_error, "message too long", sizeof(_error));
+    return CONFIG_INVALID;
+  }
+
+  // Empty message restores defaults, it's stored as empty line, because NVS can't store empty value
+  if (length == 0)
+  {
+    message = "\n";
+    length = 1;
+  }
+  uint32_t hash = messageHash(message, length);
+  if (hash == _rejectedHash)
+  {
+    strlcpy(_error, "message was reverted before", sizeof(_error));
+    return CONFIG_INVALID;
+  }
+
+  // Inactive buffer is overwritten, so the active settings stay intact when the message is invalid
+  uint8_t next = _active ^ 1;
+  if (!parse(message, length, _buffers[next]))
+    return CONFIG_INVALID;
+  int changes = compare(_buffers[_active], _buffers[next]);
+  if (changes == CONFIG_UNCHANGED)
+    return CONFIG_UNCHANGED;
+
+  // Connection settings are unconfirmed while they differ from the last confirmed ones, whatever came in between
+  if (_pending == CONFIG_UNCHANGED)
+    _confirmed = _buffers[_active];
+  int unconfirmed = compare(_confirmed, _buffers[next]) & (CONFIG_CHANGED_WIFI | CONFIG_CHANGED_MQTT);
+  _active = next;
+  if (unconfirmed != CONFIG_UNCHANGED)
+  {
+    // Connection started before the connection settings changed does not confirm them
+    if (changes & (CONFIG_CHANGED_WIFI | CONFIG_CHANGED_MQTT))
+      _pendingSince = millis();
+    _pendingHash = hash;
+  }
+  _pending = unconfirmed;
+
+  Preferences preferences;
+  if (!preferences.begin(CONFIG_NAMESPACE, false))
+    return changes;
+  if (unconfirmed != CONFIG_UNCHANGED)
+  {
+    // Stored as pending first, so a restart before confirmation reverts it
+    preferences.putBytes(KEY_PENDING, message, length);
+  }
+  else
+  {
+    // Connection settings are the confirmed ones (again), so the message needs no confirmation
+    preferences.putBytes(KEY_MESSAGE, message, length);
+    preferences.remove(KEY_PENDING);
+  }
+  preferences.end();
+  return changes;
+}
+
+void Config::confirm()
+{
+  if (!_pending)
+    return;
+  _pending = CONFIG_UNCHANGED;
+
+  Preferences preferences;
+  if (!preferences.begin(CONFIG_NAMESPACE, false))
+    return;
+  char message[CONFIG_MAX_MESSAGE];
+  size_t length = preferences.getBytes(KEY_PENDING, message, sizeof(message));
+  if (length > 0)
+    preferences.putBytes(KEY_MESSAGE, message, length);
+  preferences.remove(KEY_PENDING);
+  preferences.end();
+}
+
+int Config::rollback()
+{
+  if (!_pending)
+    return CONFIG_UNCHANGED;
+  _pending = CONFIG_UNCHANGED;
+
+  // Inactive buffer may hold settings from another unconfirmed message, so the confirmed ones are copied there
+  uint8_t previous = _active ^ 1;
+  _buffers[previous] = _confirmed;
+  int changes = compare(_buffers[_active], _buffers[previous]);
+  _active = previous;
+  _rejectedHash = _pendingHash;
+  strlcpy(_error, "unconfirmed settings reverted", sizeof(_error));
+
+  Preferences preferences;
+  if (!preferences.begin(CONFIG_NAMESPACE, false))
+    return changes;
+  preferences.putUInt(KEY_REJECTED, _rejectedHash);
+  preferences.remove(KEY_PENDING);
+  preferences.end();
+  return changes;
+}
+
+/* Parsing and validation *******************************************************************************************/
+
+bool Config::parse(const char *message, size_t length, Settings &settings)
+{
+  settings = *_defaults;
+  size_t position = 0;
+  while (position < length)
+  {
+    // Split line to key and value
+    size_t end = position;
+    while (end < length && message[end] != '\n')
+      end++;
+    size_t lineEnd = end;
+    if (lineEnd > position && message[lineEnd - 1] == '\r')
+      lineEnd--;
+    const char *line = message + position;
+    size_t lineLength = lineEnd - position;
+    position = end + 1;
+    if (lineLength == 0 || line[0] == '#')
+      continue;
+
+    const char *separator = (const char *)memchr(line, '=', lineLength);
+    if (separator == NULL)
+    {
+      snprintf(_error, sizeof(_error), "missing '=' in line %.*s", (int)min(lineLength, (size_t)32), line);
+      return false;
+    }
+    if (!setField(settings, line, separator - line, separator + 1, lineEnd - (separator + 1 - message)))
+      return false;
+  }
+  return validate(settings);
+}
+
+bool Config::setField(Settings &settings, const char *key, size_t keyLength, const char *value, size_t valueLength)
+{
+  const Field *field = NULL;
+  for (size_t i = 0; i < FIELD_COUNT; i++)
+  {
+    if (strlen(FIELDS[i].name) == keyLength && memcmp(FIELDS[i].name, key, keyLength) == 0)
+    {
+      field = &FIELDS[i];
+      break;
+    }
+  }
+  if (field == NULL)
+  {
+    snprintf(_error, sizeof(_error), "unknown key %.*s", (int)min(keyLength, (size_t)32), key);
+    return false;
+  }
+
+  uint8_t *target = (uint8_t *)&settings + field->offset;
+  if (field->type == FIELD_STRING)
+  {
+    if (valueLength < field->min || valueLength >= field->size)
+    {
+      snprintf(_error, sizeof(_error), "%s length must be %lu to %u", field->name, (unsigned long)field->min, field->size - 1);
+      return false;
+    }
+    memcpy(target, value, valueLength);
+    target[valueLength] = '\0';
+    return true;
+  }
+
+  // Number is copied to terminated buffer, because the value is not terminated
+  char number[11];
+  char *numberEnd = NULL;
+  unsigned long parsed = 0;
+  if (valueLength > 0 && valueLength < sizeof(number) && isdigit(value[0]))
+  {
+    memcpy(number, value, valueLength);
+    number[valueLength] = '\0';
+    parsed = strtoul(number, &numberEnd, 10);
+  }
+  if (numberEnd == NULL || *numberEnd != '\0' || parsed < field->min || parsed > field->max)
+  {
+    snprintf(_error, sizeof(_error), "%s must be number %lu to %lu", field->name, (unsigned long)field->min, (unsigned long)field->max);
+    return false;
+  }
+  if (field->type == FIELD_UINT16)
+  {
+    uint16_t value16 = parsed;
+    memcpy(target, &value16, sizeof(value16));
+  }
+  else
+  {
+    uint32_t value32 = parsed;
+    memcpy(target, &value32, sizeof(value32));
+  }
+  return true;
+}
+
+// Checks relations between settings, the ranges were checked while parsing
+bool Config::validate(const Settings &settings)
+{
+  if (settings.ledTimeout <= settings.ledTtl)
+  {
+    strlcpy(_error, "LED_TIMEOUT must be longer than LED_TTL", sizeof(_error));
+    return false;
+  }
+  if (settings.announcementTimeout <= settings.announcementHeartbeat)
+  {
+    strlcpy(_error, "ANNOUNCEMENT_TIMEOUT must be longer than heartbeat", sizeof(_error));
+    return false;
+  }
+  // Short interval would restart the device before it connects
+  if (settings.rebootInterval != 0 && settings.rebootInterval < 3600000)
+  {
+    strlcpy(_error, "REBOOT_INTERVAL must be 0 or at least 1 hour", sizeof(_error));
+    return false;
+  }
+  return true;
+}
+
+int Config::compare(const Settings &previous, const Settings &current) const
+{
+  int changes = CONFIG_UNCHANGED;
+  for (size_t i = 0; i < FIELD_COUNT; i++)
+  {
+    const uint8_t *a = (const uint8_t *)&previous + FIELDS[i].offset;
+    const uint8_t *b = (const uint8_t *)&current + FIELDS[i].offset;
+    bool changed = FIELDS[i].type == FIELD_STRING ? strcmp((const char *)a, (const char *)b) != 0 : memcmp(a, b, FIELDS[i].size) != 0;
+    if (changed)
+      changes |= FIELDS[i].changes;
+  }
+  return changes;
+}
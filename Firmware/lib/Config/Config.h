@@ -0,0 +1,111 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - runtime configuration                                                                     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Settings which can be changed without reflashing, typically by retained MQTT message. The message contains lines *
+ * in form KEY=value, where KEY is name of the compile-time default (e.g. LED_TTL=30000); settings not mentioned in *
+ * the message have their default value and an empty message restores all defaults.                                 *
+ * Settings are kept in two buffers: the new ones are parsed and validated in the inactive buffer, which is then    *
+ * made active, so the firmware never sees half-updated or invalid settings and reading them costs nothing. The     *
+ * message is stored in NVS and applied to the defaults after restart, so new defaults in firmware take effect.     *
+ * Changed WiFi or MQTT connection settings are stored only after the connection with them succeeds. Until then,    *
+ * the last confirmed settings are kept in a third buffer and further messages are stored as unconfirmed too. When  *
+ * the connection does not succeed in time, or the device restarts before that, the confirmed settings are restored *
+ * and the last message is ignored then.                                                                            *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+
+/* Configuration - may be overriden by build flags ******************************************************************/
+
+#ifndef CONFIG_ROLLBACK_TIMEOUT
+#define CONFIG_ROLLBACK_TIMEOUT 180000 // ms; changed connection settings are reverted when not confirmed in this time
+#endif
+#ifndef CONFIG_MAX_MESSAGE
+#define CONFIG_MAX_MESSAGE 512 // bytes; maximum length of configuration message
+#endif
+#ifndef CONFIG_NAMESPACE
+#define CONFIG_NAMESPACE "onair" // NVS namespace
+#endif
+
+/* Runtime configuration ********************************************************************************************/
+
+// Result of update(), combination of CONFIG_CHANGED_* flags, or CONFIG_INVALID
+#define CONFIG_UNCHANGED 0
+#define CONFIG_CHANGED_TIMING 1 // Timing changed, takes effect immediately
+#define CONFIG_CHANGED_WIFI 2   // WiFi network changed, reconnection is needed
+#define CONFIG_CHANGED_MQTT 4   // MQTT server or topics changed, reconnection is needed
+#define CONFIG_INVALID -1       // Message was rejected, see error()
+
+struct Settings
+{
+  // WiFi connection
+  char wifiSsid[33];
+  char wifiPass[65];
+
+  // MQTT connection
+  char mqttServer[65];
+  uint16_t mqttPort;
+  char mqttUsername[33];
+  char mqttPassword[65];
+  char mqttTopicStatus[65];
+  char mqttTopicArrive[65];
+  char mqttTopicDepart[65];
+  uint32_t mqttReconnectDelay; // ms
+
+  // Operational parameters
+  uint32_t ledInterval;           // ms; 0 means no blinking
+  uint32_t ledTtl;                // ms
+  uint32_t ledTimeout;            // ms
+  uint32_t rebootInterval;        // ms; 0 means no preventive reboot
+  uint32_t wifiTimeout;           // ms
+  uint32_t loopSleep;             // ms
+  uint32_t announcementHeartbeat; // ms
+  uint32_t announcementTimeout;   // ms
+};
+
+class Config
+{
+public:
+  // Applies message stored in NVS to the defaults, which must stay valid
+  // Returns false when there is no valid stored message or unconfirmed settings were reverted because of restart
+  bool begin(const Settings &defaults);
+
+  // Active settings; the reference is valid until next update() or rollback()
+  const Settings &get() const { return _buffers[_active]; }
+
+  // Parses, validates and activates settings from KEY=value lines
+  // Returns CONFIG_CHANGED_* flags, CONFIG_UNCHANGED or CONFIG_INVALID
+  int update(const char *message, size_t length);
+  const char *error() const { return _error; }
+
+  // CONFIG_CHANGED_* flags of connection settings waiting for confirmation, CONFIG_UNCHANGED when none
+  int pending() const { return _pending; }
+  uint32_t pendingSince() const { return _pendingSince; }
+
+  // Connection with changed settings succeeded, stores them
+  void confirm();
+
+  // Connection with changed settings failed, reverts to last confirmed settings and returns CONFIG_CHANGED_* flags
+  int rollback();
+
+private:
+  bool parse(const char *message, size_t length, Settings &settings);
+  bool setField(Settings &settings, const char *key, size_t keyLength, const char *value, size_t valueLength);
+  bool validate(const Settings &settings);
+  int compare(const Settings &previous, const Settings &current) const;
+
+  Settings _buffers[2];
+  Settings _confirmed; // Settings before unconfirmed connection change, valid while pending
+  const Settings *_defaults = NULL;
+  uint8_t _active = 0;
+  int _pending = CONFIG_UNCHANGED;
+  uint32_t _pendingSince = 0;
+  uint32_t _pendingHash = 0;  // Hash of message with unconfirmed settings
+  uint32_t _rejectedHash = 0; // Hash of message whose settings were reverted
+  char _error[64] = "";
+};
@@ -0,0 +1,342 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - DNS cache                                                                                 *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "DnsCache.h"
+#include <WiFi.h>
+#include <time.h>
+
+#define DNS_CACHE_MAGIC 0x444E5331 // "DNS1", change when Store layout changes
+#define DNS_PORT 53
+#define DNS_TYPE_A 1
+#define DNS_CLASS_IN 1
+#define DNS_MAX_PACKET 512 // bytes; maximum size of DNS response over UDP
+
+#define QUERY_NONE -1    // No response received (yet)
+#define QUERY_FAILED 0   // Server answered, but without address
+#define QUERY_RESOLVED 1 // Server answered with address
+
+RTC_NOINIT_ATTR DnsCache::Store DnsCache::_store;
+
+static uint32_t rtcTime()
+{
+  return time(NULL);
+}
+
+static uint16_t readUint16(const uint8_t *buffer)
+{
+  return (buffer[0] << 8) | buffer[1];
+}
+
+static uint32_t readUint32(const uint8_t *buffer)
+{
+  return ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) | ((uint32_t)buffer[2] << 8) | buffer[3];
+}
+
+// Skips name in DNS message, which is a sequence of labels optionally ending with pointer
+static bool skipName(const uint8_t *packet, size_t length, size_t &pos)
+{
+  while (pos < length)
+  {
+    uint8_t label = packet[pos];
+    if (label == 0)
+    {
+      pos++;
+      return true;
+    }
+    if ((label & 0xC0) == 0xC0)
+    {
+      pos += 2;
+      return pos <= length;
+    }
+    pos += label + 1;
+  }
+  return false;
+}
+
+/* Cache ************************************************************************************************************/
+
+size_t DnsCache::begin()
+{
+  // RTC memory contains garbage after power loss
+  if (_store.magic != DNS_CACHE_MAGIC || _store.checksum != checksum())
+  {
+    memset(&_store, 0, sizeof(_store));
+    _store.magic = DNS_CACHE_MAGIC;
+    save();
+    return 0;
+  }
+
+  size_t count = 0;
+  uint32_t now = rtcTime();
+  for (int i = 0; i < DNS_CACHE_SIZE; i++)
+  {
+    Entry &entry = _store.entries[i];
+    if (entry.host[0] == 0)
+      continue;
+    count++;
+
+    // If the clock went back, the entry may be too old, so it's used only as a last resort
+    if ((int32_t)(entry.expires - now) > DNS_MAX_TTL)
+      entry.expires = entry.refresh = now;
+  }
+  save();
+  return count;
+}
+
+bool DnsCache::resolve(const char *host, IPAddress &address)
+{
+  if (address.fromString(host))
+    return true;
+
+  // Valid cached address
+  Entry *entry = find(host);
+  if (entry != NULL && (int32_t)(entry->expires - rtcTime()) > 0)
+  {
+    _hits++;
+    address = IPAddress(entry->address);
+    return true;
+  }
+  _misses++;
+
+  // Ask DNS server directly to learn TTL, then system resolver, e.g. when direct queries are blocked
+  uint32_t resolved, ttl;
+  if (queryNow(host, &resolved, &ttl))
+  {
+    store(host, resolved, ttl);
+    address = IPAddress(resolved);
+    return true;
+  }
+  if (WiFi.hostByName(host, address))
+  {
+    store(host, (uint32_t)address, DNS_FALLBACK_TTL);
+    return true;
+  }
+
+  // Expired address is better than none
+  if (entry != NULL)
+  {
+    address = IPAddress(entry->address);
+    return true;
+  }
+  return false;
+}
+
+void DnsCache::loop()
+{
+  if (WiFi.status() != WL_CONNECTED)
+    return;
+
+  // Wait for response to background query
+  uint32_t now = rtcTime();
+  if (_refreshing != NULL)
+  {
+    uint32_t address, ttl;
+    int result = receiveResponse(&address, &ttl);
+    if (result == QUERY_RESOLVED)
+    {
+      _refreshes++;
+      store(_refreshing->host, address, ttl);
+      _refreshing = NULL;
+    }
+    else if (result == QUERY_FAILED || millis() - _querySent > DNS_TIMEOUT)
+    {
+      _refreshing->refresh = now + DNS_RETRY_INTERVAL;
+      save();
+      _refreshing = NULL;
+    }
+    return;
+  }
+
+  // Start refreshing first entry which is due
+  for (int i = 0; i < DNS_CACHE_SIZE; i++)
+  {
+    Entry &entry = _store.entries[i];
+    if (entry.host[0] == 0 || (int32_t)(now - entry.refresh) < 0)
+      continue;
+    if (sendQuery(entry.host))
+    {
+      _refreshing = &entry;
+      _querySent = millis();
+    }
+    else
+    {
+      entry.refresh = now + DNS_RETRY_INTERVAL;
+      save();
+    }
+    return;
+  }
+}
+
+DnsCache::Entry *DnsCache::find(const char *host)
+{
+  for (int i = 0; i < DNS_CACHE_SIZE; i++)
+  {
+    if (_store.entries[i].host[0] != 0 && strcmp(_store.entries[i].host, host) == 0)
+      return &_store.entries[i];
+  }
+  return NULL;
+}
+
+void DnsCache::store(const char *host, uint32_t address, uint32_t ttl)
+{
+  if (ttl < DNS_MIN_TTL)
+    ttl = DNS_MIN_TTL;
+  if (ttl > DNS_MAX_TTL)
+    ttl = DNS_MAX_TTL;
+
+  // Use existing entry, free slot or the entry expiring first
+  uint32_t now = rtcTime();
+  Entry *entry = find(host);
+  if (entry == NULL)
+  {
+    if (strlen(host) > DNS_CACHE_HOST_LENGTH)
+      return;
+    entry = &_store.entries[0];
+    for (int i = 0; i < DNS_CACHE_SIZE && entry->host[0] != 0; i++)
+    {
+      Entry *candidate = &_store.entries[i];
+      if (candidate->host[0] == 0 || (int32_t)(candidate->expires - entry->expires) < 0)
+        entry = candidate;
+    }
+    if (entry == _refreshing)
+      _refreshing = NULL;
+    strcpy(entry->host, host);
+  }
+  entry->address = address;
+  entry->expires = now + ttl;
+  entry->refresh = now + ttl * DNS_REFRESH / 100;
+  save();
+}
+
+void DnsCache::save()
+{
+  _store.checksum = checksum();
+}
+
+// FNV-1a hash of the entries
+uint32_t DnsCache::checksum()
+{
+  uint32_t hash = 2166136261;
+  const uint8_t *data = (const uint8_t *)_store.entries;
+  for (size_t i = 0; i < sizeof(_store.entries); i++)
+    hash = (hash ^ data[i]) * 16777619;
+  return hash;
+}
+
+/* DNS queries ******************************************************************************************************/
+
+bool DnsCache::sendQuery(const char *host)
+{
+  // Random source port and query ID make spoofed responses unlikely
+  if (!_udpStarted)
+    _udpStarted = _udp.begin(49152 + esp_random() % 16384);
+  if (!_udpStarted)
+    return false;
+
+  uint8_t packet[12 + DNS_CACHE_HOST_LENGTH + 2 + 4];
+  size_t hostLength = strlen(host);
+  if (hostLength > DNS_CACHE_HOST_LENGTH)
+    return false;
+
+  // Header: ID, recursion desired, single question
+  _queryId = esp_random();
+  memset(packet, 0, 12);
+  packet[0] = _queryId >> 8;
+  packet[1] = _queryId & 0xFF;
+  packet[2] = 0x01;
+  packet[5] = 1;
+
+  // Question: host name as labels, type A, class IN
+  size_t pos = 12;
+  const char *label = host;
+  while (*label)
+  {
+    const char *dot = strchr(label, '.');
+    size_t length = dot != NULL ? dot - label : strlen(label);
+    if (length == 0 || length > 63)
+      return false;
+    packet[pos++] = length;
+    memcpy(packet + pos, label, length);
+    pos += length;
+    label += length + (dot != NULL ? 1 : 0);
+  }
+  packet[pos++] = 0;
+  packet[pos++] = 0;
+  packet[pos++] = DNS_TYPE_A;
+  packet[pos++] = 0;
+  packet[pos++] = DNS_CLASS_IN;
+
+  // Drop responses to previous queries
+  while (_udp.parsePacket() > 0)
+    ;
+  if (!_udp.beginPacket(WiFi.dnsIP(), DNS_PORT))
+    return false;
+  _udp.write(packet, pos);
+  return _udp.endPacket();
+}
+
+int DnsCache::receiveResponse(uint32_t *address, uint32_t *ttl)
+{
+  if (_udp.parsePacket() <= 0)
+    return QUERY_NONE;
+  uint8_t packet[DNS_MAX_PACKET];
+  int length = _udp.read(packet, sizeof(packet));
+  if (length < 12 || readUint16(packet) != _queryId || !(packet[2] & 0x80) || _udp.remoteIP() != WiFi.dnsIP())
+    return QUERY_NONE;
+  if ((packet[3] & 0x0F) != 0)
+    return QUERY_FAILED;
+
+  // Skip questions
+  size_t pos = 12;
+  for (uint16_t i = readUint16(packet + 4); i > 0; i--)
+  {
+    if (!skipName(packet, length, pos))
+      return QUERY_FAILED;
+    pos += 4;
+  }
+
+  // Find first address; TTL is the shortest one of the chain (CNAME records come first)
+  uint32_t shortest = UINT32_MAX;
+  for (uint16_t i = readUint16(packet + 6); i > 0; i--)
+  {
+    if (!skipName(packet, length, pos) || pos + 10 > (size_t)length)
+      return QUERY_FAILED;
+    uint16_t type = readUint16(packet + pos);
+    uint16_t dataLength = readUint16(packet + pos + 8);
+    uint32_t recordTtl = readUint32(packet + pos + 4);
+    if (recordTtl < shortest)
+      shortest = recordTtl;
+    pos += 10;
+    if (pos + dataLength > (size_t)length)
+      return QUERY_FAILED;
+    if (type == DNS_TYPE_A && dataLength == 4)
+    {
+      *address = (uint32_t)IPAddress(packet[pos], packet[pos + 1], packet[pos + 2], packet[pos + 3]);
+      *ttl = shortest;
+      return QUERY_RESOLVED;
+    }
+    pos += dataLength;
+  }
+  return QUERY_FAILED;
+}
+
+bool DnsCache::queryNow(const char *host, uint32_t *address, uint32_t *ttl)
+{
+  // Background query is abandoned, its response would be dropped anyway
+  _refreshing = NULL;
+  if (!sendQuery(host))
+    return false;
+  uint32_t started = millis();
+  while (millis() - started < DNS_TIMEOUT)
+  {
+    int result = receiveResponse(address, ttl);
+    if (result != QUERY_NONE)
+      return result == QUERY_RESOLVED;
+    delay(10);
+  }
+  return false;
+}
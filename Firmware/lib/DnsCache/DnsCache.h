@@ -0,0 +1,98 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - DNS cache                                                                                 *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Caches addresses of MQTT servers, so reconnects go straight to TCP. Queries are sent directly to the DNS server  *
+ * to learn the TTL, entries are refreshed in background before they expire and kept in RTC memory, so they survive *
+ * software restarts (preventive reboot), but not power loss. Time is taken from the RTC, which keeps running over  *
+ * software restarts. When DNS server does not answer, expired address is used rather than none.                   *
+ * There is a single cache in RTC memory, so there should be a single instance of DnsCache.                         *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+
+/* Configuration - may be overriden by build flags ******************************************************************/
+
+#ifndef DNS_CACHE_SIZE
+#define DNS_CACHE_SIZE 4 // number of cached host names
+#endif
+#ifndef DNS_CACHE_HOST_LENGTH
+#define DNS_CACHE_HOST_LENGTH 64 // maximum length of cached host name
+#endif
+#ifndef DNS_MIN_TTL
+#define DNS_MIN_TTL 60 // s; shorter TTLs are extended to this value
+#endif
+#ifndef DNS_MAX_TTL
+#define DNS_MAX_TTL 86400 // s; longer TTLs are shortened to this value
+#endif
+#ifndef DNS_FALLBACK_TTL
+#define DNS_FALLBACK_TTL 300 // s; TTL of addresses resolved by system resolver, which does not report TTL
+#endif
+#ifndef DNS_REFRESH
+#define DNS_REFRESH 75 // %; part of TTL after which the entry is refreshed in background
+#endif
+#ifndef DNS_RETRY_INTERVAL
+#define DNS_RETRY_INTERVAL 30 // s; delay before repeating failed background refresh
+#endif
+#ifndef DNS_TIMEOUT
+#define DNS_TIMEOUT 2000 // ms; time to wait for DNS server response
+#endif
+
+/* DNS cache ********************************************************************************************************/
+
+class DnsCache
+{
+public:
+  // Restores entries kept in RTC memory, returns their number
+  size_t begin();
+
+  // Returns address of the host; cached address is returned without any network traffic while it's valid
+  bool resolve(const char *host, IPAddress &address);
+
+  // Refreshes entries which are close to expiration, must be called regularly
+  void loop();
+
+  uint32_t hits() const { return _hits; }
+  uint32_t misses() const { return _misses; }
+  uint32_t refreshes() const { return _refreshes; }
+
+private:
+  struct Entry
+  {
+    char host[DNS_CACHE_HOST_LENGTH + 1]; // Empty when the slot is free
+    uint32_t address;
+    uint32_t expires; // s; RTC time when the address expires
+    uint32_t refresh; // s; RTC time when the address should be refreshed
+  };
+
+  // Content of RTC memory, validated by magic number and checksum after restart
+  struct Store
+  {
+    uint32_t magic;
+    Entry entries[DNS_CACHE_SIZE];
+    uint32_t checksum;
+  };
+
+  bool sendQuery(const char *host);
+  int receiveResponse(uint32_t *address, uint32_t *ttl);
+  bool queryNow(const char *host, uint32_t *address, uint32_t *ttl);
+  Entry *find(const char *host);
+  void store(const char *host, uint32_t address, uint32_t ttl);
+  void save();
+  static uint32_t checksum();
+
+  static Store _store;
+  WiFiUDP _udp;
+  bool _udpStarted = false;
+  uint16_t _queryId = 0;
+  Entry *_refreshing = NULL; // Entry with background query in progress
+  uint32_t _querySent = 0;
+  uint32_t _hits = 0;
+  uint32_t _misses = 0;
+  uint32_t _refreshes = 0;
+};
@@ -0,0 +1,76 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - heap health                                                                               *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "HeapHealth.h"
+#include <esp_heap_caps.h>
+
+HeapHealth::HeapHealth(const char *const *names, size_t count) : _names(names), _count(min(count, (size_t)HEAP_MAX_SUBSYSTEMS))
+{
+  memset(_subsystems, 0, sizeof(_subsystems));
+  memset(_entered, 0, sizeof(_entered));
+}
+
+void HeapHealth::loop()
+{
+  if (_lastSample != 0 && millis() - _lastSample < HEAP_SAMPLE_INTERVAL)
+    return;
+  _lastSample = millis();
+  _free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  _minimum = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+  _largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+  int status = HEAP_HEALTHY;
+  if (_free < HEAP_MIN_FREE)
+    status = HEAP_LOW;
+  else if (_largest < HEAP_MIN_BLOCK)
+    status = HEAP_FRAGMENTED;
+  if (status != HEAP_HEALTHY && _status == HEAP_HEALTHY)
+    _unhealthySince = millis();
+  _status = status;
+}
+
+uint8_t HeapHealth::fragmentation() const
+{
+  if (_free == 0)
+    return 0;
+  return 100 - (uint64_t)_largest * 100 / _free;
+}
+
+const char *HeapHealth::statusName() const
+{
+  switch (_status)
+  {
+  case HEAP_HEALTHY:
+    return "healthy";
+  case HEAP_LOW:
+    return "low";
+  case HEAP_FRAGMENTED:
+    return "fragmented";
+  default:
+    return "unknown";
+  }
+}
+
+/* Subsystems *******************************************************************************************************/
+
+void HeapHealth::enter(size_t subsystem)
+{
+  if (subsystem < _count)
+    _entered[subsystem] = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+}
+
+void HeapHealth::leave(size_t subsystem)
+{
+  if (subsystem >= _count)
+    return;
+  int32_t used = (int32_t)(_entered[subsystem] - heap_caps_get_free_size(MALLOC_CAP_8BIT));
+  HeapSubsystem &stats = _subsystems[subsystem];
+  stats.used += used;
+  stats.calls++;
+  if (used > 0)
+    stats.growths++;
+}
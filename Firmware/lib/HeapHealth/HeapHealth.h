@@ -0,0 +1,90 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - heap health                                                                               *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Measures free heap, the largest free block and fragmentation (part of free heap not usable for the largest       *
+ * allocation), so a restart is done only when the heap really is in bad shape - TLS connection needs about 40 kB   *
+ * of heap, with 16 kB blocks. Heap is considered unhealthy when it stays below the limits for some time, because   *
+ * it drops briefly while connecting.                                                                               *
+ * Net heap use of subsystems is measured by free heap before and after each of their calls, so a leak shows up as  *
+ * steadily growing use of one subsystem. Other tasks (WiFi, TCP/IP) allocate at the same time, so single changes   *
+ * are not exact, but the trend is.                                                                                 *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+
+/* Configuration - may be overriden by build flags ******************************************************************/
+
+#ifndef HEAP_MIN_FREE
+#define HEAP_MIN_FREE 40000 // bytes; heap is unhealthy when free heap is below this
+#endif
+#ifndef HEAP_MIN_BLOCK
+#define HEAP_MIN_BLOCK 20000 // bytes; heap is unhealthy when the largest free block is below this
+#endif
+#ifndef HEAP_UNHEALTHY_TIME
+#define HEAP_UNHEALTHY_TIME 600000 // ms; restart is needed when heap is unhealthy for this time
+#endif
+#ifndef HEAP_SAMPLE_INTERVAL
+#define HEAP_SAMPLE_INTERVAL 1000 // ms; interval of heap measurement
+#endif
+#ifndef HEAP_MAX_SUBSYSTEMS
+#define HEAP_MAX_SUBSYSTEMS 8 // maximum number of measured subsystems
+#endif
+
+/* Heap health ******************************************************************************************************/
+
+#define HEAP_HEALTHY 0    // Heap is fine
+#define HEAP_LOW 1        // Free heap is below HEAP_MIN_FREE
+#define HEAP_FRAGMENTED 2 // Enough free heap, but the largest free block is below HEAP_MIN_BLOCK
+
+struct HeapSubsystem
+{
+  int32_t used;     // bytes; net heap use since start (negative when more was freed than allocated)
+  uint32_t calls;   // Number of measured calls
+  uint32_t growths; // Number of calls after which less heap was free
+};
+
+class HeapHealth
+{
+public:
+  // Names of subsystems measured by enter() and leave(), at most HEAP_MAX_SUBSYSTEMS
+  HeapHealth(const char *const *names, size_t count);
+
+  // Measures heap every HEAP_SAMPLE_INTERVAL, must be called regularly
+  void loop();
+
+  uint32_t freeHeap() const { return _free; }        // bytes; free heap at last measurement
+  uint32_t minimumFree() const { return _minimum; }  // bytes; lowest free heap since boot
+  uint32_t largestBlock() const { return _largest; } // bytes; largest free block at last measurement
+  uint8_t fragmentation() const;                     // %; part of free heap outside of the largest free block
+  int status() const { return _status; }             // HEAP_* status at last measurement
+  const char *statusName() const;
+
+  // Heap has been unhealthy for HEAP_UNHEALTHY_TIME
+  bool restartNeeded() const { return _status != HEAP_HEALTHY && millis() - _unhealthySince >= HEAP_UNHEALTHY_TIME; }
+
+  // Measures net heap use of code between enter() and leave() of the subsystem
+  void enter(size_t subsystem);
+  void leave(size_t subsystem);
+
+  size_t count() const { return _count; }
+  const char *name(size_t subsystem) const { return _names[subsystem]; }
+  const HeapSubsystem &subsystem(size_t subsystem) const { return _subsystems[subsystem]; }
+
+private:
+  const char *const *_names;
+  size_t _count;
+  HeapSubsystem _subsystems[HEAP_MAX_SUBSYSTEMS];
+  uint32_t _entered[HEAP_MAX_SUBSYSTEMS];
+
+  uint32_t _lastSample = 0;
+  uint32_t _free = 0;
+  uint32_t _minimum = 0;
+  uint32_t _largest = 0;
+  int _status = HEAP_HEALTHY;
+  uint32_t _unhealthySince = 0;
+};
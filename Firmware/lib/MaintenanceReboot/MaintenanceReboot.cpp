@@ -0,0 +1,63 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - maintenance reboot                                                                        *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "MaintenanceReboot.h"
+
+void MaintenanceReboot::begin(const char *deviceId)
+{
+  // FNV-1a hash spreads similar MAC addresses evenly
+  uint32_t hash = 2166136261;
+  for (const char *c = deviceId; *c != 0; c++)
+    hash = (hash ^ (uint8_t)*c) * 16777619;
+  _offset = hash % REBOOT_SPREAD;
+  _quietSince = millis();
+}
+
+bool MaintenanceReboot::check(uint32_t interval, uint64_t uptime, bool onAir)
+{
+  if (onAir)
+    _quietSince = millis();
+  if (interval == 0 || uptime < due(interval) || millis() - _quietSince < REBOOT_QUIET_TIME)
+    return false;
+
+  // Only the limited number of devices reconnects at the same time
+  if (rebooting() >= REBOOT_CONCURRENT)
+  {
+    if (!_waiting)
+      _postponed++;
+    _waiting = true;
+
+    // Waiting devices continue at random times after the reboots finish, not all at once
+    _waitStarted = millis();
+    _waitTime = random(REBOOT_SLOT_TIME);
+    return false;
+  }
+  if (_waiting && millis() - _waitStarted < _waitTime)
+    return false;
+  _waiting = false;
+  return true;
+}
+
+void MaintenanceReboot::announced()
+{
+  // Only the newest announcements are kept, older ones would not block the reboot anyway
+  _announced[_announcedNext] = millis();
+  _announcedNext = (_announcedNext + 1) % REBOOT_CONCURRENT;
+  if (_announcedCount < REBOOT_CONCURRENT)
+    _announcedCount++;
+}
+
+uint8_t MaintenanceReboot::rebooting() const
+{
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < _announcedCount; i++)
+  {
+    if (millis() - _announced[i] < REBOOT_SLOT_TIME)
+      count++;
+  }
+  return count;
+}
@@ -0,0 +1,68 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - maintenance reboot                                                                        *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Schedules periodic reboots so that boxes flashed at the same time do not restart (and reconnect to the server)   *
+ * at the same time:                                                                                                *
+ * - Each device adds its own offset to the reboot interval, derived from hash of its ID (MAC address).             *
+ * - The reboot waits for a quiet period - the device must be off air for some time.                                *
+ * - Devices announce their reboots to each other (over MQTT topic) and a device postpones its reboot while the     *
+ *   limit of concurrent reboots is reached, i.e. other devices are still reconnecting.                             *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+
+/* Configuration - may be overriden by build flags ******************************************************************/
+
+#ifndef REBOOT_SPREAD
+#define REBOOT_SPREAD 14400000 // ms; reboots of devices are spread over this time after the reboot interval (4 hours)
+#endif
+#ifndef REBOOT_QUIET_TIME
+#define REBOOT_QUIET_TIME 600000 // ms; device reboots only when it has been off air for this time
+#endif
+#ifndef REBOOT_CONCURRENT
+#define REBOOT_CONCURRENT 2 // maximum number of devices rebooting at the same time
+#endif
+#ifndef REBOOT_SLOT_TIME
+#define REBOOT_SLOT_TIME 120000 // ms; time needed to reboot and reconnect, announced reboot is considered in progress
+#endif
+
+/* Maintenance reboot ***********************************************************************************************/
+
+class MaintenanceReboot
+{
+public:
+  // Offset is derived from the device ID, so it's stable over reboots and different for each device
+  void begin(const char *deviceId);
+
+  // Uptime in ms when the reboot is due, 0 when interval is 0 (reboots are disabled)
+  uint64_t due(uint32_t interval) const { return interval == 0 ? 0 : (uint64_t)interval + _offset; }
+  uint32_t offset() const { return _offset; }
+
+  // Returns true when the device should reboot now, must be called regularly
+  bool check(uint32_t interval, uint64_t uptime, bool onAir);
+
+  // Other device announced its reboot
+  void announced();
+
+  // Number of reboots of other devices in progress
+  uint8_t rebooting() const;
+
+  // Number of times the reboot was postponed because of other reboots
+  uint32_t postponed() const { return _postponed; }
+
+private:
+  uint32_t _offset = 0;
+  uint32_t _quietSince = 0;
+  uint32_t _announced[REBOOT_CONCURRENT]; // Times of recent reboot announcements
+  uint8_t _announcedCount = 0;
+  uint8_t _announcedNext = 0;
+  bool _waiting = false; // Reboot was postponed
+  uint32_t _waitStarted = 0;
+  unsigned long _waitTime = 0;
+  uint32_t _postponed = 0;
+};
@@ -0,0 +1,519 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - embedded MQTT broker                                                                      *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "MqttBroker.h"
+
+// Packet types
+#define BROKER_CONNECT 0x10
+#define BROKER_CONNACK 0x20
+#define BROKER_PUBLISH 0x30
+#define BROKER_PUBACK 0x40
+#define BROKER_SUBSCRIBE 0x80
+#define BROKER_SUBACK 0x90
+#define BROKER_UNSUBSCRIBE 0xA0
+#define BROKER_UNSUBACK 0xB0
+#define BROKER_PINGREQ 0xC0
+#define BROKER_PINGRESP 0xD0
+#define BROKER_DISCONNECT 0xE0
+
+#define BROKER_VERSION_3_1_1 4
+#define BROKER_CONNACK_BAD_PROTOCOL 0x01
+#define BROKER_DEFAULT_KEEPALIVE 60 // s; used when client disables keepalive, so dead sockets are closed eventually
+
+static uint16_t readUint16(const uint8_t *buffer)
+{
+  return (buffer[0] << 8) | buffer[1];
+}
+
+// Reads length-prefixed string to a null terminated buffer, returns false when it does not fit
+static bool readString(const uint8_t *buffer, size_t &pos, size_t end, char *target, size_t capacity)
+{
+  if (pos + 2 > end)
+    return false;
+  size_t length = readUint16(buffer + pos);
+  pos += 2;
+  if (pos + length > end || length >= capacity)
+    return false;
+  memcpy(target, buffer + pos, length);
+  target[length] = 0;
+  pos += length;
+  return true;
+}
+
+MqttBroker::MqttBroker(uint16_t port) : _server(port, MQTT_BROKER_MAX_CLIENTS)
+{
+  for (int i = 0; i < MQTT_BROKER_MAX_CLIENTS; i++)
+  {
+    _sessions[i].active = false;
+    _sessions[i].connected = false;
+  }
+  memset(_retained, 0, sizeof(_retained));
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+void MqttBroker::begin()
+{
+  _server.begin();
+  _server.setNoDelay(true);
+}
+
+/* Connections ******************************************************************************************************/
+
+void MqttBroker::loop()
+{
+  accept();
+
+  for (int i = 0; i < MQTT_BROKER_MAX_CLIENTS; i++)
+  {
+    Session &session = _sessions[i];
+    if (!session.active)
+      continue;
+
+    // Socket closed without DISCONNECT - send last will
+    if (!session.socket.connected())
+    {
+      close(session, true);
+      continue;
+    }
+
+    size_t length;
+    while (session.active && (length = receivePacket(session)) > 0)
+    {
+      session.lastActivity = millis();
+      handlePacket(session, length);
+    }
+
+    // Client did not send anything for 1.5 times keepalive interval
+    if (session.active && millis() - session.lastActivity > session.keepAlive * 1500UL)
+      close(session, true);
+  }
+}
+
+void MqttBroker::accept()
+{
+  while (_server.hasClient())
+  {
+    WiFiClient socket = _server.available();
+    Session *free = NULL;
+    for (int i = 0; i < MQTT_BROKER_MAX_CLIENTS && free == NULL; i++)
+    {
+      if (!_sessions[i].active)
+        free = &_sessions[i];
+    }
+    if (free == NULL)
+    {
+      _stats.rejectedClients++;
+      socket.stop();
+      continue;
+    }
+
+    free->socket = socket;
+    free->socket.setNoDelay(true);
+    free->active = true;
+    free->connected = false;
+    free->id[0] = 0;
+    free->keepAlive = BROKER_DEFAULT_KEEPALIVE;
+    free->lastActivity = millis();
+    free->received = free->packetLength = free->headerLength = 0;
+    memset(free->subscriptions, 0, sizeof(free->subscriptions));
+    free->hasWill = false;
+  }
+}
+
+void MqttBroker::close(Session &session, bool sendWill)
+{
+  bool wasConnected = session.connected;
+  session.socket.stop();
+  session.active = false;
+  session.connected = false;
+  if (wasConnected)
+    _stats.clients--;
+  if (wasConnected && sendWill && session.hasWill)
+    publish(session.will.topic, session.will.payload, session.will.length, session.will.retain);
+}
+
+/* Packets **********************************************************************************************************/
+
+// Reads available bytes of the current packet, returns its length when complete or 0 otherwise
+size_t MqttBroker::receivePacket(Session &session)
+{
+  while (session.packetLength == 0)
+  {
+    if (!session.socket.available())
+      return 0;
+    uint8_t value = session.socket.read();
+    session.buffer[session.received++] = value;
+    if (session.received > 1 && !(value & 0x80))
+    {
+      uint32_t remaining = 0;
+      for (size_t i = 1; i < session.received; i++)
+        remaining |= (uint32_t)(session.buffer[i] & 0x7F) << (7 * (i - 1));
+      session.headerLength = session.received;
+      session.packetLength = session.headerLength + remaining;
+    }
+    else if (session.received >= 5)
+    {
+      // Malformed remaining length
+      close(session, true);
+      return 0;
+    }
+  }
+
+  // Packets which don't fit are a protocol violation for this broker, the client is disconnected
+  if (session.packetLength > MQTT_BROKER_BUFFER_SIZE)
+  {
+    close(session, true);
+    return 0;
+  }
+  while (session.received < session.packetLength)
+  {
+    int available = session.socket.available();
+    if (available <= 0)
+      return 0;
+    size_t wanted = session.packetLength - session.received;
+    if ((size_t)available < wanted)
+      wanted = available;
+    int count = session.socket.read(session.buffer + session.received, wanted);
+    if (count <= 0)
+      return 0;
+    session.received += count;
+  }
+
+  size_t length = session.packetLength;
+  session.received = session.packetLength = 0;
+  return length;
+}
+
+void MqttBroker::handlePacket(Session &session, size_t length)
+{
+  uint8_t type = session.buffer[0] & 0xF0;
+
+  // First packet must be CONNECT
+  if (!session.connected && type != BROKER_CONNECT)
+  {
+    close(session, false);
+    return;
+  }
+
+  switch (type)
+  {
+  case BROKER_CONNECT:
+    handleConnect(session, length);
+    break;
+  case BROKER_PUBLISH:
+    handlePublish(session, length);
+    break;
+  case BROKER_SUBSCRIBE:
+    handleSubscribe(session, length, true);
+    break;
+  case BROKER_UNSUBSCRIBE:
+    handleSubscribe(session, length, false);
+    break;
+  case BROKER_PINGREQ:
+  {
+    uint8_t response[] = {BROKER_PINGRESP, 0x00};
+    session.socket.write(response, sizeof(response));
+    break;
+  }
+  case BROKER_DISCONNECT:
+    close(session, false);
+    break;
+  default:
+    // PUBACK and others need no action, messages are delivered with QoS 0
+    break;
+  }
+}
+
+void MqttBroker::handleConnect(Session &session, size_t length)
+{
+  const uint8_t *buffer = session.buffer;
+  size_t pos = session.headerLength;
+  char protocol[5];
+  if (session.connected || !readString(buffer, pos, length, protocol, sizeof(protocol)) || strcmp(protocol, "MQTT") != 0 || pos + 4 > length)
+  {
+    close(session, false);
+    return;
+  }
+
+  // Only MQTT 3.1.1 is supported, newer clients are expected to fall back
+  if (buffer[pos] != BROKER_VERSION_3_1_1)
+  {
+    uint8_t response[] = {BROKER_CONNACK, 0x02, 0x00, BROKER_CONNACK_BAD_PROTOCOL};
+    session.socket.write(response, sizeof(response));
+    close(session, false);
+    return;
+  }
+  uint8_t flags = buffer[pos + 1];
+  uint16_t keepAlive = readUint16(buffer + pos + 2);
+  pos += 4;
+
+  bool ok = readString(buffer, pos, length, session.id, sizeof(session.id));
+  session.hasWill = ok && (flags & 0x04);
+  if (session.hasWill)
+  {
+    session.will.retain = flags & 0x20;
+    ok = readString(buffer, pos, length, session.will.topic, sizeof(session.will.topic)) && pos + 2 <= length;
+    if (ok)
+    {
+      session.will.length = readUint16(buffer + pos);
+      pos += 2;
+      ok = pos + session.will.length <= length && session.will.length <= MQTT_BROKER_MAX_WILL_LENGTH;
+      if (ok)
+        memcpy(session.will.payload, buffer + pos, session.will.length);
+    }
+  }
+  if (!ok)
+  {
+    close(session, false);
+    return;
+  }
+
+  // Client with the same ID takes over the previous connection
+  for (int i = 0; i < MQTT_BROKER_MAX_CLIENTS; i++)
+  {
+    Session &other = _sessions[i];
+    if (&other != &session && other.connected && strcmp(other.id, session.id) == 0)
+      close(other, false);
+  }
+
+  session.keepAlive = keepAlive > 0 ? keepAlive : BROKER_DEFAULT_KEEPALIVE;
+  session.connected = true;
+  _stats.clients++;
+  if (_stats.clients > _stats.maxClients)
+    _stats.maxClients = _stats.clients;
+
+  // Sessions are never persisted, so session present flag is always cleared
+  uint8_t response[] = {BROKER_CONNACK, 0x02, 0x00, 0x00};
+  session.socket.write(response, sizeof(response));
+}
+
+void MqttBroker::handlePublish(Session &session, size_t length)
+{
+  const uint8_t *buffer = session.buffer;
+  uint8_t qos = (buffer[0] >> 1) & 0x03;
+  bool retain = buffer[0] & 0x01;
+  size_t pos = session.headerLength;
+  char topic[MQTT_BROKER_MAX_TOPIC_LENGTH + 1];
+  if (qos > 1 || !readString(buffer, pos, length, topic, sizeof(topic)) || (qos == 1 && pos + 2 > length))
+  {
+    close(session, false);
+    return;
+  }
+  uint16_t packetId = 0;
+  if (qos == 1)
+  {
+    packetId = readUint16(buffer + pos);
+    pos += 2;
+  }
+
+  _stats.published++;
+  publish(topic, buffer + pos, length - pos, retain);
+
+  if (qos == 1)
+  {
+    uint8_t response[] = {BROKER_PUBACK, 0x02, (uint8_t)(packetId >> 8), (uint8_t)(packetId & 0xFF)};
+    session.socket.write(response, sizeof(response));
+  }
+}
+
+void MqttBroker::handleSubscribe(Session &session, size_t length, bool subscribe)
+{
+  const uint8_t *buffer = session.buffer;
+  size_t pos = session.headerLength;
+  if (pos + 2 > length)
+  {
+    close(session, false);
+    return;
+  }
+  uint16_t packetId = readUint16(buffer + pos);
+  pos += 2;
+
+  // Response is built over the already processed part of the request
+  uint8_t response[4 + MQTT_BROKER_MAX_SUBSCRIPTIONS];
+  size_t responseLength = 4;
+  while (pos < length)
+  {
+    char filter[MQTT_BROKER_MAX_TOPIC_LENGTH + 1];
+    if (!readString(buffer, pos, length, filter, sizeof(filter)) || (subscribe && pos + 1 > length))
+    {
+      close(session, false);
+      return;
+    }
+    if (subscribe)
+      pos++; // Requested QoS, everything is delivered with QoS 0
+
+    // Find existing subscription or free slot
+    int slot = -1;
+    for (int i = 0; i < MQTT_BROKER_MAX_SUBSCRIPTIONS; i++)
+    {
+      if (strcmp(session.subscriptions[i], filter) == 0)
+      {
+        slot = i;
+        break;
+      }
+      if (slot < 0 && session.subscriptions[i][0] == 0)
+        slot = i;
+    }
+
+    uint8_t result = 0x80; // Failure
+    if (subscribe && slot >= 0)
+    {
+      strcpy(session.subscriptions[slot], filter);
+      result = 0x00; // Granted QoS 0
+    }
+    else if (!subscribe && slot >= 0 && strcmp(session.subscriptions[slot], filter) == 0)
+    {
+      session.subscriptions[slot][0] = 0;
+    }
+    if (subscribe && responseLength < sizeof(response))
+      response[responseLength++] = result;
+  }
+
+  response[0] = subscribe ? BROKER_SUBACK : BROKER_UNSUBACK;
+  response[1] = responseLength - 2;
+  response[2] = packetId >> 8;
+  response[3] = packetId & 0xFF;
+  session.socket.write(response, responseLength);
+
+  // Send retained messages matching new subscriptions
+  if (subscribe)
+  {
+    for (int i = 0; i < MQTT_BROKER_MAX_RETAINED; i++)
+    {
+      MqttRetainedMessage &message = _retained[i];
+      if (message.topic[0] == 0)
+        continue;
+      for (int j = 0; j < MQTT_BROKER_MAX_SUBSCRIPTIONS; j++)
+      {
+        if (session.subscriptions[j][0] != 0 && topicMatches(session.subscriptions[j], message.topic))
+        {
+          sendMessage(session, message.topic, message.payload, message.length, true);
+          break;
+        }
+      }
+    }
+  }
+}
+
+/* Delivery *********************************************************************************************************/
+
+void MqttBroker::publish(const char *topic, const uint8_t *payload, size_t length, bool retain)
+{
+  if (retain)
+    storeRetained(topic, payload, length);
+
+  unsigned long start = micros();
+  for (int i = 0; i < MQTT_BROKER_MAX_CLIENTS; i++)
+  {
+    Session &session = _sessions[i];
+    if (!session.connected)
+      continue;
+    for (int j = 0; j < MQTT_BROKER_MAX_SUBSCRIPTIONS; j++)
+    {
+      if (session.subscriptions[j][0] != 0 && topicMatches(session.subscriptions[j], topic))
+      {
+        if (sendMessage(session, topic, payload, length, false))
+          _stats.delivered++;
+        break;
+      }
+    }
+  }
+  _stats.lastFanOut = micros() - start;
+  if (_stats.lastFanOut > _stats.maxFanOut)
+    _stats.maxFanOut = _stats.lastFanOut;
+}
+
+bool MqttBroker::sendMessage(Session &session, const char *topic, const uint8_t *payload, size_t length, bool retain)
+{
+  uint8_t packet[5 + 2 + MQTT_BROKER_MAX_TOPIC_LENGTH + MQTT_BROKER_BUFFER_SIZE];
+  size_t topicLength = strlen(topic);
+  uint32_t remaining = 2 + topicLength + length;
+  size_t pos = 0;
+  packet[pos++] = BROKER_PUBLISH | (retain ? 0x01 : 0x00);
+  do
+  {
+    uint8_t digit = remaining & 0x7F;
+    remaining >>= 7;
+    packet[pos++] = remaining > 0 ? digit | 0x80 : digit;
+  } while (remaining > 0);
+  packet[pos++] = topicLength >> 8;
+  packet[pos++] = topicLength & 0xFF;
+  memcpy(packet + pos, topic, topicLength);
+  pos += topicLength;
+  memcpy(packet + pos, payload, length);
+  pos += length;
+  return session.socket.write(packet, pos) == pos;
+}
+
+void MqttBroker::storeRetained(const char *topic, const uint8_t *payload, size_t length)
+{
+  // Find existing message or free slot
+  MqttRetainedMessage *slot = NULL;
+  for (int i = 0; i < MQTT_BROKER_MAX_RETAINED; i++)
+  {
+    if (strcmp(_retained[i].topic, topic) == 0)
+    {
+      slot = &_retained[i];
+      break;
+    }
+    if (slot == NULL && _retained[i].topic[0] == 0)
+      slot = &_retained[i];
+  }
+
+  // Empty payload deletes retained message
+  if (length == 0)
+  {
+    if (slot != NULL && strcmp(slot->topic, topic) == 0)
+      slot->topic[0] = 0;
+    return;
+  }
+  if (slot == NULL || strlen(topic) > MQTT_BROKER_MAX_TOPIC_LENGTH)
+  {
+    _stats.droppedRetained++;
+    return;
+  }
+
+  // Message which does not fit still replaces the previous one, so new subscribers don't get outdated message
+  if (length > MQTT_BROKER_MAX_RETAINED_LENGTH)
+  {
+    if (strcmp(slot->topic, topic) == 0)
+      slot->topic[0] = 0;
+    _stats.droppedRetained++;
+    return;
+  }
+  strcpy(slot->topic, topic);
+  memcpy(slot->payload, payload, length);
+  slot->length = length;
+  slot->retain = true;
+}
+
+// Matches topic against filter with + and # wildcards
+bool MqttBroker::topicMatches(const char *filter, const char *topic)
+{
+  while (*filter)
+  {
+    if (*filter == '#')
+      return true;
+    if (*filter == '+')
+    {
+      while (*topic && *topic != '/')
+        topic++;
+      filter++;
+    }
+    else
+    {
+      // Multi-level wildcard matches the parent level too ("a/#" matches "a")
+      if (*topic == 0 && strcmp(filter, "/#") == 0)
+        return true;
+      if (*filter != *topic)
+        return false;
+      filter++;
+      topic++;
+    }
+  }
+  return *topic == 0;
+}
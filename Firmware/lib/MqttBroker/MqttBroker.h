@@ -0,0 +1,119 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - embedded MQTT broker                                                                      *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Minimal MQTT 3.1.1 broker, so the boxes can work without external MQTT server. It supports just what the boxes   *
+ * need: subscriptions with wildcards, retained messages and last will. Messages are forwarded with QoS 0, QoS 1    *
+ * publications are acknowledged. Sessions are not persisted and there is no authentication, so the broker should   *
+ * be used only on trusted local network. MQTT 5 clients are refused with "unacceptable protocol version".          *
+ * All state lives in fixed size tables, there are no heap allocations except for the sockets themselves.           *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+/* Configuration - may be overriden by build flags ******************************************************************/
+
+#ifndef MQTT_BROKER_MAX_CLIENTS
+#define MQTT_BROKER_MAX_CLIENTS 8 // maximum number of connected clients
+#endif
+#ifndef MQTT_BROKER_MAX_SUBSCRIPTIONS
+#define MQTT_BROKER_MAX_SUBSCRIPTIONS 8 // maximum number of subscriptions per client (boxes use up to 4)
+#endif
+#ifndef MQTT_BROKER_MAX_RETAINED
+#define MQTT_BROKER_MAX_RETAINED 4 // maximum number of retained messages
+#endif
+#ifndef MQTT_BROKER_MAX_TOPIC_LENGTH
+#define MQTT_BROKER_MAX_TOPIC_LENGTH 64 // bytes; maximum length of topic or topic filter
+#endif
+#ifndef MQTT_BROKER_MAX_RETAINED_LENGTH
+#define MQTT_BROKER_MAX_RETAINED_LENGTH 512 // bytes; maximum length of retained message, fits configuration message
+#endif
+#ifndef MQTT_BROKER_MAX_WILL_LENGTH
+#define MQTT_BROKER_MAX_WILL_LENGTH 32 // bytes; maximum length of last will (boxes send their MAC address)
+#endif
+#ifndef MQTT_BROKER_BUFFER_SIZE
+// bytes; receive buffer per client, fits QoS 1 publication of 512 bytes configuration message, larger packets are dropped
+#define MQTT_BROKER_BUFFER_SIZE (5 + 2 + MQTT_BROKER_MAX_TOPIC_LENGTH + 2 + 512)
+#endif
+
+/* Broker ***********************************************************************************************************/
+
+// Message stored by the broker (retained message or last will), Size is maximum length of payload
+template <size_t Size>
+struct MqttStoredMessage
+{
+  char topic[MQTT_BROKER_MAX_TOPIC_LENGTH + 1];
+  uint8_t payload[Size];
+  size_t length;
+  bool retain;
+};
+typedef MqttStoredMessage<MQTT_BROKER_MAX_RETAINED_LENGTH> MqttRetainedMessage;
+typedef MqttStoredMessage<MQTT_BROKER_MAX_WILL_LENGTH> MqttWillMessage;
+
+// Broker statistics, used to measure fan-out latency and load
+struct MqttBrokerStats
+{
+  uint8_t clients;          // Currently connected clients
+  uint8_t maxClients;       // Maximum connected clients seen
+  uint32_t rejectedClients; // Connections refused because all slots were taken
+  uint32_t droppedRetained; // Retained messages not stored, because they were too long or all slots were taken
+  uint32_t published;       // Messages received from clients
+  uint32_t delivered;       // Messages delivered to subscribers
+  uint32_t lastFanOut;      // us; time to deliver last message to all subscribers
+  uint32_t maxFanOut;       // us; maximum time to deliver message to all subscribers
+};
+
+class MqttBroker
+{
+public:
+  MqttBroker(uint16_t port);
+
+  void begin();
+
+  // Accepts connections and processes packets, must be called regularly
+  void loop();
+
+  // Delivers message to subscribers as if it was published by a client
+  void publish(const char *topic, const uint8_t *payload, size_t length, bool retain);
+
+  const MqttBrokerStats &stats() const { return _stats; }
+
+private:
+  struct Session
+  {
+    WiFiClient socket;
+    bool active;    // Socket is open
+    bool connected; // CONNECT was accepted
+    char id[24];
+    uint16_t keepAlive;
+    uint32_t lastActivity;
+    uint8_t buffer[MQTT_BROKER_BUFFER_SIZE];
+    size_t received;
+    size_t packetLength;
+    size_t headerLength;
+    char subscriptions[MQTT_BROKER_MAX_SUBSCRIPTIONS][MQTT_BROKER_MAX_TOPIC_LENGTH + 1];
+    bool hasWill;
+    MqttWillMessage will;
+  };
+
+  void accept();
+  size_t receivePacket(Session &session);
+  void handlePacket(Session &session, size_t length);
+  void handleConnect(Session &session, size_t length);
+  void handlePublish(Session &session, size_t length);
+  void handleSubscribe(Session &session, size_t length, bool subscribe);
+  void close(Session &session, bool sendWill);
+  bool sendMessage(Session &session, const char *topic, const uint8_t *payload, size_t length, bool retain);
+  void storeRetained(const char *topic, const uint8_t *payload, size_t length);
+  static bool topicMatches(const char *filter, const char *topic);
+
+  WiFiServer _server;
+  Session _sessions[MQTT_BROKER_MAX_CLIENTS];
+  MqttRetainedMessage _retained[MQTT_BROKER_MAX_RETAINED];
+  MqttBrokerStats _stats;
+};
@@ -0,0 +1,784 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - MQTT client                                                                               *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "MqttClient.h"
+#include <Transport.h>
+
+#define MQTT_MAX_HEADER_SIZE 5         // Fixed header byte + up to 4 bytes of remaining length
+#define MQTT_CONNACK_UNSUPPORTED_V3 1  // MQTT 3.1.1 return code: unacceptable protocol version
+#define MQTT_CONNACK_UNSUPPORTED_V5 0x84 // MQTT 5 reason code: unsupported protocol version
+
+template <class Transport>
+MqttClient<Transport>::MqttClient()
+{
+  memset(_outboundAliases, 0, sizeof(_outboundAliases));
+  memset(_inboundAliases, 0, sizeof(_inboundAliases));
+}
+
+template <class Transport>
+MqttClient<Transport> &MqttClient<Transport>::setServer(const char *host, uint16_t port)
+{
+  if (!mqttCopyString(_host, sizeof(_host), host))
+    _host[0] = 0; // Too long name fails to connect
+  _hasAddress = false;
+  _port = port;
+  return *this;
+}
+
+template <class Transport>
+MqttClient<Transport> &MqttClient<Transport>::setServer(const char *host, IPAddress address, uint16_t port)
+{
+  if (!mqttCopyString(_host, sizeof(_host), host))
+    _host[0] = 0; // Too long name fails to connect
+  _address = address;
+  _hasAddress = true;
+  _port = port;
+  return *this;
+}
+
+template <class Transport>
+MqttClient<Transport> &MqttClient<Transport>::setCallback(MqttMessageCallback callback)
+{
+  _callback = callback;
+  return *this;
+}
+
+template <class Transport>
+MqttClient<Transport> &MqttClient<Transport>::setAckCallback(MqttAckCallback callback)
+{
+  _ackCallback = callback;
+  return *this;
+}
+
+template <class Transport>
+MqttClient<Transport> &MqttClient<Transport>::setConnectCallback(MqttConnectCallback callback)
+{
+  _connectCallback = callback;
+  return *this;
+}
+
+template <class Transport>
+MqttClient<Transport> &MqttClient<Transport>::setSessionExpiry(uint32_t seconds)
+{
+  _sessionExpiry = seconds;
+  return *this;
+}
+
+/* Connection *******************************************************************************************************/
+
+template <class Transport>
+bool MqttClient<Transport>::connect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage, bool cleanSession)
+{
+  if (!mqttCopyString(_id, sizeof(_id), id) || !mqttCopyString(_user, sizeof(_user), user) || !mqttCopyString(_pass, sizeof(_pass), pass) ||
+      !mqttCopyString(_willTopic, sizeof(_willTopic), willTopic) || !mqttCopyString(_willMessage, sizeof(_willMessage), willMessage))
+  {
+    _state = MQTT_CONNECT_FAILED;
+    return false;
+  }
+  _willQos = willQos;
+  _willRetain = willRetain;
+  _cleanSession = cleanSession;
+  _version = MQTT_VERSION_5;
+  return sendConnect();
+}
+
+// Opens network connection and sends CONNECT, CONNACK is then processed by loop()
+template <class Transport>
+bool MqttClient<Transport>::sendConnect()
+{
+  if (_transport.connected())
+    _transport.stop();
+  _received = _packetLength = 0;
+  if (!(_hasAddress ? _transport.connect(_address, _port, _host) : _transport.connect(_host, _port)))
+  {
+    _state = MQTT_CONNECT_FAILED;
+    return false;
+  }
+
+  // Topic aliases live only within single network connection
+  memset(_outboundAliases, 0, sizeof(_outboundAliases));
+  memset(_inboundAliases, 0, sizeof(_inboundAliases));
+  _serverAliasMaximum = 0;
+  _retainAvailable = true;
+  _keepAlive = MQTT_KEEPALIVE;
+
+  bool hasUser = *_user != 0;
+  bool hasPass = hasUser && *_pass != 0;
+  bool hasWill = *_willTopic != 0;
+  uint8_t flags = 0;
+  if (_cleanSession)
+    flags |= 0x02;
+  if (hasWill)
+    flags |= 0x04 | ((_willQos & 0x03) << 3) | (_willRetain ? 0x20 : 0x00);
+  if (hasPass)
+    flags |= 0x40;
+  if (hasUser)
+    flags |= 0x80;
+
+  // Variable header
+  size_t pos = MQTT_MAX_HEADER_SIZE;
+  bool ok = writeString(pos, "MQTT") && writeByte(pos, _version) && writeByte(pos, flags) && writeUint16(pos, MQTT_KEEPALIVE);
+  if (_version == MQTT_VERSION_5)
+  {
+    uint32_t propertiesLength = (_sessionExpiry > 0 ? 5 : 0) + (MQTT_TOPIC_ALIAS_COUNT > 0 ? 3 : 0);
+    ok = ok && writeVarint(pos, propertiesLength);
+    if (_sessionExpiry > 0)
+      ok = ok && writeByte(pos, MQTT_PROP_SESSION_EXPIRY) && writeUint32(pos, _sessionExpiry);
+    if (MQTT_TOPIC_ALIAS_COUNT > 0)
+      ok = ok && writeByte(pos, MQTT_PROP_TOPIC_ALIAS_MAXIMUM) && writeUint16(pos, MQTT_TOPIC_ALIAS_COUNT);
+  }
+
+  // Payload
+  ok = ok && writeString(pos, _id);
+  if (hasWill)
+  {
+    if (_version == MQTT_VERSION_5)
+      ok = ok && writeVarint(pos, 0);
+    ok = ok && writeString(pos, _willTopic) && writeString(pos, _willMessage);
+  }
+  if (hasUser)
+    ok = ok && writeString(pos, _user);
+  if (hasPass)
+    ok = ok && writeString(pos, _pass);
+  if (!ok || !sendPacket(MQTT_CONNECT, pos))
+  {
+    _transport.stop();
+    _state = MQTT_CONNECT_FAILED;
+    return false;
+  }
+  _state = MQTT_CONNECTING;
+  _connectStarted = millis();
+  return true;
+}
+
+// Handles failed handshake: server which does not speak MQTT 5 either says so or closes the connection without
+// answering, in that case try again with 3.1.1. Connection lost after some bytes arrived is a network failure, not
+// a rejection. The downgrade holds only for this connect(), the next one tries MQTT 5 again.
+template <class Transport>
+void MqttClient<Transport>::fallbackOrFail(int state)
+{
+  bool rejected = state == MQTT_CONNECT_BAD_PROTOCOL || (state == MQTT_CONNECTION_LOST && _received == 0);
+  _transport.stop();
+  _state = state;
+  if (_version == MQTT_VERSION_5 && rejected)
+  {
+    _version = MQTT_VERSION_3_1_1;
+    sendConnect();
+  }
+}
+
+template <class Transport>
+void MqttClient<Transport>::disconnect(bool sendWill)
+{
+  // MQTT 3.1.1 has no reason code, server publishes the will when the connection closes without DISCONNECT
+  if (connected() && (_version == MQTT_VERSION_5 || !sendWill))
+  {
+    size_t pos = MQTT_MAX_HEADER_SIZE;
+    if (_version == MQTT_VERSION_5)
+      writeByte(pos, sendWill ? MQTT_DISCONNECT_WITH_WILL : 0x00) && writeVarint(pos, 0);
+    sendPacket(MQTT_DISCONNECT, pos);
+  }
+  _transport.stop();
+  _state = MQTT_DISCONNECTED;
+}
+
+template <class Transport>
+bool MqttClient<Transport>::connected()
+{
+  if (_state != MQTT_CONNECTED)
+    return false;
+  if (!_transport.connected())
+  {
+    _transport.stop();
+    _state = MQTT_CONNECTION_LOST;
+    return false;
+  }
+  return true;
+}
+
+/* Publish and subscribe ********************************************************************************************/
+
+template <class Transport>
+bool MqttClient<Transport>::publish(const char *topic, const uint8_t *payload, size_t length, bool retain, uint8_t qos, uint16_t packetId, bool dup, uint32_t messageExpiry)
+{
+  bool result = tryPublish(topic, payload, length, retain, qos, packetId, dup, messageExpiry);
+  if (!result)
+    _publishFailures++;
+  return result;
+}
+
+template <class Transport>
+bool MqttClient<Transport>::tryPublish(const char *topic, const uint8_t *payload, size_t length, bool retain, uint8_t qos, uint16_t packetId, bool dup, uint32_t messageExpiry)
+{
+  if (!connected())
+    return false;
+
+  // With MQTT 5 the topic is sent only once per connection and then replaced with its alias
+  bool newAlias = false;
+  uint16_t alias = _version == MQTT_VERSION_5 ? findOutboundAlias(topic, &newAlias) : 0;
+
+  size_t pos = MQTT_MAX_HEADER_SIZE;
+  bool ok = alias != 0 && !newAlias ? writeString(pos, topic, 0) : writeString(pos, topic);
+  if (qos > 0)
+    ok = ok && writeUint16(pos, packetId);
+  if (_version == MQTT_VERSION_5)
+  {
+    uint32_t propertiesLength = (messageExpiry > 0 ? 5 : 0) + (alias != 0 ? 3 : 0);
+    ok = ok && writeVarint(pos, propertiesLength);
+    if (messageExpiry > 0)
+      ok = ok && writeByte(pos, MQTT_PROP_MESSAGE_EXPIRY) && writeUint32(pos, messageExpiry);
+    if (alias != 0)
+      ok = ok && writeByte(pos, MQTT_PROP_TOPIC_ALIAS) && writeUint16(pos, alias);
+  }
+  for (size_t i = 0; ok && i < length; i++)
+    ok = writeByte(pos, payload[i]);
+  if (!ok)
+    return false;
+
+  uint8_t header = MQTT_PUBLISH | ((qos & 0x03) << 1);
+  if (retain && _retainAvailable)
+    header |= 0x01;
+  if (dup && qos > 0)
+    header |= 0x08;
+  return sendPacket(header, pos);
+}
+
+template <class Transport>
+bool MqttClient<Transport>::publish(const char *topic, const char *payload)
+{
+  return publish(topic, (const uint8_t *)payload, strlen(payload));
+}
+
+template <class Transport>
+bool MqttClient<Transport>::subscribe(const char *topic, uint8_t qos)
+{
+  if (!connected())
+    return false;
+
+  size_t pos = MQTT_MAX_HEADER_SIZE;
+  bool ok = writeUint16(pos, nextPacketId());
+  if (_version == MQTT_VERSION_5)
+    ok = ok && writeVarint(pos, 0);
+  ok = ok && writeString(pos, topic) && writeByte(pos, qos & 0x03);
+  return ok && sendPacket(MQTT_SUBSCRIBE, pos);
+}
+
+template <class Transport>
+uint16_t MqttClient<Transport>::nextPacketId()
+{
+  // Packet identifier must be non-zero
+  if (++_lastPacketId == 0)
+    _lastPacketId = 1;
+  return _lastPacketId;
+}
+
+template <class Transport>
+uint16_t MqttClient<Transport>::findOutboundAlias(const char *topic, bool *isNew)
+{
+  uint16_t count = _serverAliasMaximum < MQTT_TOPIC_ALIAS_COUNT ? _serverAliasMaximum : MQTT_TOPIC_ALIAS_COUNT;
+  if (strlen(topic) > MQTT_MAX_TOPIC_LENGTH)
+    return 0;
+  for (uint16_t i = 0; i < count; i++)
+  {
+    if (_outboundAliases[i][0] == 0)
+    {
+      strcpy(_outboundAliases[i], topic);
+      *isNew = true;
+      return i + 1;
+    }
+    if (strcmp(_outboundAliases[i], topic) == 0)
+    {
+      *isNew = false;
+      return i + 1;
+    }
+  }
+
+  // All aliases are taken by other topics, send the full topic
+  return 0;
+}
+
+/* Incoming packets *************************************************************************************************/
+
+template <class Transport>
+bool MqttClient<Transport>::loop()
+{
+  // Connection handshake in progress
+  if (_state == MQTT_CONNECTING)
+  {
+    if (!_transport.connected())
+    {
+      fallbackOrFail(MQTT_CONNECTION_LOST);
+      return false;
+    }
+    size_t length = receivePacket();
+    if (length == 0)
+    {
+      if (millis() - _connectStarted > MQTT_SOCKET_TIMEOUT * 1000UL)
+        fallbackOrFail(MQTT_CONNECTION_TIMEOUT);
+      return false;
+    }
+    if ((_buffer[0] & 0xF0) != MQTT_CONNACK)
+    {
+      fallbackOrFail(MQTT_CONNECT_FAILED);
+      return false;
+    }
+    handleConnack(length);
+    if (_state != MQTT_CONNECTED)
+    {
+      fallbackOrFail(_state);
+      return false;
+    }
+    _pingOutstanding = false;
+    _lastInActivity = _lastOutActivity = millis();
+    if (_connectCallback != NULL)
+      _connectCallback();
+    return connected();
+  }
+
+  if (!connected())
+    return false;
+
+  // Keepalive
+  unsigned long interval = _keepAlive * 1000UL;
+  if (interval > 0 && (millis() - _lastInActivity > interval || millis() - _lastOutActivity > interval))
+  {
+    if (_pingOutstanding)
+    {
+      _transport.stop();
+      _state = MQTT_CONNECTION_TIMEOUT;
+      return false;
+    }
+    size_t pos = MQTT_MAX_HEADER_SIZE;
+    if (sendPacket(MQTT_PINGREQ, pos))
+    {
+      _lastInActivity = _pingSent = millis();
+      _pingOutstanding = true;
+    }
+  }
+
+  // Process all complete packets which are already waiting
+  size_t length;
+  while (_state == MQTT_CONNECTED && (length = receivePacket()) > 0)
+  {
+    _lastInActivity = millis();
+    handlePacket(length);
+  }
+
+  // Server stopped sending in the middle of a packet
+  if (_received > 0 && millis() - _packetStarted > MQTT_SOCKET_TIMEOUT * 1000UL)
+  {
+    _transport.stop();
+    _state = MQTT_CONNECTION_TIMEOUT;
+  }
+  return connected();
+}
+
+template <class Transport>
+void MqttClient<Transport>::handlePacket(size_t length)
+{
+  switch (_buffer[0] & 0xF0)
+  {
+  case MQTT_PUBLISH:
+    handlePublish(length);
+    break;
+  case MQTT_PUBACK:
+    handlePuback(length);
+    break;
+  case MQTT_PINGREQ:
+  {
+    size_t pos = MQTT_MAX_HEADER_SIZE;
+    sendPacket(MQTT_PINGRESP, pos);
+    break;
+  }
+  case MQTT_PINGRESP:
+    if (_pingOutstanding)
+      _pingStats.add(millis() - _pingSent);
+    _pingOutstanding = false;
+    break;
+  case MQTT_DISCONNECT:
+    _transport.stop();
+    _state = MQTT_CONNECTION_LOST;
+    break;
+  default:
+    // SUBACK and other packets need no action
+    break;
+  }
+}
+
+template <class Transport>
+void MqttClient<Transport>::handleConnack(size_t length)
+{
+  size_t pos = _headerLength;
+  if (length < pos + 2)
+  {
+    _state = MQTT_CONNECT_FAILED;
+    return;
+  }
+  _sessionPresent = _buffer[pos] & 0x01;
+  uint8_t code = _buffer[pos + 1];
+  pos += 2;
+
+  // MQTT 3.1.1 server answers MQTT 5 connect with 3.1.1 return code
+  if (code == MQTT_CONNACK_UNSUPPORTED_V3 || code == MQTT_CONNACK_UNSUPPORTED_V5)
+  {
+    _state = MQTT_CONNECT_BAD_PROTOCOL;
+    return;
+  }
+  if (code != 0)
+  {
+    // MQTT 5 reason codes are mapped to 3.1.1 return codes where possible
+    switch (code)
+    {
+    case 0x85:
+      _state = MQTT_CONNECT_BAD_CLIENT_ID;
+      break;
+    case 0x86:
+      _state = MQTT_CONNECT_BAD_CREDENTIALS;
+      break;
+    case 0x87:
+      _state = MQTT_CONNECT_UNAUTHORIZED;
+      break;
+    case 0x88:
+    case 0x89:
+      _state = MQTT_CONNECT_UNAVAILABLE;
+      break;
+    default:
+      _state = code < 6 ? code : MQTT_CONNECT_FAILED;
+      break;
+    }
+    return;
+  }
+
+  if (_version == MQTT_VERSION_5)
+  {
+    uint32_t propertiesLength;
+    if (!parseVarint(pos, length, &propertiesLength) || pos + propertiesLength > length)
+    {
+      _state = MQTT_CONNECT_FAILED;
+      return;
+    }
+    size_t end = pos + propertiesLength;
+    while (pos < end)
+    {
+      uint8_t id = _buffer[pos++];
+      if (id == MQTT_PROP_TOPIC_ALIAS_MAXIMUM && pos + 2 <= end)
+        _serverAliasMaximum = (_buffer[pos] << 8) | _buffer[pos + 1];
+      else if (id == MQTT_PROP_SERVER_KEEPALIVE && pos + 2 <= end)
+        _keepAlive = (_buffer[pos] << 8) | _buffer[pos + 1];
+      else if (id == MQTT_PROP_RETAIN_AVAILABLE && pos + 1 <= end)
+        _retainAvailable = _buffer[pos] != 0;
+      if (!skipProperty(id, pos, end))
+      {
+        _state = MQTT_CONNECT_FAILED;
+        return;
+      }
+    }
+  }
+  _state = MQTT_CONNECTED;
+}
+
+template <class Transport>
+void MqttClient<Transport>::handlePublish(size_t length)
+{
+  uint8_t qos = (_buffer[0] >> 1) & 0x03;
+  size_t pos = _headerLength;
+  if (length < pos + 2)
+    return;
+  size_t topicLength = (_buffer[pos] << 8) | _buffer[pos + 1];
+  size_t topicStart = pos + 2;
+  pos = topicStart + topicLength;
+  uint16_t packetId = 0;
+  if (qos > 0)
+  {
+    if (length < pos + 2)
+      return;
+    packetId = (_buffer[pos] << 8) | _buffer[pos + 1];
+    pos += 2;
+  }
+
+  uint16_t alias = 0;
+  if (_version == MQTT_VERSION_5)
+  {
+    uint32_t propertiesLength;
+    if (!parseVarint(pos, length, &propertiesLength) || pos + propertiesLength > length)
+      return;
+    size_t end = pos + propertiesLength;
+    while (pos < end)
+    {
+      uint8_t id = _buffer[pos++];
+      if (id == MQTT_PROP_TOPIC_ALIAS && pos + 2 <= end)
+        alias = (_buffer[pos] << 8) | _buffer[pos + 1];
+      if (!skipProperty(id, pos, end))
+        return;
+    }
+  }
+  if (pos > length)
+    return;
+
+  // Resolve topic, either from packet or from alias table
+  char *topic;
+  if (alias > MQTT_TOPIC_ALIAS_COUNT)
+    return;
+  if (topicLength == 0)
+  {
+    if (alias == 0 || _inboundAliases[alias - 1][0] == 0)
+      return;
+    topic = _inboundAliases[alias - 1];
+  }
+  else if (pos > topicStart + topicLength)
+  {
+    // Byte after topic is packet identifier or property, which were already parsed, so it can be overwritten
+    topic = (char *)_buffer + topicStart;
+    topic[topicLength] = 0;
+  }
+  else
+  {
+    // MQTT 3.1.1 with QoS 0: payload directly follows, so move topic one byte back over its length instead
+    memmove(_buffer + topicStart - 1, _buffer + topicStart, topicLength);
+    topic = (char *)_buffer + topicStart - 1;
+    topic[topicLength] = 0;
+  }
+  if (topicLength > 0 && alias != 0 && topicLength <= MQTT_MAX_TOPIC_LENGTH)
+    strcpy(_inboundAliases[alias - 1], topic);
+
+  if (_callback != NULL)
+    _callback(topic, _buffer + pos, length - pos);
+
+  if (qos == 1)
+  {
+    size_t ackPos = MQTT_MAX_HEADER_SIZE;
+    writeUint16(ackPos, packetId);
+    sendPacket(MQTT_PUBACK, ackPos);
+  }
+}
+
+template <class Transport>
+void MqttClient<Transport>::handlePuback(size_t length)
+{
+  size_t pos = _headerLength;
+  if (length < pos + 2)
+    return;
+  uint16_t packetId = (_buffer[pos] << 8) | _buffer[pos + 1];
+  if (_ackCallback != NULL)
+    _ackCallback(packetId);
+}
+
+/* Low level packet handling ****************************************************************************************/
+
+template <class Transport>
+bool MqttClient<Transport>::writeByte(size_t &pos, uint8_t value)
+{
+  if (pos >= MQTT_BUFFER_SIZE)
+    return false;
+  _sendBuffer[pos++] = value;
+  return true;
+}
+
+template <class Transport>
+bool MqttClient<Transport>::writeUint16(size_t &pos, uint16_t value)
+{
+  return writeByte(pos, value >> 8) && writeByte(pos, value & 0xFF);
+}
+
+template <class Transport>
+bool MqttClient<Transport>::writeUint32(size_t &pos, uint32_t value)
+{
+  return writeUint16(pos, value >> 16) && writeUint16(pos, value & 0xFFFF);
+}
+
+template <class Transport>
+bool MqttClient<Transport>::writeVarint(size_t &pos, uint32_t value)
+{
+  do
+  {
+    uint8_t digit = value & 0x7F;
+    value >>= 7;
+    if (!writeByte(pos, value > 0 ? digit | 0x80 : digit))
+      return false;
+  } while (value > 0);
+  return true;
+}
+
+template <class Transport>
+bool MqttClient<Transport>::writeString(size_t &pos, const char *value, size_t length)
+{
+  if (pos + 2 + length > MQTT_BUFFER_SIZE)
+    return false;
+  writeUint16(pos, length);
+  memcpy(_sendBuffer + pos, value, length);
+  pos += length;
+  return true;
+}
+
+template <class Transport>
+bool MqttClient<Transport>::sendPacket(uint8_t header, size_t end)
+{
+  // Remaining length is encoded backwards into the space reserved before the variable header
+  uint32_t remaining = end - MQTT_MAX_HEADER_SIZE;
+  uint8_t lengthBytes[4];
+  size_t lengthSize = 0;
+  do
+  {
+    uint8_t digit = remaining & 0x7F;
+    remaining >>= 7;
+    lengthBytes[lengthSize++] = remaining > 0 ? digit | 0x80 : digit;
+  } while (remaining > 0 && lengthSize < 4);
+  size_t start = MQTT_MAX_HEADER_SIZE - 1 - lengthSize;
+  _sendBuffer[start] = header;
+  memcpy(_sendBuffer + start + 1, lengthBytes, lengthSize);
+
+  size_t size = end - start;
+  bool result = _transport.write(_sendBuffer + start, size) == size;
+  if (result)
+    _lastOutActivity = millis();
+  return result;
+}
+
+// Reads whatever is available of the current packet, returns its length when it's complete or 0 otherwise
+// Data are read in bulk directly to their final place in the buffer, packets which don't fit are skipped
+template <class Transport>
+size_t MqttClient<Transport>::receivePacket()
+{
+  // Fixed header is read byte by byte, until the remaining length is known
+  while (_packetLength == 0)
+  {
+    if (!_transport.available())
+      return 0;
+    if (_received == 0)
+      _packetStarted = millis();
+    uint8_t value = _transport.read();
+    _buffer[_received++] = value;
+    if (_received > 1 && !(value & 0x80))
+    {
+      uint32_t remaining = 0;
+      for (size_t i = 1; i < _received; i++)
+        remaining |= (uint32_t)(_buffer[i] & 0x7F) << (7 * (i - 1));
+      _headerLength = _received;
+      _packetLength = _headerLength + remaining;
+    }
+    else if (_received >= MQTT_MAX_HEADER_SIZE)
+    {
+      // Malformed remaining length
+      _transport.stop();
+      _state = MQTT_CONNECTION_LOST;
+      _received = 0;
+      return 0;
+    }
+  }
+
+  // Rest of the packet
+  bool fits = _packetLength <= MQTT_BUFFER_SIZE;
+  while (_received < _packetLength)
+  {
+    int available = _transport.available();
+    if (available <= 0)
+      return 0;
+    size_t wanted = _packetLength - _received;
+    if ((size_t)available < wanted)
+      wanted = available;
+    size_t offset = _received;
+    if (!fits)
+    {
+      // Oversized packet: read it over the body of the buffer and forget it
+      offset = _headerLength;
+      if (wanted > MQTT_BUFFER_SIZE - offset)
+        wanted = MQTT_BUFFER_SIZE - offset;
+    }
+    int count = _transport.read(_buffer + offset, wanted);
+    if (count <= 0)
+      return 0;
+    _received += count;
+  }
+
+  // Packet is complete, next call starts a new one
+  size_t length = _packetLength;
+  _received = _packetLength = 0;
+  return fits ? length : 0;
+}
+
+template <class Transport>
+bool MqttClient<Transport>::parseVarint(size_t &pos, size_t end, uint32_t *value)
+{
+  *value = 0;
+  for (uint8_t shift = 0; shift < 28 && pos < end; shift += 7)
+  {
+    uint8_t digit = _buffer[pos++];
+    *value |= (uint32_t)(digit & 0x7F) << shift;
+    if (!(digit & 0x80))
+      return true;
+  }
+  return false;
+}
+
+// Skips value of MQTT 5 property with given identifier
+template <class Transport>
+bool MqttClient<Transport>::skipProperty(uint8_t id, size_t &pos, size_t end)
+{
+  size_t size;
+  switch (id)
+  {
+  case 0x01: // Payload format indicator
+  case 0x17: // Request problem information
+  case 0x19: // Request response information
+  case 0x24: // Maximum QoS
+  case 0x25: // Retain available
+  case 0x28: // Wildcard subscription available
+  case 0x29: // Subscription identifier available
+  case 0x2A: // Shared subscription available
+    size = 1;
+    break;
+  case 0x13: // Server keepalive
+  case 0x21: // Receive maximum
+  case 0x22: // Topic alias maximum
+  case 0x23: // Topic alias
+    size = 2;
+    break;
+  case 0x02: // Message expiry interval
+  case 0x11: // Session expiry interval
+  case 0x18: // Will delay interval
+  case 0x27: // Maximum packet size
+    size = 4;
+    break;
+  case 0x0B: // Subscription identifier
+  {
+    uint32_t value;
+    return parseVarint(pos, end, &value);
+  }
+  case 0x26: // User property (string pair)
+    if (!skipProperty(0x03, pos, end))
+      return false;
+    // fall through
+  case 0x03: // Content type
+  case 0x08: // Response topic
+  case 0x09: // Correlation data
+  case 0x12: // Assigned client identifier
+  case 0x15: // Authentication method
+  case 0x16: // Authentication data
+  case 0x1A: // Response information
+  case 0x1C: // Server reference
+  case 0x1F: // Reason string
+    if (pos + 2 > end)
+      return false;
+    size = 2 + ((_buffer[pos] << 8) | _buffer[pos + 1]);
+    break;
+  default:
+    return false;
+  }
+  if (pos + size > end)
+    return false;
+  pos += size;
+  return true;
+}
+
+/* Transports *******************************************************************************************************/
+
+// Client is compiled for these transports only, add new transport here; the simulator compiles it for its test
+// transports by including this file (see Simulator/TestTransports.cpp)
+#ifndef MQTT_TEST_TRANSPORTS
+template class MqttClient<TcpTransport>;
+template class MqttClient<TlsTransport>;
+#endif
@@ -0,0 +1,230 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - MQTT client                                                                               *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Minimal MQTT client speaking both MQTT 5 and MQTT 3.1.1. MQTT 5 is tried first and the client falls back to      *
+ * 3.1.1 when the server does not support it. With MQTT 5 the client supports message expiry, session expiry and    *
+ * topic aliases in both directions. API is modelled after PubSubClient, which was used before.                     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * The client never blocks waiting for the server: connect() only sends CONNECT and the CONNACK is processed by     *
+ * loop(), publish() and subscribe() just write the packet. Incoming packets are read in bulk directly to the       *
+ * statically sized receive buffer and handed to the callback in place, without any copying or heap allocation.     *
+ * Outgoing packets are built in a separate buffer, so publishing never overwrites a partially received packet.     *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+
+/* Configuration - may be overriden by build flags ******************************************************************/
+
+#ifndef MQTT_BUFFER_SIZE
+#define MQTT_BUFFER_SIZE 512 // bytes; maximum packet size in each direction (larger incoming packets are dropped)
+#endif
+#ifndef MQTT_KEEPALIVE
+#define MQTT_KEEPALIVE 15 // s; keepalive interval
+#endif
+#ifndef MQTT_SOCKET_TIMEOUT
+#define MQTT_SOCKET_TIMEOUT 15 // s; timeout for CONNACK and for reading rest of a started packet
+#endif
+#ifndef MQTT_TOPIC_ALIAS_COUNT
+#define MQTT_TOPIC_ALIAS_COUNT 4 // number of topic aliases in each direction (MQTT 5 only)
+#endif
+#ifndef MQTT_MAX_TOPIC_LENGTH
+#define MQTT_MAX_TOPIC_LENGTH 64 // bytes; maximum length of aliased topic and will topic (longer ones are not aliased)
+#endif
+#ifndef MQTT_MAX_STRING_LENGTH
+#define MQTT_MAX_STRING_LENGTH 64 // bytes; maximum length of server name, client ID, user name, password and will message
+#endif
+
+/* Constants ********************************************************************************************************/
+
+// Protocol versions
+#define MQTT_VERSION_3_1_1 4
+#define MQTT_VERSION_5 5
+
+// Client states (same values as PubSubClient, plus connecting state)
+#define MQTT_CONNECTING -5
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTION_LOST -3
+#define MQTT_CONNECT_FAILED -2
+#define MQTT_DISCONNECTED -1
+#define MQTT_CONNECTED 0
+#define MQTT_CONNECT_BAD_PROTOCOL 1
+#define MQTT_CONNECT_BAD_CLIENT_ID 2
+#define MQTT_CONNECT_UNAVAILABLE 3
+#define MQTT_CONNECT_BAD_CREDENTIALS 4
+#define MQTT_CONNECT_UNAUTHORIZED 5
+
+// Packet types
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_SUBSCRIBE 0x82
+#define MQTT_SUBACK 0x90
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+#define MQTT_DISCONNECT 0xE0
+
+// MQTT 5 DISCONNECT reason code, which asks the server to publish the will
+#define MQTT_DISCONNECT_WITH_WILL 0x04
+
+// MQTT 5 properties used by this client
+#define MQTT_PROP_MESSAGE_EXPIRY 0x02
+#define MQTT_PROP_SESSION_EXPIRY 0x11
+#define MQTT_PROP_SERVER_KEEPALIVE 0x13
+#define MQTT_PROP_TOPIC_ALIAS_MAXIMUM 0x22
+#define MQTT_PROP_TOPIC_ALIAS 0x23
+#define MQTT_PROP_RETAIN_AVAILABLE 0x25
+
+typedef void (*MqttMessageCallback)(char *topic, uint8_t *payload, unsigned int length);
+typedef void (*MqttAckCallback)(uint16_t packetId);
+typedef void (*MqttConnectCallback)();
+
+// Round trip time of keepalive pings; it shows how long incoming packets wait, e.g. for the radio to wake up
+struct MqttPingStats
+{
+  uint32_t count;    // Number of answered pings
+  uint32_t lastRtt;  // ms
+  uint32_t maxRtt;   // ms
+  uint32_t totalRtt; // ms; sum of all round trip times, for average
+
+  void add(uint32_t rtt)
+  {
+    count++;
+    lastRtt = rtt;
+    totalRtt += rtt;
+    if (rtt > maxRtt)
+      maxRtt = rtt;
+  }
+};
+
+// Copies string kept by MQTT client, NULL is kept as empty string; returns false when it does not fit
+inline bool mqttCopyString(char *target, size_t size, const char *value)
+{
+  if (value == NULL)
+    value = "";
+  if (strlen(value) >= size)
+    return false;
+  strcpy(target, value);
+  return true;
+}
+
+/* MQTT client ******************************************************************************************************/
+
+// Transport is a class with the methods of Arduino Client used here (connect, connected, stop, available, read,
+// write) and connect(address, port, host), it's held by value, so there are no virtual calls (see Transport library for available transports)
+template <class Transport>
+class MqttClient
+{
+public:
+  MqttClient();
+
+  MqttClient &setServer(const char *host, uint16_t port);
+  // Connects to already resolved address, host name is still used where the protocol needs it (TLS SNI)
+  MqttClient &setServer(const char *host, IPAddress address, uint16_t port);
+  // Topic and payload passed to the callback point to the receive buffer and are valid only during the call
+  MqttClient &setCallback(MqttMessageCallback callback);
+  MqttClient &setAckCallback(MqttAckCallback callback);
+  MqttClient &setConnectCallback(MqttConnectCallback callback);
+  MqttClient &setSessionExpiry(uint32_t seconds);
+
+  // Starts connecting to server, trying MQTT 5 first and falling back to MQTT 3.1.1 when the server rejects it
+  // Returns true when CONNECT was sent, connect callback is called from loop() when server accepts the connection
+  // Strings are copied for the fallback and reconnection, because runtime configuration may overwrite them
+  bool connect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage, bool cleanSession);
+  // Server publishes the will only when sendWill is set, e.g. when the device leaves for a reboot
+  void disconnect(bool sendWill = false);
+
+  // Publishes message; topic is copied when it's remembered as topic alias
+  bool publish(const char *topic, const uint8_t *payload, size_t length, bool retain = false, uint8_t qos = 0, uint16_t packetId = 0, bool dup = false, uint32_t messageExpiry = 0);
+  bool publish(const char *topic, const char *payload);
+  bool subscribe(const char *topic, uint8_t qos = 0);
+  // Packet identifier for QoS 1 publish; SUBSCRIBE takes its identifier from the same counter, so they never collide
+  uint16_t nextPacketId();
+
+  // Processes incoming packets, connection handshake and keepalive, must be called regularly
+  bool loop();
+
+  bool connected();
+  int state() const { return _state; }
+  uint8_t protocolVersion() const { return _version; }
+  bool sessionPresent() const { return _sessionPresent; }
+  Transport &transport() { return _transport; }
+  const MqttPingStats &pingStats() const { return _pingStats; }
+  uint32_t publishFailures() const { return _publishFailures; } // Number of messages which could not be sent since start
+
+private:
+  bool sendConnect();
+  bool tryPublish(const char *topic, const uint8_t *payload, size_t length, bool retain, uint8_t qos, uint16_t packetId, bool dup, uint32_t messageExpiry);
+  void fallbackOrFail(int state);
+
+  // Packet building
+  bool writeByte(size_t &pos, uint8_t value);
+  bool writeUint16(size_t &pos, uint16_t value);
+  bool writeUint32(size_t &pos, uint32_t value);
+  bool writeVarint(size_t &pos, uint32_t value);
+  bool writeString(size_t &pos, const char *value, size_t length);
+  bool writeString(size_t &pos, const char *value) { return writeString(pos, value, strlen(value)); }
+  bool sendPacket(uint8_t header, size_t end);
+
+  // Packet parsing
+  size_t receivePacket();
+  bool parseVarint(size_t &pos, size_t end, uint32_t *value);
+  bool skipProperty(uint8_t id, size_t &pos, size_t end);
+  void handleConnack(size_t length);
+  void handlePacket(size_t length);
+  void handlePublish(size_t length);
+  void handlePuback(size_t length);
+
+  // Topic aliases
+  uint16_t findOutboundAlias(const char *topic, bool *isNew);
+
+  Transport _transport;
+  char _host[MQTT_MAX_STRING_LENGTH + 1] = {};
+  IPAddress _address;
+  bool _hasAddress = false;
+  uint16_t _port = 0;
+  MqttMessageCallback _callback = NULL;
+  MqttAckCallback _ackCallback = NULL;
+  MqttConnectCallback _connectCallback = NULL;
+
+  // Connection parameters, kept for MQTT 3.1.1 fallback
+  char _id[MQTT_MAX_STRING_LENGTH + 1] = {};
+  char _user[MQTT_MAX_STRING_LENGTH + 1] = {};
+  char _pass[MQTT_MAX_STRING_LENGTH + 1] = {};
+  char _willTopic[MQTT_MAX_TOPIC_LENGTH + 1] = {};
+  char _willMessage[MQTT_MAX_STRING_LENGTH + 1] = {};
+  uint8_t _willQos = 0;
+  bool _willRetain = false;
+  bool _cleanSession = true;
+  uint32_t _connectStarted = 0;
+
+  // Receive state: the packet is assembled in _buffer as bytes arrive, possibly over several loop() calls, so
+  // outgoing packets are built in their own buffer
+  uint8_t _buffer[MQTT_BUFFER_SIZE];
+  uint8_t _sendBuffer[MQTT_BUFFER_SIZE];
+  size_t _headerLength = 0; // Fixed header length of current packet
+  size_t _received = 0;     // Bytes of current packet received so far
+  size_t _packetLength = 0; // Total length of current packet, 0 while fixed header is not complete
+  uint32_t _packetStarted = 0;
+  int _state = MQTT_DISCONNECTED;
+  uint8_t _version = MQTT_VERSION_5;
+  uint16_t _keepAlive = MQTT_KEEPALIVE;
+  uint32_t _sessionExpiry = 0;
+  bool _sessionPresent = false;
+  bool _retainAvailable = true;
+  bool _pingOutstanding = false;
+  uint32_t _pingSent = 0;
+  MqttPingStats _pingStats = {};
+  uint32_t _publishFailures = 0;
+  uint32_t _lastInActivity = 0;
+  uint32_t _lastOutActivity = 0;
+  uint16_t _lastPacketId = 0;
+  uint16_t _serverAliasMaximum = 0;
+  char _outboundAliases[MQTT_TOPIC_ALIAS_COUNT][MQTT_MAX_TOPIC_LENGTH + 1];
+  char _inboundAliases[MQTT_TOPIC_ALIAS_COUNT][MQTT_MAX_TOPIC_LENGTH + 1];
+};
@@ -0,0 +1,197 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - MQTT server list                                                                          *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "MqttServerList.h"
+#include <WiFi.h>
+#include <errno.h>
+#include <lwip/sockets.h>
+
+MqttServerList::MqttServerList(const MqttServer *servers, size_t count) : _servers(servers), _count(count)
+{
+  if (_count > MQTT_SERVER_LIST_SIZE)
+    _count = MQTT_SERVER_LIST_SIZE;
+  memset(_stats, 0, sizeof(_stats));
+}
+
+uint64_t MqttServerList::connectedTime(size_t index) const
+{
+  uint64_t time = _stats[index].connectedTime;
+  if (_isConnected && index == _current)
+    time += millis() - _connectedSince;
+  return time;
+}
+
+/* Probes ***********************************************************************************************************/
+
+void MqttServerList::loop()
+{
+  // Connection time is added up regularly, single connection may last longer than millis() wraparound (49.7 days)
+  if (_isConnected && millis() - _connectedSince > MQTT_PROBE_INTERVAL)
+  {
+    _stats[_current].connectedTime += millis() - _connectedSince;
+    _connectedSince = millis();
+  }
+
+  // Wait for probe in progress
+  if (_socket >= 0)
+  {
+    fd_set writable;
+    FD_ZERO(&writable);
+    FD_SET(_socket, &writable);
+    timeval timeout = {0, 0};
+    if (select(_socket + 1, NULL, &writable, NULL, &timeout) > 0)
+    {
+      int error = 0;
+      socklen_t length = sizeof(error);
+      getsockopt(_socket, SOL_SOCKET, SO_ERROR, &error, &length);
+      finishProbe(error == 0);
+    }
+    else if (millis() - _probeStarted > MQTT_PROBE_TIMEOUT)
+    {
+      finishProbe(false);
+    }
+    return;
+  }
+
+  // With single server there is nothing to choose from
+  if (_count > 1 && WiFi.status() == WL_CONNECTED && millis() - _probeStarted > MQTT_PROBE_INTERVAL)
+    startProbe();
+}
+
+void MqttServerList::startProbe()
+{
+  _probed = (_probed + 1) % _count;
+  _probeStarted = millis();
+  IPAddress address;
+  bool resolved = _dnsCache != NULL ? _dnsCache->resolve(_servers[_probed].host, address) : WiFi.hostByName(_servers[_probed].host, address);
+  if (!resolved)
+  {
+    finishProbe(false);
+    return;
+  }
+
+  // Connect without blocking, loop() checks when the connection is established
+  _socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (_socket < 0)
+    return;
+  fcntl(_socket, F_SETFL, fcntl(_socket, F_GETFL, 0) | O_NONBLOCK);
+  sockaddr_in socketAddress = {};
+  socketAddress.sin_family = AF_INET;
+  socketAddress.sin_port = htons(_servers[_probed].port);
+  socketAddress.sin_addr.s_addr = (uint32_t)address;
+  _probeStartedMicros = micros();
+  if (connect(_socket, (sockaddr *)&socketAddress, sizeof(socketAddress)) == 0)
+    finishProbe(true);
+  else if (errno != EINPROGRESS)
+    finishProbe(false);
+}
+
+void MqttServerList::finishProbe(bool success)
+{
+  if (_socket >= 0)
+  {
+    close(_socket);
+    _socket = -1;
+  }
+
+  MqttServerStats &stats = _stats[_probed];
+  stats.probes++;
+  if (success)
+  {
+    uint32_t sample = micros() - _probeStartedMicros;
+    if (sample == 0)
+      sample = 1;
+    stats.rtt = stats.rtt == 0 ? sample : (stats.rtt * 3 + sample) / 4;
+    stats.failures = 0;
+  }
+  else if (stats.failures < 255)
+  {
+    stats.failures++;
+  }
+}
+
+/* Server selection *************************************************************************************************/
+
+// Servers not measured yet are considered slowest, servers with the same RTT are preferred in list order
+int MqttServerList::fastestHealthy(bool excludeCurrent) const
+{
+  int best = -1;
+  uint32_t bestRtt = 0;
+  for (size_t i = 0; i < _count; i++)
+  {
+    if (!healthy(i) || (excludeCurrent && i == _current))
+      continue;
+    uint32_t rtt = _stats[i].rtt == 0 ? UINT32_MAX : _stats[i].rtt;
+    if (best < 0 || rtt < bestRtt)
+    {
+      best = i;
+      bestRtt = rtt;
+    }
+  }
+  return best;
+}
+
+void MqttServerList::connected()
+{
+  _isConnected = true;
+  _connectedSince = millis();
+  _stats[_current].connections++;
+  _stats[_current].failures = 0;
+}
+
+void MqttServerList::disconnected()
+{
+  if (!_isConnected)
+    return;
+  _isConnected = false;
+  _stats[_current].connectedTime += millis() - _connectedSince;
+}
+
+bool MqttServerList::failover()
+{
+  // Server stays down until a probe succeeds
+  _stats[_current].failures = MQTT_PROBE_FAILURES;
+  _faster = -1;
+  int next = fastestHealthy(true);
+  if (next < 0)
+  {
+    _current = (_current + 1) % _count;
+    return false;
+  }
+  _current = next;
+  _failovers++;
+  return true;
+}
+
+int MqttServerList::fasterServer()
+{
+  int best = fastestHealthy(true);
+  uint32_t currentRtt = _stats[_current].rtt;
+  bool faster = _isConnected && best >= 0 && _stats[best].rtt != 0 && currentRtt != 0 &&
+                (uint64_t)_stats[best].rtt * 100 < (uint64_t)currentRtt * (100 - MQTT_FAILBACK_MARGIN);
+  if (!faster)
+  {
+    _faster = -1;
+    return -1;
+  }
+
+  // Start counting again when another server becomes the fastest one
+  if (best != _faster)
+  {
+    _faster = best;
+    _fasterSince = millis();
+  }
+  return millis() - _fasterSince >= MQTT_FAILBACK_HOLD ? best : -1;
+}
+
+void MqttServerList::switchTo(size_t index)
+{
+  disconnected();
+  _current = index;
+  _faster = -1;
+  _failovers++;
+}
@@ -0,0 +1,112 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - MQTT server list                                                                          *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Keeps a list of equivalent MQTT servers and chooses which one to use. Servers are probed in background by        *
+ * opening TCP connection (non-blocking, one server at a time), which measures round trip time and health. When    *
+ * the connection fails, the fastest healthy server is used next. A faster server is switched to only after it has  *
+ * been faster by a margin for some time, so the devices do not flap between servers with similar latency.          *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+#include <DnsCache.h>
+
+/* Configuration - may be overriden by build flags ******************************************************************/
+
+#ifndef MQTT_SERVER_LIST_SIZE
+#define MQTT_SERVER_LIST_SIZE 4 // maximum number of servers
+#endif
+#ifndef MQTT_PROBE_INTERVAL
+#define MQTT_PROBE_INTERVAL 15000 // ms; interval between probes, servers are probed in turn
+#endif
+#ifndef MQTT_PROBE_TIMEOUT
+#define MQTT_PROBE_TIMEOUT 3000 // ms; probe fails when TCP connection is not established in this time
+#endif
+#ifndef MQTT_PROBE_FAILURES
+#define MQTT_PROBE_FAILURES 2 // number of consecutive failed probes after which the server is considered down
+#endif
+#ifndef MQTT_FAILBACK_MARGIN
+#define MQTT_FAILBACK_MARGIN 25 // %; other server must be faster at least by this fraction of current RTT
+#endif
+#ifndef MQTT_FAILBACK_HOLD
+#define MQTT_FAILBACK_HOLD 300000 // ms; other server must be faster for this time before switching to it
+#endif
+
+/* MQTT server list *************************************************************************************************/
+
+struct MqttServer
+{
+  const char *host;
+  uint16_t port;
+};
+
+struct MqttServerStats
+{
+  uint32_t rtt;                // us; smoothed TCP connection time, 0 when not measured yet
+  uint8_t failures;            // Consecutive failed probes or connections
+  uint32_t probes;             // Number of probes
+  uint32_t connections;        // Number of MQTT connections established
+  uint64_t connectedTime;      // ms; total time connected (not including current connection)
+};
+
+class MqttServerList
+{
+public:
+  MqttServerList(const MqttServer *servers, size_t count);
+
+  // Probes resolve server addresses using the cache instead of system resolver
+  void setDnsCache(DnsCache *dnsCache) { _dnsCache = dnsCache; }
+
+  const MqttServer &current() const { return _servers[_current]; }
+  size_t currentIndex() const { return _current; }
+  size_t count() const { return _count; }
+  const MqttServer &server(size_t index) const { return _servers[index]; }
+  const MqttServerStats &stats(size_t index) const { return _stats[index]; }
+  bool healthy(size_t index) const { return _stats[index].failures < MQTT_PROBE_FAILURES; }
+  // ms; time connected to the server including current connection
+  uint64_t connectedTime(size_t index) const;
+  uint32_t failovers() const { return _failovers; }
+
+  // Runs background probes, must be called regularly
+  void loop();
+
+  // Connection to current server was established or lost
+  void connected();
+  void disconnected();
+
+  // Current server failed, moves to the fastest healthy server; returns false when there is no other healthy
+  // server, then the next server in the list is used
+  bool failover();
+
+  // Returns index of server which is consistently faster than current one, or -1
+  int fasterServer();
+  void switchTo(size_t index);
+
+private:
+  void startProbe();
+  void finishProbe(bool success);
+  int fastestHealthy(bool excludeCurrent) const;
+
+  const MqttServer *_servers;
+  DnsCache *_dnsCache = NULL;
+  size_t _count;
+  size_t _current = 0;
+  MqttServerStats _stats[MQTT_SERVER_LIST_SIZE];
+  uint32_t _failovers = 0;
+  uint32_t _connectedSince = 0;
+  bool _isConnected = false;
+
+  // Probe in progress
+  int _socket = -1;
+  size_t _probed = 0;
+  uint32_t _probeStarted = 0;
+  uint32_t _probeStartedMicros = 0;
+
+  // Fail-back hysteresis
+  int _faster = -1;
+  uint32_t _fasterSince = 0;
+};
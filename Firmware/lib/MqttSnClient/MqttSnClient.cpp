@@ -0,0 +1,609 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - MQTT-SN client                                                                            *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "MqttSnClient.h"
+#include <Transport.h>
+
+// Message types
+#define SN_CONNECT 0x04
+#define SN_CONNACK 0x05
+#define SN_WILLTOPICREQ 0x06
+#define SN_WILLTOPIC 0x07
+#define SN_WILLMSGREQ 0x08
+#define SN_WILLMSG 0x09
+#define SN_REGISTER 0x0A
+#define SN_REGACK 0x0B
+#define SN_PUBLISH 0x0C
+#define SN_PUBACK 0x0D
+#define SN_SUBSCRIBE 0x12
+#define SN_SUBACK 0x13
+#define SN_PINGREQ 0x16
+#define SN_PINGRESP 0x17
+#define SN_DISCONNECT 0x18
+
+// Flags
+#define SN_FLAG_DUP 0x80
+#define SN_FLAG_RETAIN 0x10
+#define SN_FLAG_WILL 0x08
+#define SN_FLAG_CLEAN_SESSION 0x04
+#define SN_QOS_SHIFT 5
+#define SN_PROTOCOL_ID 0x01
+#define SN_RC_ACCEPTED 0x00
+#define SN_RC_INVALID_TOPIC 0x02
+
+// Minimum body length of received message types, shorter messages are dropped
+static size_t minimumLength(uint8_t type)
+{
+  switch (type)
+  {
+  case SN_CONNACK:
+    return 1; // Return code
+  case SN_REGISTER:
+    return 4; // Topic ID, message ID, topic name
+  case SN_PUBLISH:
+    return 5; // Flags, topic ID, message ID, data
+  case SN_REGACK:
+  case SN_PUBACK:
+    return 5; // Topic ID, message ID, return code
+  case SN_SUBACK:
+    return 6; // Flags, topic ID, message ID, return code
+  default:
+    return 0;
+  }
+}
+
+static uint16_t readUint16(const uint8_t *buffer)
+{
+  return (buffer[0] << 8) | buffer[1];
+}
+
+static void writeUint16(uint8_t *buffer, uint16_t value)
+{
+  buffer[0] = value >> 8;
+  buffer[1] = value & 0xFF;
+}
+
+template <class Transport>
+MqttSnClient<Transport>::MqttSnClient()
+{
+  memset(_topics, 0, sizeof(_topics));
+}
+
+template <class Transport>
+MqttSnClient<Transport> &MqttSnClient<Transport>::setServer(const char *host, uint16_t port)
+{
+  if (!mqttCopyString(_host, sizeof(_host), host))
+    _host[0] = 0; // Too long name fails to connect
+  _hasAddress = false;
+  _port = port;
+  return *this;
+}
+
+template <class Transport>
+MqttSnClient<Transport> &MqttSnClient<Transport>::setServer(const char *host, IPAddress address, uint16_t port)
+{
+  if (!mqttCopyString(_host, sizeof(_host), host))
+    _host[0] = 0; // Too long name fails to connect
+  _address = address;
+  _hasAddress = true;
+  _port = port;
+  return *this;
+}
+
+template <class Transport>
+MqttSnClient<Transport> &MqttSnClient<Transport>::setCallback(MqttMessageCallback callback)
+{
+  _callback = callback;
+  return *this;
+}
+
+template <class Transport>
+MqttSnClient<Transport> &MqttSnClient<Transport>::setAckCallback(MqttAckCallback callback)
+{
+  _ackCallback = callback;
+  return *this;
+}
+
+template <class Transport>
+MqttSnClient<Transport> &MqttSnClient<Transport>::setConnectCallback(MqttConnectCallback callback)
+{
+  _connectCallback = callback;
+  return *this;
+}
+
+/* Connection *******************************************************************************************************/
+
+template <class Transport>
+bool MqttSnClient<Transport>::connect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage, bool cleanSession)
+{
+  // MQTT-SN has no credentials, the gateway authenticates to the server on behalf of its clients
+  if (!mqttCopyString(_id, sizeof(_id), id) || !mqttCopyString(_willTopic, sizeof(_willTopic), willTopic) ||
+      !mqttCopyString(_willMessage, sizeof(_willMessage), willMessage))
+  {
+    _state = MQTT_CONNECT_FAILED;
+    return false;
+  }
+  _willQos = willQos;
+  _willRetain = willRetain;
+  _cleanSession = cleanSession;
+
+  _transport.close();
+  if (!(_hasAddress ? _transport.open(_address, _port) : _transport.open(_host, _port)))
+  {
+    _state = MQTT_CONNECT_FAILED;
+    return false;
+  }
+
+  // Topic IDs are valid only within single connection
+  memset(_topics, 0, sizeof(_topics));
+  _retries = 0;
+  _state = MQTT_CONNECTING;
+  return sendConnect();
+}
+
+template <class Transport>
+bool MqttSnClient<Transport>::sendConnect()
+{
+  uint8_t body[4 + 23];
+  size_t idLength = strlen(_id);
+  if (idLength > 23)
+    idLength = 23;
+  body[0] = (_cleanSession ? SN_FLAG_CLEAN_SESSION : 0) | (*_willTopic != 0 ? SN_FLAG_WILL : 0);
+  body[1] = SN_PROTOCOL_ID;
+  writeUint16(body + 2, MQTT_KEEPALIVE);
+  memcpy(body + 4, _id, idLength);
+  return sendPacket(SN_CONNECT, body, 4 + idLength);
+}
+
+template <class Transport>
+void MqttSnClient<Transport>::disconnect(bool sendWill)
+{
+  // MQTT-SN has no reason code, gateway publishes the will when it loses the client without DISCONNECT
+  if (_state == MQTT_CONNECTED && !sendWill)
+    sendPacket(SN_DISCONNECT, NULL, 0);
+  _state = MQTT_DISCONNECTED;
+}
+
+template <class Transport>
+void MqttSnClient<Transport>::lost(int state)
+{
+  _state = state;
+  _pingOutstanding = false;
+}
+
+/* Publish and subscribe ********************************************************************************************/
+
+template <class Transport>
+bool MqttSnClient<Transport>::publish(const char *topic, const uint8_t *payload, size_t length, bool retain, uint8_t qos, uint16_t packetId, bool dup, uint32_t messageExpiry)
+{
+  bool result = tryPublish(topic, payload, length, retain, qos, packetId, dup, messageExpiry);
+  if (!result)
+    _publishFailures++;
+  return result;
+}
+
+template <class Transport>
+bool MqttSnClient<Transport>::tryPublish(const char *topic, const uint8_t *payload, size_t length, bool retain, uint8_t qos, uint16_t packetId, bool dup, uint32_t messageExpiry)
+{
+  if (_state != MQTT_CONNECTED)
+    return false;
+
+  uint8_t flags = ((qos & 0x03) << SN_QOS_SHIFT) | (retain ? SN_FLAG_RETAIN : 0) | (dup && qos > 0 ? SN_FLAG_DUP : 0);
+  Topic *entry = findTopic(topic);
+  if (entry != NULL && entry->id != 0)
+    return sendPublish(entry->id, flags, packetId, payload, length);
+
+  // Gateway rejected the registration: this message fails and the topic is registered again for the next one
+  if (entry != NULL && entry->requestType == 0)
+  {
+    entry->requestType = SN_REGISTER;
+    entry->requestId = nextPacketId();
+    entry->retries = 0;
+    sendRequest(*entry);
+    return false;
+  }
+
+  // Topic is not registered yet: keep the message and send it after REGACK
+  if (entry == NULL)
+  {
+    entry = allocateTopic(topic);
+    if (entry == NULL)
+      return false;
+    entry->requestType = SN_REGISTER;
+    entry->requestId = nextPacketId();
+    entry->retries = 0;
+    if (!sendRequest(*entry))
+      return false;
+  }
+
+  // Message too long to keep fails, the topic is registered anyway, so the next one is sent right away
+  if (length > MQTT_SN_MAX_PENDING)
+    return false;
+  entry->hasPending = true;
+  entry->pendingFlags = flags;
+  entry->pendingPacketId = packetId;
+  memcpy(entry->pendingPayload, payload, length);
+  entry->pendingLength = length;
+  return true;
+}
+
+template <class Transport>
+bool MqttSnClient<Transport>::publish(const char *topic, const char *payload)
+{
+  return publish(topic, (const uint8_t *)payload, strlen(payload));
+}
+
+template <class Transport>
+bool MqttSnClient<Transport>::subscribe(const char *topic, uint8_t qos)
+{
+  if (_state != MQTT_CONNECTED)
+    return false;
+  Topic *entry = findTopic(topic);
+  if (entry == NULL)
+    entry = allocateTopic(topic);
+  if (entry == NULL)
+    return false;
+
+  // SUBACK also registers the topic
+  entry->requestType = SN_SUBSCRIBE;
+  entry->requestQos = qos & 0x03;
+  entry->requestId = nextPacketId();
+  entry->retries = 0;
+  return sendRequest(*entry);
+}
+
+template <class Transport>
+bool MqttSnClient<Transport>::sendRequest(Topic &topic)
+{
+  size_t nameLength = strlen(topic.name);
+  uint8_t body[5 + MQTT_MAX_TOPIC_LENGTH];
+  if (nameLength > MQTT_MAX_TOPIC_LENGTH)
+    return false;
+  topic.sentAt = millis();
+  if (topic.requestType == SN_REGISTER)
+  {
+    writeUint16(body, 0);
+    writeUint16(body + 2, topic.requestId);
+    memcpy(body + 4, topic.name, nameLength);
+    return sendPacket(SN_REGISTER, body, 4 + nameLength);
+  }
+  body[0] = (topic.requestQos << SN_QOS_SHIFT) | (topic.retries > 0 ? SN_FLAG_DUP : 0);
+  writeUint16(body + 1, topic.requestId);
+  memcpy(body + 3, topic.name, nameLength);
+  return sendPacket(SN_SUBSCRIBE, body, 3 + nameLength);
+}
+
+template <class Transport>
+bool MqttSnClient<Transport>::sendPublish(uint16_t topicId, uint8_t flags, uint16_t packetId, const uint8_t *payload, size_t length)
+{
+  uint8_t body[MQTT_SN_BUFFER_SIZE];
+  if (5 + length > sizeof(body))
+    return false;
+  body[0] = flags;
+  writeUint16(body + 1, topicId);
+  writeUint16(body + 3, packetId);
+  memcpy(body + 5, payload, length);
+  return sendPacket(SN_PUBLISH, body, 5 + length);
+}
+
+template <class Transport>
+bool MqttSnClient<Transport>::sendPacket(uint8_t type, const uint8_t *body, size_t length)
+{
+  // Length is single byte for packets shorter than 256 bytes, which are the only ones sent here
+  uint8_t header[2] = {(uint8_t)(length + 2), type};
+  if (length + 2 > 255 || !_transport.send(header, sizeof(header), body, length))
+    return false;
+  _lastSent = millis();
+  return true;
+}
+
+/* Incoming packets *************************************************************************************************/
+
+template <class Transport>
+bool MqttSnClient<Transport>::loop()
+{
+  if (_state != MQTT_CONNECTED && _state != MQTT_CONNECTING)
+    return false;
+
+  // Process all waiting datagrams
+  int length;
+  while ((length = _transport.receive(_buffer, sizeof(_buffer))) > 0)
+  {
+    // Length includes itself and the message type, 0x01 means it follows in two bytes
+    size_t packetLength = _buffer[0];
+    size_t headerLength = 1;
+    if (packetLength == 0x01 && length >= 3)
+    {
+      packetLength = readUint16(_buffer + 1);
+      headerLength = 3;
+    }
+    if (packetLength < headerLength + 1 || packetLength > (size_t)length)
+      continue; // Malformed or truncated
+    _lastReceived = millis();
+    handlePacket(_buffer + headerLength, packetLength - headerLength);
+  }
+
+  // Connection handshake: retransmit CONNECT until answered
+  if (_state == MQTT_CONNECTING)
+  {
+    if (millis() - _lastSent > MQTT_SN_RETRY_INTERVAL)
+    {
+      if (_retries++ >= MQTT_SN_RETRY_COUNT)
+        lost(MQTT_CONNECTION_TIMEOUT);
+      else
+        sendConnect();
+    }
+    return false;
+  }
+  if (_state != MQTT_CONNECTED)
+    return false;
+
+  // Retransmit unanswered REGISTER and SUBSCRIBE requests
+  for (int i = 0; i < MQTT_SN_MAX_TOPICS; i++)
+  {
+    Topic &topic = _topics[i];
+    if (topic.requestType != 0 && millis() - topic.sentAt > MQTT_SN_RETRY_INTERVAL)
+    {
+      if (topic.retries++ >= MQTT_SN_RETRY_COUNT)
+      {
+        lost(MQTT_CONNECTION_TIMEOUT);
+        return false;
+      }
+      sendRequest(topic);
+    }
+  }
+
+  // Keepalive: ping is retransmitted like other requests
+  unsigned long interval = MQTT_KEEPALIVE * 1000UL;
+  if (_pingOutstanding)
+  {
+    if (millis() - _lastSent > MQTT_SN_RETRY_INTERVAL)
+    {
+      if (_retries++ >= MQTT_SN_RETRY_COUNT)
+      {
+        lost(MQTT_CONNECTION_TIMEOUT);
+        return false;
+      }
+      sendPacket(SN_PINGREQ, NULL, 0);
+    }
+  }
+  else if (millis() - _lastSent > interval || millis() - _lastReceived > interval)
+  {
+    _pingOutstanding = true;
+    _retries = 0;
+    sendPacket(SN_PINGREQ, NULL, 0);
+  }
+  return true;
+}
+
+template <class Transport>
+void MqttSnClient<Transport>::handlePacket(const uint8_t *packet, size_t length)
+{
+  uint8_t type = packet[0];
+  const uint8_t *body = packet + 1;
+  length--;
+  if (length < minimumLength(type))
+    return;
+
+  switch (type)
+  {
+  case SN_CONNACK:
+    if (_state != MQTT_CONNECTING)
+      break;
+    if (body[0] != SN_RC_ACCEPTED)
+    {
+      lost(MQTT_CONNECT_UNAVAILABLE);
+      break;
+    }
+    _state = MQTT_CONNECTED;
+    _pingOutstanding = false;
+    _retries = 0;
+    if (_connectCallback != NULL)
+      _connectCallback();
+    break;
+  case SN_WILLTOPICREQ:
+  {
+    uint8_t body[1 + MQTT_MAX_TOPIC_LENGTH];
+    size_t topicLength = strlen(_willTopic);
+    if (topicLength > MQTT_MAX_TOPIC_LENGTH)
+      topicLength = MQTT_MAX_TOPIC_LENGTH;
+    body[0] = ((_willQos & 0x03) << SN_QOS_SHIFT) | (_willRetain ? SN_FLAG_RETAIN : 0);
+    memcpy(body + 1, _willTopic, topicLength);
+    sendPacket(SN_WILLTOPIC, body, 1 + topicLength);
+    break;
+  }
+  case SN_WILLMSGREQ:
+    sendPacket(SN_WILLMSG, (const uint8_t *)_willMessage, strlen(_willMessage));
+    break;
+  case SN_REGISTER:
+    handleRegister(body, length);
+    break;
+  case SN_PUBLISH:
+    handlePublish(body, length);
+    break;
+  case SN_REGACK:
+  case SN_SUBACK:
+  case SN_PUBACK:
+    handleAck(type, body, length);
+    break;
+  case SN_PINGRESP:
+    // Retransmitted ping is measured from the last transmission
+    if (_pingOutstanding)
+      _pingStats.add(millis() - _lastSent);
+    _pingOutstanding = false;
+    break;
+  case SN_PINGREQ:
+    sendPacket(SN_PINGRESP, NULL, 0);
+    break;
+  case SN_DISCONNECT:
+    lost(MQTT_CONNECTION_LOST);
+    break;
+  default:
+    break;
+  }
+}
+
+template <class Transport>
+void MqttSnClient<Transport>::handlePublish(const uint8_t *body, size_t length)
+{
+  uint8_t qos = (body[0] >> SN_QOS_SHIFT) & 0x03;
+  uint16_t topicId = readUint16(body + 1);
+  uint16_t packetId = readUint16(body + 3);
+  Topic *topic = findTopic(topicId);
+
+  uint8_t ack[5];
+  writeUint16(ack, topicId);
+  writeUint16(ack + 2, packetId);
+  if (topic == NULL)
+  {
+    // Unknown topic ID, tell the gateway so it registers the topic again
+    ack[4] = SN_RC_INVALID_TOPIC;
+    sendPacket(SN_PUBACK, ack, sizeof(ack));
+    return;
+  }
+
+  if (_callback != NULL)
+    _callback(topic->name, (uint8_t *)body + 5, length - 5);
+
+  if (qos == 1)
+  {
+    ack[4] = SN_RC_ACCEPTED;
+    sendPacket(SN_PUBACK, ack, sizeof(ack));
+  }
+}
+
+// Gateway registers topic before publishing to wildcard subscription
+template <class Transport>
+void MqttSnClient<Transport>::handleRegister(const uint8_t *body, size_t length)
+{
+  uint16_t topicId = readUint16(body);
+  uint16_t messageId = readUint16(body + 2);
+  size_t nameLength = length - 4;
+
+  uint8_t ack[5];
+  writeUint16(ack, topicId);
+  writeUint16(ack + 2, messageId);
+  ack[4] = SN_RC_INVALID_TOPIC;
+  Topic *topic = nameLength <= MQTT_MAX_TOPIC_LENGTH ? findTopic(topicId) : NULL;
+  if (topic == NULL && nameLength <= MQTT_MAX_TOPIC_LENGTH)
+    topic = allocateTopic(NULL);
+  if (topic != NULL)
+  {
+    if (topic->name[0] == 0)
+    {
+      memcpy(topic->name, body + 4, nameLength);
+      topic->name[nameLength] = 0;
+      topic->incoming = true;
+    }
+    topic->id = topicId;
+    ack[4] = SN_RC_ACCEPTED;
+  }
+  sendPacket(SN_REGACK, ack, sizeof(ack));
+}
+
+template <class Transport>
+void MqttSnClient<Transport>::handleAck(uint8_t type, const uint8_t *body, size_t length)
+{
+  if (type == SN_PUBACK)
+  {
+    // Topic ID, message ID, return code
+    if (body[4] == SN_RC_ACCEPTED && _ackCallback != NULL)
+      _ackCallback(readUint16(body + 2));
+    return;
+  }
+
+  // REGACK: topic ID, message ID, return code; SUBACK: flags, topic ID, message ID, return code
+  size_t offset = type == SN_SUBACK ? 1 : 0;
+  uint16_t topicId = readUint16(body + offset);
+  uint16_t messageId = readUint16(body + offset + 2);
+  uint8_t code = body[offset + 4];
+  for (int i = 0; i < MQTT_SN_MAX_TOPICS; i++)
+  {
+    Topic &topic = _topics[i];
+    if (topic.requestType == 0 || topic.requestId != messageId)
+      continue;
+    topic.requestType = 0;
+
+    // Message waiting for rejected registration is lost, publish() fails until the topic is registered
+    if (code != SN_RC_ACCEPTED)
+    {
+      if (topic.hasPending)
+        _publishFailures++;
+      topic.hasPending = false;
+      break;
+    }
+    if (topicId != 0)
+      topic.id = topicId;
+
+    // Send message which was waiting for the registration
+    if (topic.hasPending && topic.id != 0)
+    {
+      topic.hasPending = false;
+      sendPublish(topic.id, topic.pendingFlags, topic.pendingPacketId, topic.pendingPayload, topic.pendingLength);
+    }
+    break;
+  }
+}
+
+/* Topic table ******************************************************************************************************/
+
+template <class Transport>
+typename MqttSnClient<Transport>::Topic *MqttSnClient<Transport>::findTopic(const char *name)
+{
+  for (int i = 0; i < MQTT_SN_MAX_TOPICS; i++)
+  {
+    if (!_topics[i].incoming && _topics[i].name[0] != 0 && strcmp(_topics[i].name, name) == 0)
+      return &_topics[i];
+  }
+  return NULL;
+}
+
+template <class Transport>
+typename MqttSnClient<Transport>::Topic *MqttSnClient<Transport>::findTopic(uint16_t id)
+{
+  for (int i = 0; i < MQTT_SN_MAX_TOPICS; i++)
+  {
+    if (_topics[i].id == id && id != 0)
+      return &_topics[i];
+  }
+  return NULL;
+}
+
+template <class Transport>
+typename MqttSnClient<Transport>::Topic *MqttSnClient<Transport>::allocateTopic(const char *name)
+{
+  if (name != NULL && strlen(name) > MQTT_MAX_TOPIC_LENGTH)
+    return NULL;
+  for (int i = 0; i < MQTT_SN_MAX_TOPICS; i++)
+  {
+    Topic &topic = _topics[i];
+    if (topic.name[0] == 0 && topic.requestType == 0)
+    {
+      memset(&topic, 0, sizeof(topic));
+      if (name != NULL)
+        strcpy(topic.name, name);
+      return &topic;
+    }
+  }
+  return NULL;
+}
+
+template <class Transport>
+uint16_t MqttSnClient<Transport>::nextPacketId()
+{
+  if (++_lastPacketId == 0)
+    _lastPacketId = 1;
+  return _lastPacketId;
+}
+
+/* Transports *******************************************************************************************************/
+
+// Client is compiled for these transports only, add new transport here; the simulator compiles it for its test
+// transports by including this file (see Simulator/TestTransports.cpp)
+#ifndef MQTT_TEST_TRANSPORTS
+template class MqttSnClient<UdpTransport>;
+#endif
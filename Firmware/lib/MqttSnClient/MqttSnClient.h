@@ -0,0 +1,137 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - MQTT-SN client                                                                            *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * MQTT-SN 1.2 client over UDP, talking to a gateway which bridges it to the real MQTT server (see Gateway folder). *
+ * There is no TCP or TLS session, so it needs a fraction of RAM and reconnects with a single round trip. The API   *
+ * is the same as MqttClient, so the firmware can use either of them. Topics are registered automatically on first  *
+ * publish; a message published while its topic is being registered is kept and sent after REGACK.                  *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+#include <MqttClient.h>
+
+/* Configuration - may be overriden by build flags ******************************************************************/
+
+#ifndef MQTT_SN_BUFFER_SIZE
+#define MQTT_SN_BUFFER_SIZE 128 // bytes; maximum datagram size
+#endif
+#ifndef MQTT_SN_MAX_TOPICS
+#define MQTT_SN_MAX_TOPICS 10 // number of registered topics
+#endif
+#ifndef MQTT_SN_MAX_PENDING
+#define MQTT_SN_MAX_PENDING 16 // bytes; maximum payload of message waiting for topic registration (longer one fails)
+#endif
+#ifndef MQTT_SN_RETRY_INTERVAL
+#define MQTT_SN_RETRY_INTERVAL 3000 // ms; retransmission interval of unanswered requests (T_retry)
+#endif
+#ifndef MQTT_SN_RETRY_COUNT
+#define MQTT_SN_RETRY_COUNT 3 // number of retransmissions before the gateway is considered lost (N_retry)
+#endif
+
+#define MQTT_SN_VERSION 1 // Reported by protocolVersion()
+
+/* MQTT-SN client ***************************************************************************************************/
+
+// Transport is a datagram transport (open, close, send, receive) held by value, see Transport library
+template <class Transport>
+class MqttSnClient
+{
+public:
+  MqttSnClient();
+
+  MqttSnClient &setServer(const char *host, uint16_t port);
+  // Connects to already resolved address, host name is still used where the protocol needs it (TLS SNI)
+  MqttSnClient &setServer(const char *host, IPAddress address, uint16_t port);
+  MqttSnClient &setCallback(MqttMessageCallback callback);
+  MqttSnClient &setAckCallback(MqttAckCallback callback);
+  MqttSnClient &setConnectCallback(MqttConnectCallback callback);
+  MqttSnClient &setSessionExpiry(uint32_t seconds) { return *this; } // Not supported by MQTT-SN
+
+  // Starts connecting to gateway, connect callback is called from loop() when gateway accepts the connection
+  // Strings are copied, will is sent when the gateway asks for it
+  bool connect(const char *id, const char *user, const char *pass, const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage, bool cleanSession);
+  // Gateway publishes the will only when sendWill is set, after keep alive of the client runs out
+  void disconnect(bool sendWill = false);
+
+  // Publishes message; topic is copied to topic table
+  bool publish(const char *topic, const uint8_t *payload, size_t length, bool retain = false, uint8_t qos = 0, uint16_t packetId = 0, bool dup = false, uint32_t messageExpiry = 0);
+  bool publish(const char *topic, const char *payload);
+  bool subscribe(const char *topic, uint8_t qos = 0);
+  // Message ID for QoS 1 publish; REGISTER and SUBSCRIBE take their IDs from the same counter, so they never collide
+  uint16_t nextPacketId();
+
+  // Processes incoming datagrams, retransmissions and keepalive, must be called regularly
+  bool loop();
+
+  bool connected() const { return _state == MQTT_CONNECTED; }
+  int state() const { return _state; }
+  uint8_t protocolVersion() const { return MQTT_SN_VERSION; }
+  bool sessionPresent() const { return false; }
+  Transport &transport() { return _transport; }
+  const MqttPingStats &pingStats() const { return _pingStats; }
+  uint32_t publishFailures() const { return _publishFailures; } // Number of messages which could not be sent since start
+
+private:
+  struct Topic
+  {
+    char name[MQTT_MAX_TOPIC_LENGTH + 1];        // Topic name, empty when the slot is free
+    bool incoming;                               // Topic was registered by the gateway, not by this client
+    uint16_t id;                                 // Topic ID assigned by the gateway, 0 while not known
+    uint16_t requestId;                          // Message ID of pending REGISTER or SUBSCRIBE
+    uint8_t requestType;                         // Type of pending request, 0 if none
+    uint8_t requestQos;                          // Requested QoS of pending SUBSCRIBE
+    uint8_t retries;                             // Number of retransmissions of pending request
+    uint32_t sentAt;                             // Last transmission of pending request
+    bool hasPending;                             // Message is waiting for registration
+    uint8_t pendingFlags;                        // PUBLISH flags of waiting message
+    uint16_t pendingPacketId;                    // Packet ID of waiting message
+    uint8_t pendingPayload[MQTT_SN_MAX_PENDING]; // Payload of waiting message
+    size_t pendingLength;                        // Payload length of waiting message
+  };
+
+  bool sendConnect();
+  bool tryPublish(const char *topic, const uint8_t *payload, size_t length, bool retain, uint8_t qos, uint16_t packetId, bool dup, uint32_t messageExpiry);
+  bool sendRequest(Topic &topic);
+  bool sendPublish(uint16_t topicId, uint8_t flags, uint16_t packetId, const uint8_t *payload, size_t length);
+  bool sendPacket(uint8_t type, const uint8_t *body, size_t length);
+  void handlePacket(const uint8_t *packet, size_t length);
+  void handlePublish(const uint8_t *body, size_t length);
+  void handleRegister(const uint8_t *body, size_t length);
+  void handleAck(uint8_t type, const uint8_t *body, size_t length);
+  void lost(int state);
+  Topic *findTopic(const char *name);
+  Topic *findTopic(uint16_t id);
+  Topic *allocateTopic(const char *name);
+
+  Transport _transport;
+  char _host[MQTT_MAX_STRING_LENGTH + 1] = {};
+  IPAddress _address;
+  bool _hasAddress = false;
+  uint16_t _port = 0;
+  MqttMessageCallback _callback = NULL;
+  MqttAckCallback _ackCallback = NULL;
+  MqttConnectCallback _connectCallback = NULL;
+
+  char _id[MQTT_MAX_STRING_LENGTH + 1] = {};
+  char _willTopic[MQTT_MAX_TOPIC_LENGTH + 1] = {};
+  char _willMessage[MQTT_MAX_STRING_LENGTH + 1] = {};
+  uint8_t _willQos = 0;
+  bool _willRetain = false;
+  bool _cleanSession = true;
+
+  int _state = MQTT_DISCONNECTED;
+  uint8_t _retries = 0;
+  uint32_t _lastSent = 0;
+  uint32_t _lastReceived = 0;
+  bool _pingOutstanding = false;
+  MqttPingStats _pingStats = {};
+  uint32_t _publishFailures = 0;
+  uint16_t _lastPacketId = 0;
+  Topic _topics[MQTT_SN_MAX_TOPICS];
+  uint8_t _buffer[MQTT_SN_BUFFER_SIZE];
+};
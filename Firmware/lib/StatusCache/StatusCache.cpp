@@ -0,0 +1,77 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - status cache                                                                              *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "StatusCache.h"
+#include <sys/time.h>
+
+#define STATUS_CACHE_MAGIC 0x41495231 // "AIR1", change when Store layout changes
+
+RTC_NOINIT_ATTR StatusCache::Store StatusCache::_store;
+
+// Status must expire in the same time as without restart, so milliseconds are needed
+static uint64_t rtcTime()
+{
+  timeval now;
+  gettimeofday(&now, NULL);
+  return (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+bool StatusCache::begin()
+{
+  // RTC memory contains garbage after power loss
+  if (_store.magic != STATUS_CACHE_MAGIC || _store.checksum != checksum())
+  {
+    memset(&_store, 0, sizeof(_store));
+    _store.magic = STATUS_CACHE_MAGIC;
+    save();
+  }
+  return _store.valid;
+}
+
+void StatusCache::received(bool onAir)
+{
+  _store.valid = true;
+  _store.onAir = onAir;
+  _store.received = rtcTime();
+  save();
+}
+
+uint64_t StatusCache::age() const
+{
+  uint64_t now = rtcTime();
+  return now > _store.received ? now - _store.received : 0;
+}
+
+void StatusCache::accepted(uint32_t boot, uint32_t sequence)
+{
+  _store.announcementValid = true;
+  _store.boot = boot;
+  _store.sequence = sequence;
+  save();
+}
+
+bool StatusCache::announcement(uint32_t &boot, uint32_t &sequence) const
+{
+  boot = _store.boot;
+  sequence = _store.sequence;
+  return _store.announcementValid;
+}
+
+void StatusCache::save()
+{
+  _store.checksum = checksum();
+}
+
+// FNV-1a hash of the content
+uint32_t StatusCache::checksum()
+{
+  uint32_t hash = 2166136261;
+  const uint8_t *data = (const uint8_t *)&_store;
+  for (size_t i = 0; i < offsetof(Store, checksum); i++)
+    hash = (hash ^ data[i]) * 16777619;
+  return hash;
+}
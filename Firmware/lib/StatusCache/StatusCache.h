@@ -0,0 +1,52 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - status cache                                                                              *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Remembers the last received on-air status with the time it was received, and boot and sequence numbers of the    *
+ * last accepted announcement. The cache is kept in RTC memory, so it survives software restarts (e.g. WiFi timeout *
+ * or heap health), but not power loss. After restart the LED shows the status right away, until it expires as if   *
+ * there was no restart, and announcements which were already accepted before the restart are still discarded.      *
+ * There is a single cache in RTC memory, so there should be a single instance of StatusCache.                      *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+
+/* Status cache *****************************************************************************************************/
+
+class StatusCache
+{
+public:
+  // Restores cache kept in RTC memory, returns true when there is cached status
+  bool begin();
+
+  // Status was received now
+  void received(bool onAir);
+  bool onAir() const { return _store.onAir; }
+  uint64_t age() const; // ms; time since the status was received
+
+  // Announcement was accepted, returns false when there is no cached announcement
+  void accepted(uint32_t boot, uint32_t sequence);
+  bool announcement(uint32_t &boot, uint32_t &sequence) const;
+
+private:
+  // Content of RTC memory, validated by magic number and checksum after restart
+  struct Store
+  {
+    uint32_t magic;
+    bool valid;             // Status was received
+    bool onAir;             // Last received status
+    uint64_t received;      // ms; RTC time when the status was last received
+    bool announcementValid; // Announcement was accepted
+    uint32_t boot;          // Boot number of the last accepted announcement
+    uint32_t sequence;      // Sequence number of the last accepted announcement
+    uint32_t checksum;
+  };
+  static Store _store;
+
+  void save();
+  static uint32_t checksum();
+};
@@ -0,0 +1,118 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - telemetry                                                                                 *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "Telemetry.h"
+
+/* CBOR encoder *****************************************************************************************************/
+
+// Initial byte has major type in top 3 bits, value up to 23 is stored in the rest, longer one follows in 1-8 bytes
+void CborWriter::head(uint8_t type, uint64_t value)
+{
+  type <<= 5;
+  int bytes;
+  if (value < 24)
+  {
+    write(type | value);
+    return;
+  }
+  else if (value <= 0xFF)
+  {
+    write(type | 24);
+    bytes = 1;
+  }
+  else if (value <= 0xFFFF)
+  {
+    write(type | 25);
+    bytes = 2;
+  }
+  else if (value <= 0xFFFFFFFF)
+  {
+    write(type | 26);
+    bytes = 4;
+  }
+  else
+  {
+    write(type | 27);
+    bytes = 8;
+  }
+  for (int i = bytes - 1; i >= 0; i--)
+    write(value >> (i * 8));
+}
+
+void CborWriter::write(uint8_t value)
+{
+  if (_length >= _size)
+  {
+    _ok = false;
+    return;
+  }
+  _buffer[_length++] = value;
+}
+
+/* Telemetry ********************************************************************************************************/
+
+Telemetry::Telemetry(const int32_t *thresholds, size_t count) : _thresholds(thresholds), _count(min(count, (size_t)TELEMETRY_MAX_FIELDS))
+{
+  memset(_values, 0, sizeof(_values));
+  memset(_sent, 0, sizeof(_sent));
+}
+
+void Telemetry::set(size_t field, int32_t value)
+{
+  if (field < _count)
+    _values[field] = value;
+}
+
+size_t Telemetry::encode(uint8_t *buffer, size_t size)
+{
+  _encodedKeyframe = _keyframe || _messages + 1 >= TELEMETRY_KEYFRAME;
+  _encoded = 0;
+  size_t changed = 0;
+  for (size_t i = 0; i < _count; i++)
+  {
+    // Difference is computed in 64 bits, so it does not overflow for values of opposite signs
+    int64_t difference = (int64_t)_values[i] - _sent[i];
+    if (_encodedKeyframe || difference > _thresholds[i] || -difference > _thresholds[i])
+    {
+      _encoded |= 1UL << i;
+      changed++;
+    }
+  }
+  if (changed == 0)
+    return 0;
+
+  CborWriter writer(buffer, size);
+  writer.map(changed);
+  for (size_t i = 0; i < _count; i++)
+  {
+    if (_encoded & (1UL << i))
+    {
+      writer.integer(i);
+      writer.integer(_values[i]);
+    }
+  }
+  return writer.ok() ? writer.length() : 0;
+}
+
+void Telemetry::sent()
+{
+  for (size_t i = 0; i < _count; i++)
+  {
+    if (_encoded & (1UL << i))
+      _sent[i] = _values[i];
+  }
+  _encoded = 0;
+  if (_encodedKeyframe)
+  {
+    _keyframe = false;
+    _messages = 0;
+  }
+  else
+  {
+    _messages++;
+  }
+}
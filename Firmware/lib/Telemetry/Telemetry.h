@@ -0,0 +1,79 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - telemetry                                                                                 *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Device metrics encoded as CBOR (RFC 8949) map, keys are field numbers and values are integers, so a message      *
+ * with all fields has a few tens of bytes. Only fields which changed by more than their threshold since they were  *
+ * last sent are encoded; all fields are sent in every TELEMETRY_KEYFRAME-th message and after reset(), so receiver *
+ * which missed messages catches up. Encoding writes directly to the caller's buffer, without heap allocation.      *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+
+/* Configuration - may be overriden by build flags ******************************************************************/
+
+#ifndef TELEMETRY_KEYFRAME
+#define TELEMETRY_KEYFRAME 15 // every n-th message contains all fields
+#endif
+#ifndef TELEMETRY_MAX_FIELDS
+#define TELEMETRY_MAX_FIELDS 16 // maximum number of fields
+#endif
+
+/* CBOR encoder *****************************************************************************************************/
+
+// Writes CBOR data items to fixed buffer, ok() is false when the buffer was too small
+class CborWriter
+{
+public:
+  CborWriter(uint8_t *buffer, size_t size) : _buffer(buffer), _size(size) {}
+
+  void map(size_t count) { head(5, count); }
+  void integer(int32_t value) { value < 0 ? head(1, -1 - (int64_t)value) : head(0, value); }
+
+  bool ok() const { return _ok; }
+  size_t length() const { return _length; }
+
+private:
+  void head(uint8_t type, uint64_t value);
+  void write(uint8_t value);
+
+  uint8_t *_buffer;
+  size_t _size;
+  size_t _length = 0;
+  bool _ok = true;
+};
+
+/* Telemetry ********************************************************************************************************/
+
+class Telemetry
+{
+public:
+  // Field n changes when it differs from the last sent value by more than thresholds[n], at most TELEMETRY_MAX_FIELDS
+  Telemetry(const int32_t *thresholds, size_t count);
+
+  void set(size_t field, int32_t value);
+  int32_t value(size_t field) const { return _values[field]; }
+
+  // Encodes changed fields (or all fields in keyframe), returns length or 0 when nothing changed or buffer is too small
+  size_t encode(uint8_t *buffer, size_t size);
+
+  // Last encoded message was published, its values become the base for change detection
+  void sent();
+
+  // Next message contains all fields, e.g. after reconnection
+  void reset() { _keyframe = true; }
+
+private:
+  const int32_t *_thresholds;
+  size_t _count;
+  int32_t _values[TELEMETRY_MAX_FIELDS];
+  int32_t _sent[TELEMETRY_MAX_FIELDS];
+  uint32_t _encoded = 0; // Bit mask of fields in last encoded message
+  bool _encodedKeyframe = false;
+  bool _keyframe = true;
+  uint8_t _messages = 0; // Messages sent since last keyframe
+};
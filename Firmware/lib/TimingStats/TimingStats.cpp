@@ -0,0 +1,64 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - timing statistics                                                                         *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "TimingStats.h"
+
+TimingStats::TimingStats(const char *const *names, size_t count) : _names(names), _count(min(count, (size_t)TIMING_MAX_REGIONS))
+{
+  memset(_started, 0, sizeof(_started));
+  reset();
+}
+
+void TimingStats::stop(size_t region)
+{
+  if (region >= _count)
+    return;
+
+  // CPU frequency is read every time, because power management may change it
+  uint32_t us = (ESP.getCycleCount() - _started[region]) / getCpuFrequencyMhz();
+  size_t bucket = us < 2 ? 0 : 31 - __builtin_clz(us);
+  if (bucket >= TIMING_BUCKETS)
+    bucket = TIMING_BUCKETS - 1;
+
+  TimingHistogram &histogram = _histograms[region];
+  histogram.buckets[bucket]++;
+  if (us > histogram.max)
+    histogram.max = us;
+  if (us > TIMING_OVERRUN)
+    histogram.overruns++;
+}
+
+size_t TimingStats::encode(size_t region, char *buffer, size_t size) const
+{
+  if (region >= _count || size == 0)
+    return 0;
+  const TimingHistogram &histogram = _histograms[region];
+  int first = -1;
+  int last = -1;
+  for (int i = 0; i < TIMING_BUCKETS; i++)
+  {
+    if (histogram.buckets[i] == 0)
+      continue;
+    if (first < 0)
+      first = i;
+    last = i;
+  }
+  if (first < 0)
+    return 0;
+
+  size_t length = snprintf(buffer, size, "%s %d:", _names[region], first);
+  for (int i = first; i <= last && length < size; i++)
+    length += snprintf(buffer + length, size - length, i == first ? "%u" : ",%u", histogram.buckets[i]);
+  if (length < size)
+    length += snprintf(buffer + length, size - length, " max=%u over=%u", histogram.max, histogram.overruns);
+  return min(length, size - 1);
+}
+
+void TimingStats::reset()
+{
+  memset(_histograms, 0, sizeof(_histograms));
+}
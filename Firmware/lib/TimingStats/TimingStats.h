@@ -0,0 +1,68 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - timing statistics                                                                         *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Measures duration of code regions by CPU cycle counter and collects it to histograms with fixed logarithmic      *
+ * buckets: bucket 0 counts durations below 2 us, bucket N durations from 2^N to 2^(N+1) us and the last bucket all *
+ * longer ones. Measurement costs two reads of the cycle counter, so it can stay in production code.                *
+ * Cycle counter wraps around in about 18 s at 240 MHz, so longer durations are not measured correctly.             *
+ * Histogram text encoding: "<name> <first>:<count>,<count>,... max=<us> over=<count>", where <first> is index of   *
+ * the first non-empty bucket and the counts continue up to the last non-empty bucket.                              *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+
+/* Configuration - may be overriden by build flags ******************************************************************/
+
+#ifndef TIMING_BUCKETS
+#define TIMING_BUCKETS 16 // number of histogram buckets, the last one starts at 2^(TIMING_BUCKETS-1) us (32.8 ms)
+#endif
+#ifndef TIMING_OVERRUN
+#define TIMING_OVERRUN 50000 // us; longer durations are counted as overruns
+#endif
+#ifndef TIMING_MAX_REGIONS
+#define TIMING_MAX_REGIONS 8 // maximum number of measured regions
+#endif
+
+/* Timing statistics ************************************************************************************************/
+
+struct TimingHistogram
+{
+  uint32_t buckets[TIMING_BUCKETS];
+  uint32_t max;      // us; longest duration
+  uint32_t overruns; // Number of durations longer than TIMING_OVERRUN
+};
+
+class TimingStats
+{
+public:
+  // Names of regions measured by start() and stop(), at most TIMING_MAX_REGIONS
+  TimingStats(const char *const *names, size_t count);
+
+  void start(size_t region)
+  {
+    if (region < _count)
+      _started[region] = ESP.getCycleCount();
+  }
+  void stop(size_t region);
+
+  size_t count() const { return _count; }
+  const char *name(size_t region) const { return _names[region]; }
+  const TimingHistogram &histogram(size_t region) const { return _histograms[region]; }
+
+  // Writes text encoding of the histogram, returns its length (0 when nothing was measured)
+  size_t encode(size_t region, char *buffer, size_t size) const;
+
+  // Clears all histograms, e.g. after they were published
+  void reset();
+
+private:
+  const char *const *_names;
+  size_t _count;
+  uint32_t _started[TIMING_MAX_REGIONS];
+  TimingHistogram _histograms[TIMING_MAX_REGIONS];
+};
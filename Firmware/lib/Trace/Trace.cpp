@@ -0,0 +1,51 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - event trace                                                                               *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "Trace.h"
+#include <esp_timer.h>
+
+// Called also from interrupt handlers, so it's kept in IRAM and the lock works in both contexts
+void IRAM_ATTR Trace::record(uint8_t type, uint8_t arg, uint16_t value)
+{
+  uint32_t time = esp_timer_get_time();
+  portENTER_CRITICAL_SAFE(&_lock);
+  TraceEvent &event = _events[_next % TRACE_SIZE];
+  event.time = time;
+  event.type = type;
+  event.arg = arg;
+  event.value = value;
+  _next = _next + 1;
+  portEXIT_CRITICAL_SAFE(&_lock);
+}
+
+// Data events are recorded under the same lock, so no other event gets between them
+void Trace::record(uint8_t type, uint8_t arg, const uint8_t *data, uint16_t length)
+{
+  uint32_t time = esp_timer_get_time();
+  portENTER_CRITICAL_SAFE(&_lock);
+  _events[_next % TRACE_SIZE] = {time, type, arg, length};
+  _next = _next + 1;
+  for (uint16_t i = 0; i < length; i += 3)
+  {
+    uint8_t bytes[3] = {data[i], i + 1 < length ? data[i + 1] : (uint8_t)0, i + 2 < length ? data[i + 2] : (uint8_t)0};
+    _events[_next % TRACE_SIZE] = {time, TRACE_DATA, bytes[0], (uint16_t)(bytes[1] | bytes[2] << 8)};
+    _next = _next + 1;
+  }
+  portEXIT_CRITICAL_SAFE(&_lock);
+}
+
+size_t Trace::read(uint32_t &sequence, TraceEvent *events, size_t count)
+{
+  portENTER_CRITICAL_SAFE(&_lock);
+  if (sequence < first())
+    sequence = first();
+  size_t copied = 0;
+  while (copied < count && sequence < _next)
+    events[copied++] = _events[sequence++ % TRACE_SIZE];
+  portEXIT_CRITICAL_SAFE(&_lock);
+  return copied;
+}
@@ -0,0 +1,81 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - event trace                                                                               *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Records timestamped events to a ring buffer in RAM, the oldest events are overwritten. Recording takes a few     *
+ * hundred ns and can be done from any task and from interrupt handlers. Recorded events are read out in chunks by  *
+ * sequence number while recording goes on, so the trace can be sent over serial port or MQTT.                      *
+ * Each event takes 8 bytes, little endian: time (uint32, us since boot, wraps around in 71 minutes), type (uint8), *
+ * argument (uint8) and value (uint16). Trace/TraceConverter.cpp converts it to Perfetto (Chrome trace JSON).       *
+ * The same format is used for capture of external inputs (button, WiFi events, MQTT messages), which Simulator     *
+ * replays on host to reproduce field issues deterministically.                                                     *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+
+/* Configuration - may be overriden by build flags ******************************************************************/
+
+#ifndef TRACE_SIZE
+#define TRACE_SIZE 512 // number of events kept in the ring buffer (8 bytes each)
+#endif
+
+/* Event types - must match Trace/TraceConverter.cpp ****************************************************************/
+
+#define TRACE_LOOP_BEGIN 1 // Main loop started processing (CPU busy)
+#define TRACE_LOOP_END 2   // Main loop finished processing (CPU may sleep)
+#define TRACE_WIFI 3       // WiFi event, argument is TRACE_WIFI_*
+#define TRACE_MQTT_IN 4    // MQTT packet received, argument is packet type (high nibble of header), value is packet ID or length
+#define TRACE_MQTT_OUT 5   // MQTT packet sent, argument is packet type (high nibble of header), value is packet ID or length
+#define TRACE_GPIO 6       // Input pin changed, argument is pin number, value is level
+#define TRACE_LED 7        // LED changed, value is level
+#define TRACE_STATUS 8     // On-air status received, value is 1 when on air
+#define TRACE_MESSAGE 9    // MQTT message received, argument is TRACE_TOPIC_*, value is payload length, payload follows (except config)
+#define TRACE_DATA 10      // Next 3 bytes of data of the previous event (argument and value), recorded together with it
+#define TRACE_CLOCK 11     // Recorded periodically, so events are less than one time wraparound apart
+
+// WiFi events
+#define TRACE_WIFI_CONNECTED 1    // Associated with access point
+#define TRACE_WIFI_DISCONNECTED 2 // Disconnected from access point
+#define TRACE_WIFI_GOT_IP 3       // Got IP address
+#define TRACE_WIFI_LOST_IP 4      // Lost IP address
+
+// Topics of received messages
+#define TRACE_TOPIC_OTHER 0
+#define TRACE_TOPIC_STATUS 1
+#define TRACE_TOPIC_CONFIG 2
+#define TRACE_TOPIC_MAINTENANCE 3
+
+/* Event trace ******************************************************************************************************/
+
+struct TraceEvent
+{
+  uint32_t time; // us; lower 32 bits of time since boot
+  uint8_t type;  // TRACE_* event type
+  uint8_t arg;
+  uint16_t value;
+};
+
+class Trace
+{
+public:
+  void record(uint8_t type, uint8_t arg = 0, uint16_t value = 0);
+  // Records event with data length as value, followed by TRACE_DATA events with the data
+  void record(uint8_t type, uint8_t arg, const uint8_t *data, uint16_t length);
+
+  // Sequence number of the oldest kept event and of the next recorded event
+  uint32_t first() const { return _next > TRACE_SIZE ? _next - TRACE_SIZE : 0; }
+  uint32_t next() const { return _next; }
+
+  // Copies up to count events from sequence number (or from the oldest kept one, when it was overwritten)
+  // Returns number of copied events, sequence is moved after the last of them
+  size_t read(uint32_t &sequence, TraceEvent *events, size_t count);
+
+private:
+  TraceEvent _events[TRACE_SIZE];
+  volatile uint32_t _next = 0;
+  portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+};
@@ -0,0 +1,154 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - transports                                                                                *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "Transport.h"
+#include <esp_wifi.h>
+
+/* UDP transport ****************************************************************************************************/
+
+bool UdpTransport::open(const char *host, uint16_t port)
+{
+  IPAddress address;
+  return WiFi.hostByName(host, address) && open(address, port);
+}
+
+bool UdpTransport::open(IPAddress address, uint16_t port)
+{
+  _udp.stop();
+  _address = address;
+  _port = port;
+  return _udp.begin(port);
+}
+
+bool UdpTransport::send(const uint8_t *header, size_t headerLength, const uint8_t *body, size_t bodyLength)
+{
+  if (!_udp.beginPacket(_address, _port))
+    return false;
+  _udp.write(header, headerLength);
+  if (bodyLength > 0)
+    _udp.write(body, bodyLength);
+  return _udp.endPacket();
+}
+
+int UdpTransport::receive(uint8_t *buffer, size_t size)
+{
+  while (_udp.parsePacket() > 0)
+  {
+    int length = _udp.read(buffer, size);
+    if (length > 0 && _udp.remoteIP() == _address)
+      return length;
+  }
+  return 0;
+}
+
+/* Multicast transport **********************************************************************************************/
+
+bool MulticastTransport::open(IPAddress group, uint16_t port)
+{
+  _udp.stop();
+  _group = group;
+  _port = port;
+  return _udp.beginMulticast(group, port);
+}
+
+bool MulticastTransport::send(const uint8_t *header, size_t headerLength, const uint8_t *body, size_t bodyLength)
+{
+  if (!_udp.beginPacket(_group, _port))
+    return false;
+  _udp.write(header, headerLength);
+  if (bodyLength > 0)
+    _udp.write(body, bodyLength);
+  return _udp.endPacket();
+}
+
+int MulticastTransport::receive(uint8_t *buffer, size_t size)
+{
+  if (_udp.parsePacket() <= 0)
+    return 0;
+  int length = _udp.read(buffer, size);
+  return length > 0 ? length : 0;
+}
+
+/* ESP-NOW transport ************************************************************************************************/
+
+static const uint8_t ESPNOW_BROADCAST[ESP_NOW_ETH_ALEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+QueueHandle_t EspNowTransport::_queue = NULL;
+
+bool EspNowTransport::open(uint8_t channel)
+{
+  if (_queue == NULL)
+    _queue = xQueueCreate(ESPNOW_QUEUE_SIZE, sizeof(Frame));
+  if (_queue == NULL)
+    return false;
+
+  // Fails when connected to access point, then its channel is used
+  esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+  if (esp_now_init() != ESP_OK)
+    return false;
+
+  // Channel 0 means current channel of the station interface
+  esp_now_peer_info_t peer = {};
+  memcpy(peer.peer_addr, ESPNOW_BROADCAST, ESP_NOW_ETH_ALEN);
+  peer.channel = 0;
+  peer.ifidx = WIFI_IF_STA;
+  peer.encrypt = false;
+  if (!esp_now_is_peer_exist(ESPNOW_BROADCAST) && esp_now_add_peer(&peer) != ESP_OK)
+    return false;
+  return esp_now_register_recv_cb(onReceive) == ESP_OK;
+}
+
+void EspNowTransport::close()
+{
+  esp_now_unregister_recv_cb();
+  esp_now_deinit();
+}
+
+bool EspNowTransport::send(const uint8_t *header, size_t headerLength, const uint8_t *body, size_t bodyLength)
+{
+  uint8_t frame[ESP_NOW_MAX_DATA_LEN];
+  if (headerLength + bodyLength > sizeof(frame))
+    return false;
+  memcpy(frame, header, headerLength);
+  if (bodyLength > 0)
+    memcpy(frame + headerLength, body, bodyLength);
+  return esp_now_send(ESPNOW_BROADCAST, frame, headerLength + bodyLength) == ESP_OK;
+}
+
+int EspNowTransport::receive(uint8_t *buffer, size_t size)
+{
+  Frame frame;
+  if (_queue == NULL || xQueueReceive(_queue, &frame, 0) != pdTRUE)
+    return 0;
+  size_t length = frame.length < size ? frame.length : size;
+  memcpy(buffer, frame.data, length);
+  return length;
+}
+
+void EspNowTransport::wait(unsigned long timeout)
+{
+  Frame frame;
+  if (_queue == NULL)
+    delay(timeout);
+  else
+    xQueuePeek(_queue, &frame, pdMS_TO_TICKS(timeout));
+}
+
+// Called from WiFi task, so the frame is only queued
+#if ESP_IDF_VERSION_MAJOR >= 5
+void EspNowTransport::onReceive(const esp_now_recv_info_t *info, const uint8_t *data, int length)
+#else
+void EspNowTransport::onReceive(const uint8_t *mac, const uint8_t *data, int length)
+#endif
+{
+  if (length <= 0 || length > ESPNOW_FRAME_SIZE)
+    return;
+  Frame frame;
+  frame.length = length;
+  memcpy(frame.data, data, length);
+  xQueueSend(_queue, &frame, 0);
+}
@@ -0,0 +1,114 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - transports                                                                                *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Transports are passed to MQTT clients as template parameters and held by value, so the choice is made at compile *
+ * time and calls are resolved statically. There are two kinds of them:                                             *
+ * - Stream transports for MqttClient: connect, connected, stop, available, read and write like Arduino Client,     *
+ *   connect to resolved address also gets the host name.                                                           *
+ * - Datagram transports for MqttSnClient and AnnouncementChannel: open, close, send and receive datagrams.         *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+#include <WiFiUdp.h>
+#include <esp_idf_version.h>
+#include <esp_now.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+/* Configuration - may be overriden by build flags ******************************************************************/
+
+#ifndef ESPNOW_QUEUE_SIZE
+#define ESPNOW_QUEUE_SIZE 8 // number of received ESP-NOW frames waiting for processing
+#endif
+#ifndef ESPNOW_FRAME_SIZE
+#define ESPNOW_FRAME_SIZE 32 // bytes; maximum size of received ESP-NOW frame, longer frames are dropped
+#endif
+
+/* Stream transports ************************************************************************************************/
+
+// MQTT over TCP
+class TcpTransport : public WiFiClient
+{
+public:
+  using WiFiClient::connect;
+  int connect(IPAddress address, uint16_t port, const char *host) { return WiFiClient::connect(address, port); }
+};
+
+// MQTT over TLS, host name is used for SNI and certificate verification even when connecting to resolved address
+class TlsTransport : public WiFiClientSecure
+{
+public:
+  using WiFiClientSecure::connect;
+  int connect(IPAddress address, uint16_t port, const char *host) { return WiFiClientSecure::connect(address, port, host, _CA_cert, _cert, _private_key); }
+};
+
+/* Datagram transports **********************************************************************************************/
+
+// UDP datagrams exchanged with the host given to open(), local port is the same as the remote one
+class UdpTransport
+{
+public:
+  bool open(const char *host, uint16_t port);
+  bool open(IPAddress address, uint16_t port);
+  void close() { _udp.stop(); }
+  bool send(const uint8_t *header, size_t headerLength, const uint8_t *body, size_t bodyLength);
+  // Returns length of next datagram received from the peer, 0 if there is none; datagrams from others are dropped
+  int receive(uint8_t *buffer, size_t size);
+
+private:
+  WiFiUDP _udp;
+  IPAddress _address;
+  uint16_t _port = 0;
+};
+
+// UDP multicast group, datagrams are sent to the group and received from any member
+class MulticastTransport
+{
+public:
+  bool open(IPAddress group, uint16_t port);
+  void close() { _udp.stop(); }
+  bool send(const uint8_t *header, size_t headerLength, const uint8_t *body, size_t bodyLength);
+  int receive(uint8_t *buffer, size_t size);
+  IPAddress remoteIP() { return _udp.remoteIP(); } // Sender of last received datagram
+
+private:
+  WiFiUDP _udp;
+  IPAddress _group;
+  uint16_t _port = 0;
+};
+
+// ESP-NOW broadcast frames, delivered without access point; all devices must be on the same WiFi channel
+// There is only one radio, so all instances share the same receive queue
+class EspNowTransport
+{
+public:
+  // WiFi must be in station mode, channel is used only while not connected to access point
+  bool open(uint8_t channel);
+  void close();
+  bool send(const uint8_t *header, size_t headerLength, const uint8_t *body, size_t bodyLength);
+  int receive(uint8_t *buffer, size_t size);
+  // Waits for frame to arrive, at most timeout ms; used instead of delay() to process frames without latency
+  void wait(unsigned long timeout);
+
+private:
+  struct Frame
+  {
+    uint8_t length;
+    uint8_t data[ESPNOW_FRAME_SIZE];
+  };
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+  static void onReceive(const esp_now_recv_info_t *info, const uint8_t *data, int length);
+#else
+  static void onReceive(const uint8_t *mac, const uint8_t *data, int length);
+#endif
+
+  static QueueHandle_t _queue;
+};
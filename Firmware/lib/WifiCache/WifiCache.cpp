@@ -0,0 +1,148 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - WiFi connection cache                                                                     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "WifiCache.h"
+#include <WiFi.h>
+#include <time.h>
+
+#define WIFI_CACHE_MAGIC 0x57494631 // "WIF1", change when Store layout changes
+
+RTC_NOINIT_ATTR WifiCache::Store WifiCache::_store;
+
+static uint32_t rtcTime()
+{
+  return time(NULL);
+}
+
+bool WifiCache::begin()
+{
+  // RTC memory contains garbage after power loss
+  if (_store.magic != WIFI_CACHE_MAGIC || _store.checksum != checksum())
+  {
+    memset(&_store, 0, sizeof(_store));
+    _store.magic = WIFI_CACHE_MAGIC;
+    save();
+  }
+  return _store.ssid[0] != 0;
+}
+
+void WifiCache::connect(const char *ssid, const char *password, int32_t channel)
+{
+  // Known BSSID and channel skip the scan
+  if (_store.ssid[0] != 0 && strcmp(_store.ssid, ssid) == 0)
+    start(ssid, password, _store.channel, _store.bssid, rtcTime() - _store.leased < WIFI_REUSE_TIMEOUT);
+  else
+    start(ssid, password, channel, NULL, false);
+}
+
+void WifiCache::connectTo(const char *ssid, const char *password, int32_t channel, const uint8_t *bssid)
+{
+  // Address may belong to another network, so it's obtained from DHCP server
+  start(ssid, password, channel, bssid, false);
+}
+
+void WifiCache::start(const char *ssid, const char *password, int32_t channel, const uint8_t *bssid, bool reuse)
+{
+  _fast = bssid != NULL;
+  _renewing = false;
+  _started = millis();
+
+  // Static configuration is kept by WiFi library, so it must be removed when it's not wanted anymore
+  if (reuse)
+    WiFi.config(IPAddress(_store.address), IPAddress(_store.gateway), IPAddress(_store.subnet), IPAddress(_store.dns1), IPAddress(_store.dns2));
+  else if (_reused)
+    WiFi.config(IPAddress(), IPAddress(), IPAddress()); // Zero address turns DHCP client on
+  _reused = reuse;
+  WiFi.begin(ssid, password, channel, bssid);
+}
+
+// The attempt is over, so it does not time out again while the scan started after it runs
+void WifiCache::failed()
+{
+  _fast = false;
+  _store.ssid[0] = 0;
+  save();
+  WiFi.disconnect();
+}
+
+void WifiCache::connected()
+{
+  _connectedAt = millis();
+
+  // Reused address is stored already, only DHCP lease is worth storing
+  if (!_reused)
+    store();
+}
+
+void WifiCache::loop(bool canRenew)
+{
+  if (WiFi.status() != WL_CONNECTED)
+    return;
+
+  // Switch reused address back to DHCP, the connection is interrupted until DHCP server answers
+  uint32_t now = rtcTime();
+  if (_reused)
+  {
+    if ((canRenew && millis() - _connectedAt > WIFI_RENEW_DELAY) || now - _store.leased >= WIFI_REUSE_TIMEOUT)
+    {
+      WiFi.config(IPAddress(), IPAddress(), IPAddress());
+      _reused = false;
+      _renewing = true;
+    }
+    return;
+  }
+
+  // Wait for address from DHCP server
+  if (_renewing)
+  {
+    if ((uint32_t)WiFi.localIP() == 0)
+      return;
+    _renewing = false;
+    store();
+    return;
+  }
+
+  // Address is leased by DHCP client, which renews it
+  if (_store.ssid[0] != 0 && _store.leased != now)
+  {
+    _store.leased = now;
+    save();
+  }
+}
+
+void WifiCache::store()
+{
+  strncpy(_store.ssid, WiFi.SSID().c_str(), sizeof(_store.ssid) - 1);
+  _store.ssid[sizeof(_store.ssid) - 1] = 0;
+  const uint8_t *bssid = WiFi.BSSID();
+  if (bssid == NULL)
+    return;
+  memcpy(_store.bssid, bssid, sizeof(_store.bssid));
+  _store.channel = WiFi.channel();
+  _store.address = WiFi.localIP();
+  _store.gateway = WiFi.gatewayIP();
+  _store.subnet = WiFi.subnetMask();
+  _store.dns1 = WiFi.dnsIP(0);
+  _store.dns2 = WiFi.dnsIP(1);
+  _store.leased = rtcTime();
+  save();
+}
+
+void WifiCache::save()
+{
+  _store.checksum = checksum();
+}
+
+// FNV-1a hash of the content
+uint32_t WifiCache::checksum()
+{
+  uint32_t hash = 2166136261;
+  const uint8_t *data = (const uint8_t *)&_store;
+  for (size_t i = 0; i < offsetof(Store, checksum); i++)
+    hash = (hash ^ data[i]) * 16777619;
+  return hash;
+}
@@ -0,0 +1,94 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - WiFi connection cache                                                                     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Remembers the access point (BSSID and channel) and the address leased by DHCP, so the next connection skips the  *
+ * scan and, if the lease was in use shortly before, DHCP as well. The cache is kept in RTC memory, so it survives  *
+ * software restarts (preventive reboot), but not power loss. When the fast connection fails, the cache is cleared  *
+ * and the network is scanned as usual. Reused address is not renewed by DHCP, so the connection is switched back   *
+ * to DHCP later, when a short interruption does not matter.                                                        *
+ * There is a single cache in RTC memory, so there should be a single instance of WifiCache.                        *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+
+/* Configuration - may be overriden by build flags ******************************************************************/
+
+#ifndef WIFI_FAST_TIMEOUT
+#define WIFI_FAST_TIMEOUT 5000 // ms; fast connection fails when not connected in this time, then the network is scanned
+#endif
+#ifndef WIFI_REUSE_TIMEOUT
+#define WIFI_REUSE_TIMEOUT 600 // s; leased address is reused only if it was used by DHCP client this long ago at most
+#endif
+#ifndef WIFI_RENEW_DELAY
+#define WIFI_RENEW_DELAY 60000 // ms; time after connection with reused address when it can be switched back to DHCP
+#endif
+
+/* WiFi connection cache ********************************************************************************************/
+
+class WifiCache
+{
+public:
+  // Restores cache kept in RTC memory, returns true when there is cached access point
+  bool begin();
+
+  // Starts connecting to the network, using cached access point and address when possible
+  // Channel is used to limit the scan when there is no cached access point, 0 means all channels
+  void connect(const char *ssid, const char *password, int32_t channel = 0);
+
+  // Starts connecting to given access point, e.g. when roaming
+  void connectTo(const char *ssid, const char *password, int32_t channel, const uint8_t *bssid);
+
+  // Connection to known access point is not established in time, it should be found by scan again
+  bool timedOut() const { return _fast && millis() - _started > WIFI_FAST_TIMEOUT; }
+
+  // Connection to known access point failed, clears the cache and disconnects
+  void failed();
+
+  // Connection was established, stores access point and address
+  void connected();
+
+  // Keeps the cache up to date, must be called regularly
+  // Reused address is switched back to DHCP only if canRenew is true (connection is briefly interrupted),
+  // or when it's too long since the lease was renewed
+  void loop(bool canRenew);
+
+  // SSID of cached network, or NULL
+  const char *ssid() const { return _store.ssid[0] != 0 ? _store.ssid : NULL; }
+
+  bool fast() const { return _fast; }            // Current connection uses known access point
+  bool reusedAddress() const { return _reused; } // Current connection uses reused address, not renewed by DHCP
+
+private:
+  // Content of RTC memory, validated by magic number and checksum after restart
+  struct Store
+  {
+    uint32_t magic;
+    char ssid[33]; // Empty when nothing is cached
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint32_t address;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns1;
+    uint32_t dns2;
+    uint32_t leased; // s; RTC time when the address was last used by DHCP client
+    uint32_t checksum;
+  };
+
+  void start(const char *ssid, const char *password, int32_t channel, const uint8_t *bssid, bool reuse);
+  void store();
+  void save();
+  static uint32_t checksum();
+
+  static Store _store;
+  bool _fast = false;
+  bool _reused = false;
+  bool _renewing = false;
+  uint32_t _started = 0;
+  uint32_t _connectedAt = 0;
+};
@@ -0,0 +1,99 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - WiFi power profiles                                                                       *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "WifiPower.h"
+#include <WiFi.h>
+#include <driver/gpio.h>
+#include <esp_idf_version.h>
+
+bool WifiPower::begin(uint8_t profile)
+{
+  _profile = profile;
+  _lightSleep = false;
+
+  // WiFi library applies the sleep type whenever the station is started
+  switch (profile)
+  {
+  case WIFI_POWER_PERFORMANCE:
+    return WiFi.setSleep(WIFI_PS_NONE);
+  case WIFI_POWER_BALANCED:
+    return WiFi.setSleep(WIFI_PS_MIN_MODEM);
+  case WIFI_POWER_LOW:
+    break;
+  default:
+    return false;
+  }
+  if (!WiFi.setSleep(WIFI_PS_MAX_MODEM))
+    return false;
+
+  // Automatic light sleep when all tasks are idle (in delay), fails when not enabled in ESP-IDF configuration
+#if ESP_IDF_VERSION_MAJOR >= 5
+  esp_pm_config_t config = {};
+#else
+  esp_pm_config_esp32_t config = {};
+#endif
+  config.max_freq_mhz = getCpuFrequencyMhz();
+  config.min_freq_mhz = WIFI_POWER_MIN_FREQ;
+  config.light_sleep_enable = true;
+  _lightSleep = esp_pm_configure(&config) == ESP_OK;
+  if (!_lightSleep)
+    return false;
+
+  // Locks keep the CPU fast and awake while busy, they are created once and reused
+  if (_frequencyLock == NULL)
+    esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "busy", &_frequencyLock);
+  if (_sleepLock == NULL)
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "busy", &_sleepLock);
+  busy();
+  return _frequencyLock != NULL && _sleepLock != NULL;
+}
+
+void WifiPower::busy()
+{
+  if (!_lightSleep || _busy)
+    return;
+  _busy = true;
+  _busySince = millis();
+  if (_frequencyLock != NULL)
+    esp_pm_lock_acquire(_frequencyLock);
+  if (_sleepLock != NULL)
+    esp_pm_lock_acquire(_sleepLock);
+  if (_heldPin >= 0)
+    gpio_hold_dis((gpio_num_t)_heldPin);
+}
+
+void WifiPower::idle()
+{
+  if (!_lightSleep || !_busy)
+    return;
+
+  // Light sleep would cut off serial output in progress
+  Serial.flush();
+  if (_heldPin >= 0)
+    gpio_hold_en((gpio_num_t)_heldPin);
+  if (_sleepLock != NULL)
+    esp_pm_lock_release(_sleepLock);
+  if (_frequencyLock != NULL)
+    esp_pm_lock_release(_frequencyLock);
+  _busyTime += millis() - _busySince;
+  _busy = false;
+}
+
+const char *WifiPower::name() const
+{
+  switch (_profile)
+  {
+  case WIFI_POWER_PERFORMANCE:
+    return "performance";
+  case WIFI_POWER_BALANCED:
+    return "balanced";
+  case WIFI_POWER_LOW:
+    return _lightSleep ? "low power" : "low power (without light sleep)";
+  default:
+    return "unknown";
+  }
+}
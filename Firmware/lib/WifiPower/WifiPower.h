@@ -0,0 +1,65 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - WiFi power profiles                                                                       *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Selects how much the WiFi radio sleeps. Access point keeps packets for a sleeping station until it wakes up for  *
+ * a beacon, so each step down in power consumption adds latency to incoming messages:                              *
+ * - Performance: radio is always on, packets are received immediately.                                             *
+ * - Balanced: modem sleep, radio wakes up for every DTIM beacon (typically 100-300 ms).                            *
+ * - Low power: modem sleep with listen interval (3 beacons by default) and CPU light sleep while idle. Light sleep *
+ *   needs power management and tickless idle in the ESP-IDF build, otherwise only modem sleep is used.             *
+ *   The CPU runs at lowest frequency or sleeps, except between busy() and idle(), when it runs at full speed.      *
+ *   Timer (end of delay) and WiFi events wake it up automatically. Pins set by holdPin() keep their level while    *
+ *   the CPU sleeps.                                                                                                *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+#include <esp_pm.h>
+
+/* Configuration - may be overriden by build flags ******************************************************************/
+
+#ifndef WIFI_POWER_MIN_FREQ
+#define WIFI_POWER_MIN_FREQ 40 // MHz; lowest CPU frequency in low power profile when idle (40 MHz is crystal frequency)
+#endif
+
+/* WiFi power profiles **********************************************************************************************/
+
+#define WIFI_POWER_PERFORMANCE 0 // Radio always on - lowest latency, highest consumption
+#define WIFI_POWER_BALANCED 1    // Modem sleep between DTIM beacons
+#define WIFI_POWER_LOW 2         // Modem sleep for listen interval, light sleep while idle - highest latency
+
+class WifiPower
+{
+public:
+  // Applies the profile, should be called before connecting to WiFi
+  // Returns false when the profile could not be fully applied, e.g. light sleep is not supported by the build
+  bool begin(uint8_t profile);
+
+  uint8_t profile() const { return _profile; }
+  const char *name() const;
+  bool lightSleep() const { return _lightSleep; } // CPU light sleep is enabled
+
+  // Pin keeps its output level while the CPU sleeps (e.g. LED), it can be changed only while busy
+  void holdPin(int pin) { _heldPin = pin; }
+
+  // CPU runs at full speed and does not sleep until idle() is called, used while processing network traffic
+  void busy();
+  void idle();
+
+  // Time spent busy (awake at full speed) since start, to estimate duty cycle
+  uint32_t busyTime() const { return _busyTime; }
+
+private:
+  uint8_t _profile = WIFI_POWER_PERFORMANCE;
+  bool _lightSleep = false;
+  esp_pm_lock_handle_t _frequencyLock = NULL;
+  esp_pm_lock_handle_t _sleepLock = NULL;
+  int _heldPin = -1;
+  bool _busy = false;
+  uint32_t _busySince = 0;
+  uint32_t _busyTime = 0;
+};
@@ -0,0 +1,126 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - WiFi roaming                                                                              *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "WifiRoaming.h"
+#include <WiFi.h>
+
+WifiRoaming::WifiRoaming(const WifiNetwork *networks, size_t count, uint8_t channel) : _networks(networks), _count(count), _channel(channel)
+{
+  memset(_target, 0, sizeof(_target));
+}
+
+const WifiNetwork *WifiRoaming::find(const char *ssid) const
+{
+  if (ssid == NULL)
+    return NULL;
+  for (size_t i = 0; i < _count; i++)
+  {
+    if (strcmp(_networks[i].ssid, ssid) == 0)
+      return &_networks[i];
+  }
+  return NULL;
+}
+
+/* Scan *************************************************************************************************************/
+
+bool WifiRoaming::scan()
+{
+  _lastScan = millis();
+  WiFi.scanDelete();
+  _scanning = WiFi.scanNetworks(true, false, false, WIFI_SCAN_CHANNEL_TIME, _channel) == WIFI_SCAN_RUNNING;
+  return _scanning;
+}
+
+int WifiRoaming::scanResult(WifiAccessPoint &accessPoint)
+{
+  int16_t count = WiFi.scanComplete();
+  if (count == WIFI_SCAN_RUNNING)
+    return ROAMING_SCAN_RUNNING;
+  _scanning = false;
+
+  // Current access point is not a roaming candidate
+  const uint8_t *current = WiFi.status() == WL_CONNECTED ? WiFi.BSSID() : NULL;
+  bool found = false;
+  for (int16_t i = 0; i < count; i++)
+  {
+    const WifiNetwork *network = find(WiFi.SSID(i).c_str());
+    if (network == NULL || (current != NULL && memcmp(WiFi.BSSID(i), current, sizeof(accessPoint.bssid)) == 0))
+      continue;
+    if (found && WiFi.RSSI(i) <= accessPoint.rssi)
+      continue;
+    found = true;
+    accessPoint.network = network;
+    memcpy(accessPoint.bssid, WiFi.BSSID(i), sizeof(accessPoint.bssid));
+    accessPoint.channel = WiFi.channel(i);
+    accessPoint.rssi = WiFi.RSSI(i);
+  }
+  WiFi.scanDelete();
+  return found ? ROAMING_SCAN_FOUND : ROAMING_SCAN_NONE;
+}
+
+/* Roaming **********************************************************************************************************/
+
+bool WifiRoaming::loop(WifiAccessPoint &target)
+{
+  if (WiFi.status() != WL_CONNECTED || _roaming)
+  {
+    _rssi = 0;
+    return false;
+  }
+
+  // Single samples are noisy, so the decision is based on moving average
+  if (millis() - _lastSample >= WIFI_ROAM_SAMPLE_INTERVAL)
+  {
+    _lastSample = millis();
+    int32_t sample = WiFi.RSSI();
+    _rssi = _rssi == 0 ? sample : (_rssi * 3 + sample) / 4;
+  }
+
+  if (_scanning)
+  {
+    int result = scanResult(target);
+    return result == ROAMING_SCAN_FOUND && target.rssi >= _rssi + WIFI_ROAM_HYSTERESIS;
+  }
+  if (_rssi != 0 && _rssi < WIFI_ROAM_RSSI && millis() - _lastScan > WIFI_ROAM_SCAN_INTERVAL)
+    scan();
+  return false;
+}
+
+void WifiRoaming::roamStarted(const WifiAccessPoint &target)
+{
+  _roaming = true;
+  memcpy(_target, target.bssid, sizeof(_target));
+  _roamStarted = millis();
+}
+
+void WifiRoaming::roamFinished()
+{
+  if (!_roaming)
+    return;
+  _roaming = false;
+  _roams++;
+  _lastOutage = millis() - _roamStarted;
+  if (_lastOutage > _maxOutage)
+    _maxOutage = _lastOutage;
+}
+
+void WifiRoaming::roamFailed()
+{
+  if (!_roaming)
+    return;
+  _roaming = false;
+  _failedRoams++;
+}
+
+// Disconnection from the old access point is reported asynchronously, so the connection status is not enough
+bool WifiRoaming::leaving() const
+{
+  if (!_roaming || WiFi.status() != WL_CONNECTED)
+    return false;
+  const uint8_t *bssid = WiFi.BSSID();
+  return bssid != NULL && memcmp(bssid, _target, sizeof(_target)) != 0;
+}
@@ -0,0 +1,109 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - WiFi roaming                                                                              *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Keeps a list of known WiFi networks and finds the strongest access point of them. While connected, the signal is *
+ * sampled and smoothed; when it gets weak, the networks are scanned in background and the device should move to an *
+ * access point which is stronger by a margin, before the connection is lost. Scans run only when the signal is     *
+ * weak, because the radio leaves the channel while scanning, which delays incoming messages.                       *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+
+/* Configuration - may be overriden by build flags ******************************************************************/
+
+#ifndef WIFI_ROAM_RSSI
+#define WIFI_ROAM_RSSI -70 // dBm; better access point is searched for when the signal is weaker than this
+#endif
+#ifndef WIFI_ROAM_HYSTERESIS
+#define WIFI_ROAM_HYSTERESIS 8 // dB; other access point must be stronger at least by this margin
+#endif
+#ifndef WIFI_ROAM_SCAN_INTERVAL
+#define WIFI_ROAM_SCAN_INTERVAL 30000 // ms; minimum interval between background scans
+#endif
+#ifndef WIFI_ROAM_SAMPLE_INTERVAL
+#define WIFI_ROAM_SAMPLE_INTERVAL 1000 // ms; interval of signal strength samples
+#endif
+#ifndef WIFI_SCAN_CHANNEL_TIME
+#define WIFI_SCAN_CHANNEL_TIME 120 // ms; time spent on each channel while scanning
+#endif
+
+/* WiFi roaming *****************************************************************************************************/
+
+#define ROAMING_SCAN_RUNNING 0 // Scan is still running
+#define ROAMING_SCAN_FOUND 1   // Access point of known network was found
+#define ROAMING_SCAN_NONE 2    // No (other) access point of known network was found or scan failed
+
+struct WifiNetwork
+{
+  const char *ssid;
+  const char *password;
+};
+
+struct WifiAccessPoint
+{
+  const WifiNetwork *network;
+  uint8_t bssid[6];
+  int32_t channel;
+  int32_t rssi; // dBm
+};
+
+class WifiRoaming
+{
+public:
+  // Channel limits scans to single channel, 0 means all channels
+  WifiRoaming(const WifiNetwork *networks, size_t count, uint8_t channel = 0);
+
+  // Returns known network with the SSID, or NULL
+  const WifiNetwork *find(const char *ssid) const;
+
+  // Starts background scan, returns false when it could not be started
+  bool scan();
+
+  // Returns ROAMING_SCAN_* result of the scan; when found, accessPoint is the strongest access point of known
+  // networks other than the current one
+  int scanResult(WifiAccessPoint &accessPoint);
+
+  // Samples signal and scans when it's weak, must be called regularly while connected
+  // Returns true when the device should roam to the returned access point
+  bool loop(WifiAccessPoint &target);
+
+  // Roaming to the access point was started, finished (connected to it) or failed
+  void roamStarted(const WifiAccessPoint &target);
+  void roamFinished();
+  void roamFailed();
+
+  // Roaming is in progress, but the device is still connected to the old access point
+  bool leaving() const;
+  bool roaming() const { return _roaming; }
+
+  int32_t rssi() const { return _rssi; }                   // dBm; smoothed signal strength, 0 when not measured
+  uint32_t roams() const { return _roams; }                // Number of successful roams
+  uint32_t failedRoams() const { return _failedRoams; }    // Number of failed roams
+  unsigned long lastOutage() const { return _lastOutage; } // ms; connection outage of the last roam
+  unsigned long maxOutage() const { return _maxOutage; }   // ms; longest connection outage of roam
+
+private:
+  const WifiNetwork *_networks;
+  size_t _count;
+  uint8_t _channel;
+
+  // Signal measurement and scan
+  int32_t _rssi = 0;
+  uint32_t _lastSample = 0;
+  bool _scanning = false;
+  uint32_t _lastScan = 0;
+
+  // Roam in progress and statistics
+  bool _roaming = false;
+  uint8_t _target[6];
+  uint32_t _roamStarted = 0;
+  uint32_t _roams = 0;
+  uint32_t _failedRoams = 0;
+  unsigned long _lastOutage = 0;
+  unsigned long _maxOutage = 0;
+};
@@ -19,16 +19,38 @@
 
 /* Libraries *******************************************************************************************************/
 
+#include <Announcement.h>
 #include <Arduino.h>
-#include <PubSubClient.h>
+#include <Config.h>
+#include <DnsCache.h>
+#include <HeapHealth.h>
+#include <MaintenanceReboot.h>
+#include <MqttBroker.h>
+#include <MqttClient.h>
+#include <MqttServerList.h>
+#include <MqttSnClient.h>
+#include <StatusCache.h>
+#include <Telemetry.h>
+#include <TimingStats.h>
+#include <Trace.h>
+#include <Transport.h>
 #include <WiFi.h>
 #include <WiFiClientSecure.h>
+#include <WiFiUdp.h>
+#include <WifiCache.h>
+#include <WifiPower.h>
+#include <WifiRoaming.h>
+#include <esp_timer.h>
 
 /* Configuration - change to fit your needs *************************************************************************/
 
 // WiFi connection options
 #define WIFI_SSID "boxlab.lazyhorse.net" // WiFi network SSID
 #define WIFI_PASS "IHaveHorsePower!"     // WiFi network password
+// #define WIFI_OTHER_NETWORKS {"boxlab2.lazyhorse.net", "IHaveHorsePower!"} // Other known networks - uncomment to use
+#define WIFI_POWER_PROFILE WIFI_POWER_PERFORMANCE // WIFI_POWER_PERFORMANCE, WIFI_POWER_BALANCED or WIFI_POWER_LOW (battery)
+// WIFI_POWER_LOW is meant for slaves powered from USB battery: the CPU sleeps between loop iterations, status change is
+// delayed by up to 3 beacon intervals (~310 ms) plus LOOP_SLEEP, so it's shown within 0.5 s on typical network
 
 // MQTT connection options
 #define MQTT_SERVER "mqtt.boxlab.lazyhorse.net" // MQTT server address
@@ -39,184 +61,1061 @@
 #define MQTT_TOPIC_STATUS "onair/status"        // MQTT topic for status change messages
 #define MQTT_TOPIC_ARRIVE "onair/arrive"        // MQTT topic for arrival messages (when device connects)
 #define MQTT_TOPIC_DEPART "onair/depart"        // MQTT topic for departure messages (when device disconnects)
+#define MQTT_TOPIC_CONFIG "onair/config"        // MQTT topic for runtime configuration (see below) - remove to disable
+#define MQTT_TOPIC_HEALTH "onair/health"        // MQTT topic for heap health metrics - remove to disable
+#define MQTT_TOPIC_MAINTENANCE "onair/maintenance" // MQTT topic for coordination of maintenance reboots - remove to disable
+#define MQTT_TOPIC_BOOT "onair/boot"            // MQTT topic for boot time profile - remove to disable
+#define MQTT_TOPIC_METRICS "onair/metrics"      // MQTT topic for timing histograms (with TIMING_STATS) - remove to disable
+#define MQTT_TOPIC_TELEMETRY "onair/telemetry/" // MQTT topic prefix for CBOR telemetry, MAC address is appended - remove to disable
+#define MQTT_TOPIC_TRACE "onair/trace"          // MQTT topic for trace requests (with TRACE), trace is sent to subtopic with MAC address - remove to disable
 #define MQTT_RECONNECT_DELAY 30000              // ms; delay between reconnection attempts
+#define MQTT_PERSISTENT_SESSION                 // Remove to use clean session (status messages sent while offline are lost)
+#define MQTT_SESSION_EXPIRY 86400               // s; how long the server keeps persistent session (MQTT 5 only)
+
+// MQTT failover options - other MQTT servers with the same configuration, used when MQTT_SERVER fails or is slower
+// #define MQTT_FAILOVER_SERVERS {"mqtt2.boxlab.lazyhorse.net", 8883}, {"mqtt3.boxlab.lazyhorse.net", 8883} // Uncomment to use
+
+// Announcement options - master announces status directly to slaves, bypassing the MQTT server
+// To use them, set your own ANNOUNCEMENT_KEY and uncomment MULTICAST_GROUP and/or ESPNOW_BACKUP on all boxes
+// #define ANNOUNCEMENT_KEY "..."              // Shared key used to sign announcements, must be same for all devices
+// #define MULTICAST_GROUP 239, 255, 42, 42    // Uncomment to enable LAN fast path (multicast group address)
+#define MULTICAST_PORT 4242                    // LAN multicast UDP port
+
+// ESP-NOW backup options - announcements are also broadcast over ESP-NOW, which works without access point
+// To use it, set the access point to a fixed channel and uncomment ESPNOW_BACKUP on all boxes
+// #define ESPNOW_BACKUP    // Uncomment to enable ESP-NOW backup channel
+#define ESPNOW_CHANNEL 1 // WiFi channel of the access point, used by ESP-NOW
+
+// Embedded broker options - one box runs its own MQTT server and the other boxes connect to it directly
+// To use it, uncomment EMBEDDED_BROKER_PORT on that box, remove MQTT_SERVER_TLS on all boxes and set MQTT_SERVER to
+// "127.0.0.1" on that box and to its address on the other boxes, MQTT_PORT must be the same as EMBEDDED_BROKER_PORT
+// #define EMBEDDED_BROKER_PORT 1883 // Embedded MQTT server port
+
+// MQTT-SN options - device talks MQTT-SN over UDP to a gateway instead of MQTT over TCP/TLS to MQTT_SERVER
+// The gateway (see Gateway folder) connects to the MQTT server on behalf of the devices
+// #define MQTT_SN_GATEWAY "192.168.1.10" // MQTT-SN gateway address - uncomment to use MQTT-SN
+#define MQTT_SN_PORT 1885                 // MQTT-SN gateway UDP port
+
+// Runtime configuration - settings above and operational parameters below (except pins and sizes) can be changed
+// without reflashing by retained message to MQTT_TOPIC_CONFIG, containing lines in form KEY=value, e.g. LED_TTL=20000
+// Settings not mentioned in the message have the default value defined here, empty message restores all defaults
+// Changed WiFi or MQTT settings are reverted when the connection with them does not succeed in 3 minutes
+// Maximum message size is 512 bytes over MQTT (MQTT_BUFFER_SIZE) and the embedded broker (MQTT_BROKER_MAX_RETAINED_LENGTH),
+// 128 bytes over MQTT-SN (MQTT_SN_BUFFER_SIZE)
 
 /* Internal configuration - do not change unless you know what you are doing *****************************************/
 
 // Operational parameters
-#define LED_PIN LED_BUILTIN      // LED pin - use built-in LED
-#define LED_INTERVAL 1000        // ms; LED blink interval
-#define LED_TTL 30000            // ms; repeat interval for "on air" messages
-#define LED_TIMEOUT 70000        // ms; timeout after which the LED is turned off, if no message is received, must be greater than LED_TTL
-#define BUTTON_PIN 33            // Button pin
-#define BUTTON_DEBOUNCE 50       // ms; button debounce time
-#define REBOOT_INTERVAL 97200000 // ms; preventive reboot interval (27 hours)
-#define WIFI_TIMEOUT 60000       // ms; device will reboot when it cannot connect to WiFi for this time
-#define LOOP_SLEEP 100           // ms; loop sleep time
+#define LED_PIN LED_BUILTIN         // LED pin - use built-in LED
+#define LED_INTERVAL 1000           // ms; LED blink interval
+#define LED_TTL 30000               // ms; repeat interval for "on air" messages
+#define LED_TIMEOUT 70000           // ms; timeout after which the LED is turned off, if no message is received, must be greater than LED_TTL
+#define BUTTON_PIN 33               // Button pin
+#define BUTTON_DEBOUNCE 50          // ms; button debounce time
+// #define REBOOT_INTERVAL 97200000 // ms; preventive reboot interval (27 hours) - not needed, heap health is watched
+// Each device adds its own offset up to REBOOT_SPREAD (4 hours) and reboots only after it's off air for a while
+#define WIFI_TIMEOUT 60000          // ms; device will reboot (or retry with ESP-NOW backup) when it cannot connect to WiFi for this time
+#define LOOP_SLEEP 100              // ms; loop sleep time
+#define MQTT_INFLIGHT_SIZE 4        // number of unacknowledged QoS 1 status messages kept for retransmission
+#define ANNOUNCEMENT_REPEAT 2       // number of copies of each status change announcement (duplicates are discarded by slaves)
+#define ANNOUNCEMENT_HEARTBEAT 5000 // ms; interval of repeating current status in announcements
+#define ANNOUNCEMENT_TIMEOUT 15000  // ms; announcements are considered lost when none is received for this time
+#define BROKER_STATS_INTERVAL 60000 // ms; interval of printing embedded broker statistics
+#define SERVER_STATS_INTERVAL 300000 // ms; interval of printing MQTT server statistics (with failover servers)
+#define LATENCY_STATS_INTERVAL 300000 // ms; interval of printing WiFi power profile and MQTT ping latency
+#define SERIAL_SPEED 115200           // Serial port speed - printing at low speed delays the boot, must match monitor_speed
+#define HEAP_HEALTH_INTERVAL 300000   // ms; interval of printing and publishing heap health (device restarts only when it's bad)
+// #define TIMING_STATS               // Measure duration of loop and its parts - uncomment to enable
+#define TIMING_STATS_INTERVAL 300000  // ms; interval of printing and publishing timing histograms
+// #define TRACE                      // Record events to RAM for timeline export, requested by MQTT or "t" on serial port - uncomment to enable
+#define TRACE_CHUNK 8                 // number of events per trace message and serial line (MQTT-SN datagram has at most 128 bytes)
+#define TRACE_CHUNKS_PER_LOOP 4       // number of trace chunks sent in one loop, so sending does not block the loop
+// #define CAPTURE                    // Record external inputs for replay in Simulator (with TRACE), requested like trace with "c" - uncomment to enable
+#define CAPTURE_CLOCK_INTERVAL 1800000 // ms; interval of clock events in capture, must be less than 71 minutes (wraparound of event time)
+#define TELEMETRY_INTERVAL 60000      // ms; interval of publishing changed telemetry (all fields every TELEMETRY_KEYFRAME intervals)
+
+// With MQTT 5, "on air" status is retained and expires at the server when the master stops refreshing it
+#define MQTT_STATUS_EXPIRY (config.get().ledTimeout / 1000) // s; message expiry interval of "on air" status message
+
+// Removed options are disabled, runtime configuration can enable them
+#ifndef REBOOT_INTERVAL
+#define REBOOT_INTERVAL 0
+#endif
+#ifndef LOOP_SLEEP
+#define LOOP_SLEEP 0
+#endif
+
+#if defined(EMBEDDED_BROKER_PORT) && defined(MQTT_SERVER_TLS)
+#error "Embedded broker does not support TLS, remove MQTT_SERVER_TLS"
+#endif
+
+#if defined(ESPNOW_BACKUP) && WIFI_POWER_PROFILE != WIFI_POWER_PERFORMANCE
+#error "ESP-NOW backup needs the radio always on, use WIFI_POWER_PERFORMANCE"
+#endif
+
+#if defined(MQTT_FAILOVER_SERVERS) && defined(MQTT_SN_GATEWAY)
+#error "MQTT-SN gateway does not support failover servers, remove MQTT_FAILOVER_SERVERS"
+#endif
+
+// Address the MQTT client connects to - either MQTT server (current one from the list) or MQTT-SN gateway
+#if defined(MQTT_SN_GATEWAY)
+#define MQTT_CONNECT_HOST MQTT_SN_GATEWAY
+#define MQTT_CONNECT_PORT MQTT_SN_PORT
+#elif defined(MQTT_FAILOVER_SERVERS)
+#define MQTT_CONNECT_HOST mqttServerList.current().host
+#define MQTT_CONNECT_PORT mqttServerList.current().port
+#else
+#define MQTT_CONNECT_HOST config.get().mqttServer
+#define MQTT_CONNECT_PORT config.get().mqttPort
+#endif
+
+// MQTT client and its transport are selected at compile time, the rest of the program works with any of them
+#if defined(MQTT_SN_GATEWAY)
+typedef MqttSnClient<UdpTransport> StatusClient; // MQTT-SN over UDP
+#elif defined(MQTT_SERVER_TLS)
+typedef MqttClient<TlsTransport> StatusClient; // MQTT over TLS
+#else
+typedef MqttClient<TcpTransport> StatusClient; // MQTT over TCP
+#endif
+
+// Without cached access point, WiFi scans only the ESP-NOW channel, so announcements are received while reconnecting
+#ifdef ESPNOW_BACKUP
+#define WIFI_SCAN_CHANNEL ESPNOW_CHANNEL
+#else
+#define WIFI_SCAN_CHANNEL 0 // all channels
+#endif
+
+// Announcements are used when at least one announcement channel is enabled
+#if defined(MULTICAST_GROUP) || defined(ESPNOW_BACKUP)
+#define ANNOUNCEMENTS
+#ifndef ANNOUNCEMENT_KEY
+#error Announcements need ANNOUNCEMENT_KEY, use your own random key, anyone who knows it can switch the LEDs
+#endif
+#endif
+
+#ifdef MQTT_PERSISTENT_SESSION
+#define MQTT_CLEAN_SESSION false
+#else
+#define MQTT_CLEAN_SESSION true
+#endif
 
 /* Global variables *************************************************************************************************/
-#ifdef MQTT_SERVER_TLS
-WiFiClientSecure wifiClient; // WiFi client with TLS
+StatusClient mqttClient; // MQTT client instance
+Config config;           // Runtime configuration, changed by MQTT message
+DnsCache dnsCache;       // Cached MQTT server addresses, kept over software restarts
+WifiCache wifiCache;     // Cached WiFi access point and address, kept over software restarts
+StatusCache statusCache; // Last received on-air status, kept over software restarts
+MaintenanceReboot maintenanceReboot; // Schedules preventive reboots, so devices do not reboot all at once
+WifiPower wifiPower;     // WiFi power saving profile
+uint32_t lastMessageReceived = 0;     // Last message received millis (used to detect mqtt timeout)
+uint32_t lastLedToggle = 0;           // Last LED toggle millis (used to blink LED)
+uint32_t lastMessageSent = 0;         // Last message sent millis (used to prevent mqtt timeout)
+uint32_t lastWifiConnection = 0;      // Last WiFi connection start millis (used to detect connection timeout)
+uint32_t lastMqttConnection = 0;      // Last MQTT connection attempt millis (used to delay reconnection)
+uint32_t lastLatencyStats = 0;        // Last latency statistics print millis
+uint32_t lastBusyTime = 0;            // ms; CPU busy time at last latency statistics print
+uint32_t lastHeapHealth = 0;          // Last heap health report millis
+uint32_t lastTimingStats = 0;         // Last timing histograms report millis
+String clientId;                      // MQTT client ID (MAC address)
+bool isOnAir = false;                 // On-Air status
+bool lastLedState = false;            // Last LED blink state (used to toggle LED)
+int ledLevel = LOW;                   // Current LED level (used to record changes)
+bool lastButtonState = false;         // Last button press state (used to toggle state)
+bool firstWiFiConnection = true;      // First WiFi connection flag
+bool firstMqttConnection = true;      // First MQTT connection flag
+bool wifiConnecting = false;          // WiFi connection in progress flag
+bool wifiScanning = false;            // Scan for the strongest access point in progress (before connecting)
+bool statusRestored = false;          // On-air status was restored after restart and no message confirmed it yet
+int configChanges = CONFIG_UNCHANGED; // Changes of runtime configuration waiting for reconnection
+
+// Default settings, when not changed by runtime configuration
+const Settings defaultSettings = {
+    WIFI_SSID, WIFI_PASS,
+    MQTT_SERVER, MQTT_PORT, MQTT_USERNAME, MQTT_PASSWORD, MQTT_TOPIC_STATUS, MQTT_TOPIC_ARRIVE, MQTT_TOPIC_DEPART,
+    MQTT_RECONNECT_DELAY,
+    LED_INTERVAL, LED_TTL, LED_TIMEOUT, REBOOT_INTERVAL, WIFI_TIMEOUT, LOOP_SLEEP, ANNOUNCEMENT_HEARTBEAT, ANNOUNCEMENT_TIMEOUT};
+
+// The first network and MQTT server are set by runtime configuration
+#ifdef WIFI_OTHER_NETWORKS
+WifiNetwork wifiNetworks[] = {{WIFI_SSID, WIFI_PASS}, WIFI_OTHER_NETWORKS}; // All known WiFi networks
+#else
+WifiNetwork wifiNetworks[] = {{WIFI_SSID, WIFI_PASS}}; // All known WiFi networks
+#endif
+WifiRoaming wifiRoaming(wifiNetworks, sizeof(wifiNetworks) / sizeof(wifiNetworks[0]), WIFI_SCAN_CHANNEL); // Finds the strongest access point
+
+// Boot phases, time since reset is recorded when each of them is reached for the first time
+#define BOOT_SETUP 0     // setup() started
+#define BOOT_WIFI 1      // Associated with access point
+#define BOOT_IP 2        // Got IP address
+#define BOOT_TRANSPORT 3 // Connected to MQTT server (including TLS handshake)
+#define BOOT_CONNACK 4   // MQTT server accepted the connection
+#define BOOT_LED 5       // LED shows known status
+#define BOOT_PHASES 6
+const char *const bootPhaseNames[BOOT_PHASES] = {"setup", "wifi", "ip", "transport", "connack", "led"};
+volatile unsigned long bootPhases[BOOT_PHASES]; // ms; time since reset, 0 until reached
+bool bootProfileReported = false;               // Boot profile was published
+
+// Subsystems with measured heap use, a leak shows up as steadily growing use of one of them
+#define SUBSYSTEM_WIFI 0
+#define SUBSYSTEM_MQTT 1
+#define SUBSYSTEM_ANNOUNCEMENTS 2
+#define SUBSYSTEM_BROKER 3
+#define SUBSYSTEM_FAILOVER 4
+const char *const subsystems[] = {"WiFi", "MQTT", "announcements", "broker", "failover"};
+HeapHealth heapHealth(subsystems, sizeof(subsystems) / sizeof(subsystems[0])); // Heap measurement
+
+// Telemetry fields, which are keys of the CBOR map; a field is published when it changes by more than its threshold
+#define TELEMETRY_RSSI 0             // dBm; WiFi signal strength
+#define TELEMETRY_WIFI_CONNECTS 1    // Number of WiFi associations since boot
+#define TELEMETRY_MQTT_CONNECTS 2    // Number of MQTT connections since boot
+#define TELEMETRY_FREE_HEAP 3        // bytes
+#define TELEMETRY_LARGEST_BLOCK 4    // bytes; largest free heap block
+#define TELEMETRY_UPTIME 5           // s
+#define TELEMETRY_PUBLISH_FAILURES 6 // Number of messages which could not be published since boot
+#define TELEMETRY_ON_AIR 7           // 1 when on air
+const int32_t telemetryThresholds[] = {4, 0, 0, 4096, 4096, 3600, 0, 0};
+Telemetry telemetry(telemetryThresholds, sizeof(telemetryThresholds) / sizeof(telemetryThresholds[0])); // Changed device metrics
+char telemetryTopic[40];                 // Telemetry topic of this device
+uint32_t lastTelemetry = 0;              // Last telemetry publish millis
+volatile uint32_t wifiConnects = 0;      // Number of WiFi associations since boot
+uint32_t mqttConnects = 0;               // Number of MQTT connections since boot
+
+// Code regions with measured duration, measurement is left out when TIMING_STATS is not defined
+#define REGION_LOOP 0          // Whole loop without sleep
+#define REGION_CONNECT 1       // Ensuring MQTT connection, including blocking TLS handshake
+#define REGION_MQTT 2          // Handling MQTT messages, including callbacks
+#define REGION_CALLBACK 3      // Processing single received MQTT message
+#define REGION_ANNOUNCEMENTS 4 // Handling announcements
+#ifdef TIMING_STATS
+const char *const regions[] = {"loop", "connect", "mqtt", "callback", "announcements"};
+TimingStats timingStats(regions, sizeof(regions) / sizeof(regions[0])); // Timing histograms
+#define TIMING_START(region) timingStats.start(region)
+#define TIMING_STOP(region) timingStats.stop(region)
+#else
+#define TIMING_START(region)
+#define TIMING_STOP(region)
+#endif
+
+// Event trace, events are left out when TRACE is not defined
+#ifdef TRACE
+Trace trace;                   // Recorded events
+char traceTopic[40];           // Trace topic of this device
+uint32_t traceSequence = 0;    // Next event to send
+uint32_t traceEnd = 0;         // Event after the last one to send
+bool traceSending = false;     // Trace was requested and is being sent
+Trace *traceSource = &trace;   // Trace or capture being sent
+#define TRACE_EVENT(type, arg, value) trace.record(type, arg, value)
 #else
-WiFiClient wifiClient; // WiFi client without TLS
-#endif
-PubSubClient mqttClient(wifiClient);   // MQTT client instance
-unsigned long lastMessageReceived = 0; // Last message received millis (used to detect mqtt timeout)
-unsigned long lastLedToggle = 0;       // Last LED toggle millis (used to blink LED)
-unsigned long lastMessageSent = 0;     // Last message sent millis (used to prevent mqtt timeout)
-unsigned long lastWifiConnection = 0;  // Last WiFi connection start millis (used to detect connection timeout)
-bool isOnAir = false;                  // On-Air status
-bool lastLedState = false;             // Last LED blink state (used to toggle LED)
-bool lastButtonState = false;          // Last button press state (used to toggle state)
-bool firstWiFiConnection = true;       // First WiFi connection flag
-bool firstMqttConnection = true;       // First MQTT connection flag
+#define TRACE_EVENT(type, arg, value)
+#endif
+
+// Capture of external inputs - button, WiFi events and MQTT messages, they are enough to replay the device behavior
+#if defined(TRACE) && defined(CAPTURE)
+Trace capture;                 // Recorded inputs
+uint32_t lastCaptureClock = 0; // Last clock event millis
+#define CAPTURE_EVENT(type, arg, value) capture.record(type, arg, value)
+#else
+#define CAPTURE_EVENT(type, arg, value)
+#endif
+
+// Unacknowledged QoS 1 status message
+struct InflightMessage
+{
+  uint16_t packetId; // MQTT packet identifier, 0 when the slot is free
+  char payload;      // Status payload ('0' or '1')
+  uint32_t lastSent; // Last (re)transmission millis, used by MQTT-SN
+};
+InflightMessage inflightMessages[MQTT_INFLIGHT_SIZE]; // Status messages waiting for PUBACK
+char lastStatusSent = 0;                              // Last status published by this box, 0 when none
+
+#ifdef ANNOUNCEMENTS
+AnnouncementFilter announcementFilter; // Discards repeated and old announcements from all channels
+uint32_t announcementBoot = 0;         // Boot number of this box, sent with announcements
+uint32_t announcementSequence = 0;     // Sequence number of last sent announcement
+uint32_t lastAnnouncementSent = 0;     // Last announcement sent millis (used to send heartbeats)
+uint32_t lastAnnouncementReceived = 0; // Last valid announcement received millis (used to detect lost master)
+#endif
+#ifdef MULTICAST_GROUP
+AnnouncementChannel<MulticastTransport> multicastChannel(ANNOUNCEMENT_KEY); // LAN fast path
+#endif
+#ifdef ESPNOW_BACKUP
+AnnouncementChannel<EspNowTransport> espNowChannel(ANNOUNCEMENT_KEY); // ESP-NOW backup channel
+#endif
+
+#ifdef MQTT_FAILOVER_SERVERS
+MqttServer mqttServers[] = {{MQTT_SERVER, MQTT_PORT}, MQTT_FAILOVER_SERVERS};             // All MQTT servers
+MqttServerList mqttServerList(mqttServers, sizeof(mqttServers) / sizeof(mqttServers[0])); // Chooses MQTT server
+bool mqttFailoverDone = false;                                                            // Last connection failure was already handled
+uint32_t lastServerStats = 0;                                                             // Last server statistics print millis
+#endif
+
+#ifdef EMBEDDED_BROKER_PORT
+MqttBroker mqttBroker(EMBEDDED_BROKER_PORT); // Embedded MQTT server
+uint32_t lastBrokerStats = 0;                // Last broker statistics print millis
+#endif
 
 /* Helper methods ***************************************************************************************************/
 
-// This method ensures that the device is connected to WiFi
-void ensureWifiConnected()
+// This method returns ms since boot, unlike millis() it does not wrap around after 49.7 days
+// Intervals are measured by subtracting millis() values, which works over the wraparound
+uint64_t uptime()
 {
-  // If we are already connected, do nothing
-  if (WiFi.status() == WL_CONNECTED)
+  return esp_timer_get_time() / 1000;
+}
+
+// This method points the first known WiFi network and MQTT server to active settings, which have changed
+void applyNetworkSettings()
+{
+  wifiNetworks[0].ssid = config.get().wifiSsid;
+  wifiNetworks[0].password = config.get().wifiPass;
+#ifdef MQTT_FAILOVER_SERVERS
+  mqttServers[0].host = config.get().mqttServer;
+  mqttServers[0].port = config.get().mqttPort;
+#endif
+}
+
+// This method records the time when boot phase is reached for the first time
+void bootPhase(int phase)
+{
+  if (bootPhases[phase] == 0)
+    bootPhases[phase] = millis();
+}
+
+// This method is called by WiFi library when associated with access point, before DHCP
+void wifiAssociated(arduino_event_id_t event)
+{
+  bootPhase(BOOT_WIFI);
+  wifiConnects++;
+}
+
+// This method sets LED level, changes are recorded in trace
+void setLed(int level)
+{
+  if (level != ledLevel)
+  {
+    ledLevel = level;
+    TRACE_EVENT(TRACE_LED, 0, level);
+  }
+  digitalWrite(LED_PIN, level);
+}
+
+#ifdef TRACE
+// This method is called by WiFi library on connection changes, which are recorded in trace and capture
+void traceWifiEvent(arduino_event_id_t event)
+{
+  uint8_t traced;
+  switch (event)
+  {
+  case ARDUINO_EVENT_WIFI_STA_CONNECTED:
+    traced = TRACE_WIFI_CONNECTED;
+    break;
+  case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+    traced = TRACE_WIFI_DISCONNECTED;
+    break;
+  case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+    traced = TRACE_WIFI_GOT_IP;
+    break;
+  case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+    traced = TRACE_WIFI_LOST_IP;
+    break;
+  default:
+    return;
+  }
+  TRACE_EVENT(TRACE_WIFI, traced, 0);
+  CAPTURE_EVENT(TRACE_WIFI, traced, 0);
+}
+
+#ifdef BUTTON_PIN
+// This method is called from interrupt on button edges, before debouncing, so the trace shows the real press time
+void IRAM_ATTR traceButtonEdge()
+{
+  int level = digitalRead(BUTTON_PIN);
+  TRACE_EVENT(TRACE_GPIO, BUTTON_PIN, level);
+  CAPTURE_EVENT(TRACE_GPIO, BUTTON_PIN, level);
+}
+#endif
+#endif
+
+// This method prints and publishes times of boot phases, once the LED shows known status and MQTT is connected
+// MQTT-SN fails the first message to a topic while the topic is being registered, so it's tried again in next loop
+void reportBootProfile()
+{
+  if (bootProfileReported || bootPhases[BOOT_LED] == 0 || !mqttClient.connected())
+    return;
+  char payload[112];
+  int length = snprintf(payload, sizeof(payload), "%s", clientId.c_str());
+  for (int i = 0; i < BOOT_PHASES && length < (int)sizeof(payload); i++)
+    length += snprintf(payload + length, sizeof(payload) - length, " %s=%lu", bootPhaseNames[i], bootPhases[i]);
+#ifdef MQTT_TOPIC_BOOT
+  if (!mqttClient.publish(MQTT_TOPIC_BOOT, payload))
     return;
+#endif
+  bootProfileReported = true;
+  Serial.printf("Boot profile (ms since reset): %s\n", payload);
+}
 
-  // Turn LED ON
-  digitalWrite(LED_PIN, HIGH);
+// This method starts connecting to WiFi - to cached access point, or to the strongest one found by scan
+void startWifiConnection()
+{
+  const WifiNetwork *network = wifiRoaming.find(wifiCache.ssid());
+  if (network != NULL)
+  {
+    Serial.printf("%s...", network->ssid);
+    wifiCache.connect(network->ssid, network->password, WIFI_SCAN_CHANNEL);
+    return;
+  }
 
-  // Connect to WiFi
-  if (firstWiFiConnection)
+  // Connection is started when scan finishes, if the scan does not start, WiFi library scans for the first network
+  wifiScanning = wifiRoaming.scan();
+  if (!wifiScanning)
   {
-    Serial.print("Connecting to " WIFI_SSID "...");
+    Serial.printf("%s...", wifiNetworks[0].ssid);
+    wifiCache.connect(wifiNetworks[0].ssid, wifiNetworks[0].password, WIFI_SCAN_CHANNEL);
   }
-  else
+}
+
+// This method continues connecting to WiFi when the scan for the strongest access point finishes
+void finishWifiScan()
+{
+  WifiAccessPoint accessPoint;
+  int result = wifiRoaming.scanResult(accessPoint);
+  if (result == ROAMING_SCAN_RUNNING)
+    return;
+  wifiScanning = false;
+  if (result == ROAMING_SCAN_FOUND)
   {
-    Serial.print("Reconnecting to " WIFI_SSID "...");
+    Serial.printf("%s (%d dBm)...", accessPoint.network->ssid, accessPoint.rssi);
+    wifiCache.connectTo(accessPoint.network->ssid, accessPoint.network->password, accessPoint.channel, accessPoint.bssid);
   }
-  firstWiFiConnection = false;
-  WiFi.begin(WIFI_SSID, WIFI_PASS);
-  lastWifiConnection = millis();
-  while (WiFi.status() != WL_CONNECTED)
+  else
   {
-    delay(500);
-    Serial.print(".");
+    // Access point may be hidden or missed by the scan, so let WiFi library try
+    Serial.printf("%s...", wifiNetworks[0].ssid);
+    wifiCache.connect(wifiNetworks[0].ssid, wifiNetworks[0].password, WIFI_SCAN_CHANNEL);
+  }
+}
 
-    // If we cannot connect to WiFi for a long time, reboot
-    if (millis() - lastWifiConnection > WIFI_TIMEOUT)
+// This method ensures that the device is connected to WiFi, returns true when connected
+// The connection is established in background, so the loop keeps running (and receiving announcements) meanwhile
+bool ensureWifiConnected()
+{
+  if (WiFi.status() != WL_CONNECTED || wifiRoaming.leaving())
+  {
+    // Wait for connection in progress
+    if (wifiConnecting)
     {
+      if (wifiScanning)
+        finishWifiScan();
+
+      // Known access point does not answer, scan the network (the overall timeout keeps running)
+      if (wifiCache.timedOut())
+      {
+        Serial.print("Failed, scanning...");
+        wifiCache.failed();
+        wifiRoaming.roamFailed();
+        startWifiConnection();
+        return false;
+      }
+      if (millis() - lastWifiConnection < config.get().wifiTimeout)
+        return false;
+#ifdef ESPNOW_BACKUP
+      // ESP-NOW keeps working without access point, so try again instead of rebooting
+      Serial.println("Failed!");
+      WiFi.disconnect();
+      wifiScanning = false;
+      wifiRoaming.roamFailed();
+#else
+      // If we cannot connect to WiFi for a long time, reboot
       Serial.println("\nWiFi connection timeout, rebooting...");
       ESP.restart();
+#endif
     }
+
+    // Turn LED ON
+    setLed(HIGH);
+
+    // Connect to WiFi
+    if (firstWiFiConnection)
+    {
+      Serial.print("Connecting to WiFi ");
+    }
+    else
+    {
+      Serial.print("Reconnecting to WiFi ");
+    }
+    firstWiFiConnection = false;
+    lastWifiConnection = millis();
+    wifiConnecting = true;
+    startWifiConnection();
+    return false;
   }
-  Serial.println("OK");
+
+  // If we are already connected, do nothing
+  if (!wifiConnecting)
+    return true;
+  wifiConnecting = false;
+  wifiCache.connected();
+  Serial.printf("OK, %s connection in %lu ms\n", wifiCache.fast() ? "fast" : "full", (unsigned long)(millis() - lastWifiConnection));
   Serial.print("IP: ");
-  Serial.println(WiFi.localIP().toString());
+  Serial.print(WiFi.localIP().toString());
+  Serial.println(wifiCache.reusedAddress() ? " (reused)" : "");
+  if (bootPhases[BOOT_IP] == 0)
+  {
+    bootPhase(BOOT_IP);
+    Serial.printf("WiFi connected %lu ms after boot\n", bootPhases[BOOT_IP]);
+  }
+  if (wifiRoaming.roaming())
+  {
+    // Reconnect to MQTT server right away, the connection did not survive the change of access point
+    wifiRoaming.roamFinished();
+    Serial.printf("Roaming outage %lu ms (%u roams, %u failed, longest outage %lu ms)\n",
+                  wifiRoaming.lastOutage(), wifiRoaming.roams(), wifiRoaming.failedRoams(), wifiRoaming.maxOutage());
+    lastMqttConnection = millis() - config.get().mqttReconnectDelay;
+  }
+
+#ifdef MULTICAST_GROUP
+  // Join multicast group again, membership does not survive reconnection
+  Serial.printf("Joining multicast group on port %d...", MULTICAST_PORT);
+  Serial.println(multicastChannel.transport().open(IPAddress(MULTICAST_GROUP), MULTICAST_PORT) ? "OK" : "Failed!");
+#endif
+
+#ifdef EMBEDDED_BROKER_PORT
+  // Start embedded MQTT server, does nothing if it's already running
+  mqttBroker.begin();
+  Serial.printf("Embedded MQTT server listening on %s:%d\n", WiFi.localIP().toString().c_str(), EMBEDDED_BROKER_PORT);
+#endif
+  return true;
 }
 
-// This method ensures that the device is connected to WiFi and MQTT server
-void ensureMqttConnected()
+// This method sets the on-air status received from master
+void applyStatus(bool onAir, const char *source)
 {
-  while (mqttClient.state() != MQTT_CONNECTED)
+  // Start blinking immediately
+  if (onAir && !isOnAir)
+    lastLedToggle = millis() - config.get().ledInterval - 1;
+  isOnAir = onAir;
+  lastMessageReceived = millis();
+  TRACE_EVENT(TRACE_STATUS, 0, onAir);
+  statusRestored = false;
+  statusCache.received(onAir);
+  if (onAir)
   {
-    // First, ensure we are connected to WiFi
-    ensureWifiConnected();
+    Serial.printf("On-Air status set to ON for %u ms (%s)\n", config.get().ledTimeout, source);
+  }
+  else
+  {
+    Serial.printf("On-Air status set to OFF (%s)\n", source);
+  }
+}
 
-    // Turn LED on
-    digitalWrite(LED_PIN, HIGH);
+#ifdef ANNOUNCEMENTS
+// This method announces status directly to slaves over all announcement channels
+// Each copy has the same sequence number on all channels, so slaves keep only the copy which arrives first
+// MQTT remains the reliable path, so failures here are only reported
+// Multicast is skipped while WiFi is down, only ESP-NOW works without access point
+void announceStatus(bool onAir, int copies)
+{
+  Announcement announcement = {onAir, announcementBoot, 0};
+  lastAnnouncementSent = millis();
+  for (int i = 0; i < copies; i++)
+  {
+    announcement.sequence = ++announcementSequence;
+#ifdef MULTICAST_GROUP
+    if (WiFi.status() == WL_CONNECTED && !multicastChannel.send(announcement))
+      Serial.println("Multicast announcement failed!");
+#endif
+#ifdef ESPNOW_BACKUP
+    if (!espNowChannel.send(announcement))
+      Serial.println("ESP-NOW announcement failed!");
+#endif
+  }
+}
 
-    // If it's not first connection attempt, print the current state and wait for a while
-    if (!firstMqttConnection)
+// This method processes announcements received from master over single channel
+template <class Transport>
+void receiveAnnouncements(AnnouncementChannel<Transport> &channel, const char *source)
+{
+  Announcement announcement;
+  int result;
+  while ((result = channel.receive(&announcement)) != ANNOUNCEMENT_NONE)
+  {
+    if (result == ANNOUNCEMENT_INVALID)
     {
-      switch (mqttClient.state())
-      {
-      case MQTT_CONNECTION_TIMEOUT:
-        Serial.println("MQTT connection state: timeout (server didn't respond)");
-        break;
-      case MQTT_CONNECTION_LOST:
-        Serial.println("MQTT connection state: connection lost (server disconnected)");
-        break;
-      case MQTT_CONNECT_FAILED:
-        Serial.println("MQTT connection state: connection failed (server didn't accept the connection)");
-        break;
-      case MQTT_DISCONNECTED:
-        Serial.println("MQTT connection state: disconnected");
-        break;
-      case MQTT_CONNECT_BAD_PROTOCOL:
-        Serial.println("MQTT connection state: bad protocol (unsupoorted version)");
-        break;
-      case MQTT_CONNECT_BAD_CLIENT_ID:
-        Serial.println("MQTT connection state: bad client ID (server rejected client ID)");
-        break;
-      case MQTT_CONNECT_UNAVAILABLE:
-        Serial.println("MQTT connection state: unavailable (server was unable to accept connection)");
-        break;
-      case MQTT_CONNECT_BAD_CREDENTIALS:
-        Serial.println("MQTT connection state: bad credentials");
-        break;
-      case MQTT_CONNECT_UNAUTHORIZED:
-        Serial.println("MQTT connection state: unauthorized");
-        break;
-      default:
-        Serial.printf("MQTT connection state: %d (unknown)\n", mqttClient.state());
-        break;
-      }
-      Serial.printf("Waiting %d ms before next connection attempt...\n", MQTT_RECONNECT_DELAY);
-      delay(MQTT_RECONNECT_DELAY);
+      Serial.printf("Invalid announcement received (%s)\n", source);
+      continue;
     }
-    firstMqttConnection = false;
+    if (!announcementFilter.accept(announcement))
+      continue;
+    lastAnnouncementReceived = millis();
+    statusCache.accepted(announcement.boot, announcement.sequence);
 
-    // Connect to MQTT server
-    Serial.printf("Connecting to %s:%d...", MQTT_SERVER, MQTT_PORT);
-    auto clientId = WiFi.macAddress();
-    mqttClient.setServer(MQTT_SERVER, MQTT_PORT);
-    if (mqttClient.connect(clientId.c_str(), MQTT_USERNAME, MQTT_PASSWORD, MQTT_TOPIC_DEPART, 0, false, clientId.c_str()))
+    // Heartbeat with unchanged status only extends its validity
+    if (announcement.onAir == isOnAir)
+    {
+      lastMessageReceived = millis();
+      statusCache.received(isOnAir);
+    }
+    else
     {
-      Serial.println("OK");
+      applyStatus(announcement.onAir, source);
+    }
+  }
+}
 
-      // Send a message that we have arrived
-      Serial.printf("Publishing to topic %s...", MQTT_TOPIC_ARRIVE);
-      if (mqttClient.publish(MQTT_TOPIC_ARRIVE, clientId.c_str()))
-      {
-        Serial.println("OK");
-      }
-      else
-      {
-        Serial.println("Failed!");
-      }
+// This method processes announcements received from master over all channels
+void receiveAnnouncements()
+{
+#ifdef MULTICAST_GROUP
+  receiveAnnouncements(multicastChannel, "LAN");
+#endif
+#ifdef ESPNOW_BACKUP
+  receiveAnnouncements(espNowChannel, "ESP-NOW");
+#endif
+}
+#endif
 
-      // Subscribe to chat topic
-      Serial.printf("Subscribing to topic %s...", MQTT_TOPIC_STATUS);
-      if (mqttClient.subscribe(MQTT_TOPIC_STATUS))
-      {
-        Serial.println("OK");
-      }
-      else
-      {
-        Serial.println("Failed!");
-      }
+// This method writes QoS 1 status message to the MQTT server
+// With MQTT 5 the status is retained and "on air" status expires, so it never outlives the master
+bool sendStatusPacket(const InflightMessage &message, bool dup)
+{
+  bool retain = mqttClient.protocolVersion() == MQTT_VERSION_5;
+  uint32_t expiry = message.payload == '1' ? MQTT_STATUS_EXPIRY : 0;
+  TRACE_EVENT(TRACE_MQTT_OUT, MQTT_PUBLISH >> 4, message.packetId);
+  return mqttClient.publish(config.get().mqttTopicStatus, (const uint8_t *)&message.payload, 1, retain, 1, message.packetId, dup, expiry);
+}
+
+// This method publishes status message with QoS 1 and keeps it until it's acknowledged by server
+bool publishStatus(char payload)
+{
+  lastStatusSent = payload;
+
+  // Suppress duplicates: if the newest message in flight carries the same status, it will be retransmitted anyway
+  InflightMessage *newest = NULL;
+  InflightMessage *slot = NULL;
+  for (int i = 0; i < MQTT_INFLIGHT_SIZE; i++)
+  {
+    InflightMessage *message = &inflightMessages[i];
+    if (message->packetId == 0)
+    {
+      if (slot == NULL)
+        slot = message;
+      continue;
     }
-    else
+    if (newest == NULL || (uint16_t)(message->packetId - newest->packetId) < 0x8000)
+      newest = message;
+  }
+  if (newest != NULL && newest->payload == payload)
+    return true;
+
+  // When table is full, drop the oldest message - it was superseded by newer status anyway
+  if (slot == NULL)
+  {
+    slot = &inflightMessages[0];
+    for (int i = 1; i < MQTT_INFLIGHT_SIZE; i++)
     {
-      // Connection failed
-      Serial.println("Failed!");
+      if ((uint16_t)(inflightMessages[i].packetId - slot->packetId) >= 0x8000)
+        slot = &inflightMessages[i];
     }
   }
+
+  // Packet identifier comes from the client, SUBSCRIBE sent on the same connection uses the same counter
+  slot->packetId = mqttClient.nextPacketId();
+  slot->payload = payload;
+  slot->lastSent = millis();
+  return sendStatusPacket(*slot, false);
 }
 
-// This method is called when a message is received from MQTT
-void mqttCallback(char *topic, byte *payload, unsigned int length)
+// This method retransmits status messages which were not acknowledged, when the session is resumed after reconnection
+// MQTT forbids resending while the connection is up (MQTT-4.4.0-1), TCP delivers the packet or the connection fails;
+// MQTT-SN datagrams get lost silently, so they are repeated after MQTT_SN_RETRY_INTERVAL too (force is false)
+// Slots are reused, so their order says nothing; messages are resent in packet identifier order and a late message
+// takes all newer ones with it, so the newest status always arrives last and slaves never end with a stale one
+void retransmitStatusMessages(bool force)
 {
+  // Sort pending messages by packet identifier, which grows with each message (with wraparound)
+  InflightMessage *pending[MQTT_INFLIGHT_SIZE];
+  int count = 0;
+  for (int i = 0; i < MQTT_INFLIGHT_SIZE; i++)
+  {
+    InflightMessage *message = &inflightMessages[i];
+    if (message->packetId == 0)
+      continue;
+    int j = count++;
+    for (; j > 0 && (uint16_t)(pending[j - 1]->packetId - message->packetId) < 0x8000; j--)
+      pending[j] = pending[j - 1];
+    pending[j] = message;
+  }
+
+  bool resend = force;
+  for (int i = 0; i < count; i++)
+  {
+    InflightMessage *message = pending[i];
+#ifdef MQTT_SN_GATEWAY
+    resend = resend || millis() - message->lastSent > MQTT_SN_RETRY_INTERVAL;
+#endif
+    if (!resend)
+      continue;
+    Serial.printf("Retransmitting status message %u...", message->packetId);
+    message->lastSent = millis();
+    Serial.println(sendStatusPacket(*message, true) ? "OK" : "Failed!");
+  }
+}
+
+// This method is called when the server acknowledges QoS 1 status message
+void mqttAckCallback(uint16_t packetId)
+{
+  TRACE_EVENT(TRACE_MQTT_IN, MQTT_PUBACK >> 4, packetId);
+  for (int i = 0; i < MQTT_INFLIGHT_SIZE; i++)
+  {
+    if (inflightMessages[i].packetId == packetId)
+      inflightMessages[i].packetId = 0;
+  }
+}
+
+// This method ensures that the device is connected to WiFi and MQTT server
+// The connection is established asynchronously, so the rest of the loop keeps running in the meantime
+void ensureMqttConnected()
+{
+  // If we are connected or waiting for server to accept the connection, do nothing
+  if (mqttClient.connected() || mqttClient.state() == MQTT_CONNECTING)
+    return;
+
+  // First, ensure we are connected to WiFi
+  if (!ensureWifiConnected())
+    return;
+
+  // Turn LED on
+  setLed(HIGH);
+
+  // If it's not first connection attempt, wait for a while and print the current state
+  if (!firstMqttConnection)
+  {
+#ifdef MQTT_FAILOVER_SERVERS
+    // Right after failure, move to another healthy server and connect to it without waiting
+    if (!mqttFailoverDone)
+    {
+      mqttFailoverDone = true;
+      mqttServerList.disconnected();
+      if (mqttServerList.failover())
+        lastMqttConnection = millis() - config.get().mqttReconnectDelay;
+    }
+#endif
+    if (millis() - lastMqttConnection < config.get().mqttReconnectDelay)
+      return;
+    switch (mqttClient.state())
+    {
+    case MQTT_CONNECTION_TIMEOUT:
+      Serial.println("MQTT connection state: timeout (server didn't respond)");
+      break;
+    case MQTT_CONNECTION_LOST:
+      Serial.println("MQTT connection state: connection lost (server disconnected)");
+      break;
+    case MQTT_CONNECT_FAILED:
+      Serial.println("MQTT connection state: connection failed (server didn't accept the connection)");
+      break;
+    case MQTT_DISCONNECTED:
+      Serial.println("MQTT connection state: disconnected");
+      break;
+    case MQTT_CONNECT_BAD_PROTOCOL:
+      Serial.println("MQTT connection state: bad protocol (unsupoorted version)");
+      break;
+    case MQTT_CONNECT_BAD_CLIENT_ID:
+      Serial.println("MQTT connection state: bad client ID (server rejected client ID)");
+      break;
+    case MQTT_CONNECT_UNAVAILABLE:
+      Serial.println("MQTT connection state: unavailable (server was unable to accept connection)");
+      break;
+    case MQTT_CONNECT_BAD_CREDENTIALS:
+      Serial.println("MQTT connection state: bad credentials");
+      break;
+    case MQTT_CONNECT_UNAUTHORIZED:
+      Serial.println("MQTT connection state: unauthorized");
+      break;
+    default:
+      Serial.printf("MQTT connection state: %d (unknown)\n", mqttClient.state());
+      break;
+    }
+  }
+  firstMqttConnection = false;
+  lastMqttConnection = millis();
+#ifdef MQTT_FAILOVER_SERVERS
+  mqttFailoverDone = false;
+#endif
+
+  // Connect to MQTT server
+  Serial.printf("Connecting to %s:%d...", MQTT_CONNECT_HOST, MQTT_CONNECT_PORT);
+  clientId = WiFi.macAddress();
+#if defined(TRACE) && defined(MQTT_TOPIC_TRACE)
+  snprintf(traceTopic, sizeof(traceTopic), "%s/%s", MQTT_TOPIC_TRACE, clientId.c_str());
+#endif
+#ifdef MQTT_TOPIC_TELEMETRY
+  snprintf(telemetryTopic, sizeof(telemetryTopic), "%s%s", MQTT_TOPIC_TELEMETRY, clientId.c_str());
+#endif
+  IPAddress address;
+  if (dnsCache.resolve(MQTT_CONNECT_HOST, address))
+  {
+    // Use cached address, so there is no DNS query
+    mqttClient.setServer(MQTT_CONNECT_HOST, address, MQTT_CONNECT_PORT);
+  }
+  else
+  {
+    // Let the client try to resolve the name itself
+    mqttClient.setServer(MQTT_CONNECT_HOST, MQTT_CONNECT_PORT);
+  }
+  const Settings &settings = config.get();
+  TRACE_EVENT(TRACE_MQTT_OUT, MQTT_CONNECT >> 4, 0);
+  if (mqttClient.connect(clientId.c_str(), settings.mqttUsername, settings.mqttPassword, settings.mqttTopicDepart, 0, false, clientId.c_str(), MQTT_CLEAN_SESSION))
+  {
+    bootPhase(BOOT_TRANSPORT);
+    Serial.println("OK, waiting for server");
+  }
+  else
+  {
+    // Connection failed
+    Serial.println("Failed!");
+  }
+}
+
+// This method is called when MQTT server accepts the connection
+void mqttConnectCallback()
+{
+  bootPhase(BOOT_CONNACK);
+  mqttConnects++;
+  TRACE_EVENT(TRACE_MQTT_IN, MQTT_CONNACK >> 4, 0);
+#ifdef MQTT_FAILOVER_SERVERS
+  mqttServerList.connected();
+#endif
+
+  switch (mqttClient.protocolVersion())
+  {
+  case MQTT_VERSION_5:
+    Serial.println("Connected to MQTT server (MQTT 5)");
+    break;
+  case MQTT_VERSION_3_1_1:
+    Serial.println("Connected to MQTT server (MQTT 3.1.1)");
+    break;
+  default:
+    Serial.println("Connected to MQTT-SN gateway");
+    break;
+  }
+
+  // Changed connection settings work, keep them - unless this connection was started before they were changed
+  uint32_t changedAgo = millis() - config.pendingSince();
+  bool wifiChanged = config.pending() & CONFIG_CHANGED_WIFI;
+  if (config.pending() != CONFIG_UNCHANGED && millis() - lastMqttConnection <= changedAgo &&
+      (!wifiChanged || millis() - lastWifiConnection <= changedAgo))
+  {
+    config.confirm();
+    Serial.println("Changed configuration confirmed");
+  }
+
+  // Send a message that we have arrived
+  Serial.printf("Publishing to topic %s...", config.get().mqttTopicArrive);
+  if (mqttClient.publish(config.get().mqttTopicArrive, clientId.c_str()))
+  {
+    Serial.println("OK");
+  }
+  else
+  {
+    Serial.println("Failed!");
+  }
+
+  // Subscribe to chat topic
+  Serial.printf("Subscribing to topic %s...", config.get().mqttTopicStatus);
+  if (mqttClient.subscribe(config.get().mqttTopicStatus, 1))
+  {
+    Serial.println("OK");
+  }
+  else
+  {
+    Serial.println("Failed!");
+  }
+
+#ifdef MQTT_TOPIC_MAINTENANCE
+  // Subscribe to maintenance topic
+  Serial.printf("Subscribing to topic %s...", MQTT_TOPIC_MAINTENANCE);
+  if (mqttClient.subscribe(MQTT_TOPIC_MAINTENANCE, 0))
+  {
+    Serial.println("OK");
+  }
+  else
+  {
+    Serial.println("Failed!");
+  }
+#endif
+
+#if defined(TRACE) && defined(MQTT_TOPIC_TRACE)
+  // Subscribe to trace requests
+  Serial.printf("Subscribing to topic %s...", MQTT_TOPIC_TRACE);
+  if (mqttClient.subscribe(MQTT_TOPIC_TRACE, 0))
+  {
+    Serial.println("OK");
+  }
+  else
+  {
+    Serial.println("Failed!");
+  }
+#endif
+
+#ifdef MQTT_TOPIC_CONFIG
+  // Subscribe to configuration topic, the retained configuration is delivered right away
+  Serial.printf("Subscribing to topic %s...", MQTT_TOPIC_CONFIG);
+  if (mqttClient.subscribe(MQTT_TOPIC_CONFIG, 1))
+  {
+    Serial.println("OK");
+  }
+  else
+  {
+    Serial.println("Failed!");
+  }
+#endif
+
+  // Resend status messages which were not acknowledged before the connection was lost
+  retransmitStatusMessages(true);
+
+  // Publish all telemetry right away, messages published while disconnected were lost
+  telemetry.reset();
+  lastTelemetry = millis() - TELEMETRY_INTERVAL;
+}
+
+#ifdef MQTT_TOPIC_CONFIG
+// This method applies runtime configuration, reconnection with changed connection settings is done in the loop
+void applyConfig(const char *message, size_t length)
+{
+  Serial.print("Applying configuration...");
+  int changes = config.update(message, length);
+  if (changes == CONFIG_INVALID)
+  {
+    Serial.printf("Failed! %s\n", config.error());
+    return;
+  }
+  if (changes == CONFIG_UNCHANGED)
+  {
+    Serial.println("OK, unchanged");
+    return;
+  }
+  Serial.println("OK");
+  applyNetworkSettings();
+  configChanges |= changes;
+}
+#endif
+
+#ifdef TRACE
+// This method starts sending events recorded so far or captured inputs, they are sent by sendTrace() a few chunks at a time
+void requestTrace(bool inputs)
+{
+#ifdef CAPTURE
+  traceSource = inputs ? &capture : &trace;
+#else
+  if (inputs)
+    return;
+#endif
+  traceSequence = traceSource->first();
+  traceEnd = traceSource->next();
+  traceSending = true;
+  Serial.printf("Sending %s of %u events\n", inputs ? "capture" : "trace", traceEnd - traceSequence);
+}
+
+// This method prints recorded events in hex and publishes them in binary, TRACE_CHUNK events per line and message
+void sendTrace()
+{
+  for (int i = 0; i < TRACE_CHUNKS_PER_LOOP && traceSending; i++)
+  {
+    TraceEvent events[TRACE_CHUNK];
+    size_t count = traceSequence < traceEnd ? traceSource->read(traceSequence, events, min((uint32_t)TRACE_CHUNK, traceEnd - traceSequence)) : 0;
+    if (count == 0)
+    {
+      traceSending = false;
+      Serial.println("Trace sent");
+      return;
+    }
+
+    // Events are little endian in memory, so they are sent as they are
+    char line[TRACE_CHUNK * sizeof(TraceEvent) * 2 + 1];
+    const uint8_t *bytes = (const uint8_t *)events;
+    for (size_t j = 0; j < count * sizeof(TraceEvent); j++)
+      snprintf(line + j * 2, 3, "%02x", bytes[j]);
+    Serial.printf("Trace: %s\n", line);
+#ifdef MQTT_TOPIC_TRACE
+    if (mqttClient.connected())
+      mqttClient.publish(traceTopic, bytes, count * sizeof(TraceEvent));
+#endif
+  }
+}
+#endif
+
+#if defined(TRACE) && defined(CAPTURE)
+// This method records received message to capture, topic is recorded as TRACE_TOPIC_* code to save space
+void captureMessage(const char *topic, const uint8_t *payload, unsigned int length)
+{
+  uint8_t code = TRACE_TOPIC_OTHER;
+  if (strcmp(topic, config.get().mqttTopicStatus) == 0)
+    code = TRACE_TOPIC_STATUS;
+#ifdef MQTT_TOPIC_CONFIG
+  else if (strcmp(topic, MQTT_TOPIC_CONFIG) == 0)
+    code = TRACE_TOPIC_CONFIG;
+#endif
+#ifdef MQTT_TOPIC_MAINTENANCE
+  else if (strcmp(topic, MQTT_TOPIC_MAINTENANCE) == 0)
+    code = TRACE_TOPIC_MAINTENANCE;
+#endif
+#ifdef MQTT_TOPIC_TRACE
+  // Requests for trace are not inputs of the device
+  else if (strcmp(topic, MQTT_TOPIC_TRACE) == 0)
+    return;
+#endif
+  // Configuration carries WiFi and MQTT passwords, which must not leave the device in a capture
+  if (code == TRACE_TOPIC_CONFIG)
+    capture.record(TRACE_MESSAGE, code, length);
+  else
+    capture.record(TRACE_MESSAGE, code, payload, length);
+}
+#endif
+
+// This method processes a message received from MQTT
+void processMessage(char *topic, byte *payload, unsigned int length)
+{
+#ifdef MQTT_TOPIC_CONFIG
+  if (strcmp(topic, MQTT_TOPIC_CONFIG) == 0)
+  {
+    applyConfig((const char *)payload, length);
+    return;
+  }
+#endif
+#if defined(TRACE) && defined(MQTT_TOPIC_TRACE)
+  if (strcmp(topic, MQTT_TOPIC_TRACE) == 0)
+  {
+    // Trace is requested from this device by its MAC address, or from all devices by "*", "capture " prefix requests inputs
+    bool inputs = length > 8 && memcmp(payload, "capture ", 8) == 0;
+    if (inputs)
+    {
+      payload += 8;
+      length -= 8;
+    }
+    if ((length == 1 && payload[0] == '*') || (length == clientId.length() && memcmp(payload, clientId.c_str(), length) == 0))
+      requestTrace(inputs);
+    return;
+  }
+#endif
+#ifdef MQTT_TOPIC_MAINTENANCE
+  if (strcmp(topic, MQTT_TOPIC_MAINTENANCE) == 0)
+  {
+    // Other device is rebooting, this one waits when too many devices reboot at the same time
+    Serial.printf("Device %.*s is rebooting for maintenance\n", (int)length, (const char *)payload);
+    if (length != clientId.length() || memcmp(payload, clientId.c_str(), length) != 0)
+      maintenanceReboot.announced();
+    return;
+  }
+#endif
+
   // Process message
   if (length == 1 && payload[0] == '1')
   {
-    isOnAir = true;
-    lastMessageReceived = millis();
-    Serial.printf("On-Air status set to ON for %i ms\n", LED_TIMEOUT);
+    applyStatus(true, "MQTT");
   }
   else if (length == 1 && payload[0] == '0')
   {
-    isOnAir = false;
-    lastMessageReceived = millis();
-    Serial.println("On-Air status set to OFF");
+    applyStatus(false, "MQTT");
   }
   else
   {
@@ -230,14 +1129,96 @@ void mqttCallback(char *topic, byte *payload, unsigned int length)
   }
 }
 
+// This method prints heap health and publishes it, so it's known whether the device needs to be restarted
+// Published uptime and maintenance reboot time (0 when disabled) are in seconds
+void reportHeapHealth()
+{
+  Serial.printf("Heap %s: free %u B (lowest %u B), largest block %u B, fragmentation %u%%\n", heapHealth.statusName(),
+                heapHealth.freeHeap(), heapHealth.minimumFree(), heapHealth.largestBlock(), heapHealth.fragmentation());
+  for (size_t i = 0; i < heapHealth.count(); i++)
+  {
+    const HeapSubsystem &stats = heapHealth.subsystem(i);
+    if (stats.calls > 0)
+      Serial.printf("Heap use of %s: %d B (grew in %u of %u calls)\n", heapHealth.name(i), stats.used, stats.growths, stats.calls);
+  }
+
+#ifdef MQTT_TOPIC_HEALTH
+  if (!mqttClient.connected())
+    return;
+  char payload[112];
+  snprintf(payload, sizeof(payload), "%s free=%u lowest=%u block=%u frag=%u uptime=%lu reboot=%lu", clientId.c_str(), heapHealth.freeHeap(),
+           heapHealth.minimumFree(), heapHealth.largestBlock(), heapHealth.fragmentation(), (unsigned long)(uptime() / 1000),
+           (unsigned long)(maintenanceReboot.due(config.get().rebootInterval) / 1000));
+  Serial.printf("Publishing to topic %s...", MQTT_TOPIC_HEALTH);
+  Serial.println(mqttClient.publish(MQTT_TOPIC_HEALTH, payload) ? "OK" : "Failed!");
+#endif
+}
+
+// This method is called when a message is received from MQTT
+void mqttCallback(char *topic, byte *payload, unsigned int length)
+{
+  TRACE_EVENT(TRACE_MQTT_IN, MQTT_PUBLISH >> 4, length);
+#if defined(TRACE) && defined(CAPTURE)
+  captureMessage(topic, payload, length);
+#endif
+  TIMING_START(REGION_CALLBACK);
+  processMessage(topic, payload, length);
+  TIMING_STOP(REGION_CALLBACK);
+}
+
+#ifdef TIMING_STATS
+// This method prints and publishes timing histograms of the last interval, one message per region
+void reportTimingStats()
+{
+  for (size_t i = 0; i < timingStats.count(); i++)
+  {
+    char payload[112];
+    size_t length = snprintf(payload, sizeof(payload), "%s ", clientId.c_str());
+    if (timingStats.encode(i, payload + length, sizeof(payload) - length) == 0)
+      continue;
+    Serial.printf("Timing: %s\n", payload);
+#ifdef MQTT_TOPIC_METRICS
+    if (mqttClient.connected() && !mqttClient.publish(MQTT_TOPIC_METRICS, payload))
+      Serial.printf("Publishing to topic %s failed!\n", MQTT_TOPIC_METRICS);
+#endif
+  }
+  timingStats.reset();
+}
+#endif
+
+#ifdef MQTT_TOPIC_TELEMETRY
+// This method publishes telemetry fields, which changed since they were last published
+void reportTelemetry()
+{
+  telemetry.set(TELEMETRY_RSSI, WiFi.RSSI());
+  telemetry.set(TELEMETRY_WIFI_CONNECTS, wifiConnects);
+  telemetry.set(TELEMETRY_MQTT_CONNECTS, mqttConnects);
+  telemetry.set(TELEMETRY_FREE_HEAP, heapHealth.freeHeap());
+  telemetry.set(TELEMETRY_LARGEST_BLOCK, heapHealth.largestBlock());
+  telemetry.set(TELEMETRY_UPTIME, uptime() / 1000);
+  telemetry.set(TELEMETRY_PUBLISH_FAILURES, mqttClient.publishFailures());
+  telemetry.set(TELEMETRY_ON_AIR, isOnAir);
+
+  uint8_t payload[64];
+  size_t length = telemetry.encode(payload, sizeof(payload));
+  if (length == 0)
+    return;
+  if (mqttClient.publish(telemetryTopic, payload, length))
+    telemetry.sent();
+  else
+    Serial.printf("Publishing to topic %s failed!\n", telemetryTopic);
+}
+#endif
+
 /* Main program *****************************************************************************************************/
 
 // This method is called once at the beginning of the program
 void setup()
 {
+  bootPhase(BOOT_SETUP);
+
   // Initialize serial port
-  Serial.begin(9600);
-  delay(500);
+  Serial.begin(SERIAL_SPEED);
   Serial.println();
   Serial.println();
 #ifdef BUTTON_PIN
@@ -248,38 +1229,183 @@ void setup()
 
   // Initialize LED pin and turn LED ON
   pinMode(LED_PIN, OUTPUT);
-  digitalWrite(LED_PIN, HIGH);
+  setLed(HIGH);
 
 #ifdef BUTTON_PIN
   // Initialize button pin, if defined
   pinMode(BUTTON_PIN, INPUT_PULLUP);
   // Set last button state to inverse of current state to force initial state change
   lastButtonState = !digitalRead(BUTTON_PIN);
+#ifdef TRACE
+  attachInterrupt(BUTTON_PIN, traceButtonEdge, CHANGE);
+#endif
+#endif
+
+#if defined(ANNOUNCEMENTS) && defined(BUTTON_PIN)
+  // Announcements from this boot must be newer than all announcements from previous boots, even recorded ones;
+  // only master with button sends them, slaves do not count boots, so they don't wear the flash by NVS commits
+  announcementBoot = nextAnnouncementBoot();
+  if (announcementBoot == 0)
+    Serial.println("Boot number not saved, slaves will ignore announcements until they restart!");
+#endif
+
+  // Load runtime configuration, it may change WiFi and MQTT settings
+  Serial.print("Loading configuration...");
+  if (config.begin(defaultSettings))
+    Serial.println("OK");
+  else
+    Serial.printf("defaults used (%s)\n", config.error()[0] != 0 ? config.error() : "none stored");
+  applyNetworkSettings();
+
+  // Restore on-air status, so the LED does not go dark after restart until the next message arrives
+  if (statusCache.begin() && statusCache.onAir() && statusCache.age() < config.get().ledTimeout)
+  {
+    isOnAir = true;
+    statusRestored = true;
+    lastMessageReceived = millis() - (unsigned long)statusCache.age();
+    Serial.printf("On-Air status restored, received %lu ms ago\n", (unsigned long)statusCache.age());
+  }
+#ifdef ANNOUNCEMENTS
+  // Announcements accepted before restart must not be accepted again
+  Announcement announcement = {false, 0, 0};
+  if (statusCache.announcement(announcement.boot, announcement.sequence))
+    announcementFilter.accept(announcement);
+#endif
+
+  // Set WiFi power saving before connecting, it trades latency of incoming messages for power consumption
+  Serial.print("Setting WiFi power profile...");
+  wifiPower.holdPin(LED_PIN);
+  bool powerProfileApplied = wifiPower.begin(WIFI_POWER_PROFILE);
+  Serial.printf("%s, %s\n", powerProfileApplied ? "OK" : "Failed!", wifiPower.name());
+
+#ifdef ESPNOW_BACKUP
+  // Start ESP-NOW, it needs WiFi in station mode, but not connection to access point
+  WiFi.mode(WIFI_STA);
+  Serial.printf("Starting ESP-NOW on channel %d...", ESPNOW_CHANNEL);
+  Serial.println(espNowChannel.transport().open(ESPNOW_CHANNEL) ? "OK" : "Failed!");
+#endif
+
+  // Start connecting to WiFi right away, the rest of initialization runs while associating with access point
+  if (wifiCache.begin())
+    Serial.println("Using cached WiFi access point");
+  WiFi.onEvent(wifiAssociated, ARDUINO_EVENT_WIFI_STA_CONNECTED);
+#ifdef TRACE
+  WiFi.onEvent(traceWifiEvent, ARDUINO_EVENT_WIFI_STA_CONNECTED);
+  WiFi.onEvent(traceWifiEvent, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+  WiFi.onEvent(traceWifiEvent, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+  WiFi.onEvent(traceWifiEvent, ARDUINO_EVENT_WIFI_STA_LOST_IP);
 #endif
+  ensureWifiConnected();
+  Serial.println();
 
-#ifdef MQTT_SERVER_TLS
+#if defined(MQTT_SERVER_TLS) && !defined(MQTT_SN_GATEWAY)
   // Disable TLS server certificate verification
-  wifiClient.setInsecure();
+  mqttClient.transport().setInsecure();
+#endif
+
+  // Restore DNS cache, it survives software restarts
+  Serial.printf("Restored %u cached DNS entries\n", (unsigned)dnsCache.begin());
+
+  // Schedule maintenance reboot, each device has its own time
+  maintenanceReboot.begin(WiFi.macAddress().c_str());
+  if (config.get().rebootInterval != 0)
+    Serial.printf("Maintenance reboot after %lu s of uptime\n", (unsigned long)(maintenanceReboot.due(config.get().rebootInterval) / 1000));
+#ifdef MQTT_FAILOVER_SERVERS
+  mqttServerList.setDnsCache(&dnsCache);
 #endif
 
-  // Set MQTT client callback
+  // Set MQTT client callbacks
   mqttClient.setCallback(mqttCallback);
+  mqttClient.setAckCallback(mqttAckCallback);
+  mqttClient.setConnectCallback(mqttConnectCallback);
+#ifdef MQTT_PERSISTENT_SESSION
+  mqttClient.setSessionExpiry(MQTT_SESSION_EXPIRY);
+#endif
 }
 
 // This method is called repeatedly in an endless loop
 void loop()
 {
-#ifdef REBOOT_INTERVAL
-  // Reboot every REBOOT_INTERVAL ms if defined, unless currently on air
-  if (!isOnAir && millis() > REBOOT_INTERVAL)
+  // In low power profile, the CPU runs at full speed only while processing the loop
+  wifiPower.busy();
+  TRACE_EVENT(TRACE_LOOP_BEGIN, 0, 0);
+  TIMING_START(REGION_LOOP);
+
+  // Reboot after REBOOT_INTERVAL ms (plus offset of this device) if set, when off air and few other devices reboot
+  if (maintenanceReboot.check(config.get().rebootInterval, uptime(), isOnAir))
+  {
+    Serial.println("Rebooting for maintenance...");
+#ifdef MQTT_TOPIC_MAINTENANCE
+    // Tell other devices, so they wait until this one reconnects
+    if (mqttClient.connected())
+      mqttClient.publish(MQTT_TOPIC_MAINTENANCE, clientId.c_str());
+#endif
+    // Reboot is a real departure, subscribers see it from the will
+    mqttClient.disconnect(true);
+    ESP.restart();
+  }
+
+  // Reboot when heap stays low or fragmented, unless currently on air
+  heapHealth.loop();
+  if (!isOnAir && heapHealth.restartNeeded())
   {
-    Serial.println("Rebooting...");
+    Serial.printf("Heap is %s (free %u B, largest block %u B), rebooting...\n", heapHealth.statusName(), heapHealth.freeHeap(), heapHealth.largestBlock());
     ESP.restart();
   }
-#endif
+  if (millis() - lastHeapHealth > HEAP_HEALTH_INTERVAL)
+  {
+    lastHeapHealth = millis();
+    reportHeapHealth();
+  }
+
+  // Revert changed connection settings, which did not connect in time
+  if (config.pending() != CONFIG_UNCHANGED && millis() - config.pendingSince() > CONFIG_ROLLBACK_TIMEOUT)
+  {
+    Serial.println("Connection with changed configuration failed, reverting it");
+    configChanges |= config.rollback();
+    applyNetworkSettings();
+  }
+
+  // Reconnect with changed connection settings
+  if (configChanges & CONFIG_CHANGED_WIFI)
+  {
+    Serial.println("WiFi configuration changed, reconnecting");
+    wifiCache.failed();
+    wifiScanning = false;
+    wifiConnecting = false;
+    mqttClient.disconnect();
+  }
+  else if (configChanges & CONFIG_CHANGED_MQTT)
+  {
+    Serial.println("MQTT configuration changed, reconnecting");
+    mqttClient.disconnect();
+    lastMqttConnection = millis() - config.get().mqttReconnectDelay;
+  }
+  configChanges = CONFIG_UNCHANGED;
+
+  // Roam to stronger access point before the connection is lost
+  heapHealth.enter(SUBSYSTEM_WIFI);
+  WifiAccessPoint accessPoint;
+  if (!wifiConnecting && wifiRoaming.loop(accessPoint))
+  {
+    Serial.printf("WiFi signal is weak (%d dBm), roaming to %s (%d dBm)...", wifiRoaming.rssi(), accessPoint.network->ssid, accessPoint.rssi);
+    wifiRoaming.roamStarted(accessPoint);
+    wifiCache.connectTo(accessPoint.network->ssid, accessPoint.network->password, accessPoint.channel, accessPoint.bssid);
+    lastWifiConnection = millis();
+    wifiConnecting = true;
+  }
+
+  // Finish WiFi connection in progress, even when MQTT client has not noticed the interruption yet
+  if (wifiConnecting)
+    ensureWifiConnected();
+  heapHealth.leave(SUBSYSTEM_WIFI);
 
   // Ensure MQTT connection
+  heapHealth.enter(SUBSYSTEM_MQTT);
+  TIMING_START(REGION_CONNECT);
   ensureMqttConnected();
+  TIMING_STOP(REGION_CONNECT);
+  heapHealth.leave(SUBSYSTEM_MQTT);
 
 #ifdef BUTTON_PIN
   // Check for button state, if defined
@@ -293,63 +1419,220 @@ void loop()
       lastButtonState = currentButtonState;
       if (currentButtonState == LOW)
       {
+#ifdef ANNOUNCEMENTS
+        announceStatus(true, ANNOUNCEMENT_REPEAT);
+#endif
         Serial.print("Button pressed, enabling ON AIR mode...");
-        bool result = mqttClient.publish(MQTT_TOPIC_STATUS, "1");
+        bool result = publishStatus('1');
         lastMessageSent = millis();
         Serial.println(result ? "OK" : "Failed!");
       }
       else
       {
+#ifdef ANNOUNCEMENTS
+        announceStatus(false, ANNOUNCEMENT_REPEAT);
+#endif
         Serial.print("Button released, disabling ON AIR mode...");
-        bool result = mqttClient.publish(MQTT_TOPIC_STATUS, "0");
+        bool result = publishStatus('0');
         Serial.println(result ? "OK" : "Failed!");
       }
     }
   }
 
-  // Send message every LED_TTL ms
-  if (isOnAir && millis() - lastMessageSent > LED_TTL)
+  // Send message every LED_TTL ms - unless this box turned the status off, then it's on only until its message comes
+  // back, which may take long while it's disconnected and the refresh would be retransmitted after the off message
+  if (isOnAir && lastStatusSent != '0' && millis() - lastMessageSent > config.get().ledTtl)
   {
     Serial.print("Sending ON AIR message before TTL...");
-    bool result = mqttClient.publish(MQTT_TOPIC_STATUS, "1");
+    bool result = publishStatus('1');
     lastMessageSent = millis();
     Serial.println(result ? "OK" : "Failed!");
   }
+
+#ifdef ANNOUNCEMENTS
+  // Repeat current status, so slaves keep it while MQTT server or access point is down
+  if (millis() - lastAnnouncementSent > config.get().announcementHeartbeat)
+    announceStatus(lastButtonState == LOW, 1);
+#endif
+#endif
+
+#ifdef EMBEDDED_BROKER_PORT
+  // Handle embedded MQTT server clients
+  heapHealth.enter(SUBSYSTEM_BROKER);
+  mqttBroker.loop();
+  heapHealth.leave(SUBSYSTEM_BROKER);
+  if (millis() - lastBrokerStats > BROKER_STATS_INTERVAL)
+  {
+    lastBrokerStats = millis();
+    const MqttBrokerStats &stats = mqttBroker.stats();
+    Serial.printf("Broker: %u clients (max %u, rejected %u), %u published, %u delivered, fan-out %u us (max %u us)\n",
+                  stats.clients, stats.maxClients, stats.rejectedClients, stats.published, stats.delivered, stats.lastFanOut, stats.maxFanOut);
+    if (stats.droppedRetained > 0)
+      Serial.printf("Broker: %u retained messages dropped, too long or too many topics!\n", stats.droppedRetained);
+  }
 #endif
 
+#ifdef MQTT_FAILOVER_SERVERS
+  // Probe MQTT servers and move to another one when it's consistently faster than the current one
+  heapHealth.enter(SUBSYSTEM_FAILOVER);
+  mqttServerList.loop();
+  heapHealth.leave(SUBSYSTEM_FAILOVER);
+  int fasterServer = mqttServerList.fasterServer();
+  if (fasterServer >= 0)
+  {
+    Serial.printf("MQTT server %s is faster, switching to it\n", mqttServerList.server(fasterServer).host);
+    mqttServerList.switchTo(fasterServer);
+    mqttClient.disconnect();
+    mqttFailoverDone = true;
+    lastMqttConnection = millis() - config.get().mqttReconnectDelay;
+  }
+  if (millis() - lastServerStats > SERVER_STATS_INTERVAL)
+  {
+    lastServerStats = millis();
+    for (size_t i = 0; i < mqttServerList.count(); i++)
+    {
+      const MqttServerStats &stats = mqttServerList.stats(i);
+      Serial.printf("MQTT server %s:%d%s: %s, RTT %u us, %u probes, %u connections, connected %lu s\n",
+                    mqttServerList.server(i).host, mqttServerList.server(i).port, i == mqttServerList.currentIndex() ? " (current)" : "",
+                    mqttServerList.healthy(i) ? "up" : "down", stats.rtt, stats.probes, stats.connections, (unsigned long)(mqttServerList.connectedTime(i) / 1000));
+    }
+    Serial.printf("MQTT server failovers: %u\n", mqttServerList.failovers());
+  }
+#endif
+
+  // Ping round trip shows how long incoming messages wait for the radio in current power profile
+  uint32_t latencyStatsAge = millis() - lastLatencyStats;
+  if (latencyStatsAge > LATENCY_STATS_INTERVAL)
+  {
+    lastLatencyStats = millis();
+    const MqttPingStats &stats = mqttClient.pingStats();
+    Serial.printf("WiFi power profile %s: %u pings, RTT %u ms (average %u ms, max %u ms)\n", wifiPower.name(),
+                  stats.count, stats.lastRtt, stats.count > 0 ? stats.totalRtt / stats.count : 0, stats.maxRtt);
+    if (wifiPower.lightSleep())
+    {
+      // Busy time since last print, so the ratio is right also after millis() wraparound
+      Serial.printf("CPU busy %lu%% of time\n", (unsigned long)((wifiPower.busyTime() - lastBusyTime) / (latencyStatsAge / 100)));
+      lastBusyTime = wifiPower.busyTime();
+    }
+  }
+
+  // Refresh cached addresses before they expire, reused WiFi address is renewed only when off air
+  heapHealth.enter(SUBSYSTEM_WIFI);
+  dnsCache.loop();
+  wifiCache.loop(!isOnAir);
+  heapHealth.leave(SUBSYSTEM_WIFI);
+
   // Handle MQTT messages
+  heapHealth.enter(SUBSYSTEM_MQTT);
+  TIMING_START(REGION_MQTT);
   mqttClient.loop();
+#ifdef MQTT_SN_GATEWAY
+  retransmitStatusMessages(false);
+#endif
+  TIMING_STOP(REGION_MQTT);
+  heapHealth.leave(SUBSYSTEM_MQTT);
+
+#ifdef ANNOUNCEMENTS
+  // Handle announcements
+  heapHealth.enter(SUBSYSTEM_ANNOUNCEMENTS);
+  TIMING_START(REGION_ANNOUNCEMENTS);
+  receiveAnnouncements();
+  TIMING_STOP(REGION_ANNOUNCEMENTS);
+  heapHealth.leave(SUBSYSTEM_ANNOUNCEMENTS);
+#endif
 
-  if (isOnAir && millis() - lastMessageReceived > LED_TIMEOUT)
+  if (isOnAir && millis() - lastMessageReceived > config.get().ledTimeout)
   {
     isOnAir = false;
+    statusRestored = false;
+    statusCache.received(false);
     Serial.println("On-Air status set to OFF (timeout)");
   }
 
-  // Check for on-air status
-  if (isOnAir)
+  // Check for on-air status, it's known when connected to MQTT server, receiving announcements or restored
+  bool statusKnown = mqttClient.connected() || statusRestored;
+#ifdef ANNOUNCEMENTS
+  statusKnown = statusKnown || (lastAnnouncementReceived != 0 && millis() - lastAnnouncementReceived < config.get().announcementTimeout);
+#endif
+  if (statusKnown)
+  {
+    bootPhase(BOOT_LED);
+    reportBootProfile();
+  }
+  if (!statusKnown)
+  {
+    // Keep LED on while connecting
+    setLed(HIGH);
+  }
+  else if (isOnAir)
   {
-    if (LED_INTERVAL == 0)
+    if (config.get().ledInterval == 0)
     {
       // Turn on LED
-      digitalWrite(LED_PIN, HIGH);
+      setLed(HIGH);
     }
-    else if (millis() - lastLedToggle > LED_INTERVAL)
+    else if (millis() - lastLedToggle > config.get().ledInterval)
     {
       // Blink LED
       lastLedToggle = millis();
       lastLedState = !lastLedState;
-      digitalWrite(LED_PIN, lastLedState ? HIGH : LOW);
+      setLed(lastLedState ? HIGH : LOW);
     }
   }
   else
   {
     // Turn off LED
-    digitalWrite(LED_PIN, LOW);
+    setLed(LOW);
   }
 
-#ifdef LOOP_SLEEP
+#ifdef MQTT_TOPIC_TELEMETRY
+  if (mqttClient.connected() && millis() - lastTelemetry >= TELEMETRY_INTERVAL)
+  {
+    lastTelemetry = millis();
+    reportTelemetry();
+  }
+#endif
+
+#ifdef TRACE
+  // Send trace requested by MQTT message, or by "t" (trace) or "c" (capture) on serial port
+  if (Serial.available() > 0)
+  {
+    int command = Serial.read();
+    if (command == 't' || command == 'c')
+      requestTrace(command == 'c');
+  }
+  if (traceSending)
+    sendTrace();
+#endif
+#if defined(TRACE) && defined(CAPTURE)
+  if (millis() - lastCaptureClock > CAPTURE_CLOCK_INTERVAL)
+  {
+    lastCaptureClock = millis();
+    capture.record(TRACE_CLOCK);
+  }
+#endif
+
+#ifdef TIMING_STATS
+  if (millis() - lastTimingStats > TIMING_STATS_INTERVAL)
+  {
+    lastTimingStats = millis();
+    reportTimingStats();
+  }
+#endif
+
+  // CPU may sleep from now on, it's woken up by timer at the end of loop sleep or by network traffic
+  TIMING_STOP(REGION_LOOP);
+  TRACE_EVENT(TRACE_LOOP_END, 0, 0);
+  wifiPower.idle();
+
   // Sleep for a while
-  delay(LOOP_SLEEP);
+  if (config.get().loopSleep != 0)
+  {
+#ifdef ESPNOW_BACKUP
+    // Wake up as soon as ESP-NOW frame arrives
+    espNowChannel.transport().wait(config.get().loopSleep);
+#else
+    delay(config.get().loopSleep);
 #endif
+  }
 }
\ No newline at end of file
@@ -0,0 +1,635 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - MQTT-SN gateway                                                                           *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Small transparent MQTT-SN 1.2 gateway for Linux. It listens for MQTT-SN datagrams from the boxes and opens one   *
+ * MQTT 3.1.1 connection to the MQTT server for each of them, so client IDs, clean session and last will behave the *
+ * same as when the boxes connect directly. Supports QoS 0 and 1, REGISTER, SUBSCRIBE, will and keepalive.          *
+ * Connection to the MQTT server is plain TCP; run the gateway next to the server or use a TLS tunnel.              *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Build: g++ -std=c++17 -O2 -o mqttsn-gateway MqttSnGateway.cpp                                                    *
+ * Usage: mqttsn-gateway [-l listen-port] [-s server] [-p server-port] [-u username] [-P password] [-v]             *
+ ********************************************************************************************************************/
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+/* Protocol constants ***********************************************************************************************/
+
+// MQTT-SN message types
+#define SN_CONNECT 0x04
+#define SN_CONNACK 0x05
+#define SN_WILLTOPICREQ 0x06
+#define SN_WILLTOPIC 0x07
+#define SN_WILLMSGREQ 0x08
+#define SN_WILLMSG 0x09
+#define SN_REGISTER 0x0A
+#define SN_REGACK 0x0B
+#define SN_PUBLISH 0x0C
+#define SN_PUBACK 0x0D
+#define SN_SUBSCRIBE 0x12
+#define SN_SUBACK 0x13
+#define SN_PINGREQ 0x16
+#define SN_PINGRESP 0x17
+#define SN_DISCONNECT 0x18
+
+// MQTT-SN flags and return codes
+#define SN_FLAG_RETAIN 0x10
+#define SN_FLAG_WILL 0x08
+#define SN_FLAG_CLEAN_SESSION 0x04
+#define SN_QOS_SHIFT 5
+#define SN_TOPIC_TYPE_MASK 0x03
+#define SN_RC_ACCEPTED 0x00
+#define SN_RC_CONGESTION 0x01
+#define SN_RC_INVALID_TOPIC 0x02
+#define SN_RC_NOT_SUPPORTED 0x03
+
+// MQTT packet types
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_SUBSCRIBE 0x82
+#define MQTT_SUBACK 0x90
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+#define MQTT_DISCONNECT 0xE0
+
+/* Configuration ****************************************************************************************************/
+
+struct Options
+{
+  uint16_t listenPort = 1885;
+  std::string server = "127.0.0.1";
+  uint16_t serverPort = 1883;
+  std::string username;
+  std::string password;
+  bool verbose = false;
+};
+
+static Options options;
+
+/* Clients **********************************************************************************************************/
+
+enum class ClientState
+{
+  WaitingWillTopic, // CONNECT received, WILLTOPICREQ sent
+  WaitingWillMessage, // WILLTOPIC received, WILLMSGREQ sent
+  Connecting, // MQTT CONNECT sent to server, waiting for CONNACK
+  Connected
+};
+
+struct Client
+{
+  sockaddr_in address;
+  std::string name; // Address as text, for logging
+  int socket = -1;  // TCP connection to MQTT server
+  ClientState state = ClientState::Connecting;
+  std::string id;
+  uint8_t flags = 0;
+  uint16_t duration = 0;
+  uint8_t willFlags = 0;
+  std::string willTopic;
+  std::string willMessage;
+  time_t lastActivity = 0;
+  std::vector<uint8_t> received;            // Unprocessed data from MQTT server
+  std::map<uint16_t, std::string> topics;   // Topic ID -> name
+  std::map<std::string, uint16_t> topicIds; // Topic name -> ID
+  std::map<uint16_t, uint16_t> pending;     // Message ID of PUBLISH or SUBSCRIBE -> topic ID, for acknowledgement
+  uint16_t nextTopicId = 1;
+  uint16_t nextMessageId = 1;
+};
+
+static int udpSocket = -1;
+static std::map<std::string, Client> clients;
+
+static std::string addressToString(const sockaddr_in &address)
+{
+  char text[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &address.sin_addr, text, sizeof(text));
+  return std::string(text) + ":" + std::to_string(ntohs(address.sin_port));
+}
+
+static void log(const Client &client, const char *format, const std::string &detail = "")
+{
+  if (!options.verbose)
+    return;
+  printf("%s [%s] ", client.name.c_str(), client.id.c_str());
+  printf(format, detail.c_str());
+  printf("\n");
+  fflush(stdout);
+}
+
+static uint16_t readUint16(const uint8_t *buffer)
+{
+  return (buffer[0] << 8) | buffer[1];
+}
+
+static void appendUint16(std::vector<uint8_t> &packet, uint16_t value)
+{
+  packet.push_back(value >> 8);
+  packet.push_back(value & 0xFF);
+}
+
+static void appendString(std::vector<uint8_t> &packet, const std::string &value)
+{
+  appendUint16(packet, value.size());
+  packet.insert(packet.end(), value.begin(), value.end());
+}
+
+/* Sending **********************************************************************************************************/
+
+static void sendSn(const Client &client, uint8_t type, const std::vector<uint8_t> &body)
+{
+  std::vector<uint8_t> packet;
+  size_t length = body.size() + 2;
+  if (length > 255)
+  {
+    packet.push_back(0x01);
+    appendUint16(packet, length + 2);
+  }
+  else
+  {
+    packet.push_back(length);
+  }
+  packet.push_back(type);
+  packet.insert(packet.end(), body.begin(), body.end());
+  sendto(udpSocket, packet.data(), packet.size(), 0, (const sockaddr *)&client.address, sizeof(client.address));
+}
+
+static bool sendMqtt(const Client &client, uint8_t header, const std::vector<uint8_t> &body)
+{
+  std::vector<uint8_t> packet;
+  packet.push_back(header);
+  size_t remaining = body.size();
+  do
+  {
+    uint8_t digit = remaining & 0x7F;
+    remaining >>= 7;
+    packet.push_back(remaining > 0 ? digit | 0x80 : digit);
+  } while (remaining > 0);
+  packet.insert(packet.end(), body.begin(), body.end());
+  return send(client.socket, packet.data(), packet.size(), MSG_NOSIGNAL) == (ssize_t)packet.size();
+}
+
+static uint16_t topicIdFor(Client &client, const std::string &name)
+{
+  auto found = client.topicIds.find(name);
+  if (found != client.topicIds.end())
+    return found->second;
+  uint16_t id = client.nextTopicId++;
+  client.topics[id] = name;
+  client.topicIds[name] = id;
+  return id;
+}
+
+/* Connection to MQTT server ****************************************************************************************/
+
+static int openServerConnection()
+{
+  addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *result;
+  if (getaddrinfo(options.server.c_str(), std::to_string(options.serverPort).c_str(), &hints, &result) != 0)
+    return -1;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd >= 0 && connect(fd, result->ai_addr, result->ai_addrlen) != 0)
+  {
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+  if (fd >= 0)
+  {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return fd;
+}
+
+static void sendServerConnect(Client &client)
+{
+  client.socket = openServerConnection();
+  if (client.socket < 0)
+  {
+    log(client, "cannot connect to MQTT server%s");
+    sendSn(client, SN_CONNACK, {SN_RC_CONGESTION});
+    return;
+  }
+
+  bool hasWill = client.flags & SN_FLAG_WILL;
+  uint8_t flags = 0;
+  if (client.flags & SN_FLAG_CLEAN_SESSION)
+    flags |= 0x02;
+  if (hasWill)
+    flags |= 0x04 | (((client.willFlags >> SN_QOS_SHIFT) & 0x03) << 3) | (client.willFlags & SN_FLAG_RETAIN ? 0x20 : 0x00);
+  if (!options.username.empty())
+    flags |= 0x80;
+  if (!options.username.empty() && !options.password.empty())
+    flags |= 0x40;
+
+  std::vector<uint8_t> body;
+  appendString(body, "MQTT");
+  body.push_back(4);
+  body.push_back(flags);
+  appendUint16(body, client.duration);
+  appendString(body, client.id);
+  if (hasWill)
+  {
+    appendString(body, client.willTopic);
+    appendString(body, client.willMessage);
+  }
+  if (flags & 0x80)
+    appendString(body, options.username);
+  if (flags & 0x40)
+    appendString(body, options.password);
+  client.state = ClientState::Connecting;
+  sendMqtt(client, MQTT_CONNECT, body);
+}
+
+static void closeClient(Client &client, bool graceful)
+{
+  if (client.socket >= 0)
+  {
+    // Without DISCONNECT the server publishes last will
+    if (graceful)
+      sendMqtt(client, MQTT_DISCONNECT, {});
+    close(client.socket);
+    client.socket = -1;
+  }
+}
+
+/* MQTT-SN packets from clients *************************************************************************************/
+
+static void handleSnPacket(Client &client, uint8_t type, const uint8_t *body, size_t length)
+{
+  switch (type)
+  {
+  case SN_CONNECT:
+  {
+    if (length < 4)
+      return;
+    closeClient(client, false);
+    client.received.clear();
+    client.topics.clear();
+    client.topicIds.clear();
+    client.pending.clear();
+    client.flags = body[0];
+    client.duration = readUint16(body + 2);
+    client.id.assign((const char *)body + 4, length - 4);
+    log(client, "CONNECT%s");
+    if (client.flags & SN_FLAG_WILL)
+    {
+      client.state = ClientState::WaitingWillTopic;
+      sendSn(client, SN_WILLTOPICREQ, {});
+    }
+    else
+    {
+      sendServerConnect(client);
+    }
+    break;
+  }
+  case SN_WILLTOPIC:
+    if (client.state != ClientState::WaitingWillTopic || length < 1)
+      return;
+    client.willFlags = body[0];
+    client.willTopic.assign((const char *)body + 1, length - 1);
+    client.state = ClientState::WaitingWillMessage;
+    sendSn(client, SN_WILLMSGREQ, {});
+    break;
+  case SN_WILLMSG:
+    if (client.state != ClientState::WaitingWillMessage)
+      return;
+    client.willMessage.assign((const char *)body, length);
+    sendServerConnect(client);
+    break;
+  case SN_REGISTER:
+  {
+    if (client.state != ClientState::Connected || length < 4)
+      return;
+    std::string name((const char *)body + 4, length - 4);
+    uint16_t id = topicIdFor(client, name);
+    log(client, "REGISTER %s", name);
+    sendSn(client, SN_REGACK, {(uint8_t)(id >> 8), (uint8_t)(id & 0xFF), body[2], body[3], SN_RC_ACCEPTED});
+    break;
+  }
+  case SN_PUBLISH:
+  {
+    if (client.state != ClientState::Connected || length < 5)
+      return;
+    uint8_t flags = body[0];
+    uint8_t qos = (flags >> SN_QOS_SHIFT) & 0x03;
+    uint16_t topicId = readUint16(body + 1);
+    uint16_t messageId = readUint16(body + 3);
+    auto topic = client.topics.find(topicId);
+    if ((flags & SN_TOPIC_TYPE_MASK) != 0 || topic == client.topics.end() || qos > 1)
+    {
+      sendSn(client, SN_PUBACK, {body[1], body[2], body[3], body[4], (uint8_t)(qos > 1 ? SN_RC_NOT_SUPPORTED : SN_RC_INVALID_TOPIC)});
+      return;
+    }
+    std::vector<uint8_t> packet;
+    appendString(packet, topic->second);
+    if (qos == 1)
+    {
+      appendUint16(packet, messageId);
+      client.pending[messageId] = topicId;
+    }
+    packet.insert(packet.end(), body + 5, body + length);
+    log(client, "PUBLISH %s", topic->second);
+    sendMqtt(client, MQTT_PUBLISH | (qos << 1) | (flags & SN_FLAG_RETAIN ? 0x01 : 0x00) | (flags & 0x80 ? 0x08 : 0x00), packet);
+    break;
+  }
+  case SN_PUBACK:
+    // Client acknowledged message from server
+    if (client.state == ClientState::Connected && length >= 5 && body[4] == SN_RC_ACCEPTED)
+      sendMqtt(client, MQTT_PUBACK, {body[2], body[3]});
+    break;
+  case SN_REGACK:
+    break;
+  case SN_SUBSCRIBE:
+  {
+    if (client.state != ClientState::Connected || length < 3 || (body[0] & SN_TOPIC_TYPE_MASK) != 0)
+      return;
+    uint8_t qos = (body[0] >> SN_QOS_SHIFT) & 0x03;
+    uint16_t messageId = readUint16(body + 1);
+    std::string filter((const char *)body + 3, length - 3);
+
+    // Wildcard filters get topic ID 0, topics are then registered by the gateway before publishing
+    bool wildcard = filter.find_first_of("+#") != std::string::npos;
+    client.pending[messageId] = wildcard ? 0 : topicIdFor(client, filter);
+    std::vector<uint8_t> packet;
+    appendUint16(packet, messageId);
+    appendString(packet, filter);
+    packet.push_back(qos > 1 ? 1 : qos);
+    log(client, "SUBSCRIBE %s", filter);
+    sendMqtt(client, MQTT_SUBSCRIBE, packet);
+    break;
+  }
+  case SN_PINGREQ:
+    // Ping is forwarded, so the answer tells the client that the whole path works
+    if (client.state == ClientState::Connected)
+      sendMqtt(client, MQTT_PINGREQ, {});
+    break;
+  case SN_DISCONNECT:
+    log(client, "DISCONNECT%s");
+    closeClient(client, true);
+    sendSn(client, SN_DISCONNECT, {});
+    break;
+  default:
+    break;
+  }
+}
+
+/* MQTT packets from server *****************************************************************************************/
+
+static void handleMqttPacket(Client &client, uint8_t header, const uint8_t *body, size_t length)
+{
+  switch (header & 0xF0)
+  {
+  case MQTT_CONNACK:
+    if (client.state != ClientState::Connecting || length < 2)
+      return;
+    if (body[1] == 0)
+    {
+      client.state = ClientState::Connected;
+      log(client, "connected%s");
+      sendSn(client, SN_CONNACK, {SN_RC_ACCEPTED});
+    }
+    else
+    {
+      log(client, "rejected by MQTT server%s");
+      closeClient(client, false);
+      sendSn(client, SN_CONNACK, {SN_RC_NOT_SUPPORTED});
+    }
+    break;
+  case MQTT_PUBLISH:
+  {
+    uint8_t qos = (header >> 1) & 0x03;
+    if (length < 2)
+      return;
+    size_t topicLength = readUint16(body);
+    size_t pos = 2 + topicLength;
+    if (pos + (qos > 0 ? 2 : 0) > length)
+      return;
+    std::string topic((const char *)body + 2, topicLength);
+    uint16_t messageId = qos > 0 ? readUint16(body + pos) : 0;
+    if (qos > 0)
+      pos += 2;
+
+    // Register topic first if the client does not know it yet
+    bool known = client.topicIds.count(topic) > 0;
+    uint16_t topicId = topicIdFor(client, topic);
+    if (!known)
+    {
+      std::vector<uint8_t> registration = {(uint8_t)(topicId >> 8), (uint8_t)(topicId & 0xFF), 0, 0};
+      registration.insert(registration.end(), topic.begin(), topic.end());
+      sendSn(client, SN_REGISTER, registration);
+    }
+
+    std::vector<uint8_t> packet = {(uint8_t)(((qos > 1 ? 1 : qos) << SN_QOS_SHIFT) | (header & 0x01 ? SN_FLAG_RETAIN : 0)),
+                                   (uint8_t)(topicId >> 8), (uint8_t)(topicId & 0xFF), (uint8_t)(messageId >> 8), (uint8_t)(messageId & 0xFF)};
+    packet.insert(packet.end(), body + pos, body + length);
+    sendSn(client, SN_PUBLISH, packet);
+    break;
+  }
+  case MQTT_PUBACK:
+  {
+    if (length < 2)
+      return;
+    uint16_t messageId = readUint16(body);
+    uint16_t topicId = client.pending.count(messageId) ? client.pending[messageId] : 0;
+    client.pending.erase(messageId);
+    sendSn(client, SN_PUBACK, {(uint8_t)(topicId >> 8), (uint8_t)(topicId & 0xFF), body[0], body[1], SN_RC_ACCEPTED});
+    break;
+  }
+  case MQTT_SUBACK:
+  {
+    if (length < 3)
+      return;
+    uint16_t messageId = readUint16(body);
+    uint16_t topicId = client.pending.count(messageId) ? client.pending[messageId] : 0;
+    client.pending.erase(messageId);
+    uint8_t granted = body[2];
+    uint8_t code = granted == 0x80 ? SN_RC_NOT_SUPPORTED : SN_RC_ACCEPTED;
+    sendSn(client, SN_SUBACK, {(uint8_t)((granted & 0x03) << SN_QOS_SHIFT), (uint8_t)(topicId >> 8), (uint8_t)(topicId & 0xFF), body[0], body[1], code});
+    break;
+  }
+  case MQTT_PINGRESP:
+    sendSn(client, SN_PINGRESP, {});
+    break;
+  default:
+    break;
+  }
+}
+
+// Processes complete packets received from the MQTT server
+static void processServerData(Client &client)
+{
+  std::vector<uint8_t> &data = client.received;
+  while (data.size() >= 2)
+  {
+    size_t remaining = 0;
+    size_t pos = 1;
+    int shift = 0;
+    bool complete = false;
+    while (pos < data.size() && pos < 5)
+    {
+      uint8_t digit = data[pos++];
+      remaining |= (size_t)(digit & 0x7F) << shift;
+      shift += 7;
+      if (!(digit & 0x80))
+      {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete || data.size() < pos + remaining)
+      return;
+    handleMqttPacket(client, data[0], data.data() + pos, remaining);
+    data.erase(data.begin(), data.begin() + pos + remaining);
+  }
+}
+
+/* Main loop ********************************************************************************************************/
+
+static void usage()
+{
+  fprintf(stderr, "Usage: mqttsn-gateway [-l listen-port] [-s server] [-p server-port] [-u username] [-P password] [-v]\n");
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  int option;
+  while ((option = getopt(argc, argv, "l:s:p:u:P:v")) != -1)
+  {
+    switch (option)
+    {
+    case 'l':
+      options.listenPort = atoi(optarg);
+      break;
+    case 's':
+      options.server = optarg;
+      break;
+    case 'p':
+      options.serverPort = atoi(optarg);
+      break;
+    case 'u':
+      options.username = optarg;
+      break;
+    case 'P':
+      options.password = optarg;
+      break;
+    case 'v':
+      options.verbose = true;
+      break;
+    default:
+      usage();
+    }
+  }
+
+  udpSocket = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in listenAddress = {};
+  listenAddress.sin_family = AF_INET;
+  listenAddress.sin_addr.s_addr = htonl(INADDR_ANY);
+  listenAddress.sin_port = htons(options.listenPort);
+  if (udpSocket < 0 || bind(udpSocket, (const sockaddr *)&listenAddress, sizeof(listenAddress)) != 0)
+  {
+    perror("Cannot listen");
+    return 1;
+  }
+  printf("MQTT-SN gateway listening on UDP port %u, forwarding to %s:%u\n", options.listenPort, options.server.c_str(), options.serverPort);
+  fflush(stdout);
+
+  while (true)
+  {
+    // Wait for datagram or data from any MQTT server connection
+    std::vector<pollfd> descriptors = {{udpSocket, POLLIN, 0}};
+    std::vector<std::string> keys;
+    for (auto &entry : clients)
+    {
+      if (entry.second.socket >= 0)
+      {
+        descriptors.push_back({entry.second.socket, POLLIN, 0});
+        keys.push_back(entry.first);
+      }
+    }
+    poll(descriptors.data(), descriptors.size(), 1000);
+    time_t now = time(NULL);
+
+    if (descriptors[0].revents & POLLIN)
+    {
+      uint8_t buffer[1024];
+      sockaddr_in address;
+      socklen_t addressLength = sizeof(address);
+      ssize_t size = recvfrom(udpSocket, buffer, sizeof(buffer), 0, (sockaddr *)&address, &addressLength);
+      if (size >= 2)
+      {
+        std::string key = addressToString(address);
+        Client &client = clients[key];
+        client.address = address;
+        client.name = key;
+        client.lastActivity = now;
+
+        // One or three byte length
+        size_t header = buffer[0] == 0x01 ? 3 : 1;
+        size_t length = header == 3 ? (size >= 3 ? readUint16(buffer + 1) : 0) : buffer[0];
+        if ((ssize_t)length <= size && length > header)
+          handleSnPacket(client, buffer[header], buffer + header + 1, length - header - 1);
+      }
+    }
+
+    for (size_t i = 1; i < descriptors.size(); i++)
+    {
+      if (!(descriptors[i].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+      Client &client = clients[keys[i - 1]];
+      uint8_t buffer[4096];
+      ssize_t size = recv(client.socket, buffer, sizeof(buffer), 0);
+      if (size <= 0)
+      {
+        log(client, "MQTT server closed connection%s");
+        closeClient(client, false);
+        sendSn(client, SN_DISCONNECT, {});
+        continue;
+      }
+      client.received.insert(client.received.end(), buffer, buffer + size);
+      processServerData(client);
+    }
+
+    // Clients silent for 1.5 times keepalive are gone: drop server connection without DISCONNECT, so will is sent
+    for (auto entry = clients.begin(); entry != clients.end();)
+    {
+      Client &client = entry->second;
+      time_t timeout = client.duration > 0 ? client.duration * 3 / 2 : 3600;
+      if (now - client.lastActivity > timeout)
+      {
+        log(client, "timed out%s");
+        closeClient(client, false);
+        entry = clients.erase(entry);
+      }
+      else
+      {
+        ++entry;
+      }
+    }
+  }
+}
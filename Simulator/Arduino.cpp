@@ -0,0 +1,652 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator: Arduino core and ESP-IDF                                                       *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "Simulator.h"
+#include <Preferences.h>
+#include <WiFi.h>
+#include <driver/gpio.h>
+#include <esp_heap_caps.h>
+#include <esp_now.h>
+#include <esp_pm.h>
+#include <freertos/queue.h>
+#include <mbedtls/md.h>
+
+#include <sys/time.h>
+#include <time.h>
+
+/* Virtual clock ****************************************************************************************************/
+
+static uint64_t currentTime = 0;
+static uint64_t scheduledCount = 0; // Keeps order of actions scheduled for the same time
+static std::map<std::pair<uint64_t, uint64_t>, std::function<void()>> scheduled;
+std::function<void()> simWaiting;
+
+uint64_t simTime()
+{
+  return currentTime;
+}
+
+void simAt(uint64_t time, std::function<void()> action)
+{
+  scheduled[{std::max(time, currentTime), scheduledCount++}] = action;
+}
+
+// Actions may schedule further actions, so the first one is taken each time
+void simAdvance(uint64_t duration)
+{
+  if (simWaiting)
+    simWaiting();
+  uint64_t end = currentTime + duration;
+  while (!scheduled.empty() && scheduled.begin()->first.first <= end)
+  {
+    auto first = scheduled.begin();
+    currentTime = first->first.first;
+    std::function<void()> action = first->second;
+    scheduled.erase(first);
+    action();
+  }
+  currentTime = end;
+}
+
+uint32_t millis()
+{
+  return currentTime / 1000;
+}
+
+uint32_t micros()
+{
+  return currentTime;
+}
+
+void delay(uint32_t ms)
+{
+  simAdvance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+  simAdvance(us);
+}
+
+void yield()
+{
+}
+
+int64_t esp_timer_get_time()
+{
+  return currentTime;
+}
+
+// Wall clock is virtual too, so the runs are repeatable; it replaces the host C library functions
+time_t time(time_t *result) noexcept
+{
+  time_t now = SIM_EPOCH + currentTime / 1000000;
+  if (result != NULL)
+    *result = now;
+  return now;
+}
+
+int gettimeofday(struct timeval *tv, void *tz) noexcept
+{
+  tv->tv_sec = SIM_EPOCH + currentTime / 1000000;
+  tv->tv_usec = currentTime % 1000000;
+  return 0;
+}
+
+/* Log **************************************************************************************************************/
+
+bool simQuiet = false;
+static bool lineStart = true;
+static std::string serialInput;
+
+static void printTime()
+{
+  printf("%6llu.%03llu ", (unsigned long long)(currentTime / 1000000), (unsigned long long)(currentTime / 1000 % 1000));
+}
+
+void simLog(const char *format, ...)
+{
+  if (!lineStart)
+  {
+    putchar('\n');
+    lineStart = true;
+  }
+  printTime();
+  printf("# ");
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+  putchar('\n');
+}
+
+void simSerialInput(const char *text)
+{
+  serialInput += text;
+}
+
+/* Serial port ******************************************************************************************************/
+
+HardwareSerial Serial;
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  for (size_t i = 0; i < size; i++)
+    write(buffer[i]);
+  return size;
+}
+
+size_t Print::printf(const char *format, ...)
+{
+  char buffer[512];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (length < 0)
+    return 0;
+  return write((const uint8_t *)buffer, std::min((size_t)length, sizeof(buffer) - 1));
+}
+
+size_t Stream::readBytes(uint8_t *buffer, size_t length)
+{
+  size_t count = 0;
+  while (count < length && available() > 0)
+    buffer[count++] = read();
+  return count;
+}
+
+// Carriage returns are left out, each line starts with time
+size_t HardwareSerial::write(uint8_t value)
+{
+  if (simQuiet || value == '\r')
+    return 1;
+  if (lineStart)
+    printTime();
+  putchar(value);
+  lineStart = value == '\n';
+  return 1;
+}
+
+int HardwareSerial::available()
+{
+  return serialInput.size();
+}
+
+int HardwareSerial::read()
+{
+  if (serialInput.empty())
+    return -1;
+  int value = (uint8_t)serialInput[0];
+  serialInput.erase(0, 1);
+  return value;
+}
+
+int HardwareSerial::peek()
+{
+  return serialInput.empty() ? -1 : (uint8_t)serialInput[0];
+}
+
+/* GPIO *************************************************************************************************************/
+
+struct Pin
+{
+  uint8_t mode = INPUT;
+  int level = LOW;
+  void (*handler)(void) = NULL;
+  int edges = 0;
+  bool held = false;
+};
+
+static std::map<uint8_t, Pin> pins;
+std::function<void(uint8_t pin, int level)> simPinChanged;
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  pins[pin].mode = mode;
+  if (mode == INPUT_PULLUP)
+    pins[pin].level = HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t level)
+{
+  Pin &state = pins[pin];
+  if (state.level == level)
+    return;
+  state.level = level;
+  if (simPinChanged)
+    simPinChanged(pin, level);
+}
+
+int digitalRead(uint8_t pin)
+{
+  return pins[pin].level;
+}
+
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode)
+{
+  pins[pin].handler = handler;
+  pins[pin].edges = mode;
+}
+
+void detachInterrupt(uint8_t pin)
+{
+  pins[pin].handler = NULL;
+}
+
+void simSetPin(uint8_t pin, int level)
+{
+  Pin &state = pins[pin];
+  if (state.level == level)
+    return;
+  state.level = level;
+  if (state.handler != NULL && (state.edges & (level == HIGH ? RISING : FALLING)))
+    state.handler();
+}
+
+esp_err_t gpio_hold_en(gpio_num_t pin)
+{
+  pins[pin].held = true;
+  return ESP_OK;
+}
+
+esp_err_t gpio_hold_dis(gpio_num_t pin)
+{
+  pins[pin].held = false;
+  return ESP_OK;
+}
+
+bool simPinHeld(uint8_t pin)
+{
+  return pins[pin].held;
+}
+
+/* Random numbers ***************************************************************************************************/
+
+// Fixed seed, so the runs are repeatable
+static uint32_t randomState = 0x4f6e4169;
+
+uint32_t esp_random()
+{
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}
+
+long random(long max)
+{
+  return max > 0 ? esp_random() % max : 0;
+}
+
+long random(long min, long max)
+{
+  return max > min ? min + random(max - min) : min;
+}
+
+void randomSeed(unsigned long seed)
+{
+  if (seed != 0)
+    randomState = seed;
+}
+
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+size_t strlcpy(char *target, const char *source, size_t size)
+{
+  size_t length = strlen(source);
+  if (size > 0)
+  {
+    size_t count = length < size - 1 ? length : size - 1;
+    memcpy(target, source, count);
+    target[count] = 0;
+  }
+  return length;
+}
+#endif
+
+/* ESP **************************************************************************************************************/
+
+#define SIM_CPU_FREQUENCY 240 // MHz
+#define SIM_HEAP_SIZE 300000  // bytes
+#define SIM_FREE_HEAP 200000  // bytes
+#define SIM_LARGEST_BLOCK 110000 // bytes
+
+EspClass ESP;
+
+void EspClass::restart()
+{
+  Serial.flush();
+  throw SimRestart();
+}
+
+uint32_t EspClass::getFreeHeap()
+{
+  return SIM_FREE_HEAP;
+}
+
+uint32_t EspClass::getMinFreeHeap()
+{
+  return SIM_FREE_HEAP;
+}
+
+uint32_t EspClass::getMaxAllocHeap()
+{
+  return SIM_LARGEST_BLOCK;
+}
+
+uint32_t EspClass::getHeapSize()
+{
+  return SIM_HEAP_SIZE;
+}
+
+uint32_t EspClass::getCycleCount()
+{
+  return currentTime * SIM_CPU_FREQUENCY;
+}
+
+uint64_t EspClass::getEfuseMac()
+{
+  uint8_t mac[6];
+  WiFi.macAddress(mac);
+  uint64_t value = 0;
+  for (int i = 5; i >= 0; i--)
+    value = value << 8 | mac[i];
+  return value;
+}
+
+uint32_t getCpuFrequencyMhz()
+{
+  return SIM_CPU_FREQUENCY;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+  return SIM_FREE_HEAP;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+  return SIM_FREE_HEAP;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+  return SIM_LARGEST_BLOCK;
+}
+
+/* Power management *************************************************************************************************/
+
+struct esp_pm_lock
+{
+  esp_pm_lock_type_t type;
+  int count; // Number of acquisitions not released yet
+};
+
+bool simPowerManagement = false;
+static bool lightSleepEnabled = false;
+static std::list<esp_pm_lock> locks; // Never freed, handles stay valid
+static wifi_ps_type_t wifiSleep = WIFI_PS_MIN_MODEM; // Default of WiFi library
+
+esp_err_t esp_pm_configure(const void *config)
+{
+  if (!simPowerManagement)
+    return ESP_ERR_NOT_SUPPORTED;
+  lightSleepEnabled = ((const esp_pm_config_t *)config)->light_sleep_enable;
+  return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t type, int arg, const char *name, esp_pm_lock_handle_t *handle)
+{
+  if (!simPowerManagement)
+    return ESP_ERR_NOT_SUPPORTED;
+  locks.push_back({type, 0});
+  *handle = &locks.back();
+  return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle)
+{
+  handle->count++;
+  return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle)
+{
+  if (handle->count == 0)
+    return ESP_ERR_INVALID_STATE;
+  handle->count--;
+  return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_ps(wifi_ps_type_t type)
+{
+  wifiSleep = type;
+  return ESP_OK;
+}
+
+wifi_ps_type_t simWifiSleep()
+{
+  return wifiSleep;
+}
+
+static bool lockHeld(esp_pm_lock_type_t type)
+{
+  for (const esp_pm_lock &lock : locks)
+  {
+    if (lock.type == type && lock.count > 0)
+      return true;
+  }
+  return false;
+}
+
+bool simCpuFullSpeed()
+{
+  return !simPowerManagement || lockHeld(ESP_PM_CPU_FREQ_MAX);
+}
+
+bool simLightSleepAllowed()
+{
+  return simPowerManagement && lightSleepEnabled && !lockHeld(ESP_PM_NO_LIGHT_SLEEP);
+}
+
+/* ESP-NOW **********************************************************************************************************/
+
+esp_err_t esp_wifi_set_channel(uint8_t primary, wifi_second_chan_t second)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_now_init()
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_now_deinit()
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t *peer)
+{
+  return ESP_OK;
+}
+
+bool esp_now_is_peer_exist(const uint8_t *address)
+{
+  return false;
+}
+
+esp_err_t esp_now_register_recv_cb(esp_now_recv_cb_t callback)
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_now_unregister_recv_cb()
+{
+  return ESP_OK;
+}
+
+esp_err_t esp_now_send(const uint8_t *address, const uint8_t *data, size_t length)
+{
+  return ESP_OK;
+}
+
+/* FreeRTOS queues **************************************************************************************************/
+
+struct SimQueue
+{
+  size_t length;
+  size_t itemSize;
+  std::deque<std::vector<uint8_t>> items;
+};
+
+// Waits in steps of one tick, so the items sent by scheduled actions are noticed
+static bool waitForItem(QueueHandle_t queue, TickType_t timeout)
+{
+  for (TickType_t waited = 0; queue->items.empty() && waited < timeout; waited++)
+    simAdvance(1000);
+  return !queue->items.empty();
+}
+
+QueueHandle_t xQueueCreate(uint32_t length, uint32_t itemSize)
+{
+  return new SimQueue{length, itemSize, {}};
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t timeout)
+{
+  if (queue->items.size() >= queue->length)
+    return pdFALSE;
+  const uint8_t *bytes = (const uint8_t *)item;
+  queue->items.emplace_back(bytes, bytes + queue->itemSize);
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t timeout)
+{
+  if (!waitForItem(queue, timeout))
+    return pdFALSE;
+  memcpy(item, queue->items.front().data(), queue->itemSize);
+  queue->items.pop_front();
+  return pdTRUE;
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t timeout)
+{
+  if (!waitForItem(queue, timeout))
+    return pdFALSE;
+  memcpy(item, queue->items.front().data(), queue->itemSize);
+  return pdTRUE;
+}
+
+/* Preferences ******************************************************************************************************/
+
+static std::map<std::string, std::vector<uint8_t>> storage;
+
+bool Preferences::begin(const char *name, bool readOnly, const char *partition)
+{
+  _namespace = std::string(name) + ".";
+  _readOnly = readOnly;
+  return true;
+}
+
+bool Preferences::clear()
+{
+  if (_readOnly)
+    return false;
+  for (auto i = storage.begin(); i != storage.end();)
+    i = i->first.compare(0, _namespace.size(), _namespace) == 0 ? storage.erase(i) : std::next(i);
+  return true;
+}
+
+bool Preferences::isKey(const char *key)
+{
+  return storage.count(_namespace + key) > 0;
+}
+
+bool Preferences::remove(const char *key)
+{
+  return !_readOnly && storage.erase(_namespace + key) > 0;
+}
+
+uint32_t Preferences::getUInt(const char *key, uint32_t defaultValue)
+{
+  uint32_t value = defaultValue;
+  getBytes(key, &value, sizeof(value));
+  return value;
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t length)
+{
+  if (_readOnly)
+    return 0;
+  const uint8_t *bytes = (const uint8_t *)value;
+  storage[_namespace + key] = std::vector<uint8_t>(bytes, bytes + length);
+  return length;
+}
+
+size_t Preferences::getBytesLength(const char *key)
+{
+  auto item = storage.find(_namespace + key);
+  return item != storage.end() ? item->second.size() : 0;
+}
+
+// Like NVS, fails when the value does not fit
+size_t Preferences::getBytes(const char *key, void *buffer, size_t maxLength)
+{
+  auto item = storage.find(_namespace + key);
+  if (item == storage.end() || item->second.size() > maxLength)
+    return 0;
+  memcpy(buffer, item->second.data(), item->second.size());
+  return item->second.size();
+}
+
+/* Message digest ***************************************************************************************************/
+
+static const int mdInfo = 0;
+
+const mbedtls_md_info_t *mbedtls_md_info_from_type(mbedtls_md_type_t type)
+{
+  return type == MBEDTLS_MD_SHA256 ? (const mbedtls_md_info_t *)&mdInfo : NULL;
+}
+
+// FNV-1a over key and input, spread to 32 bytes of SHA-256 output
+int mbedtls_md_hmac(const mbedtls_md_info_t *info, const unsigned char *key, size_t keyLength, const unsigned char *input, size_t inputLength, unsigned char *output)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < keyLength + inputLength; i++)
+  {
+    hash ^= i < keyLength ? key[i] : input[i - keyLength];
+    hash *= 0x100000001b3ULL;
+  }
+  for (int i = 0; i < 32; i++)
+  {
+    hash ^= hash >> 29;
+    hash *= 0x100000001b3ULL;
+    output[i] = hash >> 56;
+  }
+  return 0;
+}
+
+/* Network addresses ************************************************************************************************/
+
+String IPAddress::toString() const
+{
+  char text[16];
+  snprintf(text, sizeof(text), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+  return String(text);
+}
+
+bool IPAddress::fromString(const char *text)
+{
+  unsigned int a, b, c, d;
+  char end;
+  if (sscanf(text, "%u.%u.%u.%u%c", &a, &b, &c, &d, &end) != 4 || a > 255 || b > 255 || c > 255 || d > 255)
+    return false;
+  *this = IPAddress(a, b, c, d);
+  return true;
+}
@@ -0,0 +1,86 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator: network faults                                                                 *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "Simulator.h"
+
+#include <cmath>
+
+/* Random values ****************************************************************************************************/
+
+// Own generator, so faults do not change random values seen by the firmware
+static uint32_t randomState = 0x9E3779B9;
+
+void simSeedFaults(uint32_t seed)
+{
+  randomState = seed != 0 ? seed : 0x9E3779B9;
+}
+
+// Uniform in [0, 1)
+static double uniform()
+{
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState / 4294967296.0;
+}
+
+// Random values are drawn only for enabled faults, so the run without faults does not depend on the seed
+static bool chance(double probability)
+{
+  return probability > 0 && uniform() < probability;
+}
+
+static uint64_t latency()
+{
+  uint64_t result = simFaults.latency;
+  if (simFaults.jitter > 0)
+    result += (uint64_t)(-std::log(1 - uniform()) * simFaults.jitter);
+  if (chance(simFaults.spikeChance))
+    result += simFaults.spike;
+  return result;
+}
+
+/* Path *************************************************************************************************************/
+
+SimFaults simFaults;
+
+// Start and end of partitions, us
+static std::vector<std::pair<uint64_t, uint64_t>> partitions;
+
+// Multiples of retransmission timeout, like tcp_backoff of lwIP
+static const uint8_t backoff[] = {1, 2, 3, 4, 5, 6, 7, 7, 7, 7, 7, 7};
+
+void simPartition(uint64_t duration)
+{
+  partitions.push_back({simTime(), simTime() + duration});
+}
+
+bool simPartitioned(uint64_t time)
+{
+  for (const auto &partition : partitions)
+  {
+    if (time >= partition.first && time < partition.second)
+      return true;
+  }
+  return false;
+}
+
+// Segment is sent again until it gets through, a partition which started later does not stop it once it's on its way
+bool simDeliver(uint64_t &time)
+{
+  for (size_t retry = 0;; retry++)
+  {
+    if (!simPartitioned(time) && !chance(simFaults.loss))
+    {
+      time += latency();
+      return true;
+    }
+    if (retry == sizeof(backoff))
+      return false;
+    time += backoff[retry] * (uint64_t)SIM_RTO;
+  }
+}
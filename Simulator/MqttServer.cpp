@@ -0,0 +1,629 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator: MQTT server                                                                    *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "Simulator.h"
+
+#define MQTT_VERSION_5 5
+
+// Packet types (high nibble of fixed header)
+#define MQTT_CONNECT 1
+#define MQTT_CONNACK 2
+#define MQTT_PUBLISH 3
+#define MQTT_PUBACK 4
+#define MQTT_SUBSCRIBE 8
+#define MQTT_SUBACK 9
+#define MQTT_UNSUBSCRIBE 10
+#define MQTT_UNSUBACK 11
+#define MQTT_PINGREQ 12
+#define MQTT_PINGRESP 13
+#define MQTT_DISCONNECT 14
+
+// MQTT 5 properties used here
+#define MQTT_PROP_MESSAGE_EXPIRY 0x02
+#define MQTT_PROP_SESSION_EXPIRY 0x11
+
+SimMqttServer simMqttServer;
+
+bool simTopicMatches(const std::string &filter, const std::string &topic)
+{
+  size_t f = 0, t = 0;
+  while (f < filter.size())
+  {
+    if (filter[f] == '#')
+      return true;
+    if (filter[f] == '+')
+    {
+      while (t < topic.size() && topic[t] != '/')
+        t++;
+      f++;
+      continue;
+    }
+    if (t >= topic.size() || filter[f] != topic[t])
+      return false;
+    f++;
+    t++;
+  }
+  return t == topic.size();
+}
+
+/* Packet reading and writing ***************************************************************************************/
+
+// Reads fields of packet body, any read past the end makes the reader invalid
+class Reader
+{
+public:
+  Reader(const uint8_t *data, size_t length) : _data(data), _length(length) {}
+
+  bool ok() const { return _ok; }
+  size_t remaining() const { return _ok ? _length - _pos : 0; }
+
+  uint8_t byte() { return need(1) ? _data[_pos++] : 0; }
+  uint16_t uint16()
+  {
+    uint16_t high = byte();
+    return high << 8 | byte();
+  }
+  uint32_t uint32()
+  {
+    uint32_t high = uint16();
+    return high << 16 | uint16();
+  }
+  uint32_t varint()
+  {
+    uint32_t value = 0;
+    for (int shift = 0; shift < 28; shift += 7)
+    {
+      uint8_t digit = byte();
+      value |= (uint32_t)(digit & 0x7F) << shift;
+      if (!(digit & 0x80))
+        return value;
+    }
+    _ok = false;
+    return 0;
+  }
+  std::string string()
+  {
+    uint16_t length = uint16();
+    if (!need(length))
+      return "";
+    std::string value((const char *)_data + _pos, length);
+    _pos += length;
+    return value;
+  }
+  std::string rest()
+  {
+    std::string value((const char *)_data + _pos, remaining());
+    _pos = _length;
+    return value;
+  }
+
+  // Properties of MQTT 5 packet, expiry intervals are returned and the other ones skipped
+  bool properties(uint32_t *messageExpiry, uint32_t *sessionExpiry)
+  {
+    uint32_t length = varint();
+    if (!need(length))
+      return false;
+    size_t end = _pos + length;
+    while (_ok && _pos < end)
+    {
+      uint8_t id = byte();
+      switch (id)
+      {
+      case MQTT_PROP_MESSAGE_EXPIRY:
+        if (messageExpiry != NULL)
+          *messageExpiry = uint32();
+        else
+          uint32();
+        break;
+      case MQTT_PROP_SESSION_EXPIRY:
+        if (sessionExpiry != NULL)
+          *sessionExpiry = uint32();
+        else
+          uint32();
+        break;
+      case 0x01: // Payload format indicator
+      case 0x17: // Request problem information
+      case 0x19: // Request response information
+        byte();
+        break;
+      case 0x18: // Will delay interval
+      case 0x27: // Maximum packet size
+        uint32();
+        break;
+      case 0x21: // Receive maximum
+      case 0x22: // Topic alias maximum
+        uint16();
+        break;
+      case 0x03: // Content type
+      case 0x08: // Response topic
+      case 0x09: // Correlation data
+      case 0x15: // Authentication method
+      case 0x16: // Authentication data
+        string();
+        break;
+      case 0x0B: // Subscription identifier
+        varint();
+        break;
+      case 0x26: // User property
+        string();
+        string();
+        break;
+      default: // Topic alias and properties not allowed from client
+        _ok = false;
+        break;
+      }
+    }
+    return _ok && _pos == end;
+  }
+
+private:
+  bool need(size_t count)
+  {
+    if (_ok && _length - _pos >= count)
+      return true;
+    _ok = false;
+    return false;
+  }
+
+  const uint8_t *_data;
+  size_t _length;
+  size_t _pos = 0;
+  bool _ok = true;
+};
+
+static void writeUint16(std::vector<uint8_t> &body, uint16_t value)
+{
+  body.push_back(value >> 8);
+  body.push_back(value & 0xFF);
+}
+
+static void writeString(std::vector<uint8_t> &body, const std::string &value)
+{
+  writeUint16(body, value.size());
+  body.insert(body.end(), value.begin(), value.end());
+}
+
+/* Connections ******************************************************************************************************/
+
+bool SimMqttServer::accept(const std::shared_ptr<SimConnection> &connection)
+{
+  if (!up())
+    return false;
+  Peer peer;
+  peer.connection = connection;
+  peer.lastPacket = simTime();
+  _peers.push_back(peer);
+  if (!_checking)
+  {
+    _checking = true;
+    simAfter(1000000, [this]() { checkKeepAlive(); });
+  }
+  return true;
+}
+
+// Data for connection which the server does not know (any more) is answered by RST
+void SimMqttServer::receive(const std::shared_ptr<SimConnection> &connection)
+{
+  Peer *peer = find(connection);
+  if (peer == NULL)
+  {
+    uint64_t time = simTime();
+    if (!connection->closedByClient && simDeliver(time))
+      connection->closedAt = std::min(connection->closedAt, time);
+    return;
+  }
+  size_t available = connection->toServer.available();
+  size_t start = peer->buffer.size();
+  peer->buffer.resize(start + available);
+  connection->toServer.read(peer->buffer.data() + start, available);
+
+  // Complete packets are processed, the rest waits for more data
+  while (!peer->closed && peer->buffer.size() >= 2)
+  {
+    uint32_t length = 0;
+    size_t pos = 1;
+    bool complete = false;
+    for (int shift = 0; pos < peer->buffer.size() && shift < 28 && !complete; shift += 7)
+    {
+      uint8_t digit = peer->buffer[pos++];
+      length |= (uint32_t)(digit & 0x7F) << shift;
+      complete = !(digit & 0x80);
+    }
+    if (!complete && pos > 4)
+      drop(*peer, true);
+    if (!complete || peer->buffer.size() < pos + length)
+      break;
+    std::vector<uint8_t> packet(peer->buffer.begin(), peer->buffer.begin() + pos + length);
+    peer->buffer.erase(peer->buffer.begin(), peer->buffer.begin() + pos + length);
+    peer->lastPacket = simTime();
+    process(*peer, packet[0], packet.data() + pos, length);
+    if (heard && !peer->id.empty())
+      heard(peer->id);
+  }
+  _peers.remove_if([](const Peer &peer) { return peer.closed; });
+}
+
+// Client closed the connection without DISCONNECT, otherwise it's gone already
+void SimMqttServer::closed(const std::shared_ptr<SimConnection> &connection)
+{
+  Peer *peer = find(connection);
+  if (peer != NULL)
+    drop(*peer, true);
+  _peers.remove_if([](const Peer &peer) { return peer.closed; });
+}
+
+void SimMqttServer::restart(uint64_t downtime, bool keepSessions)
+{
+  for (Peer &peer : _peers)
+    drop(peer, false);
+  _peers.clear();
+  if (!keepSessions)
+  {
+    _sessions.clear();
+    _retained.clear();
+  }
+  _downUntil = simTime() + downtime;
+}
+
+void SimMqttServer::drop(Peer &peer, bool sendWill)
+{
+  if (peer.closed)
+    return;
+  peer.closed = true;
+  uint64_t time = simTime();
+  if (!peer.connection->toClient.failed && simDeliver(time))
+    peer.connection->closedAt = std::min(peer.connection->closedAt, time);
+  if (peer.id.empty())
+    return;
+  auto session = _sessions.find(peer.id);
+  if (session != _sessions.end() && !session->second.persistent)
+    _sessions.erase(session);
+  if (sessionChanged)
+    sessionChanged(peer.id, false);
+  if (sendWill && peer.hasWill)
+    route(peer.will);
+}
+
+// Connections are dropped when nothing comes from the client for 1.5 times its keep alive
+void SimMqttServer::checkKeepAlive()
+{
+  for (Peer &peer : _peers)
+  {
+    if (peer.keepAlive > 0 && simTime() - peer.lastPacket > peer.keepAlive * 1500000ULL)
+      drop(peer, true);
+  }
+  _peers.remove_if([](const Peer &peer) { return peer.closed; });
+  _checking = !_peers.empty();
+  if (_checking)
+    simAfter(1000000, [this]() { checkKeepAlive(); });
+}
+
+SimMqttServer::Peer *SimMqttServer::find(const std::shared_ptr<SimConnection> &connection)
+{
+  for (Peer &peer : _peers)
+  {
+    if (peer.connection == connection && !peer.closed)
+      return &peer;
+  }
+  return NULL;
+}
+
+SimMqttServer::Peer *SimMqttServer::online(const std::string &id)
+{
+  for (Peer &peer : _peers)
+  {
+    if (peer.id == id && !peer.closed)
+      return &peer;
+  }
+  return NULL;
+}
+
+void SimMqttServer::send(Peer &peer, uint8_t header, const std::vector<uint8_t> &body)
+{
+  if (peer.closed || peer.connection->broken || peer.connection->closedByClient || peer.connection->toClient.failed)
+    return;
+  std::vector<uint8_t> packet;
+  packet.push_back(header);
+  size_t length = body.size();
+  do
+  {
+    uint8_t digit = length & 0x7F;
+    length >>= 7;
+    packet.push_back(digit | (length > 0 ? 0x80 : 0x00));
+  } while (length > 0);
+  packet.insert(packet.end(), body.begin(), body.end());
+
+  // When TCP gives up retransmitting, the server resets the connection
+  uint64_t time = simTime();
+  std::shared_ptr<SimConnection> connection = peer.connection;
+  if (!simDeliver(time))
+  {
+    connection->toClient.failed = true;
+    simAt(time, [this, connection]() { closed(connection); });
+    return;
+  }
+  connection->toClient.write(packet.data(), packet.size(), time);
+}
+
+/* Packets **********************************************************************************************************/
+
+void SimMqttServer::process(Peer &peer, uint8_t header, const uint8_t *body, size_t length)
+{
+  uint8_t type = header >> 4;
+  if (peer.id.empty() != (type == MQTT_CONNECT))
+  {
+    drop(peer, true);
+    return;
+  }
+  Reader reader(body, length);
+  switch (type)
+  {
+  case MQTT_CONNECT:
+    onConnect(peer, body, length);
+    break;
+  case MQTT_PUBLISH:
+    onPublish(peer, header, body, length);
+    break;
+  case MQTT_PUBACK:
+    _sessions[peer.id].inflight.erase(reader.uint16());
+    break;
+  case MQTT_SUBSCRIBE:
+    onSubscribe(peer, body, length);
+    break;
+  case MQTT_UNSUBSCRIBE:
+  {
+    uint16_t packetId = reader.uint16();
+    if (peer.version == MQTT_VERSION_5)
+      reader.properties(NULL, NULL);
+    std::vector<uint8_t> response;
+    writeUint16(response, packetId);
+    if (peer.version == MQTT_VERSION_5)
+      response.push_back(0);
+    auto &subscriptions = _sessions[peer.id].subscriptions;
+    while (reader.ok() && reader.remaining() > 0)
+    {
+      std::string filter = reader.string();
+      size_t count = subscriptions.size();
+      subscriptions.erase(std::remove_if(subscriptions.begin(), subscriptions.end(), [&](const std::pair<std::string, uint8_t> &s) { return s.first == filter; }),
+                          subscriptions.end());
+      if (peer.version == MQTT_VERSION_5)
+        response.push_back(subscriptions.size() < count ? 0x00 : 0x11);
+    }
+    if (!reader.ok())
+      drop(peer, true);
+    else
+      send(peer, MQTT_UNSUBACK << 4, response);
+    break;
+  }
+  case MQTT_PINGREQ:
+    send(peer, MQTT_PINGRESP << 4, {});
+    break;
+  case MQTT_DISCONNECT:
+    // MQTT 5 reason code 0x04 asks for the will, no reason code means normal disconnection
+    drop(peer, peer.version == MQTT_VERSION_5 && reader.remaining() > 0 && reader.byte() == 0x04);
+    break;
+  default:
+    drop(peer, true);
+    break;
+  }
+}
+
+void SimMqttServer::onConnect(Peer &peer, const uint8_t *body, size_t length)
+{
+  Reader reader(body, length);
+  std::string protocol = reader.string();
+  peer.version = reader.byte();
+  uint8_t flags = reader.byte();
+  peer.keepAlive = reader.uint16();
+  uint32_t sessionExpiry = 0;
+  if (peer.version == MQTT_VERSION_5)
+    reader.properties(NULL, &sessionExpiry);
+  std::string id = reader.string();
+  if (flags & 0x04)
+  {
+    uint32_t willExpiry = 0;
+    if (peer.version == MQTT_VERSION_5)
+      reader.properties(&willExpiry, NULL);
+    peer.hasWill = true;
+    peer.will.topic = reader.string();
+    peer.will.payload = reader.string();
+    peer.will.qos = (flags >> 3) & 0x03;
+    peer.will.retain = flags & 0x20;
+    peer.will.expiry = willExpiry > 0 ? simTime() + willExpiry * 1000000ULL : UINT64_MAX;
+  }
+  if (flags & 0x80)
+    reader.string();
+  if (flags & 0x40)
+    reader.string();
+  if (!reader.ok() || protocol != "MQTT" || (peer.version != 4 && peer.version != MQTT_VERSION_5) || id.empty())
+  {
+    drop(peer, false);
+    return;
+  }
+
+  // Another connection with the same client ID is taken over
+  Peer *previous = online(id);
+  if (previous != NULL)
+    drop(*previous, true);
+
+  bool cleanStart = flags & 0x02;
+  bool persistent = peer.version == MQTT_VERSION_5 ? sessionExpiry > 0 : !cleanStart;
+  bool sessionPresent = !cleanStart && _sessions.count(id) > 0;
+  if (!sessionPresent)
+    _sessions[id] = Session();
+  Session &session = _sessions[id];
+  session.persistent = persistent;
+  peer.id = id;
+
+  std::vector<uint8_t> response = {(uint8_t)(sessionPresent ? 0x01 : 0x00), 0x00};
+  if (peer.version == MQTT_VERSION_5)
+    response.push_back(0);
+  send(peer, MQTT_CONNACK << 4, response);
+  if (sessionChanged)
+    sessionChanged(id, true);
+
+  // Unacknowledged messages are sent again, then the ones which came while the client was away
+  std::map<uint16_t, SimMessage> inflight = session.inflight;
+  for (auto &message : inflight)
+    deliver(&peer, session, message.second, message.second.qos, true, message.first);
+  while (!session.queue.empty())
+  {
+    SimMessage message = session.queue.front();
+    session.queue.pop_front();
+    deliver(&peer, session, message, message.qos);
+  }
+}
+
+void SimMqttServer::onPublish(Peer &peer, uint8_t header, const uint8_t *body, size_t length)
+{
+  Reader reader(body, length);
+  SimMessage message;
+  message.qos = (header >> 1) & 0x03;
+  message.retain = header & 0x01;
+  message.topic = reader.string();
+  uint16_t packetId = message.qos > 0 ? reader.uint16() : 0;
+  uint32_t expiry = 0;
+  if (peer.version == MQTT_VERSION_5)
+    reader.properties(&expiry, NULL);
+  message.payload = reader.rest();
+  message.expiry = expiry > 0 ? simTime() + expiry * 1000000ULL : UINT64_MAX;
+  if (!reader.ok() || message.qos > 1 || message.topic.empty())
+  {
+    drop(peer, true);
+    return;
+  }
+  if (message.qos == 1)
+  {
+    std::vector<uint8_t> response;
+    writeUint16(response, packetId);
+    send(peer, MQTT_PUBACK << 4, response);
+  }
+  if (published)
+    published(peer.id, message);
+  route(message);
+}
+
+void SimMqttServer::onSubscribe(Peer &peer, const uint8_t *body, size_t length)
+{
+  Reader reader(body, length);
+  uint16_t packetId = reader.uint16();
+  if (peer.version == MQTT_VERSION_5)
+    reader.properties(NULL, NULL);
+  std::vector<uint8_t> response;
+  writeUint16(response, packetId);
+  if (peer.version == MQTT_VERSION_5)
+    response.push_back(0);
+  Session &session = _sessions[peer.id];
+  std::vector<std::pair<std::string, uint8_t>> added;
+  while (reader.ok() && reader.remaining() > 0)
+  {
+    std::string filter = reader.string();
+    uint8_t qos = std::min(reader.byte() & 0x03, 1);
+    for (auto &subscription : session.subscriptions)
+    {
+      if (subscription.first == filter)
+        subscription.first.clear();
+    }
+    session.subscriptions.erase(std::remove_if(session.subscriptions.begin(), session.subscriptions.end(),
+                                               [](const std::pair<std::string, uint8_t> &s) { return s.first.empty(); }),
+                                session.subscriptions.end());
+    session.subscriptions.push_back({filter, qos});
+    added.push_back({filter, qos});
+    response.push_back(qos);
+  }
+  if (!reader.ok() || added.empty())
+  {
+    drop(peer, true);
+    return;
+  }
+  send(peer, MQTT_SUBACK << 4, response);
+
+  // Retained messages are sent to new subscriptions with retain flag
+  for (auto &subscription : added)
+  {
+    for (auto &retained : _retained)
+    {
+      if (simTopicMatches(subscription.first, retained.first))
+        deliver(&peer, session, retained.second, std::min(retained.second.qos, subscription.second));
+    }
+  }
+}
+
+/* Routing **********************************************************************************************************/
+
+void SimMqttServer::publish(const std::string &topic, const std::string &payload, bool retain, uint8_t qos)
+{
+  route({topic, payload, qos, retain, UINT64_MAX});
+}
+
+// Message goes to all sessions with matching subscription, with the highest QoS of matching subscriptions
+void SimMqttServer::route(const SimMessage &message)
+{
+  if (message.retain)
+  {
+    if (message.payload.empty())
+      _retained.erase(message.topic);
+    else
+      _retained[message.topic] = message;
+  }
+  SimMessage forwarded = message;
+  forwarded.retain = false;
+  for (auto &session : _sessions)
+  {
+    int qos = -1;
+    for (auto &subscription : session.second.subscriptions)
+    {
+      if (simTopicMatches(subscription.first, message.topic))
+        qos = std::max(qos, (int)subscription.second);
+    }
+    if (qos >= 0)
+      deliver(online(session.first), session.second, forwarded, std::min((int)message.qos, qos));
+  }
+}
+
+// QoS 1 messages for the client away are queued, when it has persistent session
+void SimMqttServer::deliver(Peer *peer, Session &session, const SimMessage &message, uint8_t qos, bool dup, uint16_t packetId)
+{
+  if (simTime() >= message.expiry)
+    return;
+  if (peer == NULL)
+  {
+    if (qos > 0 && session.persistent)
+      session.queue.push_back(message);
+    return;
+  }
+  std::vector<uint8_t> body;
+  writeString(body, message.topic);
+  if (qos > 0)
+  {
+    if (packetId == 0)
+    {
+      packetId = session.nextPacketId++;
+      if (session.nextPacketId == 0)
+        session.nextPacketId = 1;
+    }
+    writeUint16(body, packetId);
+    SimMessage inflight = message;
+    inflight.qos = qos;
+    session.inflight[packetId] = inflight;
+  }
+  if (peer->version == MQTT_VERSION_5)
+  {
+    // Remaining lifetime of the message is passed on
+    if (message.expiry != UINT64_MAX)
+    {
+      uint32_t remaining = (message.expiry - simTime() + 999999) / 1000000;
+      body.insert(body.end(), {5, MQTT_PROP_MESSAGE_EXPIRY, (uint8_t)(remaining >> 24), (uint8_t)(remaining >> 16), (uint8_t)(remaining >> 8), (uint8_t)remaining});
+    }
+    else
+    {
+      body.push_back(0);
+    }
+  }
+  body.insert(body.end(), message.payload.begin(), message.payload.end());
+  send(*peer, MQTT_PUBLISH << 4 | (dup ? 0x08 : 0x00) | qos << 1 | (message.retain ? 0x01 : 0x00), body);
+}
@@ -0,0 +1,644 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator: WiFi and network connections                                                   *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "Simulator.h"
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+#include <WiFiUdp.h>
+
+/* Network pipes ****************************************************************************************************/
+
+// TCP keeps the order, so data never arrives before data written earlier
+void SimPipe::write(const uint8_t *buffer, size_t size, uint64_t time)
+{
+  if (!chunks.empty() && chunks.back().time > time)
+    time = chunks.back().time;
+  chunks.push_back({time, std::vector<uint8_t>(buffer, buffer + size)});
+}
+
+size_t SimPipe::available() const
+{
+  size_t count = 0;
+  for (const Chunk &chunk : chunks)
+  {
+    if (chunk.time > simTime())
+      break;
+    count += chunk.data.size();
+  }
+  return count - offset;
+}
+
+size_t SimPipe::read(uint8_t *buffer, size_t size)
+{
+  size_t count = 0;
+  while (count < size && !chunks.empty() && chunks.front().time <= simTime())
+  {
+    const std::vector<uint8_t> &data = chunks.front().data;
+    size_t part = std::min(size - count, data.size() - offset);
+    memcpy(buffer + count, data.data() + offset, part);
+    count += part;
+    offset += part;
+    if (offset == data.size())
+    {
+      chunks.pop_front();
+      offset = 0;
+    }
+  }
+  return count;
+}
+
+void SimPipe::clear()
+{
+  chunks.clear();
+  offset = 0;
+}
+
+/* WiFi station *****************************************************************************************************/
+
+struct AccessPoint
+{
+  std::string ssid;
+  int32_t rssi;
+  uint8_t channel;
+  uint8_t bssid[6];
+};
+
+static const uint8_t deviceMac[6] = {0x24, 0x0A, 0xC4, 0x5E, 0xA1, 0x01};
+static const IPAddress dhcpAddress(192, 168, 1, 100);
+static const IPAddress gatewayAddress(192, 168, 1, 1);
+static const IPAddress subnetMask(255, 255, 255, 0);
+static const IPAddress serverAddress(192, 168, 1, 10);
+
+static bool linkUp = true;
+static wl_status_t wifiStatus = WL_IDLE_STATUS;
+static bool associated = false;
+static uint32_t attempt = 0; // Scheduled steps of older connection attempts are ignored
+static std::string targetSsid;
+static uint8_t targetChannel = 0;
+static uint8_t targetBssid[6];
+static bool hasTargetBssid = false;
+static IPAddress staticAddress, staticGateway, staticSubnet, staticDns;
+static AccessPoint current;
+static std::vector<AccessPoint> accessPoints;
+static std::vector<AccessPoint> scanResults;
+static int16_t scanState = WIFI_SCAN_FAILED;
+static std::vector<std::pair<WiFiEventCb, arduino_event_id_t>> eventHandlers;
+static std::vector<std::weak_ptr<SimConnection>> connections;
+static std::map<uint16_t, std::deque<std::shared_ptr<SimConnection>>> listening; // Not yet accepted connections by port
+
+WiFiClass WiFi;
+
+static void fireEvent(arduino_event_id_t event)
+{
+  for (auto &handler : eventHandlers)
+  {
+    if (handler.second == event)
+      handler.first(event);
+  }
+}
+
+// Connections die with the link, the server notices only by missing keep alive
+static void breakConnections()
+{
+  for (auto &weak : connections)
+  {
+    std::shared_ptr<SimConnection> connection = weak.lock();
+    if (connection)
+      connection->broken = true;
+  }
+  connections.clear();
+}
+
+// Access point which the device connects to, the one requested by BSSID or channel, or the strongest with the SSID
+static AccessPoint findAccessPoint()
+{
+  AccessPoint found = {targetSsid, SIM_RSSI, 1, {0x02, 0x00, 0x00, 0x00, 0x00, 0x01}};
+  bool matched = false;
+  for (const AccessPoint &accessPoint : accessPoints)
+  {
+    if (accessPoint.ssid != targetSsid || (hasTargetBssid && memcmp(accessPoint.bssid, targetBssid, 6) != 0) ||
+        (targetChannel != 0 && accessPoint.channel != targetChannel))
+      continue;
+    if (!matched || accessPoint.rssi > found.rssi)
+      found = accessPoint;
+    matched = true;
+  }
+  return found;
+}
+
+// Like WiFi library with auto reconnect, the attempts go on until connected or disconnect() is called
+static void associate(uint32_t forAttempt)
+{
+  if (forAttempt != attempt)
+    return;
+  if (!linkUp)
+  {
+    wifiStatus = WL_NO_SSID_AVAIL;
+    fireEvent(ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+    simAfter(SIM_CONNECT_TIME, [forAttempt]() { associate(forAttempt); });
+    return;
+  }
+  associated = true;
+  current = findAccessPoint();
+  fireEvent(ARDUINO_EVENT_WIFI_STA_CONNECTED);
+  simAfter((uint32_t)staticAddress != 0 ? 0 : SIM_DHCP_TIME, [forAttempt]() {
+    if (forAttempt != attempt || !associated)
+      return;
+    wifiStatus = WL_CONNECTED;
+    fireEvent(ARDUINO_EVENT_WIFI_STA_GOT_IP);
+  });
+}
+
+void simSetLink(bool up)
+{
+  if (up == linkUp)
+    return;
+  linkUp = up;
+  if (up || !associated)
+    return;
+  associated = false;
+  wifiStatus = WL_DISCONNECTED;
+  breakConnections();
+  fireEvent(ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+  uint32_t forAttempt = ++attempt;
+  simAfter(SIM_CONNECT_TIME, [forAttempt]() { associate(forAttempt); });
+}
+
+bool simLink()
+{
+  return linkUp;
+}
+
+void simAddAccessPoint(const char *ssid, int32_t rssi, uint8_t channel)
+{
+  AccessPoint accessPoint = {ssid, rssi, channel, {0x02, 0x00, 0x00, 0x00, 0x00, (uint8_t)(accessPoints.size() + 1)}};
+  accessPoints.push_back(accessPoint);
+}
+
+int WiFiClass::onEvent(WiFiEventCb callback, arduino_event_id_t event)
+{
+  eventHandlers.push_back({callback, event});
+  return eventHandlers.size();
+}
+
+wl_status_t WiFiClass::begin(const char *ssid, const char *password, int32_t channel, const uint8_t *bssid, bool connect)
+{
+  disconnect();
+  targetSsid = ssid;
+  targetChannel = channel;
+  hasTargetBssid = bssid != NULL;
+  if (hasTargetBssid)
+    memcpy(targetBssid, bssid, 6);
+  if (!connect)
+    return wifiStatus;
+  uint32_t forAttempt = ++attempt;
+  simAfter(SIM_CONNECT_TIME, [forAttempt]() { associate(forAttempt); });
+  return wifiStatus;
+}
+
+bool WiFiClass::config(IPAddress address, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2)
+{
+  staticAddress = address;
+  staticGateway = gateway;
+  staticSubnet = subnet;
+  staticDns = dns1;
+  return true;
+}
+
+bool WiFiClass::disconnect(bool wifiOff, bool eraseAp)
+{
+  attempt++;
+  bool wasAssociated = associated;
+  associated = false;
+  wifiStatus = WL_DISCONNECTED;
+  if (wasAssociated)
+  {
+    breakConnections();
+    fireEvent(ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+  }
+  return true;
+}
+
+bool WiFiClass::reconnect()
+{
+  begin(targetSsid.c_str(), NULL, targetChannel, hasTargetBssid ? targetBssid : NULL);
+  return true;
+}
+
+wl_status_t WiFiClass::status()
+{
+  return wifiStatus;
+}
+
+String WiFiClass::macAddress()
+{
+  char text[18];
+  snprintf(text, sizeof(text), "%02X:%02X:%02X:%02X:%02X:%02X", deviceMac[0], deviceMac[1], deviceMac[2], deviceMac[3], deviceMac[4], deviceMac[5]);
+  return String(text);
+}
+
+uint8_t *WiFiClass::macAddress(uint8_t *mac)
+{
+  memcpy(mac, deviceMac, 6);
+  return mac;
+}
+
+IPAddress WiFiClass::localIP()
+{
+  if (wifiStatus != WL_CONNECTED)
+    return IPAddress();
+  return (uint32_t)staticAddress != 0 ? staticAddress : dhcpAddress;
+}
+
+IPAddress WiFiClass::gatewayIP()
+{
+  if (wifiStatus != WL_CONNECTED)
+    return IPAddress();
+  return (uint32_t)staticAddress != 0 ? staticGateway : gatewayAddress;
+}
+
+IPAddress WiFiClass::subnetMask()
+{
+  if (wifiStatus != WL_CONNECTED)
+    return IPAddress();
+  return (uint32_t)staticAddress != 0 ? staticSubnet : ::subnetMask;
+}
+
+IPAddress WiFiClass::dnsIP(uint8_t index)
+{
+  if (wifiStatus != WL_CONNECTED || index > 0)
+    return IPAddress();
+  return (uint32_t)staticAddress != 0 ? staticDns : gatewayAddress;
+}
+
+String WiFiClass::SSID()
+{
+  return associated ? String(current.ssid) : String();
+}
+
+uint8_t *WiFiClass::BSSID()
+{
+  return associated ? current.bssid : NULL;
+}
+
+int8_t WiFiClass::RSSI()
+{
+  return associated ? current.rssi : 0;
+}
+
+int32_t WiFiClass::channel()
+{
+  return associated ? current.channel : 0;
+}
+
+/* Scan *************************************************************************************************************/
+
+int16_t WiFiClass::scanNetworks(bool async, bool showHidden, bool passive, uint32_t maxMsPerChannel, uint8_t channel, const char *ssid, const uint8_t *bssid)
+{
+  if (scanState == WIFI_SCAN_RUNNING)
+    return WIFI_SCAN_RUNNING;
+  scanState = WIFI_SCAN_RUNNING;
+  simAfter(SIM_SCAN_TIME, [channel]() {
+    scanResults.clear();
+    for (const AccessPoint &accessPoint : accessPoints)
+    {
+      if (linkUp && (channel == 0 || accessPoint.channel == channel))
+        scanResults.push_back(accessPoint);
+    }
+    scanState = scanResults.size();
+  });
+  if (async)
+    return WIFI_SCAN_RUNNING;
+  while (scanState == WIFI_SCAN_RUNNING)
+    simAdvance(1000);
+  return scanState;
+}
+
+int16_t WiFiClass::scanComplete()
+{
+  return scanState;
+}
+
+void WiFiClass::scanDelete()
+{
+  scanResults.clear();
+  if (scanState != WIFI_SCAN_RUNNING)
+    scanState = WIFI_SCAN_FAILED;
+}
+
+String WiFiClass::SSID(uint8_t index)
+{
+  return index < scanResults.size() ? String(scanResults[index].ssid) : String();
+}
+
+uint8_t *WiFiClass::BSSID(uint8_t index)
+{
+  return index < scanResults.size() ? scanResults[index].bssid : NULL;
+}
+
+int32_t WiFiClass::RSSI(uint8_t index)
+{
+  return index < scanResults.size() ? scanResults[index].rssi : 0;
+}
+
+int32_t WiFiClass::channel(uint8_t index)
+{
+  return index < scanResults.size() ? scanResults[index].channel : 0;
+}
+
+/* DNS **************************************************************************************************************/
+
+// All names are resolved to the simulated MQTT server, the query takes a round trip
+int WiFiClass::hostByName(const char *host, IPAddress &address)
+{
+  if (address.fromString(host))
+    return 1;
+  if (wifiStatus != WL_CONNECTED)
+    return 0;
+  simAdvance(2 * SIM_LATENCY);
+  if (wifiStatus != WL_CONNECTED)
+    return 0;
+  address = serverAddress;
+  return 1;
+}
+
+/* TCP client *******************************************************************************************************/
+
+WiFiClientSecure::WiFiClientSecure()
+{
+  _handshakeTime = SIM_TLS_TIME;
+}
+
+// All connections go to the simulated MQTT server; connecting blocks for a round trip and the handshake, lost
+// segments are sent again until the timeout
+int WiFiClient::connect(IPAddress address, uint16_t port)
+{
+  stop();
+  if (WiFi.status() != WL_CONNECTED)
+    return 0;
+  uint64_t start = simTime();
+  uint64_t time = start;
+  if (!simDeliver(time) || !simDeliver(time) || time - start > SIM_CONNECT_TIMEOUT)
+  {
+    simAdvance(SIM_CONNECT_TIMEOUT);
+    return 0;
+  }
+  simAdvance(time - start);
+  if (WiFi.status() != WL_CONNECTED)
+    return 0;
+  std::shared_ptr<SimConnection> connection = std::make_shared<SimConnection>();
+  if (!simMqttServer.accept(connection))
+    return 0;
+  connections.push_back(connection);
+  _connection = connection;
+  if (_handshakeTime > 0)
+  {
+    // Handshake takes two round trips besides computation
+    start = time = simTime();
+    bool done = simDeliver(time) && simDeliver(time) && simDeliver(time) && simDeliver(time);
+    time += _handshakeTime - 4 * SIM_LATENCY;
+    simAdvance(done && time - start < SIM_HANDSHAKE_TIMEOUT ? time - start : SIM_HANDSHAKE_TIMEOUT);
+    if (!done || !connected())
+    {
+      stop();
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int WiFiClient::connect(const char *host, uint16_t port)
+{
+  IPAddress address;
+  if (!WiFi.hostByName(host, address))
+    return 0;
+  return connect(address, port);
+}
+
+// When TCP gives up retransmitting, the device resets the connection and the server learns about it if RST gets through
+size_t WiFiClient::write(const uint8_t *buffer, size_t size)
+{
+  if (!connected())
+    return 0;
+  std::shared_ptr<SimConnection> connection = _connection;
+  if (connection->incoming)
+  {
+    connection->toServer.write(buffer, size, simTime());
+    return size;
+  }
+  if (connection->toServer.failed)
+    return size;
+  uint64_t time = simTime();
+  if (!simDeliver(time))
+  {
+    connection->toServer.failed = true;
+    connection->closedAt = std::min(connection->closedAt, time);
+    if (simDeliver(time))
+      simAt(time, [connection]() { simMqttServer.closed(connection); });
+    return size;
+  }
+  connection->toServer.write(buffer, size, time);
+  simAt(time, [connection]() {
+    if (!connection->broken)
+      simMqttServer.receive(connection);
+  });
+  return size;
+}
+
+int WiFiClient::available()
+{
+  return _connection && !_connection->broken ? _connection->toClient.available() : 0;
+}
+
+int WiFiClient::read()
+{
+  uint8_t value;
+  return read(&value, 1) == 1 ? value : -1;
+}
+
+int WiFiClient::read(uint8_t *buffer, size_t size)
+{
+  if (!_connection || _connection->broken)
+    return -1;
+  return _connection->toClient.read(buffer, size);
+}
+
+int WiFiClient::peek()
+{
+  if (available() == 0)
+    return -1;
+  const SimPipe &pipe = _connection->toClient;
+  return pipe.chunks.front().data[pipe.offset];
+}
+
+// The server learns about the closed connection when FIN arrives, or by missing keep alive when it's lost
+void WiFiClient::stop()
+{
+  if (!_connection)
+    return;
+  std::shared_ptr<SimConnection> connection = _connection;
+  _connection.reset();
+  if (connection->closedByClient || connection->broken)
+    return;
+  connection->closedByClient = true;
+  if (connection->incoming)
+    return;
+  uint64_t time = simTime();
+  if (!connection->toServer.failed && simDeliver(time))
+    simAt(time, [connection]() { simMqttServer.closed(connection); });
+}
+
+// Like on device, the connection closed by server stays connected until received data are read
+uint8_t WiFiClient::connected()
+{
+  if (!_connection || _connection->broken || _connection->closedByClient)
+    return false;
+  return simTime() < _connection->closedAt || _connection->toClient.available() > 0;
+}
+
+/* TCP server *******************************************************************************************************/
+
+std::shared_ptr<SimConnection> simConnectDevice(uint16_t port)
+{
+  auto found = listening.find(port);
+  if (WiFi.status() != WL_CONNECTED || found == listening.end())
+    return NULL;
+  std::shared_ptr<SimConnection> connection = std::make_shared<SimConnection>();
+  connection->incoming = true;
+  connections.push_back(connection);
+  found->second.push_back(connection);
+  return connection;
+}
+
+void WiFiServer::begin()
+{
+  listening[_port].clear();
+}
+
+void WiFiServer::end()
+{
+  listening.erase(_port);
+}
+
+bool WiFiServer::hasClient()
+{
+  auto found = listening.find(_port);
+  return found != listening.end() && !found->second.empty();
+}
+
+WiFiClient WiFiServer::available()
+{
+  if (!hasClient())
+    return WiFiClient();
+  std::deque<std::shared_ptr<SimConnection>> &queue = listening[_port];
+  WiFiClient client(queue.front());
+  queue.pop_front();
+  return client;
+}
+
+/* UDP **************************************************************************************************************/
+
+#define DNS_PORT 53
+#define DNS_TTL 300 // s
+
+// Answers query for A record with the address of MQTT server, the response is built from the query
+static bool answerDnsQuery(const std::vector<uint8_t> &query, std::vector<uint8_t> &response)
+{
+  if (query.size() < 12 || query[4] != 0 || query[5] != 1)
+    return false;
+  size_t pos = 12;
+  while (pos < query.size() && query[pos] != 0)
+    pos += query[pos] + 1;
+  pos += 5;
+  if (pos > query.size())
+    return false;
+  response.assign(query.begin(), query.begin() + pos);
+  response[2] = 0x81; // Response, recursion desired
+  response[3] = 0x80; // Recursion available, no error
+  response[7] = 1;    // Single answer
+  uint32_t address = serverAddress;
+  response.insert(response.end(), {0xC0, 0x0C, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00, DNS_TTL >> 8, DNS_TTL & 0xFF, 0x00, 0x04});
+  for (int i = 0; i < 4; i++)
+    response.push_back(address >> (8 * i));
+  return true;
+}
+
+uint8_t WiFiUDP::beginMulticast(IPAddress group, uint16_t port)
+{
+  return WiFi.status() == WL_CONNECTED;
+}
+
+void WiFiUDP::stop()
+{
+  _incoming.clear();
+  _received = {};
+  _readPos = 0;
+}
+
+int WiFiUDP::beginPacket(IPAddress address, uint16_t port)
+{
+  _sending = {0, address, port, {}};
+  _open = true;
+  return WiFi.status() == WL_CONNECTED;
+}
+
+int WiFiUDP::beginPacket(const char *host, uint16_t port)
+{
+  IPAddress address;
+  return WiFi.hostByName(host, address) && beginPacket(address, port);
+}
+
+size_t WiFiUDP::write(const uint8_t *buffer, size_t size)
+{
+  if (!_open)
+    return 0;
+  _sending.data.insert(_sending.data.end(), buffer, buffer + size);
+  return size;
+}
+
+// Only DNS queries to the gateway get a response, after round trip
+int WiFiUDP::endPacket()
+{
+  if (!_open)
+    return 0;
+  _open = false;
+  if (WiFi.status() != WL_CONNECTED)
+    return 0;
+  std::vector<uint8_t> response;
+  if (_sending.port == DNS_PORT && _sending.address == WiFi.dnsIP() && answerDnsQuery(_sending.data, response))
+    _incoming.push_back({simTime() + 2 * SIM_LATENCY, _sending.address, DNS_PORT, response});
+  return 1;
+}
+
+int WiFiUDP::parsePacket()
+{
+  _received = {};
+  _readPos = 0;
+  if (_incoming.empty() || _incoming.front().time > simTime())
+    return 0;
+  _received = _incoming.front();
+  _incoming.pop_front();
+  return _received.data.size();
+}
+
+int WiFiUDP::read()
+{
+  return _readPos < _received.data.size() ? _received.data[_readPos++] : -1;
+}
+
+int WiFiUDP::read(unsigned char *buffer, size_t length)
+{
+  size_t count = std::min(length, _received.data.size() - _readPos);
+  memcpy(buffer, _received.data.data() + _readPos, count);
+  _readPos += count;
+  return count;
+}
+
+int WiFiUDP::peek()
+{
+  return _readPos < _received.data.size() ? _received.data[_readPos] : -1;
+}
@@ -0,0 +1,761 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator                                                                                 *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Replays inputs captured by the box (button edges, WiFi link changes and received MQTT messages, see CAPTURE in   *
+ * the firmware) to the firmware running in simulation, so a field issue can be reproduced and debugged on host.    *
+ * Input is serial port log with "Trace: <hex>" lines after "c" command, or binary capture received over MQTT.      *
+ * The run is deterministic: the same capture and firmware give the same output, which is serial output of the      *
+ * device and simulation events marked by "#", all with virtual time in seconds since boot.                         *
+ * Capture keeps the last 512 events, so inputs are moved to start 10 s after boot, when the device is connected,   *
+ * unless -a is given or they start earlier. Multicast announcements, ESP-NOW and MQTT-SN are not simulated.        *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * With -s, scenario script (see scenarios folder) gives inputs and network faults: lost and delayed TCP segments,  *
+ * partitions, access point and MQTT server outages. The device should show on-air status of the last input; time   *
+ * of wrong LED state and recovery after each fault (the server hears from the device again and the LED is right)   *
+ * are reported, the exit code is 2 when the device did not recover.                                                *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * With -k, soak runs the device for days of virtual time from one hour before millis() wraps around (49.7 days     *
+ * after boot), with button held and released and one fault after another at random times, all given by the seed.   *
+ * Each day the host heap in use, messages published by the device, MQTT connections and time of wrong status are   *
+ * reported. Host heap is allocated by the firmware and the simulation, ESP.getFreeHeap() does not change here.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Build: g++ -std=gnu++17 -O2 -Iinclude $(for d in ../Firmware/lib/[A-Z]*; do [ -d $d ] && echo -I$d; done) \      *
+ *        -o onair-sim *.cpp ../Firmware/src/main.cpp $(find ../Firmware/lib -name '*.cpp')                         *
+ * Usage: onair-sim [-a] [-d seconds] [-q] [-v] [-s scenario | -k days [-r seed] | capture]                         *
+ ********************************************************************************************************************/
+
+#include "Simulator.h"
+#include <Config.h>
+#include <Trace.h>
+
+#include <malloc.h>
+#include <math.h>
+#include <unistd.h>
+
+/* Configuration ****************************************************************************************************/
+
+#define REPLAY_START 10000000 // us; time of the first replayed input, unless inputs are replayed at recorded times
+#define REPLAY_TAIL 60000000  // us; how long the simulation runs after the last input, unless duration is given
+#define TOPIC_CONFIG "onair/config"           // Must match MQTT_TOPIC_CONFIG of the firmware
+#define TOPIC_MAINTENANCE "onair/maintenance" // Must match MQTT_TOPIC_MAINTENANCE of the firmware
+#define BUTTON_PIN 33                         // Must match BUTTON_PIN of the firmware
+#define SOAK_WRAP (4294967296ULL * 1000)     // us; time when millis() wraps around
+#define SOAK_BEFORE_WRAP 3600000000ULL         // us; soak starts this long before the wraparound
+#define SOAK_START (SOAK_WRAP - SOAK_BEFORE_WRAP) // us; time of boot in soak
+#define SOAK_DAY 86400000000ULL                // us; interval of soak reports
+#define SOAK_ON_AIR 3600                       // s; mean time the button is held (on air)
+#define SOAK_OFF_AIR 10800                     // s; mean time between on-air periods
+#define SOAK_FAULT_INTERVAL 7200               // s; mean time between faults
+#define SOAK_FAULT_MAX 300                     // s; longest fault
+#define SOAK_LINK_DOWN_MAX 30                  // s; longest WiFi outage, longer one would restart the device
+
+/* Firmware *********************************************************************************************************/
+
+void setup();
+void loop();
+extern bool isOnAir;
+extern Config config;
+
+/* Capture **********************************************************************************************************/
+
+struct Input
+{
+  uint64_t time; // us since boot, unwrapped
+  uint8_t type;  // TRACE_GPIO, TRACE_WIFI or TRACE_MESSAGE
+  uint8_t arg;
+  uint16_t value;
+  std::string data; // Payload of message
+};
+
+static int hexDigit(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+// Serial log contains other lines too, only the hex after "Trace: " is taken
+static std::vector<uint8_t> parseLog(const std::string &text)
+{
+  std::vector<uint8_t> data;
+  size_t pos = 0;
+  while ((pos = text.find("Trace: ", pos)) != std::string::npos)
+  {
+    pos += 7;
+    while (pos + 1 < text.size() && hexDigit(text[pos]) >= 0 && hexDigit(text[pos + 1]) >= 0)
+    {
+      data.push_back(hexDigit(text[pos]) << 4 | hexDigit(text[pos + 1]));
+      pos += 2;
+    }
+  }
+  return data;
+}
+
+// Time is lower 32 bits of us since boot, clock events keep the events less than one wraparound apart
+// Payload of message follows in data events, the oldest ones may have been overwritten, then the message is skipped;
+// configuration is captured without payload, so it's skipped too and the simulation runs with default settings
+static std::vector<Input> parseInputs(const std::vector<uint8_t> &data, size_t &skipped)
+{
+  std::vector<Input> inputs;
+  uint32_t previous = 0;
+  uint64_t wraps = 0;
+  skipped = 0;
+  for (size_t pos = 0; pos + sizeof(TraceEvent) <= data.size(); pos += sizeof(TraceEvent))
+  {
+    const uint8_t *p = data.data() + pos;
+    uint32_t time = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+    if (pos > 0 && time < previous)
+      wraps++;
+    previous = time;
+    Input input = {(wraps << 32) + time, p[4], p[5], (uint16_t)(p[6] | p[7] << 8), ""};
+    switch (input.type)
+    {
+    case TRACE_GPIO:
+    case TRACE_WIFI:
+      inputs.push_back(input);
+      break;
+    case TRACE_MESSAGE:
+      inputs.push_back(input);
+      break;
+    case TRACE_DATA:
+      if (!inputs.empty() && inputs.back().type == TRACE_MESSAGE && inputs.back().data.size() < inputs.back().value)
+      {
+        inputs.back().data += (char)input.arg;
+        inputs.back().data += (char)(input.value & 0xFF);
+        inputs.back().data += (char)(input.value >> 8);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+
+  // Data events carry 3 bytes each, so the last one may be padded
+  for (size_t i = 0; i < inputs.size();)
+  {
+    Input &input = inputs[i];
+    if (input.type == TRACE_MESSAGE && input.data.size() < input.value)
+    {
+      skipped++;
+      inputs.erase(inputs.begin() + i);
+      continue;
+    }
+    if (input.type == TRACE_MESSAGE)
+      input.data.resize(input.value);
+    i++;
+  }
+  return inputs;
+}
+
+static bool loadCapture(const char *path, std::vector<Input> &inputs, size_t &skipped)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    perror("Cannot open capture");
+    return false;
+  }
+  std::string content;
+  char buffer[4096];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    content.append(buffer, size);
+  fclose(file);
+
+  // Serial log is recognized by trace lines, anything else is binary capture
+  std::vector<uint8_t> data = content.find("Trace: ") != std::string::npos ? parseLog(content) : std::vector<uint8_t>(content.begin(), content.end());
+  inputs = parseInputs(data, skipped);
+  return true;
+}
+
+/* Metrics **********************************************************************************************************/
+
+// Fault of the network, the device recovers when the server hears from it again and it shows the right status
+struct Fault
+{
+  std::string name;
+  uint64_t start;                  // us
+  uint64_t end = UINT64_MAX;       // us; UINT64_MAX until the fault is over
+  uint64_t recovered = UINT64_MAX; // us
+};
+
+static std::vector<Fault> faults;
+static bool expected = false;             // The device should be on air, as the last input says
+static uint64_t measureFrom = UINT64_MAX; // us; status is not measured before the first input
+static int ledLevel = LOW;
+static bool wrong = false;        // LED shows other status than expected
+static uint64_t wrongSince = 0;   // us
+static uint64_t wrongTime = 0;    // us
+static uint64_t longestWrong = 0; // us
+static bool online = false;       // The device has a session on the server
+static uint64_t lastHeard = 0;    // us; last packet from the device
+static size_t connections = 0;    // MQTT connections of the device
+static size_t messages = 0;       // Messages published by the device
+
+// LED is wrong when on-air status differs, or when it's lit (connecting) while the device should be off air
+static void observe()
+{
+  bool now = simTime() >= measureFrom && (isOnAir != expected || (!expected && ledLevel == HIGH));
+  if (now && !wrong)
+    wrongSince = simTime();
+  if (!now && wrong)
+  {
+    wrongTime += simTime() - wrongSince;
+    longestWrong = std::max(longestWrong, simTime() - wrongSince);
+  }
+  wrong = now;
+  for (Fault &fault : faults)
+  {
+    if (fault.recovered == UINT64_MAX && simTime() >= fault.end && online && lastHeard >= fault.end && !wrong)
+      fault.recovered = simTime();
+  }
+}
+
+// Time of wrong status including the current period
+static uint64_t wrongSoFar()
+{
+  return wrongTime + (wrong ? simTime() - wrongSince : 0);
+}
+
+static void faultStarted(const std::string &name, uint64_t duration)
+{
+  Fault fault;
+  fault.name = name;
+  fault.start = simTime();
+  if (duration != UINT64_MAX)
+  {
+    fault.end = simTime() + duration;
+    simAt(fault.end, observe);
+  }
+  faults.push_back(fault);
+}
+
+static void faultEnded(const std::string &name)
+{
+  for (Fault &fault : faults)
+  {
+    if (fault.name == name && fault.end == UINT64_MAX)
+      fault.end = simTime();
+  }
+  observe();
+}
+
+/* Replay ***********************************************************************************************************/
+
+static uint64_t lastInput = 0; // us; time of the last replayed input, reaction times are measured from it
+static size_t replayed = 0;
+
+static const char *topicOf(uint8_t code)
+{
+  switch (code)
+  {
+  case TRACE_TOPIC_STATUS:
+    return config.get().mqttTopicStatus;
+  case TRACE_TOPIC_CONFIG:
+    return TOPIC_CONFIG;
+  case TRACE_TOPIC_MAINTENANCE:
+    return TOPIC_MAINTENANCE;
+  default:
+    return NULL;
+  }
+}
+
+// Link goes up so that the device is associated at the recorded time of its connection
+static void replay(const Input &input)
+{
+  switch (input.type)
+  {
+  case TRACE_GPIO:
+    simLog("Input: GPIO %u %s", input.arg, input.value ? "high" : "low");
+    simSetPin(input.arg, input.value ? HIGH : LOW);
+    if (input.arg == BUTTON_PIN)
+      expected = !input.value;
+    break;
+  case TRACE_WIFI:
+    if (input.arg == TRACE_WIFI_DISCONNECTED && simLink())
+    {
+      simLog("Input: WiFi link down");
+      simSetLink(false);
+      faultStarted("link down", UINT64_MAX);
+    }
+    else if (input.arg == TRACE_WIFI_CONNECTED && !simLink())
+    {
+      simLog("Input: WiFi link up");
+      simSetLink(true);
+      faultEnded("link down");
+    }
+    else
+    {
+      return;
+    }
+    break;
+  case TRACE_MESSAGE:
+  {
+    // Config message is retained, so it's received again on every connection
+    const char *topic = topicOf(input.arg);
+    if (topic == NULL)
+      return;
+    simLog("Input: message to %s \"%.40s\"", topic, input.data.c_str());
+    simMqttServer.publish(topic, input.data, input.arg == TRACE_TOPIC_CONFIG);
+    if (input.arg == TRACE_TOPIC_STATUS)
+      expected = input.data == "1";
+    break;
+  }
+  }
+  lastInput = simTime();
+  measureFrom = std::min(measureFrom, simTime());
+  replayed++;
+  observe();
+}
+
+static void schedule(const std::vector<Input> &inputs, uint64_t offset)
+{
+  for (const Input &input : inputs)
+  {
+    uint64_t time = input.time - offset;
+    if (input.type == TRACE_WIFI && input.arg == TRACE_WIFI_CONNECTED)
+      time = time > SIM_CONNECT_TIME ? time - SIM_CONNECT_TIME : 0;
+    simAt(time, [input]() { replay(input); });
+  }
+}
+
+/* Scenario *********************************************************************************************************/
+
+// Schedules command at time (us), returns false when it's not valid; command is one of:
+//   press, release            button (GPIO BUTTON_PIN) low or high
+//   status <payload>          message from another client to the status topic
+//   config <settings>         retained message to the config topic, the rest of line is the payload
+//   link down, link up        access point is not reachable or reachable again
+//   loss <probability>        TCP segments are lost, retransmitted after timeout
+//   latency <ms> [<ms>]       one way latency and mean of random delay added to it
+//   spike <probability> <ms>  TCP segments are delayed by spike
+//   partition <seconds>       nothing gets through to the server
+//   restart <seconds> [clean] server is down, sessions and retained messages are lost when clean
+//   seed <number>             seed of random faults
+static bool scheduleCommand(uint64_t time, const std::string &name, const std::string &rest)
+{
+  double first = 0;
+  double second = 0;
+  int count = sscanf(rest.c_str(), "%lf %lf", &first, &second);
+  Input input = {time, 0, 0, 0, ""};
+  if (name == "press" || name == "release")
+  {
+    input.type = TRACE_GPIO;
+    input.arg = BUTTON_PIN;
+    input.value = name == "release";
+    simAt(time, [input]() { replay(input); });
+  }
+  else if (name == "status" || name == "config")
+  {
+    input.type = TRACE_MESSAGE;
+    input.arg = name == "status" ? TRACE_TOPIC_STATUS : TRACE_TOPIC_CONFIG;
+    input.data = rest;
+    simAt(time, [input]() { replay(input); });
+  }
+  else if (name == "link" && (rest == "down" || rest == "up"))
+  {
+    input.type = TRACE_WIFI;
+    input.arg = rest == "up" ? TRACE_WIFI_CONNECTED : TRACE_WIFI_DISCONNECTED;
+    simAt(time, [input]() { replay(input); });
+  }
+  else if (name == "loss" && count == 1 && first >= 0 && first < 1)
+  {
+    simAt(time, [first]() {
+      simLog("Fault: %.1f%% of TCP segments lost", first * 100);
+      simFaults.loss = first;
+    });
+  }
+  else if (name == "latency" && count >= 1 && first >= 0 && second >= 0)
+  {
+    simAt(time, [first, second, count]() {
+      simLog("Fault: latency %.1f ms, random delay %.1f ms on average", first, count == 2 ? second : 0.0);
+      simFaults.latency = (uint64_t)(first * 1000);
+      simFaults.jitter = count == 2 ? (uint64_t)(second * 1000) : 0;
+    });
+  }
+  else if (name == "spike" && count == 2 && first >= 0 && first < 1 && second >= 0)
+  {
+    simAt(time, [first, second]() {
+      simLog("Fault: %.1f%% of TCP segments delayed by %.1f ms", first * 100, second);
+      simFaults.spikeChance = first;
+      simFaults.spike = (uint64_t)(second * 1000);
+    });
+  }
+  else if (name == "partition" && count == 1 && first > 0)
+  {
+    simAt(time, [first]() {
+      simLog("Fault: partition for %.1f s", first);
+      simPartition((uint64_t)(first * 1e6));
+      faultStarted("partition", (uint64_t)(first * 1e6));
+    });
+  }
+  else if (name == "restart" && count >= 1 && first > 0)
+  {
+    bool clean = rest.find("clean") != std::string::npos;
+    simAt(time, [first, clean]() {
+      simLog("Fault: server restart, down for %.1f s%s", first, clean ? ", sessions lost" : "");
+      simMqttServer.restart((uint64_t)(first * 1e6), !clean);
+      faultStarted("server restart", (uint64_t)(first * 1e6));
+    });
+  }
+  else if (name == "seed" && count == 1)
+  {
+    uint32_t seed = (uint32_t)first;
+    simAt(time, [seed]() { simSeedFaults(seed); });
+  }
+  else
+  {
+    return false;
+  }
+  return true;
+}
+
+// Line is "<seconds> <command> [arguments]", where command is one of scheduleCommand() or "end", when the simulation
+// ends. Empty lines and lines starting with "#" are skipped; returns time of end, 0 when there's an error
+static uint64_t loadScenario(const char *path)
+{
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+  {
+    perror("Cannot open scenario");
+    return 0;
+  }
+  uint64_t end = 0;
+  char line[256];
+  for (int number = 1; fgets(line, sizeof(line), file) != NULL; number++)
+  {
+    line[strcspn(line, "\r\n")] = 0;
+    char command[16] = "";
+    double seconds = 0;
+    int consumed = 0;
+    if (line[strspn(line, " \t")] == 0 || line[strspn(line, " \t")] == '#')
+      continue;
+    if (sscanf(line, "%lf %15s %n", &seconds, command, &consumed) < 2 || seconds < 0)
+    {
+      fprintf(stderr, "%s:%d: expected time and command\n", path, number);
+      fclose(file);
+      return 0;
+    }
+    uint64_t time = (uint64_t)(seconds * 1e6);
+    std::string name = command;
+    std::string rest = line + consumed;
+    if (name == "end" && rest.empty())
+    {
+      end = time;
+    }
+    else if (!scheduleCommand(time, name, rest))
+    {
+      fprintf(stderr, "%s:%d: invalid command \"%s\"\n", path, number, line + strspn(line, " \t"));
+      fclose(file);
+      return 0;
+    }
+  }
+  fclose(file);
+  if (end == 0)
+    fprintf(stderr, "%s: missing end\n", path);
+  return end;
+}
+
+/* Soak *************************************************************************************************************/
+
+// Own generator, so the schedule does not change random values seen by the firmware or faults
+static uint32_t soakState = 0x9E3779B9;
+static uint64_t soakEnd = 0;       // us
+static bool soakPressed = false;   // Button is held
+static size_t soakHeap = 0;        // bytes; host heap in use when the device is connected after boot
+static uint64_t soakWrapWrong = 0; // us; time of wrong status when millis() wrapped around
+
+static double soakRandom()
+{
+  soakState ^= soakState << 13;
+  soakState ^= soakState >> 17;
+  soakState ^= soakState << 5;
+  return soakState / 4294967296.0;
+}
+
+// Exponentially distributed interval with mean in seconds, returns us
+static uint64_t soakInterval(double mean)
+{
+  return (uint64_t)(-log(1 - soakRandom()) * mean * 1e6);
+}
+
+// Memory allocated on host, by the firmware and by the simulated network; ESP.getFreeHeap() does not change
+static size_t heapInUse()
+{
+  return mallinfo2().uordblks;
+}
+
+static void soakReport()
+{
+  unsigned day = (simTime() - SOAK_START) / SOAK_DAY;
+  simLog("Day %u: host heap %zu bytes in use (%+lld since boot), %zu messages published, %zu MQTT connections, wrong %.3f s", day,
+         heapInUse(), (long long)heapInUse() - (long long)soakHeap, messages, connections, wrongSoFar() / 1e6);
+  if (simTime() + SOAK_DAY <= soakEnd)
+    simAt(simTime() + SOAK_DAY, soakReport);
+}
+
+// Button is held during on-air periods; each press or release schedules the next one, so the schedule does not take
+// host heap
+static void soakButton()
+{
+  uint64_t time = simTime() + soakInterval(soakPressed ? SOAK_ON_AIR : SOAK_OFF_AIR);
+  if (time >= soakEnd)
+    return;
+  soakPressed = !soakPressed;
+  scheduleCommand(time, soakPressed ? "press" : "release", "");
+  simAt(time, soakButton);
+}
+
+// One fault at a time, the next one is scheduled when it ends; the device should recover before the soak ends
+static void soakFault()
+{
+  uint64_t time = simTime() + soakInterval(SOAK_FAULT_INTERVAL);
+  if (time + SOAK_FAULT_MAX * 1000000ULL + REPLAY_TAIL >= soakEnd)
+    return;
+  double length = 1 + soakRandom() * (SOAK_FAULT_MAX - 1); // s
+  char text[32];
+  switch ((int)(soakRandom() * 4))
+  {
+  case 0:
+    length = std::min(length, (double)SOAK_LINK_DOWN_MAX);
+    scheduleCommand(time, "link", "down");
+    scheduleCommand(time + (uint64_t)(length * 1e6), "link", "up");
+    break;
+  case 1:
+    snprintf(text, sizeof(text), "%.1f", length);
+    scheduleCommand(time, "partition", text);
+    break;
+  case 2:
+    snprintf(text, sizeof(text), "%.1f%s", length, soakRandom() < 0.25 ? " clean" : "");
+    scheduleCommand(time, "restart", text);
+    break;
+  default:
+    scheduleCommand(time, "loss", "0.2");
+    scheduleCommand(time, "latency", "50 100");
+    scheduleCommand(time + (uint64_t)(length * 1e6), "loss", "0");
+    scheduleCommand(time + (uint64_t)(length * 1e6), "latency", "0");
+    break;
+  }
+  simAt(time + (uint64_t)(length * 1e6), soakFault);
+}
+
+// Button and faults are scenario commands, so a part of the logged soak can be repeated as scenario
+static void scheduleSoak(uint64_t end, uint32_t seed)
+{
+  soakState = seed != 0 ? seed : 0x9E3779B9;
+  soakEnd = end;
+
+  // Growing list of faults would show up as heap used by the firmware
+  faults.reserve(2 * (end - SOAK_START) / (SOAK_FAULT_INTERVAL * 1000000ULL) + 16);
+  scheduleCommand(SOAK_START, "seed", std::to_string(seed));
+  simAt(SOAK_START + REPLAY_START, []() {
+    soakHeap = heapInUse();
+    soakButton();
+    soakFault();
+  });
+  if (SOAK_START + SOAK_DAY <= end)
+    simAt(SOAK_START + SOAK_DAY, soakReport);
+
+  // Timers compare millis() values, so they must work across its wraparound
+  if (SOAK_WRAP + SOAK_BEFORE_WRAP <= end)
+  {
+    simAt(SOAK_WRAP, []() {
+      simLog("millis() wrapped around to %u", (unsigned)millis());
+      soakWrapWrong = wrongSoFar();
+    });
+    simAt(SOAK_WRAP + SOAK_BEFORE_WRAP, []() {
+      simLog("Wrong %.3f s in %.0f s after millis() wrapped around", (wrongSoFar() - soakWrapWrong) / 1e6, SOAK_BEFORE_WRAP / 1e6);
+    });
+  }
+}
+
+/* Main *************************************************************************************************************/
+
+static void usage()
+{
+  fprintf(stderr, "Usage: onair-sim [-a] [-d seconds] [-q] [-v] [-s scenario | -k days [-r seed] | capture]\n");
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  bool absolute = false;
+  bool verbose = false;
+  const char *scenario = NULL;
+  uint64_t duration = 0;
+  unsigned soakDays = 0;
+  uint32_t seed = 1;
+  int option;
+  while ((option = getopt(argc, argv, "ad:k:qr:s:v")) != -1)
+  {
+    switch (option)
+    {
+    case 'a':
+      absolute = true;
+      break;
+    case 'd':
+      duration = strtoull(optarg, NULL, 10) * 1000000;
+      break;
+    case 'k':
+      soakDays = strtoul(optarg, NULL, 10);
+      break;
+    case 'q':
+      simQuiet = true;
+      break;
+    case 'r':
+      seed = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      scenario = optarg;
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind > (scenario == NULL && soakDays == 0 ? 1 : 0) || (scenario != NULL && soakDays > 0))
+    usage();
+
+  // Soak runs on the clock moved close to millis() wraparound, as if the device was booted long ago
+  uint64_t start = 0;
+  if (soakDays > 0)
+  {
+    start = SOAK_START;
+    simAdvance(start);
+    duration = start + soakDays * SOAK_DAY;
+    simLog("Soak for %u days, seed %u", soakDays, seed);
+    scheduleSoak(duration, seed);
+  }
+  else if (scenario != NULL)
+  {
+    uint64_t end = loadScenario(scenario);
+    if (end == 0)
+      return 1;
+    if (duration == 0)
+      duration = end;
+  }
+  else
+  {
+    // Inputs of other types than messages do not need configuration, so unknown topics are skipped now
+    std::vector<Input> inputs;
+    size_t skipped = 0;
+    if (optind < argc && !loadCapture(argv[optind], inputs, skipped))
+      return 1;
+    for (size_t i = 0; i < inputs.size();)
+    {
+      if (inputs[i].type == TRACE_MESSAGE && inputs[i].arg == TRACE_TOPIC_OTHER)
+      {
+        skipped++;
+        inputs.erase(inputs.begin() + i);
+        continue;
+      }
+      i++;
+    }
+    uint64_t offset = !absolute && !inputs.empty() && inputs.front().time > REPLAY_START ? inputs.front().time - REPLAY_START : 0;
+    if (duration == 0)
+      duration = (inputs.empty() ? 0 : inputs.back().time - offset) + REPLAY_TAIL;
+    if (optind < argc)
+      simLog("Replaying %zu inputs (%zu skipped), shifted by %.3f s", inputs.size(), skipped, offset / 1e6);
+    schedule(inputs, offset);
+  }
+
+  // Simulated world reports what the device does
+  uint64_t ledOnSince = 0;
+  uint64_t ledOnTime = 0;
+  simPinChanged = [&](uint8_t pin, int level) {
+    if (pin != LED_BUILTIN)
+      return;
+    if (verbose)
+      simLog("LED %s", level ? "on" : "off");
+    if (level && !ledLevel)
+      ledOnSince = simTime();
+    if (!level && ledLevel)
+      ledOnTime += simTime() - ledOnSince;
+    ledLevel = level;
+    observe();
+  };
+  simMqttServer.sessionChanged = [&](const std::string &clientId, bool connected) {
+    connections += connected;
+    online = connected;
+    simLog("MQTT server: %s %s", clientId.c_str(), connected ? "connected" : "disconnected");
+    observe();
+  };
+  simMqttServer.published = [&](const std::string &clientId, const SimMessage &message) {
+    messages++;
+    if (verbose)
+      simLog("MQTT server: %s published to %s (%zu bytes)", clientId.c_str(), message.topic.c_str(), message.payload.size());
+  };
+  simMqttServer.heard = [&](const std::string &) {
+    lastHeard = simTime();
+    observe();
+  };
+
+  // On-air status is checked whenever the firmware waits, so the time of change is exact
+  bool onAir = false;
+  size_t onAirChanges = 0;
+  simWaiting = [&]() {
+    if (isOnAir != onAir)
+    {
+      onAir = isOnAir;
+      onAirChanges++;
+      simLog("On air %s, %.3f s after last input", onAir ? "ON" : "OFF", (simTime() - lastInput) / 1e6);
+    }
+    observe();
+  };
+
+  // Access point is known after setup loads the configuration, the device finds it when its first scan finishes
+  bool restarted = false;
+  try
+  {
+    setup();
+    simAddAccessPoint(config.get().wifiSsid, SIM_RSSI, 1);
+    while (simTime() < duration)
+    {
+      loop();
+      simAdvance(SIM_LOOP_TIME);
+    }
+  }
+  catch (const SimRestart &)
+  {
+    simLog("Device restarted, simulation ends");
+    restarted = true;
+  }
+
+  // Wrong status lasting until the end is counted too
+  observe();
+  if (wrong)
+  {
+    wrongTime += simTime() - wrongSince;
+    longestWrong = std::max(longestWrong, simTime() - wrongSince);
+  }
+  bool unrecovered = false;
+  uint64_t longestRecovery = 0;
+  for (const Fault &fault : faults)
+  {
+    if (fault.recovered != UINT64_MAX)
+      longestRecovery = std::max(longestRecovery, fault.recovered - fault.end);
+    if (fault.recovered != UINT64_MAX && soakDays == 0)
+      simLog("Fault %s at %.3f s: recovered %.3f s after it ended", fault.name.c_str(), fault.start / 1e6, (fault.recovered - fault.end) / 1e6);
+    else if (fault.recovered == UINT64_MAX)
+      simLog("Fault %s at %.3f s: not recovered", fault.name.c_str(), fault.start / 1e6);
+    unrecovered = unrecovered || fault.recovered == UINT64_MAX;
+  }
+  if (ledLevel)
+    ledOnTime += simTime() - ledOnSince;
+  if (soakDays > 0)
+    simLog("Soak: %zu faults, longest recovery %.3f s, %zu messages published, host heap %zu bytes after boot and %zu at the end",
+           faults.size(), longestRecovery / 1e6, messages, soakHeap, heapInUse());
+  simLog("Summary: %zu inputs replayed, %zu on-air changes, %zu MQTT connections, LED on %.1f%% of time, wrong %.3f s (longest %.3f s)%s",
+         replayed, onAirChanges, connections, simTime() > start ? ledOnTime * 100.0 / (simTime() - start) : 0.0, wrongTime / 1e6, longestWrong / 1e6,
+         restarted ? ", restarted" : "");
+  return unrecovered ? 2 : 0;
+}
@@ -0,0 +1,268 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator                                                                                 *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Runs the unchanged firmware on host, against simulated Arduino core (include folder), WiFi and MQTT server. All  *
+ * of them use a virtual clock, which moves only when the firmware waits (delay) and by fixed time per loop, so a   *
+ * run does not depend on host speed or timing and hours of device time take seconds. Scheduled actions (network   *
+ * packets, replayed inputs) run in time order while the clock moves, like interrupts and other tasks on device.    *
+ * This header is the interface of the simulated world, used by the simulated core and by the driver.               *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+#include <esp_wifi.h>
+
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* Configuration - may be overriden by build flags ******************************************************************/
+
+#ifndef SIM_LOOP_TIME
+#define SIM_LOOP_TIME 1000 // us; time of single loop() run besides waiting
+#endif
+#ifndef SIM_LATENCY
+#define SIM_LATENCY 5000 // us; one way network latency between the device and MQTT server
+#endif
+#ifndef SIM_CONNECT_TIME
+#define SIM_CONNECT_TIME 600000 // us; time of association with access point (WiFi connected event after begin)
+#endif
+#ifndef SIM_DHCP_TIME
+#define SIM_DHCP_TIME 400000 // us; time of getting address from DHCP server (got IP event after connected)
+#endif
+#ifndef SIM_SCAN_TIME
+#define SIM_SCAN_TIME 1500000 // us; time of WiFi scan
+#endif
+#ifndef SIM_TLS_TIME
+#define SIM_TLS_TIME 800000 // us; time of TLS handshake, the firmware is blocked meanwhile
+#endif
+#ifndef SIM_RTO
+#define SIM_RTO 500000 // us; TCP retransmission timeout, backs off like lwIP and gives up after 12 retransmissions
+#endif
+#ifndef SIM_CONNECT_TIMEOUT
+#define SIM_CONNECT_TIMEOUT 3000000 // us; WiFiClient connect timeout, when SYN or its answer is lost
+#endif
+#ifndef SIM_HANDSHAKE_TIMEOUT
+#define SIM_HANDSHAKE_TIMEOUT 120000000 // us; WiFiClientSecure handshake timeout, the firmware is blocked meanwhile
+#endif
+#ifndef SIM_RSSI
+#define SIM_RSSI -60 // dBm; signal strength of the access point
+#endif
+#ifndef SIM_EPOCH
+#define SIM_EPOCH 1767225600 // s; wall clock time at boot (2026-01-01 00:00:00 UTC)
+#endif
+
+/* Virtual clock ****************************************************************************************************/
+
+// us since boot
+uint64_t simTime();
+
+// Moves the clock, actions scheduled until then are run in time order
+void simAdvance(uint64_t duration);
+
+// Schedules action to run at time (us since boot), actions at the same time run in order of scheduling
+void simAt(uint64_t time, std::function<void()> action);
+inline void simAfter(uint64_t delay, std::function<void()> action) { simAt(simTime() + delay, action); }
+
+// Called whenever the firmware starts waiting, so its state can be observed at the exact time of a change
+extern std::function<void()> simWaiting;
+
+// Thrown by ESP.restart(), the firmware cannot continue after it
+struct SimRestart
+{
+};
+
+/* Log **************************************************************************************************************/
+
+// Serial output of the device is printed with virtual time, unless quiet
+extern bool simQuiet;
+
+// Prints event of the simulation with virtual time, marked by "#"
+void simLog(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+// Feeds characters to serial input of the device
+void simSerialInput(const char *text);
+
+/* GPIO *************************************************************************************************************/
+
+// Sets level of input pin, interrupt handler attached to the pin is called on matching edge
+void simSetPin(uint8_t pin, int level);
+
+// Called when the firmware changes level of output pin
+extern std::function<void(uint8_t pin, int level)> simPinChanged;
+
+// Pin keeps its level while the CPU sleeps (gpio_hold_en)
+bool simPinHeld(uint8_t pin);
+
+/* Power management *************************************************************************************************/
+
+// Only the requested state is simulated: sleep does not change timing, latency or any consumption figures, so power
+// management is checked by what the firmware asks for. It's not enabled by default, as in Arduino-ESP32 builds.
+extern bool simPowerManagement;
+
+// Sleep type last set for WiFi modem
+wifi_ps_type_t simWifiSleep();
+
+// CPU would run at full speed (power management is off or frequency lock is held)
+bool simCpuFullSpeed();
+
+// CPU would enter light sleep while waiting (enabled by configuration and no lock prevents it)
+bool simLightSleepAllowed();
+
+/* WiFi *************************************************************************************************************/
+
+// Access point is reachable; when the link goes down, the device is disconnected and its connections die
+void simSetLink(bool up);
+bool simLink();
+
+// Access point found by scan, the device connects to any SSID while the link is up
+void simAddAccessPoint(const char *ssid, int32_t rssi, uint8_t channel);
+
+/* Network faults ***************************************************************************************************/
+
+// Faults of the path between the access point and the MQTT server, applied to TCP segments in both directions;
+// DNS is answered by the access point, so it's not affected. Random values are deterministic for the seed.
+struct SimFaults
+{
+  double loss = 0;                // Probability that a segment is lost, TCP sends it again after retransmission timeout
+  uint64_t latency = SIM_LATENCY; // us; minimum one way latency
+  uint64_t jitter = 0;            // us; mean of random delay added to latency (exponential distribution)
+  double spikeChance = 0;         // Probability that a segment is delayed by spike
+  uint64_t spike = 0;             // us; delay of spike
+};
+extern SimFaults simFaults;
+
+// Seeds random generator of faults
+void simSeedFaults(uint32_t seed);
+
+// Nothing gets through the path for duration starting now, TCP retransmits meanwhile
+void simPartition(uint64_t duration);
+bool simPartitioned(uint64_t time);
+
+// Sends TCP segment at time, which is changed to time of arrival; returns false when TCP gives up retransmitting,
+// then time is when the connection is reset. Later segments never arrive before earlier ones (see SimPipe).
+bool simDeliver(uint64_t &time);
+
+/* Network connections **********************************************************************************************/
+
+// One direction of TCP connection, written data can be read after latency
+struct SimPipe
+{
+  struct Chunk
+  {
+    uint64_t time; // us; when the data arrives
+    std::vector<uint8_t> data;
+  };
+  std::deque<Chunk> chunks;
+  size_t offset = 0;   // Read position in the first chunk
+  bool failed = false; // TCP gave up retransmitting, data written later never arrives
+
+  void write(const uint8_t *buffer, size_t size, uint64_t time);
+  size_t available() const; // Bytes which arrived by now
+  size_t read(uint8_t *buffer, size_t size);
+  void clear();
+};
+
+// TCP connection between the device and MQTT server, or LAN client connected to server socket of the device; the
+// device always reads toClient and writes toServer
+struct SimConnection
+{
+  SimPipe toServer;
+  SimPipe toClient;
+  uint64_t closedAt = UINT64_MAX; // us; when the device learns that the connection was closed by server or reset
+  bool closedByClient = false;
+  bool broken = false;   // Link went down, nothing more is delivered
+  bool incoming = false; // Opened by LAN client, the device's writes do not go to MQTT server
+};
+
+// LAN client connects to server socket of the device (embedded broker), returns NULL when the device is not connected
+// to WiFi or does not listen on the port. The client writes to toClient and reads toServer, data arrive immediately,
+// without faults of the path to MQTT server. It closes the connection by setting closedAt to simTime().
+std::shared_ptr<SimConnection> simConnectDevice(uint16_t port);
+
+/* MQTT server ******************************************************************************************************/
+
+struct SimMessage
+{
+  std::string topic;
+  std::string payload;
+  uint8_t qos;
+  bool retain;
+  uint64_t expiry; // us; when the message expires, UINT64_MAX when never
+};
+
+// MQTT 3.1.1 and 5 server with retained messages, wills, persistent sessions (subscriptions and QoS 1 messages kept
+// while the client is away) and message expiry; QoS 2, topic aliases and authentication are not supported
+class SimMqttServer
+{
+public:
+  // Called by simulated WiFiClient; accept() returns false when the server is down
+  bool accept(const std::shared_ptr<SimConnection> &connection);
+  void receive(const std::shared_ptr<SimConnection> &connection);
+  void closed(const std::shared_ptr<SimConnection> &connection);
+
+  // Publishes message from another client (e.g. replayed input)
+  void publish(const std::string &topic, const std::string &payload, bool retain, uint8_t qos = 1);
+
+  // Closes all connections and refuses new ones for downtime; sessions are lost unless the server persists them
+  void restart(uint64_t downtime, bool keepSessions = true);
+  bool up() const { return simTime() >= _downUntil; }
+
+  // Called when a client publishes a message, when it connects or disconnects and when any packet comes from it
+  std::function<void(const std::string &clientId, const SimMessage &message)> published;
+  std::function<void(const std::string &clientId, bool connected)> sessionChanged;
+  std::function<void(const std::string &clientId)> heard;
+
+private:
+  struct Session
+  {
+    std::vector<std::pair<std::string, uint8_t>> subscriptions; // Topic filter and maximum QoS
+    std::map<uint16_t, SimMessage> inflight;                    // Sent QoS 1 messages waiting for PUBACK
+    std::deque<SimMessage> queue;                               // QoS 1 messages waiting for the client to come back
+    uint16_t nextPacketId = 1;
+    bool persistent = false;
+  };
+  struct Peer
+  {
+    std::shared_ptr<SimConnection> connection;
+    std::vector<uint8_t> buffer; // Received data not processed yet
+    std::string id;              // Empty until CONNECT is received
+    uint8_t version = 4;
+    uint16_t keepAlive = 0;  // s
+    uint64_t lastPacket = 0; // us
+    bool hasWill = false;
+    SimMessage will;
+    bool closed = false;
+  };
+
+  void process(Peer &peer, uint8_t header, const uint8_t *body, size_t length);
+  void onConnect(Peer &peer, const uint8_t *body, size_t length);
+  void onPublish(Peer &peer, uint8_t header, const uint8_t *body, size_t length);
+  void onSubscribe(Peer &peer, const uint8_t *body, size_t length);
+  void route(const SimMessage &message);
+  void deliver(Peer *peer, Session &session, const SimMessage &message, uint8_t qos, bool dup = false, uint16_t packetId = 0);
+  void send(Peer &peer, uint8_t header, const std::vector<uint8_t> &body);
+  void drop(Peer &peer, bool sendWill);
+  void checkKeepAlive();
+  Peer *find(const std::shared_ptr<SimConnection> &connection);
+  Peer *online(const std::string &id);
+
+  std::list<Peer> _peers;
+  std::map<std::string, Session> _sessions;
+  std::map<std::string, SimMessage> _retained;
+  uint64_t _downUntil = 0;
+  bool _checking = false; // Keep alive check is scheduled
+};
+
+extern SimMqttServer simMqttServer;
+
+// Topic matches filter with + and # wildcards
+bool simTopicMatches(const std::string &filter, const std::string &topic);
@@ -0,0 +1,129 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator: test transports                                                                *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "TestTransports.h"
+
+// Client implementations are included to compile them for the test transports, their own instantiations for device
+// transports are compiled with the firmware libraries
+#define MQTT_TEST_TRANSPORTS
+#include <MqttClient.cpp>
+#include <MqttSnClient.cpp>
+
+/* Loopback transport ***********************************************************************************************/
+
+size_t LoopbackTransport::Queue::push(const uint8_t *buffer, size_t size)
+{
+  size_t count = 0;
+  while (count < size && length < LOOPBACK_BUFFER_SIZE)
+  {
+    data[(start + length++) % LOOPBACK_BUFFER_SIZE] = buffer[count++];
+  }
+  return count;
+}
+
+size_t LoopbackTransport::Queue::pop(uint8_t *buffer, size_t size)
+{
+  size_t count = 0;
+  while (count < size && length > 0)
+  {
+    buffer[count++] = data[start];
+    start = (start + 1) % LOOPBACK_BUFFER_SIZE;
+    length--;
+  }
+  return count;
+}
+
+int LoopbackTransport::connect(const char *host, uint16_t port)
+{
+  _incoming.length = 0;
+  _outgoing.length = 0;
+  _connected = !_refused;
+  return _connected;
+}
+
+void LoopbackTransport::stop()
+{
+  _connected = false;
+  _incoming.length = 0;
+}
+
+int LoopbackTransport::read()
+{
+  uint8_t value;
+  return _incoming.pop(&value, 1) == 1 ? value : -1;
+}
+
+int LoopbackTransport::read(uint8_t *buffer, size_t size)
+{
+  return _incoming.pop(buffer, size);
+}
+
+size_t LoopbackTransport::write(const uint8_t *buffer, size_t size)
+{
+  return _connected ? _outgoing.push(buffer, size) : 0;
+}
+
+size_t LoopbackTransport::peerWrite(const uint8_t *buffer, size_t size)
+{
+  return _connected ? _incoming.push(buffer, size) : 0;
+}
+
+size_t LoopbackTransport::peerRead(uint8_t *buffer, size_t size)
+{
+  return _outgoing.pop(buffer, size);
+}
+
+/* Simulated radio **************************************************************************************************/
+
+void SimulatedRadio::join(SimulatedRadio &other)
+{
+  other._next = _next;
+  _next = &other;
+}
+
+bool SimulatedRadio::send(const uint8_t *header, size_t headerLength, const uint8_t *body, size_t bodyLength)
+{
+  if (headerLength + bodyLength > ESPNOW_FRAME_SIZE)
+    return false;
+
+  // Broadcast has no acknowledgement, so sending succeeds even if nobody receives the frame
+  for (SimulatedRadio *radio = _next; radio != this; radio = radio->_next)
+  {
+    if (radio->_loss == 0 || esp_random() % 100 >= radio->_loss)
+      radio->deliver(header, headerLength, body, bodyLength);
+  }
+  return true;
+}
+
+bool SimulatedRadio::deliver(const uint8_t *header, size_t headerLength, const uint8_t *body, size_t bodyLength)
+{
+  if (_count == SIMULATED_RADIO_QUEUE_SIZE)
+    return false;
+  Frame &frame = _frames[(_start + _count++) % SIMULATED_RADIO_QUEUE_SIZE];
+  frame.length = headerLength + bodyLength;
+  memcpy(frame.data, header, headerLength);
+  if (bodyLength > 0)
+    memcpy(frame.data + headerLength, body, bodyLength);
+  return true;
+}
+
+int SimulatedRadio::receive(uint8_t *buffer, size_t size)
+{
+  if (_count == 0)
+    return 0;
+  Frame &frame = _frames[_start];
+  _start = (_start + 1) % SIMULATED_RADIO_QUEUE_SIZE;
+  _count--;
+  size_t length = frame.length < size ? frame.length : size;
+  memcpy(buffer, frame.data, length);
+  return length;
+}
+
+/* Clients **********************************************************************************************************/
+
+template class MqttClient<LoopbackTransport>;
+template class MqttSnClient<SimulatedRadio>;
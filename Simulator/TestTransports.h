@@ -0,0 +1,97 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator: test transports                                                                *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * In-memory transports for host tests of the MQTT clients and announcements, they are not part of the firmware.    *
+ * The clients are compiled for them here, see the end of TestTransports.cpp.                                       *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Transport.h>
+
+/* Configuration - may be overriden by build flags ******************************************************************/
+
+#ifndef LOOPBACK_BUFFER_SIZE
+#define LOOPBACK_BUFFER_SIZE 512 // bytes; capacity of each direction of loopback transport
+#endif
+#ifndef SIMULATED_RADIO_QUEUE_SIZE
+#define SIMULATED_RADIO_QUEUE_SIZE 8 // number of frames waiting in each simulated radio
+#endif
+
+/* Stream transports ************************************************************************************************/
+
+// In-memory connection for testing and benchmarking the client without network; the other end is driven by
+// peerWrite() and peerRead(), e.g. by a simulated server
+class LoopbackTransport
+{
+public:
+  // Client side
+  int connect(const char *host, uint16_t port);
+  int connect(IPAddress address, uint16_t port, const char *host) { return connect(host, port); }
+  uint8_t connected() { return _connected; }
+  void stop();
+  int available() { return _incoming.length; }
+  int read();
+  int read(uint8_t *buffer, size_t size);
+  size_t write(const uint8_t *buffer, size_t size);
+
+  // Peer side
+  size_t peerWrite(const uint8_t *buffer, size_t size); // Sends data to the client, returns number of bytes stored
+  size_t peerRead(uint8_t *buffer, size_t size);        // Takes data written by the client
+  void peerClose() { _connected = false; }              // Simulates connection closed by the server
+  void setRefused(bool refused) { _refused = refused; } // Makes following connect() calls fail
+
+private:
+  struct Queue
+  {
+    uint8_t data[LOOPBACK_BUFFER_SIZE];
+    size_t start;
+    size_t length;
+    size_t push(const uint8_t *buffer, size_t size);
+    size_t pop(uint8_t *buffer, size_t size);
+  };
+
+  Queue _incoming = {};
+  Queue _outgoing = {};
+  bool _connected = false;
+  bool _refused = false;
+};
+
+/* Datagram transports **********************************************************************************************/
+
+// Broadcast radio simulated in memory, for running protocols built on datagram transports without hardware
+// Radios joined together receive each other's frames, each frame is lost with the given probability
+class SimulatedRadio
+{
+public:
+  void join(SimulatedRadio &other);
+  void setLoss(uint8_t percent) { _loss = percent; }
+  // Radios have no addresses, opening only drops frames received before (so it can stand in for MQTT-SN gateway)
+  bool open(const char *host, uint16_t port) { return open(IPAddress(), port); }
+  bool open(IPAddress address, uint16_t port)
+  {
+    _count = 0;
+    return true;
+  }
+  void close() { _count = 0; }
+  bool send(const uint8_t *header, size_t headerLength, const uint8_t *body, size_t bodyLength);
+  int receive(uint8_t *buffer, size_t size);
+
+private:
+  struct Frame
+  {
+    uint8_t length;
+    uint8_t data[ESPNOW_FRAME_SIZE];
+  };
+
+  bool deliver(const uint8_t *header, size_t headerLength, const uint8_t *body, size_t bodyLength);
+
+  SimulatedRadio *_next = this; // Radios joined together form a ring
+  Frame _frames[SIMULATED_RADIO_QUEUE_SIZE];
+  size_t _start = 0;
+  size_t _count = 0;
+  uint8_t _loss = 0;
+};
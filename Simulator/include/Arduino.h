@@ -0,0 +1,219 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator: Arduino core                                                                   *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * The part of Arduino-ESP32 core used by the firmware, implemented on the virtual clock of the simulator (see      *
+ * Simulator.h). Only what the firmware calls is here, with the same signatures, so the firmware builds unchanged.  *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include <freertos/FreeRTOS.h>
+
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define INPUT_PULLUP 0x05
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define LED_BUILTIN 2
+
+// Placement attributes of ESP32 have no meaning on host, RTC memory is ordinary memory zeroed at start
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define RTC_DATA_ATTR
+
+/* Time and GPIO ****************************************************************************************************/
+
+// Unsigned long has 32 bits on ESP32 but 64 bits on host, so these return uint32_t to wrap around like on the
+// device: millis() after 49.7 days and micros() after 71.6 minutes
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*handler)(void), int mode);
+void detachInterrupt(uint8_t pin);
+
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+uint32_t esp_random();
+uint32_t getCpuFrequencyMhz();
+
+// Added to glibc in 2.38
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+size_t strlcpy(char *target, const char *source, size_t size);
+#endif
+
+/* String ***********************************************************************************************************/
+
+class String
+{
+public:
+  String() {}
+  String(const char *value) : _value(value != NULL ? value : "") {}
+  String(const std::string &value) : _value(value) {}
+  String(char value) : _value(1, value) {}
+  String(int value) : _value(std::to_string(value)) {}
+  String(unsigned int value) : _value(std::to_string(value)) {}
+  String(long value) : _value(std::to_string(value)) {}
+  String(unsigned long value) : _value(std::to_string(value)) {}
+
+  const char *c_str() const { return _value.c_str(); }
+  unsigned int length() const { return _value.size(); }
+  bool isEmpty() const { return _value.empty(); }
+  char operator[](unsigned int index) const { return index < _value.size() ? _value[index] : 0; }
+
+  String &operator+=(const String &other)
+  {
+    _value += other._value;
+    return *this;
+  }
+  String operator+(const String &other) const { return String(_value + other._value); }
+  bool operator==(const String &other) const { return _value == other._value; }
+  bool operator!=(const String &other) const { return _value != other._value; }
+  bool equals(const String &other) const { return _value == other._value; }
+
+private:
+  std::string _value;
+};
+
+/* Print and Stream *************************************************************************************************/
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t value) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *text) { return write((const uint8_t *)text, strlen(text)); }
+
+  size_t print(const char *text) { return write(text); }
+  size_t print(const String &text) { return write(text.c_str()); }
+  size_t print(char value) { return write((uint8_t)value); }
+  size_t print(int value) { return printf("%d", value); }
+  size_t print(unsigned int value) { return printf("%u", value); }
+  size_t print(long value) { return printf("%ld", value); }
+  size_t print(unsigned long value) { return printf("%lu", value); }
+  size_t println() { return write("\r\n"); }
+  template <class T>
+  size_t println(const T &value) { return print(value) + println(); }
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() {}
+  size_t readBytes(uint8_t *buffer, size_t length);
+};
+
+// Output goes to the simulator log with virtual time, input is fed by the simulator
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long baud) {}
+  void end() {}
+  size_t write(uint8_t value) override;
+  using Print::write;
+  int available() override;
+  int read() override;
+  int peek() override;
+  operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+/* Network base classes *********************************************************************************************/
+
+class IPAddress
+{
+public:
+  IPAddress() {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : _address(a | b << 8 | c << 16 | (uint32_t)d << 24) {}
+  IPAddress(uint32_t address) : _address(address) {}
+
+  operator uint32_t() const { return _address; }
+  uint8_t operator[](int index) const { return _address >> (8 * index); }
+  bool operator==(const IPAddress &other) const { return _address == other._address; }
+  bool operator!=(const IPAddress &other) const { return _address != other._address; }
+
+  String toString() const;
+  bool fromString(const char *text);
+
+private:
+  uint32_t _address = 0;
+};
+
+class Client : public Stream
+{
+public:
+  virtual int connect(IPAddress address, uint16_t port) = 0;
+  virtual int connect(const char *host, uint16_t port) = 0;
+  virtual int read(uint8_t *buffer, size_t size) = 0;
+  virtual void stop() = 0;
+  virtual uint8_t connected() = 0;
+  virtual operator bool() = 0;
+  using Stream::read;
+};
+
+class UDP : public Stream
+{
+public:
+  virtual uint8_t begin(uint16_t port) = 0;
+  virtual void stop() = 0;
+  virtual int beginPacket(IPAddress address, uint16_t port) = 0;
+  virtual int beginPacket(const char *host, uint16_t port) = 0;
+  virtual int endPacket() = 0;
+  virtual int parsePacket() = 0;
+  virtual int read(unsigned char *buffer, size_t length) = 0;
+  virtual int read(char *buffer, size_t length) = 0;
+  virtual IPAddress remoteIP() = 0;
+  virtual uint16_t remotePort() = 0;
+  using Stream::read;
+};
+
+/* ESP **************************************************************************************************************/
+
+class EspClass
+{
+public:
+  [[noreturn]] void restart();
+  uint32_t getFreeHeap();
+  uint32_t getMinFreeHeap();
+  uint32_t getMaxAllocHeap();
+  uint32_t getHeapSize();
+  uint32_t getCycleCount();
+  uint32_t getCpuFreqMHz() { return getCpuFrequencyMhz(); }
+  uint64_t getEfuseMac();
+};
+
+extern EspClass ESP;
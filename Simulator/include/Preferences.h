@@ -0,0 +1,31 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator: preferences                                                                    *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Non-volatile storage in memory, kept for the whole run.                                                          *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+
+class Preferences
+{
+public:
+  bool begin(const char *name, bool readOnly = false, const char *partition = NULL);
+  void end() {}
+  bool clear();
+  bool isKey(const char *key);
+  bool remove(const char *key);
+  size_t putUInt(const char *key, uint32_t value) { return putBytes(key, &value, sizeof(value)); }
+  uint32_t getUInt(const char *key, uint32_t defaultValue = 0);
+  size_t putBytes(const char *key, const void *value, size_t length);
+  size_t getBytesLength(const char *key);
+  size_t getBytes(const char *key, void *buffer, size_t maxLength);
+
+private:
+  std::string _namespace;
+  bool _readOnly = false;
+};
@@ -0,0 +1,133 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator: WiFi                                                                           *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Station connected to a simulated access point, whose link the simulator takes down and up. TCP connections go to *
+ * the simulated MQTT server through simulated network faults (see simFaults) and die with the link. Server sockets *
+ * accept connections of simulated LAN clients (see simConnectDevice). The gateway answers DNS queries, all names   *
+ * resolve to the MQTT server. Other UDP datagrams (announcements, MQTT-SN) are sent nowhere.                       *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <Arduino.h>
+#include <esp_wifi.h>
+
+#include <memory>
+
+#define WL_IDLE_STATUS 0
+#define WL_NO_SSID_AVAIL 1
+#define WL_CONNECTED 3
+#define WL_CONNECT_FAILED 4
+#define WL_DISCONNECTED 6
+typedef int wl_status_t;
+
+#define WIFI_SCAN_RUNNING (-1)
+#define WIFI_SCAN_FAILED (-2)
+
+#define WIFI_OFF 0
+#define WIFI_STA 1
+#define WIFI_AP 2
+#define WIFI_AP_STA 3
+
+typedef enum
+{
+  ARDUINO_EVENT_WIFI_STA_START = 2,
+  ARDUINO_EVENT_WIFI_STA_STOP = 3,
+  ARDUINO_EVENT_WIFI_STA_CONNECTED = 4,
+  ARDUINO_EVENT_WIFI_STA_DISCONNECTED = 5,
+  ARDUINO_EVENT_WIFI_STA_GOT_IP = 7,
+  ARDUINO_EVENT_WIFI_STA_LOST_IP = 9,
+} arduino_event_id_t;
+
+typedef void (*WiFiEventCb)(arduino_event_id_t event);
+
+struct SimConnection;
+
+class WiFiClient : public Client
+{
+public:
+  int connect(IPAddress address, uint16_t port) override;
+  int connect(IPAddress address, uint16_t port, int32_t timeout) { return connect(address, port); }
+  int connect(const char *host, uint16_t port) override;
+  size_t write(uint8_t value) override { return write(&value, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override;
+  int available() override;
+  int read() override;
+  int read(uint8_t *buffer, size_t size) override;
+  int peek() override;
+  void flush() override {}
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override { return connected(); }
+  int setNoDelay(bool noDelay) { return 0; }
+
+  WiFiClient() {}
+  WiFiClient(const std::shared_ptr<SimConnection> &connection) : _connection(connection) {} // Accepted connection
+
+protected:
+  uint32_t _handshakeTime = 0; // us; time of blocking handshake after TCP connection (TLS)
+
+private:
+  std::shared_ptr<SimConnection> _connection;
+};
+
+// Accepts connections of simulated LAN clients
+class WiFiServer
+{
+public:
+  WiFiServer(uint16_t port, uint8_t maxClients = 4) : _port(port) {}
+  void begin();
+  void end();
+  bool hasClient();
+  WiFiClient available();
+  WiFiClient accept() { return available(); }
+  void setNoDelay(bool noDelay) {}
+
+private:
+  uint16_t _port;
+};
+
+class WiFiClass
+{
+public:
+  int onEvent(WiFiEventCb callback, arduino_event_id_t event);
+
+  bool mode(int mode) { return true; }
+  wl_status_t begin(const char *ssid, const char *password = NULL, int32_t channel = 0, const uint8_t *bssid = NULL, bool connect = true);
+  bool config(IPAddress address, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress(), IPAddress dns2 = IPAddress());
+  bool disconnect(bool wifiOff = false, bool eraseAp = false);
+  bool reconnect();
+  wl_status_t status();
+
+  bool setSleep(bool enabled) { return setSleep(enabled ? WIFI_PS_MIN_MODEM : WIFI_PS_NONE); }
+  bool setSleep(wifi_ps_type_t type) { return esp_wifi_set_ps(type) == ESP_OK; }
+  bool setAutoReconnect(bool autoReconnect) { return true; }
+  bool setHostname(const char *hostname) { return true; }
+  bool persistent(bool persistent) { return true; }
+
+  String macAddress();
+  uint8_t *macAddress(uint8_t *mac);
+  IPAddress localIP();
+  IPAddress gatewayIP();
+  IPAddress subnetMask();
+  IPAddress dnsIP(uint8_t index = 0);
+  String SSID();
+  uint8_t *BSSID();
+  int8_t RSSI();
+  int32_t channel();
+
+  int16_t scanNetworks(bool async = false, bool showHidden = false, bool passive = false, uint32_t maxMsPerChannel = 300, uint8_t channel = 0, const char *ssid = NULL, const uint8_t *bssid = NULL);
+  int16_t scanComplete();
+  void scanDelete();
+  String SSID(uint8_t index);
+  uint8_t *BSSID(uint8_t index);
+  int32_t RSSI(uint8_t index);
+  int32_t channel(uint8_t index);
+
+  int hostByName(const char *host, IPAddress &address);
+};
+
+extern WiFiClass WiFi;
@@ -0,0 +1,31 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator: WiFi TLS client                                                                *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * TLS handshake blocks the caller like on the device, the connection is then the same as a plain one.              *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <WiFi.h>
+
+class WiFiClientSecure : public WiFiClient
+{
+public:
+  WiFiClientSecure();
+  using WiFiClient::connect;
+  int connect(IPAddress address, uint16_t port, const char *host, const char *caCert, const char *cert, const char *privateKey)
+  {
+    return WiFiClient::connect(address, port);
+  }
+  void setInsecure() {}
+  void setCACert(const char *caCert) { _CA_cert = caCert; }
+  void setHandshakeTimeout(unsigned long timeout) {}
+
+protected:
+  const char *_CA_cert = NULL;
+  const char *_cert = NULL;
+  const char *_private_key = NULL;
+};
@@ -0,0 +1,51 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator: WiFi UDP                                                                       *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <WiFi.h>
+
+#include <deque>
+#include <vector>
+
+class WiFiUDP : public UDP
+{
+public:
+  uint8_t begin(uint16_t port) override { return 1; }
+  uint8_t begin(IPAddress address, uint16_t port) { return 1; }
+  uint8_t beginMulticast(IPAddress group, uint16_t port);
+  void stop() override;
+  int beginPacket(IPAddress address, uint16_t port) override;
+  int beginPacket(const char *host, uint16_t port) override;
+  int beginMulticastPacket() { return beginPacket(IPAddress(), 0); }
+  int endPacket() override;
+  size_t write(uint8_t value) override { return write(&value, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override;
+  int parsePacket() override;
+  int available() override { return _received.data.size() - _readPos; }
+  int read() override;
+  int read(unsigned char *buffer, size_t length) override;
+  int read(char *buffer, size_t length) override { return read((unsigned char *)buffer, length); }
+  int peek() override;
+  void flush() override {}
+  IPAddress remoteIP() override { return _received.address; }
+  uint16_t remotePort() override { return _received.port; }
+
+private:
+  struct Datagram
+  {
+    uint64_t time; // us; when the datagram arrives
+    IPAddress address;
+    uint16_t port;
+    std::vector<uint8_t> data;
+  };
+  std::deque<Datagram> _incoming;
+  Datagram _received = {};
+  size_t _readPos = 0;
+  Datagram _sending = {};
+  bool _open = false;
+};
@@ -0,0 +1,15 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator: GPIO driver                                                                    *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <esp_timer.h>
+
+typedef int gpio_num_t;
+
+esp_err_t gpio_hold_en(gpio_num_t pin);
+esp_err_t gpio_hold_dis(gpio_num_t pin);
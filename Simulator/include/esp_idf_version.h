@@ -0,0 +1,14 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator: ESP-IDF version                                                                *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * The simulated core is Arduino-ESP32 3.x, built on ESP-IDF 5.                                                     *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#define ESP_IDF_VERSION_MAJOR 5
+#define ESP_IDF_VERSION_MINOR 1
+#define ESP_IDF_VERSION_PATCH 0
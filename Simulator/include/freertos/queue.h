@@ -0,0 +1,18 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator: FreeRTOS queues                                                                *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Waiting for an item moves the virtual clock, so the items sent meanwhile by simulated interrupts can arrive.     *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+
+QueueHandle_t xQueueCreate(uint32_t length, uint32_t itemSize);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t timeout);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t timeout);
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t timeout);
+#define xQueueSendFromISR(queue, item, woken) xQueueSend(queue, item, 0)
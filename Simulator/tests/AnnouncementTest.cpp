@@ -0,0 +1,146 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator tests: status announcements                                                     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "Test.h"
+#include "TestTransports.h"
+#include <Announcement.h>
+
+/* Helpers **********************************************************************************************************/
+
+#define KEY "TestSharedKey"
+
+typedef AnnouncementChannel<SimulatedRadio> RadioChannel;
+
+// Receives single announcement and passes it through the filter, returns result of receive() or -1 when the filter
+// dropped valid announcement
+static int receive(RadioChannel &channel, AnnouncementFilter &filter, Announcement *announcement)
+{
+  int result = channel.receive(announcement);
+  if (result == ANNOUNCEMENT_VALID && !filter.accept(*announcement))
+    return -1;
+  return result;
+}
+
+// Takes raw datagram, like anybody listening on the network
+static std::vector<uint8_t> record(SimulatedRadio &radio)
+{
+  std::vector<uint8_t> datagram(ESPNOW_FRAME_SIZE);
+  datagram.resize(radio.receive(datagram.data(), datagram.size()));
+  return datagram;
+}
+
+static void replay(SimulatedRadio &radio, const std::vector<uint8_t> &datagram)
+{
+  radio.send(datagram.data(), datagram.size(), NULL, 0);
+}
+
+/* Tests ************************************************************************************************************/
+
+TEST(AnnouncementReachesAllSlaves)
+{
+  RadioChannel master(KEY), first(KEY), second(KEY);
+  master.transport().join(first.transport());
+  master.transport().join(second.transport());
+  AnnouncementFilter firstFilter, secondFilter;
+  Announcement announcement;
+
+  CHECK(master.send({true, 1, 1}));
+  CHECK(receive(first, firstFilter, &announcement) == ANNOUNCEMENT_VALID);
+  CHECK(announcement.onAir && announcement.boot == 1 && announcement.sequence == 1);
+  CHECK(receive(second, secondFilter, &announcement) == ANNOUNCEMENT_VALID);
+  CHECK(first.receive(&announcement) == ANNOUNCEMENT_NONE);
+
+  // Lost frames are not retransmitted
+  second.transport().setLoss(100);
+  CHECK(master.send({false, 1, 2}));
+  CHECK(receive(first, firstFilter, &announcement) == ANNOUNCEMENT_VALID);
+  CHECK(second.receive(&announcement) == ANNOUNCEMENT_NONE);
+}
+
+// Master sends each copy over all channels, the slave keeps the first one to arrive
+TEST(AnnouncementDuplicatesAreDropped)
+{
+  RadioChannel multicastMaster(KEY), multicastSlave(KEY), espNowMaster(KEY), espNowSlave(KEY);
+  multicastMaster.transport().join(multicastSlave.transport());
+  espNowMaster.transport().join(espNowSlave.transport());
+  AnnouncementFilter filter;
+  Announcement announcement;
+
+  for (uint32_t sequence = 1; sequence <= 3; sequence++)
+  {
+    multicastMaster.send({true, 1, sequence});
+    espNowMaster.send({true, 1, sequence});
+  }
+  CHECK(receive(espNowSlave, filter, &announcement) == ANNOUNCEMENT_VALID);
+  CHECK(receive(multicastSlave, filter, &announcement) == -1);
+  CHECK(receive(multicastSlave, filter, &announcement) == ANNOUNCEMENT_VALID);
+  CHECK(receive(espNowSlave, filter, &announcement) == -1);
+  CHECK(receive(multicastSlave, filter, &announcement) == ANNOUNCEMENT_VALID);
+  CHECK(receive(espNowSlave, filter, &announcement) == -1);
+  CHECK(announcement.sequence == 3);
+}
+
+TEST(AnnouncementWithWrongKeyIsInvalid)
+{
+  RadioChannel master(KEY), slave("OtherKey"), listener(KEY);
+  master.transport().join(slave.transport());
+  master.transport().join(listener.transport());
+  Announcement announcement;
+
+  CHECK(master.send({true, 1, 1}));
+  CHECK(slave.receive(&announcement) == ANNOUNCEMENT_INVALID);
+
+  // Changed status does not match the MAC
+  std::vector<uint8_t> datagram = record(listener.transport());
+  CHECK(datagram.size() == ANNOUNCEMENT_SIZE);
+  datagram[3] = '0';
+  replay(master.transport(), datagram);
+  CHECK(listener.receive(&announcement) == ANNOUNCEMENT_INVALID);
+
+  // Truncated datagram
+  datagram.pop_back();
+  replay(master.transport(), datagram);
+  CHECK(listener.receive(&announcement) == ANNOUNCEMENT_INVALID);
+}
+
+// Recorded announcements carry valid MAC, only boot and sequence numbers tell that they are old
+TEST(AnnouncementReplayIsRejected)
+{
+  RadioChannel master(KEY), slave(KEY);
+  SimulatedRadio attacker;
+  master.transport().join(slave.transport());
+  master.transport().join(attacker);
+  AnnouncementFilter filter;
+  Announcement announcement;
+
+  master.send({true, 5, 1});
+  std::vector<uint8_t> onAir = record(attacker);
+  CHECK(receive(slave, filter, &announcement) == ANNOUNCEMENT_VALID);
+  master.send({false, 5, 2});
+  std::vector<uint8_t> offAir = record(attacker);
+  CHECK(receive(slave, filter, &announcement) == ANNOUNCEMENT_VALID);
+
+  // Older sequence number of the same boot
+  replay(attacker, onAir);
+  CHECK(receive(slave, filter, &announcement) == -1);
+
+  // Master rebooted, announcements from its previous boot are old too
+  master.send({true, 6, 1});
+  CHECK(receive(slave, filter, &announcement) == ANNOUNCEMENT_VALID);
+  replay(attacker, offAir);
+  CHECK(receive(slave, filter, &announcement) == -1);
+}
+
+TEST(AnnouncementSequenceWrapsAround)
+{
+  AnnouncementFilter filter;
+  CHECK(filter.accept({true, 1, 0xFFFFFFFF}));
+  CHECK(filter.accept({false, 1, 0}));
+  CHECK(!filter.accept({true, 1, 0xFFFFFFFF}));
+  filter.reset();
+  CHECK(filter.accept({true, 1, 0xFFFFFFFF}));
+}
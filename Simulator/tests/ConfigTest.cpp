@@ -0,0 +1,102 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator tests: runtime configuration                                                    *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "Test.h"
+#include <Config.h>
+#include <Preferences.h>
+
+/* Helpers **********************************************************************************************************/
+
+static const Settings defaults = {
+    "OnAirNet", "password", "mqtt.example.com", 8883, "user", "secret", "onair/status", "onair/arrive", "onair/depart",
+    5000, 500, 10000, 30000, 0, 30000, 10, 5000, 15000};
+
+// Config with empty NVS, like the first boot
+static void begin(Config &config)
+{
+  Preferences preferences;
+  preferences.begin(CONFIG_NAMESPACE, false);
+  preferences.clear();
+  preferences.end();
+  config.begin(defaults);
+}
+
+static int update(Config &config, const char *message)
+{
+  return config.update(message, strlen(message));
+}
+
+// Settings which a restart would load from NVS
+static Settings restarted()
+{
+  Config config;
+  config.begin(defaults);
+  return config.get();
+}
+
+/* Tests ************************************************************************************************************/
+
+TEST(ConfigConfirmsConnectionSettings)
+{
+  Config config;
+  begin(config);
+  CHECK(update(config, "MQTT_SERVER=mqtt2.example.com") == CONFIG_CHANGED_MQTT);
+  CHECK(config.pending() == CONFIG_CHANGED_MQTT);
+  config.confirm();
+  CHECK(config.pending() == CONFIG_UNCHANGED);
+  CHECK(strcmp(restarted().mqttServer, "mqtt2.example.com") == 0);
+}
+
+// Messages received while connection settings wait for confirmation used to overwrite the settings to revert to
+TEST(ConfigRollbackRestoresConfirmedSettings)
+{
+  Config config;
+  begin(config);
+  CHECK(update(config, "LED_TTL=20000") == CONFIG_CHANGED_TIMING);
+  CHECK(update(config, "LED_TTL=20000\nMQTT_SERVER=mqtt2.example.com") == CONFIG_CHANGED_MQTT);
+  CHECK(update(config, "LED_TTL=25000\nMQTT_SERVER=mqtt2.example.com") == CONFIG_CHANGED_TIMING);
+  CHECK(update(config, "LED_TTL=25000\nMQTT_SERVER=mqtt3.example.com\nWIFI_SSID=Other") == (CONFIG_CHANGED_MQTT | CONFIG_CHANGED_WIFI));
+  CHECK(config.pending() == (CONFIG_CHANGED_MQTT | CONFIG_CHANGED_WIFI));
+
+  // Timing-only change still carries unconfirmed connection settings, so it's not stored as confirmed
+  CHECK(strcmp(restarted().mqttServer, "mqtt.example.com") == 0);
+
+  CHECK(config.rollback() == (CONFIG_CHANGED_TIMING | CONFIG_CHANGED_MQTT | CONFIG_CHANGED_WIFI));
+  CHECK(config.pending() == CONFIG_UNCHANGED);
+  CHECK(strcmp(config.get().mqttServer, "mqtt.example.com") == 0);
+  CHECK(strcmp(config.get().wifiSsid, "OnAirNet") == 0);
+  CHECK(config.get().ledTtl == 20000);
+  CHECK(restarted().ledTtl == 20000);
+
+  // Reverted message is ignored when it comes again
+  CHECK(update(config, "LED_TTL=25000\nMQTT_SERVER=mqtt3.example.com\nWIFI_SSID=Other") == CONFIG_INVALID);
+}
+
+// Message which returns to the confirmed connection settings needs no confirmation
+TEST(ConfigReturnToConfirmedSettingsIsNotPending)
+{
+  Config config;
+  begin(config);
+  CHECK(update(config, "MQTT_SERVER=mqtt2.example.com") == CONFIG_CHANGED_MQTT);
+  CHECK(update(config, "LED_TTL=20000") == (CONFIG_CHANGED_MQTT | CONFIG_CHANGED_TIMING));
+  CHECK(config.pending() == CONFIG_UNCHANGED);
+  CHECK(config.rollback() == CONFIG_UNCHANGED);
+  CHECK(restarted().ledTtl == 20000);
+}
+
+// Restart before confirmation reverts to the confirmed message
+TEST(ConfigRestartRevertsUnconfirmedSettings)
+{
+  Config config;
+  begin(config);
+  CHECK(update(config, "LED_TTL=20000") == CONFIG_CHANGED_TIMING);
+  CHECK(update(config, "MQTT_SERVER=mqtt2.example.com") != CONFIG_INVALID);
+  Config afterRestart;
+  CHECK(!afterRestart.begin(defaults));
+  CHECK(strcmp(afterRestart.get().mqttServer, "mqtt.example.com") == 0);
+  CHECK(afterRestart.get().ledTtl == 20000);
+}
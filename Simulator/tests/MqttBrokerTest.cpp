@@ -0,0 +1,256 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator tests: embedded MQTT broker                                                     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "Test.h"
+#include <MqttBroker.h>
+
+#include <algorithm>
+#include <chrono>
+
+/* Helpers **********************************************************************************************************/
+
+#define BROKER_PORT 1883
+
+// Box on the LAN speaking MQTT 3.1.1 to the broker with raw packets
+struct LanClient
+{
+  std::shared_ptr<SimConnection> connection;
+
+  void write(const std::vector<uint8_t> &packet) { connection->toClient.write(packet.data(), packet.size(), simTime()); }
+
+  // Takes everything the broker sent so far
+  std::vector<uint8_t> read()
+  {
+    std::vector<uint8_t> data(connection->toServer.available());
+    connection->toServer.read(data.data(), data.size());
+    return data;
+  }
+
+  bool closed() const { return connection->closedByClient; }
+};
+
+// Packet with remaining length encoded in front of the body
+static std::vector<uint8_t> packet(uint8_t header, const std::vector<uint8_t> &body)
+{
+  std::vector<uint8_t> result = {header};
+  size_t remaining = body.size();
+  do
+  {
+    uint8_t digit = remaining & 0x7F;
+    remaining >>= 7;
+    result.push_back(remaining > 0 ? digit | 0x80 : digit);
+  } while (remaining > 0);
+  result.insert(result.end(), body.begin(), body.end());
+  return result;
+}
+
+static void appendString(std::vector<uint8_t> &body, const std::string &value)
+{
+  body.push_back(value.size() >> 8);
+  body.push_back(value.size() & 0xFF);
+  body.insert(body.end(), value.begin(), value.end());
+}
+
+static std::vector<uint8_t> publishPacket(const std::string &topic, const std::string &payload, bool retain = false, uint16_t packetId = 0)
+{
+  std::vector<uint8_t> body;
+  appendString(body, topic);
+  if (packetId != 0)
+  {
+    body.push_back(packetId >> 8);
+    body.push_back(packetId & 0xFF);
+  }
+  body.insert(body.end(), payload.begin(), payload.end());
+  return packet(0x30 | (packetId != 0 ? 0x02 : 0x00) | (retain ? 0x01 : 0x00), body);
+}
+
+static std::vector<uint8_t> subscribePacket(const std::string &filter)
+{
+  std::vector<uint8_t> body = {0x00, 0x01};
+  appendString(body, filter);
+  body.push_back(0x01);
+  return packet(0x82, body);
+}
+
+// The device must be connected to WiFi to accept LAN clients
+static void joinNetwork()
+{
+  if (WiFi.status() == WL_CONNECTED)
+    return;
+  WiFi.begin("test");
+  while (WiFi.status() != WL_CONNECTED)
+    simAdvance(10000);
+}
+
+// Connects LAN client with the ID and checks that the broker accepted it
+static LanClient connect(MqttBroker &broker, const std::string &id)
+{
+  LanClient client = {simConnectDevice(BROKER_PORT)};
+  CHECK(client.connection != NULL);
+  std::vector<uint8_t> body;
+  appendString(body, "MQTT");
+  body.insert(body.end(), {0x04, 0x02, 0x00, 0x0F});
+  appendString(body, id);
+  client.write(packet(0x10, body));
+  broker.loop();
+  CHECK(client.read() == std::vector<uint8_t>({0x20, 0x02, 0x00, 0x00}));
+  return client;
+}
+
+// Subscribes and checks that the broker granted the subscription, returns retained messages sent after SUBACK
+static std::vector<uint8_t> subscribe(MqttBroker &broker, LanClient &client, const std::string &filter)
+{
+  client.write(subscribePacket(filter));
+  broker.loop();
+  std::vector<uint8_t> data = client.read();
+  std::vector<uint8_t> suback = {0x90, 0x03, 0x00, 0x01, 0x00};
+  CHECK(data.size() >= suback.size() && std::equal(suback.begin(), suback.end(), data.begin()));
+  data.erase(data.begin(), data.begin() + std::min(data.size(), suback.size()));
+  return data;
+}
+
+/* Tests ************************************************************************************************************/
+
+TEST(MqttBrokerDeliversToSubscribers)
+{
+  joinNetwork();
+  MqttBroker broker(BROKER_PORT);
+  broker.begin();
+  LanClient master = connect(broker, "master");
+  LanClient slave = connect(broker, "slave");
+  subscribe(broker, slave, "onair/status");
+
+  master.write(publishPacket("onair/status", "1", false, 7));
+  broker.loop();
+  CHECK(master.read() == std::vector<uint8_t>({0x40, 0x02, 0x00, 0x07}));
+  CHECK(slave.read() == publishPacket("onair/status", "1"));
+  CHECK(broker.stats().published == 1);
+  CHECK(broker.stats().delivered == 1);
+}
+
+TEST(MqttBrokerMultiLevelWildcardMatchesParent)
+{
+  joinNetwork();
+  MqttBroker broker(BROKER_PORT);
+  broker.begin();
+  LanClient monitor = connect(broker, "monitor");
+  subscribe(broker, monitor, "onair/#");
+
+  broker.publish("onair", (const uint8_t *)"a", 1, false);
+  CHECK(monitor.read() == publishPacket("onair", "a"));
+  broker.publish("onair/status", (const uint8_t *)"b", 1, false);
+  CHECK(monitor.read() == publishPacket("onair/status", "b"));
+  broker.publish("onairx", (const uint8_t *)"c", 1, false);
+  CHECK(monitor.read().empty());
+}
+
+// Configuration messages are up to 512 bytes, published with QoS 1 and retained
+TEST(MqttBrokerForwardsConfigurationMessage)
+{
+  joinNetwork();
+  MqttBroker broker(BROKER_PORT);
+  broker.begin();
+  LanClient master = connect(broker, "master");
+  LanClient slave = connect(broker, "slave");
+  subscribe(broker, slave, "onair/config");
+
+  std::string config = "LED_TTL=20000\n" + std::string(512 - 14, '#');
+  master.write(publishPacket("onair/config", config, true, 1));
+  broker.loop();
+  CHECK(!master.closed());
+  CHECK(master.read() == std::vector<uint8_t>({0x40, 0x02, 0x00, 0x01}));
+  CHECK(slave.read() == publishPacket("onair/config", config));
+}
+
+// Retained message which does not fit the table must not leave the previous one for new subscribers
+TEST(MqttBrokerReplacesRetainedMessage)
+{
+  joinNetwork();
+  MqttBroker broker(BROKER_PORT);
+  broker.begin();
+  broker.publish("onair/config", (const uint8_t *)"LED_TTL=1", 9, true);
+  std::string config(MQTT_BROKER_MAX_RETAINED_LENGTH + 1, '#');
+  broker.publish("onair/config", (const uint8_t *)config.data(), config.size(), true);
+  broker.publish("onair/status", (const uint8_t *)"1", 1, true);
+
+  LanClient slave = connect(broker, "slave");
+  CHECK(subscribe(broker, slave, "onair/#") == publishPacket("onair/status", "1", true));
+  CHECK(broker.stats().droppedRetained == 1);
+}
+
+// Boxes fall back to default settings when the retained configuration is lost, e.g. after restart of the broker box
+TEST(MqttBrokerRetainsConfigurationMessage)
+{
+  joinNetwork();
+  MqttBroker broker(BROKER_PORT);
+  broker.begin();
+  LanClient master = connect(broker, "master");
+  std::string config = "LED_TTL=20000\n" + std::string(512 - 14, '#');
+  master.write(publishPacket("onair/config", config, true, 1));
+  broker.loop();
+  master.read();
+
+  LanClient slave = connect(broker, "slave");
+  CHECK(subscribe(broker, slave, "onair/config") == publishPacket("onair/config", config, true));
+  CHECK(broker.stats().droppedRetained == 0);
+}
+
+TEST(MqttBrokerRefusesClientsOverLimit)
+{
+  joinNetwork();
+  MqttBroker broker(BROKER_PORT);
+  broker.begin();
+  std::vector<LanClient> clients;
+  for (int i = 0; i < MQTT_BROKER_MAX_CLIENTS; i++)
+    clients.push_back(connect(broker, "box" + std::to_string(i)));
+  LanClient extra = {simConnectDevice(BROKER_PORT)};
+  broker.loop();
+  CHECK(extra.closed());
+  CHECK(broker.stats().clients == MQTT_BROKER_MAX_CLIENTS);
+  CHECK(broker.stats().rejectedClients == 1);
+}
+
+/* Benchmarks *******************************************************************************************************/
+
+// Host CPU time of delivering status message to all subscribers; the simulated clock does not move while the broker
+// works, so the broker's own fan-out statistics are zero here and ESP32 is roughly 10 times slower than the host.
+// The master box connects to its own broker too, so one client slot is not available for slaves.
+BENCHMARK(MqttBrokerFanOut)
+{
+  joinNetwork();
+  MqttBroker broker(BROKER_PORT);
+  broker.begin();
+  std::vector<LanClient> slaves;
+  for (int i = 0; i < MQTT_BROKER_MAX_CLIENTS + 1; i++)
+  {
+    LanClient slave = {simConnectDevice(BROKER_PORT)};
+    std::vector<uint8_t> body;
+    appendString(body, "MQTT");
+    body.insert(body.end(), {0x04, 0x02, 0x00, 0x0F});
+    appendString(body, "slave" + std::to_string(i));
+    slave.write(packet(0x10, body));
+    slave.write(subscribePacket("onair/status"));
+    broker.loop();
+    slave.read();
+    if (slave.closed())
+      break;
+    slaves.push_back(slave);
+
+    const int count = 10000;
+    auto start = std::chrono::steady_clock::now();
+    for (int j = 0; j < count; j++)
+      broker.publish("onair/status", (const uint8_t *)"1", 1, false);
+    double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    for (LanClient &subscriber : slaves)
+      subscriber.read();
+    printf("  %2zu subscribers: %6.2f us per message\n", slaves.size(), elapsed / count);
+  }
+
+  printf("  Maximum slaves: %zu (%d clients, %zu bytes of broker state, %zu per client)\n", slaves.size() - 1,
+         broker.stats().maxClients, sizeof(MqttBroker), sizeof(MqttBroker) / MQTT_BROKER_MAX_CLIENTS);
+  CHECK(broker.stats().rejectedClients == 1);
+}
@@ -0,0 +1,220 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator tests: MQTT client                                                              *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "Test.h"
+#include "TestTransports.h"
+#include <MqttClient.h>
+
+#include <chrono>
+
+/* Helpers **********************************************************************************************************/
+
+typedef MqttClient<LoopbackTransport> LoopbackClient;
+
+static std::string receivedTopic;
+static std::string receivedPayload;
+static int receivedCount = 0;
+
+static void onMessage(char *topic, uint8_t *payload, unsigned int length)
+{
+  receivedTopic = topic;
+  receivedPayload.assign((const char *)payload, length);
+  receivedCount++;
+}
+
+static void peerWrite(LoopbackClient &client, const std::vector<uint8_t> &data)
+{
+  client.transport().peerWrite(data.data(), data.size());
+}
+
+// Takes everything the client wrote so far
+static std::vector<uint8_t> peerRead(LoopbackClient &client)
+{
+  std::vector<uint8_t> data(LOOPBACK_BUFFER_SIZE);
+  data.resize(client.transport().peerRead(data.data(), data.size()));
+  return data;
+}
+
+// Connects the client with MQTT 5 and answers CONNECT with CONNACK, which has no properties
+static void connect(LoopbackClient &client)
+{
+  receivedCount = 0;
+  client.setServer("server", 1883).setCallback(onMessage);
+  CHECK(client.connect("device", NULL, NULL, NULL, 0, false, NULL, true));
+  CHECK(!peerRead(client).empty());
+  peerWrite(client, {0x20, 0x03, 0x00, 0x00, 0x00});
+  client.loop();
+  CHECK(client.connected());
+  CHECK(client.protocolVersion() == MQTT_VERSION_5);
+}
+
+// MQTT 5 PUBLISH with QoS 0 and no properties
+static std::vector<uint8_t> publishPacket(const std::string &topic, const std::string &payload)
+{
+  std::vector<uint8_t> packet = {0x30, (uint8_t)(2 + topic.size() + 1 + payload.size()), 0x00, (uint8_t)topic.size()};
+  packet.insert(packet.end(), topic.begin(), topic.end());
+  packet.push_back(0x00);
+  packet.insert(packet.end(), payload.begin(), payload.end());
+  return packet;
+}
+
+/* Tests ************************************************************************************************************/
+
+TEST(MqttClientReceivesPublish)
+{
+  LoopbackClient client;
+  connect(client);
+  peerWrite(client, publishPacket("onair/status", "1"));
+  client.loop();
+  CHECK(receivedCount == 1);
+  CHECK(receivedTopic == "onair/status");
+  CHECK(receivedPayload == "1");
+}
+
+// The firmware publishes between loop() calls, while an incoming packet may be only partially received
+TEST(MqttClientPublishesDuringPartialReceive)
+{
+  LoopbackClient client;
+  connect(client);
+  std::vector<uint8_t> packet = publishPacket("onair/status", "1");
+  size_t half = packet.size() / 2;
+  peerWrite(client, std::vector<uint8_t>(packet.begin(), packet.begin() + half));
+  client.loop();
+  CHECK(receivedCount == 0);
+  CHECK(client.publish("onair/arrive", "24:0A:C4:5E:A1:01"));
+  CHECK(!peerRead(client).empty());
+  peerWrite(client, std::vector<uint8_t>(packet.begin() + half, packet.end()));
+  client.loop();
+  CHECK(receivedCount == 1);
+  CHECK(receivedTopic == "onair/status");
+  CHECK(receivedPayload == "1");
+}
+
+// Server which does not speak MQTT 5 answers with "unacceptable protocol version", the client tries 3.1.1 at once
+TEST(MqttClientFallsBackWhenServerRejectsVersion5)
+{
+  LoopbackClient client;
+  client.setServer("server", 1883).setCallback(onMessage);
+  CHECK(client.connect("device", NULL, NULL, NULL, 0, false, NULL, true));
+  std::vector<uint8_t> connect = peerRead(client);
+  CHECK(connect.size() > 8 && connect[8] == MQTT_VERSION_5);
+  peerWrite(client, {0x20, 0x02, 0x00, 0x01});
+  client.loop();
+  CHECK(client.state() == MQTT_CONNECTING);
+  CHECK(client.protocolVersion() == MQTT_VERSION_3_1_1);
+  connect = peerRead(client);
+  CHECK(connect.size() > 8 && connect[8] == MQTT_VERSION_3_1_1);
+  peerWrite(client, {0x20, 0x02, 0x00, 0x00});
+  client.loop();
+  CHECK(client.connected());
+
+  // Next connection tries MQTT 5 again
+  client.disconnect();
+  CHECK(client.connect("device", NULL, NULL, NULL, 0, false, NULL, true));
+  CHECK(client.protocolVersion() == MQTT_VERSION_5);
+}
+
+// Connection lost while CONNACK is arriving is a network failure, which must not downgrade the protocol
+TEST(MqttClientKeepsVersion5AfterNetworkFailure)
+{
+  LoopbackClient client;
+  client.setServer("server", 1883).setCallback(onMessage);
+  CHECK(client.connect("device", NULL, NULL, NULL, 0, false, NULL, true));
+  peerRead(client);
+  peerWrite(client, {0x20, 0x03});
+  client.loop();
+  client.transport().peerClose();
+  client.loop();
+  CHECK(client.state() == MQTT_CONNECTION_LOST);
+  CHECK(client.protocolVersion() == MQTT_VERSION_5);
+}
+
+// Status messages resent after reconnection follow SUBSCRIBE on the same connection, identifiers must not repeat
+TEST(MqttClientSharesPacketIdentifiers)
+{
+  LoopbackClient client;
+  connect(client);
+  CHECK(client.subscribe("onair/status", 1));
+  std::vector<uint8_t> subscribe = peerRead(client);
+  CHECK(subscribe.size() > 4 && subscribe[0] == MQTT_SUBSCRIBE);
+  uint16_t subscribeId = (subscribe[2] << 8) | subscribe[3];
+  uint16_t publishId = client.nextPacketId();
+  CHECK(publishId != 0 && publishId != subscribeId);
+  CHECK(client.publish("onair/status", (const uint8_t *)"1", 1, true, 1, publishId));
+  CHECK(client.subscribe("onair/config", 1));
+  peerRead(client);
+  CHECK(client.nextPacketId() != publishId);
+}
+
+// Runtime configuration reuses its buffers, the alias must keep the topic the server was told about
+TEST(MqttClientCopiesAliasedTopic)
+{
+  LoopbackClient client;
+  client.setServer("server", 1883).setCallback(onMessage);
+  CHECK(client.connect("device", NULL, NULL, NULL, 0, false, NULL, true));
+  peerRead(client);
+  peerWrite(client, {0x20, 0x06, 0x00, 0x00, 0x03, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, 0x00, 0x04});
+  client.loop();
+  CHECK(client.connected());
+
+  char topic[] = "onair/status";
+  CHECK(client.publish(topic, "1"));
+  std::vector<uint8_t> first = peerRead(client);
+  CHECK(first.size() > 4 && first[3] == strlen(topic));
+  strcpy(topic, "onair/arrive");
+  CHECK(client.publish(topic, "1"));
+  std::vector<uint8_t> second = peerRead(client);
+  CHECK(second.size() > 4 + strlen(topic) && std::string(second.begin() + 4, second.begin() + 4 + strlen(topic)) == topic);
+}
+
+// Maintenance reboot is a real departure, so the server must publish the will
+TEST(MqttClientDisconnectsWithWill)
+{
+  LoopbackClient client;
+  connect(client);
+  client.disconnect(true);
+  CHECK(peerRead(client) == std::vector<uint8_t>({MQTT_DISCONNECT, 0x02, MQTT_DISCONNECT_WITH_WILL, 0x00}));
+  CHECK(!client.connected());
+
+  connect(client);
+  client.disconnect();
+  CHECK(peerRead(client) == std::vector<uint8_t>({MQTT_DISCONNECT, 0x02, 0x00, 0x00}));
+}
+
+/* Benchmarks *******************************************************************************************************/
+
+// Host CPU time of building a status message and of parsing received one, and RAM of the client without transport;
+// ESP32 is roughly 10 times slower than the host. Flash size needs the device build (pio run -t size).
+BENCHMARK(MqttClientPerMessage)
+{
+  LoopbackClient client;
+  connect(client);
+  const int count = 100000;
+  uint8_t drain[LOOPBACK_BUFFER_SIZE];
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; i++)
+  {
+    client.publish("onair/status", (const uint8_t *)"1", 1, true, 1, client.nextPacketId());
+    client.transport().peerRead(drain, sizeof(drain));
+  }
+  double publishTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+  std::vector<uint8_t> packet = publishPacket("onair/status", "1");
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; i++)
+  {
+    client.transport().peerWrite(packet.data(), packet.size());
+    client.loop();
+  }
+  double receiveTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+  printf("  Publish: %.3f us per message\n", publishTime / count);
+  printf("  Receive: %.3f us per message\n", receiveTime / count);
+  printf("  Client state: %zu bytes (%d bytes of buffers)\n", sizeof(LoopbackClient) - sizeof(LoopbackTransport), 2 * MQTT_BUFFER_SIZE);
+  CHECK(receivedCount == count);
+}
@@ -0,0 +1,128 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator tests: MQTT-SN client                                                           *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ ********************************************************************************************************************/
+
+#include "Test.h"
+#include "TestTransports.h"
+#include <MqttSnClient.h>
+
+/* Helpers **********************************************************************************************************/
+
+typedef MqttSnClient<SimulatedRadio> RadioSnClient;
+
+static int deliveredCount = 0;
+static size_t deliveredLength = 0;
+
+// Payload is not touched, so a bad length shows up as a failed check and not as a crash
+static void onDelivered(char *topic, uint8_t *payload, unsigned int length)
+{
+  deliveredLength = length;
+  deliveredCount++;
+}
+
+static void gatewaySend(SimulatedRadio &gateway, const std::vector<uint8_t> &datagram)
+{
+  gateway.send(datagram.data(), datagram.size(), NULL, 0);
+}
+
+// Takes the oldest datagram sent by the client
+static std::vector<uint8_t> gatewayReceive(SimulatedRadio &gateway)
+{
+  std::vector<uint8_t> datagram(ESPNOW_FRAME_SIZE);
+  datagram.resize(gateway.receive(datagram.data(), datagram.size()));
+  return datagram;
+}
+
+// Connects the client through the gateway radio and registers topic ID 1 for incoming "onair/status"
+static void connect(RadioSnClient &client, SimulatedRadio &gateway)
+{
+  deliveredCount = 0;
+  client.transport().join(gateway);
+  client.setServer("gateway", 1885).setCallback(onDelivered);
+  CHECK(client.connect("device", NULL, NULL, NULL, 0, false, NULL, true));
+  CHECK(gatewayReceive(gateway)[1] == 0x04);
+  gatewaySend(gateway, {0x03, 0x05, 0x00});
+  client.loop();
+  CHECK(client.connected());
+
+  std::vector<uint8_t> datagram = {0x12, 0x0A, 0x00, 0x01, 0x00, 0x01};
+  std::string topic = "onair/status";
+  datagram.insert(datagram.end(), topic.begin(), topic.end());
+  gatewaySend(gateway, datagram);
+  client.loop();
+  CHECK(gatewayReceive(gateway) == std::vector<uint8_t>({0x07, 0x0B, 0x00, 0x01, 0x00, 0x01, 0x00}));
+}
+
+/* Tests ************************************************************************************************************/
+
+TEST(MqttSnClientReceivesPublish)
+{
+  SimulatedRadio gateway;
+  RadioSnClient client;
+  connect(client, gateway);
+  gatewaySend(gateway, {0x08, 0x0C, 0x00, 0x00, 0x01, 0x00, 0x00, '1'});
+  client.loop();
+  CHECK(deliveredCount == 1);
+  CHECK(deliveredLength == 1);
+}
+
+// Length byte 0 used to make the body length wrap around to SIZE_MAX
+TEST(MqttSnClientDropsMalformedLength)
+{
+  SimulatedRadio gateway;
+  RadioSnClient client;
+  connect(client, gateway);
+  gatewaySend(gateway, {0x00, 0x0C, 0x00, 0x00, 0x01, 0x00, 0x00, '1'});
+  gatewaySend(gateway, {0x01, 0x0C, 0x00, 0x00, 0x01, 0x00, 0x00, '1'});
+  gatewaySend(gateway, {0x01, 0x00, 0x40, 0x0C, 0x00, 0x00, 0x01, 0x00, 0x00, '1'}); // Longer than the datagram
+  gatewaySend(gateway, {0x06, 0x0C, 0x00, 0x00, 0x01, 0x00});                        // Shorter than PUBLISH header
+  client.loop();
+  CHECK(deliveredCount == 0);
+  CHECK(client.connected());
+}
+
+TEST(MqttSnClientFailsPublishAfterRejectedRegistration)
+{
+  SimulatedRadio gateway;
+  RadioSnClient client;
+  connect(client, gateway);
+
+  // First message waits for REGACK, which rejects the topic
+  CHECK(client.publish("onair/arrive", "1"));
+  std::vector<uint8_t> request = gatewayReceive(gateway);
+  CHECK(request.size() == 18 && request[1] == 0x0A);
+  gatewaySend(gateway, {0x07, 0x0B, 0x00, 0x00, request[4], request[5], 0x02});
+  client.loop();
+  CHECK(client.publishFailures() == 1);
+
+  // Next message fails too, but the topic is registered again
+  CHECK(!client.publish("onair/arrive", "1"));
+  CHECK(client.publishFailures() == 2);
+  request = gatewayReceive(gateway);
+  CHECK(request.size() == 18 && request[1] == 0x0A);
+  gatewaySend(gateway, {0x07, 0x0B, 0x00, 0x02, request[4], request[5], 0x00});
+  client.loop();
+  CHECK(client.publish("onair/arrive", "1"));
+  CHECK(gatewayReceive(gateway) == std::vector<uint8_t>({0x08, 0x0C, 0x00, 0x00, 0x02, 0x00, 0x00, '1'}));
+}
+
+// Telemetry, health and boot profile do not fit MQTT_SN_MAX_PENDING, their topics must be registered anyway
+TEST(MqttSnClientRegistersTopicOfLongMessage)
+{
+  SimulatedRadio gateway;
+  RadioSnClient client;
+  connect(client, gateway);
+
+  std::string payload(MQTT_SN_MAX_PENDING + 1, 'x');
+  CHECK(!client.publish("onair/boot", payload.c_str()));
+  std::vector<uint8_t> request = gatewayReceive(gateway);
+  CHECK(request.size() == 16 && request[1] == 0x0A);
+  gatewaySend(gateway, {0x07, 0x0B, 0x00, 0x02, request[4], request[5], 0x00});
+  client.loop();
+  CHECK(client.publish("onair/boot", payload.c_str()));
+  std::vector<uint8_t> publish = gatewayReceive(gateway);
+  CHECK(publish.size() == 7 + payload.size() && publish[1] == 0x0C && publish[3] == 0x00 && publish[4] == 0x02);
+}
@@ -0,0 +1,50 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator tests                                                                           *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Minimal test framework: TEST(name) defines a test and BENCHMARK(name) a benchmark, both are registered before    *
+ * main() runs. CHECK(condition) reports failed condition with its location and the test goes on.                   *
+ ********************************************************************************************************************/
+
+#pragma once
+
+#include "Simulator.h"
+
+#include <stdio.h>
+
+struct TestCase
+{
+  const char *name;
+  void (*run)();
+  bool benchmark;
+};
+
+std::vector<TestCase> &testCases();
+extern int testFailures;
+
+struct TestRegistration
+{
+  TestRegistration(const char *name, void (*run)(), bool benchmark) { testCases().push_back({name, run, benchmark}); }
+};
+
+#define TEST(name)                                                        \
+  static void test_##name();                                              \
+  static TestRegistration registration_##name(#name, test_##name, false); \
+  static void test_##name()
+
+#define BENCHMARK(name)                                                       \
+  static void benchmark_##name();                                             \
+  static TestRegistration registration_##name(#name, benchmark_##name, true); \
+  static void benchmark_##name()
+
+#define CHECK(condition)                                                   \
+  do                                                                       \
+  {                                                                        \
+    if (!(condition))                                                      \
+    {                                                                      \
+      testFailures++;                                                      \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+    }                                                                      \
+  } while (0)
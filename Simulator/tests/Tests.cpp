@@ -0,0 +1,68 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator tests                                                                           *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Host tests of firmware libraries, run against the simulated Arduino core with virtual clock. Benchmarks are run  *
+ * only with -b, because they take longer and only report numbers. Exit code is 1 when any check failed.            *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Build: g++ -std=gnu++17 -O2 -I.. -I../include \                                                                  *
+ *        $(for d in ../../Firmware/lib/[A-Z]*; do [ -d $d ] && echo -I$d; done) -o onair-tests *.cpp \             *
+ *        ../Arduino.cpp ../Network.cpp ../Faults.cpp ../MqttServer.cpp ../TestTransports.cpp \                     *
+ *        $(find ../../Firmware/lib -name '*.cpp')                                                                  *
+ * Usage: onair-tests [-b] [name...]                                                                                *
+ ********************************************************************************************************************/
+
+#include "Test.h"
+
+#include <string.h>
+#include <unistd.h>
+
+std::vector<TestCase> &testCases()
+{
+  static std::vector<TestCase> cases;
+  return cases;
+}
+
+int testFailures = 0;
+
+static bool selected(const char *name, int count, char **names)
+{
+  for (int i = 0; i < count; i++)
+  {
+    if (strcmp(names[i], name) == 0)
+      return true;
+  }
+  return count == 0;
+}
+
+int main(int argc, char **argv)
+{
+  bool benchmarks = false;
+  int option;
+  while ((option = getopt(argc, argv, "b")) != -1)
+  {
+    if (option != 'b')
+    {
+      fprintf(stderr, "Usage: onair-tests [-b] [name...]\n");
+      return 1;
+    }
+    benchmarks = true;
+  }
+
+  // Serial output of the libraries is not interesting here
+  simQuiet = true;
+  int run = 0;
+  for (const TestCase &test : testCases())
+  {
+    if (test.benchmark != benchmarks || !selected(test.name, argc - optind, argv + optind))
+      continue;
+    int failures = testFailures;
+    test.run();
+    run++;
+    printf("%s %s\n", testFailures == failures ? "OK    " : "FAILED", test.name);
+  }
+  printf("%d %s, %d failed checks\n", run, benchmarks ? "benchmarks" : "tests", testFailures);
+  return testFailures > 0 ? 1 : 0;
+}
@@ -0,0 +1,94 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - simulator tests: WiFi power profiles                                                      *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * The simulator cannot tell how much current a profile draws, how long a sleeping radio delays incoming packets    *
+ * (beacon and listen intervals) or how slower CPU stretches processing, these need measurements on the device.     *
+ * What is tested here is the part decided by the firmware: modem sleep type, light sleep configuration, locks      *
+ * which keep the CPU fast and awake while busy, held LED pin and the busy time used to estimate duty cycle.        *
+ ********************************************************************************************************************/
+
+#include "Test.h"
+#include <WifiPower.h>
+
+/* Helpers **********************************************************************************************************/
+
+#define LED 2
+
+// Power management is enabled only for the test, other tests run like default Arduino-ESP32 builds
+struct PowerManagement
+{
+  PowerManagement() { simPowerManagement = true; }
+  ~PowerManagement() { simPowerManagement = false; }
+};
+
+/* Tests ************************************************************************************************************/
+
+TEST(WifiPowerPerformanceKeepsRadioOn)
+{
+  WifiPower power;
+  CHECK(power.begin(WIFI_POWER_PERFORMANCE));
+  CHECK(simWifiSleep() == WIFI_PS_NONE);
+  CHECK(!power.lightSleep());
+  power.busy();
+  simAdvance(100000);
+  power.idle();
+  CHECK(power.busyTime() == 0);
+  CHECK(simCpuFullSpeed());
+}
+
+TEST(WifiPowerBalancedUsesModemSleep)
+{
+  WifiPower power;
+  CHECK(power.begin(WIFI_POWER_BALANCED));
+  CHECK(simWifiSleep() == WIFI_PS_MIN_MODEM);
+  CHECK(!power.lightSleep());
+  CHECK(strcmp(power.name(), "balanced") == 0);
+}
+
+// Default Arduino-ESP32 build has no power management, the profile falls back to modem sleep
+TEST(WifiPowerLowWithoutPowerManagement)
+{
+  WifiPower power;
+  CHECK(!power.begin(WIFI_POWER_LOW));
+  CHECK(simWifiSleep() == WIFI_PS_MAX_MODEM);
+  CHECK(!power.lightSleep());
+  CHECK(!simLightSleepAllowed());
+  CHECK(strcmp(power.name(), "low power (without light sleep)") == 0);
+}
+
+TEST(WifiPowerLowSleepsWhileIdle)
+{
+  PowerManagement powerManagement;
+  WifiPower power;
+  power.holdPin(LED);
+  CHECK(power.begin(WIFI_POWER_LOW));
+  CHECK(simWifiSleep() == WIFI_PS_MAX_MODEM);
+  CHECK(power.lightSleep());
+  CHECK(strcmp(power.name(), "low power") == 0);
+
+  // Setup runs busy until the first idle()
+  CHECK(simCpuFullSpeed());
+  CHECK(!simLightSleepAllowed());
+  CHECK(!simPinHeld(LED));
+  simAdvance(300000);
+  power.idle();
+  CHECK(!simCpuFullSpeed());
+  CHECK(simLightSleepAllowed());
+  CHECK(simPinHeld(LED));
+
+  // Processing a message
+  simAdvance(1000000);
+  power.busy();
+  power.busy();
+  CHECK(simCpuFullSpeed());
+  CHECK(!simLightSleepAllowed());
+  CHECK(!simPinHeld(LED));
+  simAdvance(20000);
+  power.idle();
+  power.idle();
+  CHECK(simLightSleepAllowed());
+  CHECK(power.busyTime() == 320);
+}
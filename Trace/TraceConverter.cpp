@@ -0,0 +1,302 @@
+/********************************************************************************************************************
+ * On-Air Indicator Box - trace converter                                                                           *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Copyright (c) Michal Altair Valasek, 2024 | www.rider.cz | github.com/ridercz                                    *
+ * Licensed under terms of the Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.     *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Converts event trace recorded by the box (see Trace library of the firmware) to Chrome trace JSON, which can be  *
+ * opened in Perfetto UI (ui.perfetto.dev) or chrome://tracing. Input is either serial port log, where the trace is *
+ * in lines "Trace: <hex>", or binary trace received over MQTT, e.g. mosquitto_sub -t onair/trace/<MAC> -N > file.  *
+ * Times are in us since boot of the box; clocks of different boxes are not synchronized.                           *
+ * ---------------------------------------------------------------------------------------------------------------- *
+ * Build: g++ -std=c++17 -O2 -o trace-converter TraceConverter.cpp                                                  *
+ * Usage: trace-converter [-n name] [-o output.json] [input]                                                        *
+ ********************************************************************************************************************/
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/* Trace format - must match Trace library of the firmware **********************************************************/
+
+#define TRACE_EVENT_SIZE 8
+
+// Event types
+#define TRACE_LOOP_BEGIN 1
+#define TRACE_LOOP_END 2
+#define TRACE_WIFI 3
+#define TRACE_MQTT_IN 4
+#define TRACE_MQTT_OUT 5
+#define TRACE_GPIO 6
+#define TRACE_LED 7
+#define TRACE_STATUS 8
+#define TRACE_MESSAGE 9
+#define TRACE_DATA 10
+#define TRACE_CLOCK 11
+
+// Timeline tracks (threads in Chrome trace format)
+#define TRACK_LOOP 1
+#define TRACK_MQTT 2
+#define TRACK_WIFI 3
+
+struct TraceEvent
+{
+  uint64_t time; // us since boot, unwrapped
+  uint8_t type;
+  uint8_t arg;
+  uint16_t value;
+};
+
+/* Input ************************************************************************************************************/
+
+static int hexDigit(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+// Serial log contains other lines too, only the hex after "Trace: " is taken
+static std::vector<uint8_t> parseLog(const std::string &text)
+{
+  std::vector<uint8_t> data;
+  size_t pos = 0;
+  while ((pos = text.find("Trace: ", pos)) != std::string::npos)
+  {
+    pos += 7;
+    while (pos + 1 < text.size() && hexDigit(text[pos]) >= 0 && hexDigit(text[pos + 1]) >= 0)
+    {
+      data.push_back(hexDigit(text[pos]) << 4 | hexDigit(text[pos + 1]));
+      pos += 2;
+    }
+  }
+  return data;
+}
+
+// Time is lower 32 bits of us since boot, so it wraps around every 71 minutes
+static std::vector<TraceEvent> parseEvents(const std::vector<uint8_t> &data)
+{
+  std::vector<TraceEvent> events;
+  uint32_t previous = 0;
+  uint64_t wraps = 0;
+  for (size_t pos = 0; pos + TRACE_EVENT_SIZE <= data.size(); pos += TRACE_EVENT_SIZE)
+  {
+    const uint8_t *p = data.data() + pos;
+    uint32_t time = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+    if (!events.empty() && time < previous)
+      wraps++;
+    previous = time;
+    events.push_back({(wraps << 32) + time, p[4], p[5], (uint16_t)(p[6] | p[7] << 8)});
+  }
+  return events;
+}
+
+/* Output ***********************************************************************************************************/
+
+static const char *packetName(uint8_t type)
+{
+  switch (type)
+  {
+  case 1:
+    return "CONNECT";
+  case 2:
+    return "CONNACK";
+  case 3:
+    return "PUBLISH";
+  case 4:
+    return "PUBACK";
+  case 8:
+    return "SUBSCRIBE";
+  case 9:
+    return "SUBACK";
+  case 12:
+    return "PINGREQ";
+  case 13:
+    return "PINGRESP";
+  case 14:
+    return "DISCONNECT";
+  default:
+    return "packet";
+  }
+}
+
+static const char *wifiEventName(uint8_t event)
+{
+  switch (event)
+  {
+  case 1:
+    return "WiFi connected";
+  case 2:
+    return "WiFi disconnected";
+  case 3:
+    return "Got IP address";
+  case 4:
+    return "Lost IP address";
+  default:
+    return "WiFi event";
+  }
+}
+
+static const char *topicName(uint8_t topic)
+{
+  switch (topic)
+  {
+  case 1:
+    return "status message";
+  case 2:
+    return "config message";
+  case 3:
+    return "maintenance message";
+  default:
+    return "message";
+  }
+}
+
+static void writeMetadata(FILE *output, const char *type, int track, const char *name)
+{
+  fprintf(output, "{\"name\":\"%s\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n", type, track, name);
+}
+
+static void writeInstant(FILE *output, const TraceEvent &event, int track, const char *name, const char *argName, int argValue)
+{
+  fprintf(output, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%llu,\"pid\":1,\"tid\":%d,\"args\":{\"%s\":%d}},\n", name,
+          (unsigned long long)event.time, track, argName, argValue);
+}
+
+static void writeCounter(FILE *output, const TraceEvent &event, const char *name, int value)
+{
+  fprintf(output, "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%llu,\"pid\":1,\"args\":{\"value\":%d}},\n", name, (unsigned long long)event.time, value);
+}
+
+static void writeTrace(FILE *output, const std::vector<TraceEvent> &events, const std::string &name)
+{
+  fprintf(output, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  writeMetadata(output, "process_name", 0, name.c_str());
+  writeMetadata(output, "thread_name", TRACK_LOOP, "loop");
+  writeMetadata(output, "thread_name", TRACK_MQTT, "MQTT");
+  writeMetadata(output, "thread_name", TRACK_WIFI, "WiFi");
+
+  // The oldest events may have been overwritten in the middle of loop, so its end without begin is skipped
+  bool inLoop = false;
+  for (const TraceEvent &event : events)
+  {
+    char text[32];
+    switch (event.type)
+    {
+    case TRACE_LOOP_BEGIN:
+    case TRACE_LOOP_END:
+      if (inLoop == (event.type == TRACE_LOOP_BEGIN))
+        break;
+      inLoop = !inLoop;
+      fprintf(output, "{\"name\":\"loop\",\"ph\":\"%s\",\"ts\":%llu,\"pid\":1,\"tid\":%d},\n", inLoop ? "B" : "E",
+              (unsigned long long)event.time, TRACK_LOOP);
+      break;
+    case TRACE_WIFI:
+      writeInstant(output, event, TRACK_WIFI, wifiEventName(event.arg), "event", event.arg);
+      break;
+    case TRACE_MQTT_IN:
+    case TRACE_MQTT_OUT:
+      snprintf(text, sizeof(text), "%s %s", packetName(event.arg), event.type == TRACE_MQTT_IN ? "in" : "out");
+      writeInstant(output, event, TRACK_MQTT, text, "value", event.value);
+      break;
+    case TRACE_GPIO:
+      snprintf(text, sizeof(text), "GPIO %u", event.arg);
+      writeCounter(output, event, text, event.value);
+      break;
+    case TRACE_LED:
+      writeCounter(output, event, "LED", event.value);
+      break;
+    case TRACE_STATUS:
+      writeCounter(output, event, "on air", event.value);
+      break;
+    case TRACE_MESSAGE:
+      writeInstant(output, event, TRACK_MQTT, topicName(event.arg), "length", event.value);
+      break;
+    case TRACE_DATA:
+    case TRACE_CLOCK:
+      break;
+    default:
+      snprintf(text, sizeof(text), "event %u", event.type);
+      writeInstant(output, event, TRACK_LOOP, text, "value", event.value);
+      break;
+    }
+  }
+
+  // Chrome trace format does not allow trailing comma, so the list ends with an empty metadata event
+  fprintf(output, "{\"name\":\"trace_end\",\"ph\":\"M\",\"pid\":1,\"args\":{}}\n]}\n");
+}
+
+/* Main *************************************************************************************************************/
+
+static void usage()
+{
+  fprintf(stderr, "Usage: trace-converter [-n name] [-o output.json] [input]\n");
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  std::string name = "On-Air box";
+  const char *outputPath = NULL;
+  int option;
+  while ((option = getopt(argc, argv, "n:o:")) != -1)
+  {
+    switch (option)
+    {
+    case 'n':
+      name = optarg;
+      break;
+    case 'o':
+      outputPath = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind > 1)
+    usage();
+
+  FILE *input = optind < argc ? fopen(argv[optind], "rb") : stdin;
+  if (input == NULL)
+  {
+    perror("Cannot open input");
+    return 1;
+  }
+  std::string content;
+  char buffer[4096];
+  size_t size;
+  while ((size = fread(buffer, 1, sizeof(buffer), input)) > 0)
+    content.append(buffer, size);
+  if (input != stdin)
+    fclose(input);
+
+  // Serial log is recognized by trace lines, anything else is binary trace
+  std::vector<uint8_t> data = content.find("Trace: ") != std::string::npos ? parseLog(content) : std::vector<uint8_t>(content.begin(), content.end());
+  std::vector<TraceEvent> events = parseEvents(data);
+  if (events.empty())
+  {
+    fprintf(stderr, "No trace events found\n");
+    return 1;
+  }
+
+  FILE *output = outputPath != NULL ? fopen(outputPath, "w") : stdout;
+  if (output == NULL)
+  {
+    perror("Cannot open output");
+    return 1;
+  }
+  writeTrace(output, events, name);
+  if (output != stdout)
+    fclose(output);
+  fprintf(stderr, "%zu events converted\n", events.size());
+  return 0;
+}